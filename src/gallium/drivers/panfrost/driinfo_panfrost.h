@@ -0,0 +1,14 @@
+// panfrost specific driconf options
+
+DRI_CONF_SECTION_PERFORMANCE
+   DRI_CONF_OPT_B(pan_skip_draws_while_compiling, false,
+                  "Skip draws whose shader variant is still being compiled in the background instead of waiting for it")
+   DRI_CONF_OPT_I(pan_bo_cache_max_size, 0, 0, 4096,
+                  "Maximum size of the BO cache in MiB, 0 to derive it from the system memory size")
+   DRI_CONF_OPT_B(pan_async_submit, false,
+                  "Hand batches over to the kernel from a per-context submit thread")
+   DRI_CONF_OPT_B(pan_transaction_elimination, false,
+                  "Skip the writeback of unchanged tiles of render targets only written by this driver, based on per-tile checksums")
+   DRI_CONF_OPT_B(pan_warm_up_blitter, false,
+                  "Compile the blit and preload shaders of common render target formats in the background at startup")
+DRI_CONF_SECTION_END
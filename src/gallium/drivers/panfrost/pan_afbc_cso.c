@@ -59,12 +59,9 @@ write_afbc_header(nir_builder *b, nir_def *buf, nir_def *idx, nir_def *hdr)
 }
 
 static nir_def *
-get_morton_index(nir_builder *b, nir_def *idx, nir_def *src_stride,
-                 nir_def *dst_stride)
+get_morton_index_xy(nir_builder *b, nir_def *x, nir_def *y,
+                    nir_def *src_stride)
 {
-   nir_def *x = nir_umod(b, idx, dst_stride);
-   nir_def *y = nir_udiv(b, idx, dst_stride);
-
    nir_def *offset = nir_imul(b, nir_iand_imm(b, y, ~0x7), src_stride);
    offset = nir_iadd(b, offset, nir_ishl_imm(b, nir_ushr_imm(b, x, 3), 6));
 
@@ -79,6 +76,25 @@ get_morton_index(nir_builder *b, nir_def *idx, nir_def *src_stride,
    return nir_iadd(b, offset, tile_idx);
 }
 
+static nir_def *
+get_morton_index(nir_builder *b, nir_def *idx, nir_def *src_stride,
+                 nir_def *dst_stride)
+{
+   nir_def *x = nir_umod(b, idx, dst_stride);
+   nir_def *y = nir_udiv(b, idx, dst_stride);
+
+   return get_morton_index_xy(b, x, y, src_stride);
+}
+
+/* Index of the header of superblock (x, y) in a sparse layout */
+static nir_def *
+get_superblock_index(nir_builder *b, nir_def *x, nir_def *y, nir_def *stride,
+                     bool tiled)
+{
+   return tiled ? get_morton_index_xy(b, x, y, stride)
+                : nir_iadd(b, nir_imul(b, y, stride), x);
+}
+
 static nir_def *
 get_superblock_size(nir_builder *b, unsigned arch, nir_def *hdr,
                     nir_def *uncompressed_size)
@@ -128,9 +144,30 @@ get_superblock_size(nir_builder *b, unsigned arch, nir_def *hdr,
              : size;
 }
 
+static nir_def *
+get_aligned_superblock_size(nir_builder *b, unsigned arch, nir_def *hdr,
+                            unsigned bpp, unsigned align)
+{
+   nir_def *uncompressed_size = nir_imm_int(b, 4 * 4 * bpp / 8); /* bytes */
+   nir_def *size = get_superblock_size(b, arch, hdr, uncompressed_size);
+
+   return nir_iand(b, nir_iadd(b, size, nir_imm_int(b, align - 1)),
+                   nir_inot(b, nir_imm_int(b, align - 1)));
+}
+
+static nir_def *
+get_metadata_entry(nir_builder *b, nir_def *metadata, nir_def *idx,
+                   unsigned field)
+{
+   nir_def *offset = nir_iadd_imm(
+      b, nir_imul_imm(b, idx, sizeof(struct pan_afbc_block_info)), field);
+
+   return nir_iadd(b, metadata, nir_u2u64(b, offset));
+}
+
 static nir_def *
 get_packed_offset(nir_builder *b, nir_def *metadata, nir_def *idx,
-                  nir_def **out_size)
+                  nir_def *row_base, nir_def **out_size)
 {
    nir_def *metadata_offset =
       nir_u2u64(b, nir_imul_imm(b, idx, sizeof(struct pan_afbc_block_info)));
@@ -144,31 +181,15 @@ get_packed_offset(nir_builder *b, nir_def *metadata, nir_def *idx,
       *out_size =
          nir_channel(b, entry, offsetof(struct pan_afbc_block_info, size) / 4);
 
-   return nir_u2u64(b, offset);
+   return nir_u2u64(b, nir_iadd(b, offset, row_base));
 }
 
 #define MAX_LINE_SIZE 16
 
 static void
-copy_superblock(nir_builder *b, nir_def *dst, nir_def *dst_idx, nir_def *hdr_sz,
-                nir_def *src, nir_def *src_idx, nir_def *metadata,
-                nir_def *meta_idx, unsigned align)
+copy_body(nir_builder *b, nir_def *dst_bodyptr, nir_def *src_bodyptr,
+          nir_def *size, unsigned align)
 {
-   nir_def *hdr = read_afbc_header(b, src, src_idx);
-   nir_def *src_body_base_ptr = nir_u2u64(b, nir_channel(b, hdr, 0));
-   nir_def *src_bodyptr = nir_iadd(b, src, src_body_base_ptr);
-
-   nir_def *size;
-   nir_def *dst_offset = get_packed_offset(b, metadata, meta_idx, &size);
-   nir_def *dst_body_base_ptr = nir_iadd(b, dst_offset, hdr_sz);
-   nir_def *dst_bodyptr = nir_iadd(b, dst, dst_body_base_ptr);
-
-   /* Replace the `base_body_ptr` field if not zero (solid color) */
-   nir_def *hdr2 =
-      nir_vector_insert_imm(b, hdr, nir_u2u32(b, dst_body_base_ptr), 0);
-   hdr = nir_bcsel(b, nir_ieq_imm(b, src_body_base_ptr, 0), hdr, hdr2);
-   write_afbc_header(b, dst, dst_idx, hdr);
-
    nir_variable *offset_var =
       nir_local_variable_create(b->impl, glsl_uint_type(), "offset");
    nir_store_var(b, offset_var, nir_imm_int(b, 0), 1);
@@ -193,12 +214,36 @@ copy_superblock(nir_builder *b, nir_def *dst, nir_def *dst_idx, nir_def *hdr_sz,
    nir_pop_loop(b, loop);
 }
 
+static void
+copy_superblock(nir_builder *b, nir_def *dst, nir_def *dst_idx, nir_def *hdr_sz,
+                nir_def *src, nir_def *src_idx, nir_def *metadata,
+                nir_def *meta_idx, nir_def *row_base, unsigned align)
+{
+   nir_def *hdr = read_afbc_header(b, src, src_idx);
+   nir_def *src_body_base_ptr = nir_u2u64(b, nir_channel(b, hdr, 0));
+   nir_def *src_bodyptr = nir_iadd(b, src, src_body_base_ptr);
+
+   nir_def *size;
+   nir_def *dst_offset =
+      get_packed_offset(b, metadata, meta_idx, row_base, &size);
+   nir_def *dst_body_base_ptr = nir_iadd(b, dst_offset, hdr_sz);
+   nir_def *dst_bodyptr = nir_iadd(b, dst, dst_body_base_ptr);
+
+   /* Replace the `base_body_ptr` field if not zero (solid color) */
+   nir_def *hdr2 =
+      nir_vector_insert_imm(b, hdr, nir_u2u32(b, dst_body_base_ptr), 0);
+   hdr = nir_bcsel(b, nir_ieq_imm(b, src_body_base_ptr, 0), hdr, hdr2);
+   write_afbc_header(b, dst, dst_idx, hdr);
+
+   copy_body(b, dst_bodyptr, src_bodyptr, size, align);
+}
+
 #define panfrost_afbc_size_get_info_field(b, field)                            \
    panfrost_afbc_get_info_field(size, b, field)
 
 static nir_shader *
 panfrost_afbc_create_size_shader(struct panfrost_screen *screen, unsigned bpp,
-                                 unsigned align)
+                                 unsigned align, bool tiled)
 {
    struct panfrost_device *dev = pan_device(&screen->base);
 
@@ -208,23 +253,128 @@ panfrost_afbc_create_size_shader(struct panfrost_screen *screen, unsigned bpp,
 
    panfrost_afbc_add_info_ubo(size, b);
 
+   /* Only the superblocks in the damaged rectangle are dispatched, the sizes
+    * of the others are still valid from the previous run */
    nir_def *coord = nir_load_global_invocation_id(&b, 32);
-   nir_def *block_idx = nir_channel(&b, coord, 0);
+   nir_def *x = nir_iadd(&b, nir_channel(&b, coord, 0),
+                         panfrost_afbc_size_get_info_field(&b, origin_x));
+   nir_def *y = nir_iadd(&b, nir_channel(&b, coord, 1),
+                         panfrost_afbc_size_get_info_field(&b, origin_y));
+   nir_def *src_stride = panfrost_afbc_size_get_info_field(&b, src_stride);
+   nir_def *block_idx = get_superblock_index(&b, x, y, src_stride, tiled);
    nir_def *src = panfrost_afbc_size_get_info_field(&b, src);
    nir_def *metadata = panfrost_afbc_size_get_info_field(&b, metadata);
-   nir_def *uncompressed_size = nir_imm_int(&b, 4 * 4 * bpp / 8); /* bytes */
 
    nir_def *hdr = read_afbc_header(&b, src, block_idx);
-   nir_def *size = get_superblock_size(&b, dev->arch, hdr, uncompressed_size);
-   size = nir_iand(&b, nir_iadd(&b, size, nir_imm_int(&b, align - 1)),
-                   nir_inot(&b, nir_imm_int(&b, align - 1)));
+   nir_def *size = get_aligned_superblock_size(&b, dev->arch, hdr, bpp, align);
+
+   nir_store_global(&b,
+                    get_metadata_entry(&b, metadata, block_idx,
+                                       offsetof(struct pan_afbc_block_info,
+                                                size)),
+                    4, size, 0x1);
+
+   return b.shader;
+}
+
+#define panfrost_afbc_scan_get_info_field(b, field)                            \
+   panfrost_afbc_get_info_field(scan, b, field)
 
-   nir_def *offset = nir_u2u64(
-      &b,
-      nir_iadd(&b,
-               nir_imul_imm(&b, block_idx, sizeof(struct pan_afbc_block_info)),
-               nir_imm_int(&b, offsetof(struct pan_afbc_block_info, size))));
-   nir_store_global(&b, nir_iadd(&b, metadata, offset), 4, size, 0x1);
+static nir_shader *
+panfrost_afbc_create_scan_rows_shader(struct panfrost_screen *screen,
+                                      bool tiled)
+{
+   nir_builder b = nir_builder_init_simple_shader(
+      MESA_SHADER_COMPUTE, screen->vtbl.get_compiler_options(),
+      "panfrost_afbc_scan_rows");
+
+   panfrost_afbc_add_info_ubo(scan, b);
+
+   nir_def *y = nir_channel(&b, nir_load_global_invocation_id(&b, 32), 0);
+   nir_def *metadata = panfrost_afbc_scan_get_info_field(&b, metadata);
+   nir_def *rows = panfrost_afbc_scan_get_info_field(&b, rows);
+   nir_def *src_stride = panfrost_afbc_scan_get_info_field(&b, src_stride);
+   nir_def *width = panfrost_afbc_scan_get_info_field(&b, width);
+
+   nir_variable *x_var =
+      nir_local_variable_create(b.impl, glsl_uint_type(), "x");
+   nir_variable *sum_var =
+      nir_local_variable_create(b.impl, glsl_uint_type(), "sum");
+   nir_store_var(&b, x_var, nir_imm_int(&b, 0), 1);
+   nir_store_var(&b, sum_var, nir_imm_int(&b, 0), 1);
+
+   nir_loop *loop = nir_push_loop(&b);
+   {
+      nir_def *x = nir_load_var(&b, x_var);
+      nir_def *sum = nir_load_var(&b, sum_var);
+      nir_if *loop_check = nir_push_if(&b, nir_uge(&b, x, width));
+      nir_jump(&b, nir_jump_break);
+      nir_push_else(&b, loop_check);
+
+      nir_def *idx = get_superblock_index(&b, x, y, src_stride, tiled);
+      nir_def *size = nir_load_global(
+         &b,
+         get_metadata_entry(&b, metadata, idx,
+                            offsetof(struct pan_afbc_block_info, size)),
+         4, 1, 32);
+      nir_store_global(
+         &b,
+         get_metadata_entry(&b, metadata, idx,
+                            offsetof(struct pan_afbc_block_info, offset)),
+         4, sum, 0x1);
+
+      nir_store_var(&b, sum_var, nir_iadd(&b, sum, size), 1);
+      nir_store_var(&b, x_var, nir_iadd_imm(&b, x, 1), 1);
+      nir_pop_if(&b, loop_check);
+   }
+   nir_pop_loop(&b, loop);
+
+   nir_def *row_ptr = nir_iadd(&b, rows, nir_u2u64(&b, nir_imul_imm(&b, y, 4)));
+   nir_store_global(&b, row_ptr, 4, nir_load_var(&b, sum_var), 0x1);
+
+   return b.shader;
+}
+
+static nir_shader *
+panfrost_afbc_create_scan_total_shader(struct panfrost_screen *screen)
+{
+   nir_builder b = nir_builder_init_simple_shader(
+      MESA_SHADER_COMPUTE, screen->vtbl.get_compiler_options(),
+      "panfrost_afbc_scan_total");
+
+   panfrost_afbc_add_info_ubo(scan, b);
+
+   nir_def *rows = panfrost_afbc_scan_get_info_field(&b, rows);
+   nir_def *total = panfrost_afbc_scan_get_info_field(&b, total);
+   nir_def *height = panfrost_afbc_scan_get_info_field(&b, height);
+
+   nir_variable *y_var =
+      nir_local_variable_create(b.impl, glsl_uint_type(), "y");
+   nir_variable *sum_var =
+      nir_local_variable_create(b.impl, glsl_uint_type(), "sum");
+   nir_store_var(&b, y_var, nir_imm_int(&b, 0), 1);
+   nir_store_var(&b, sum_var, nir_imm_int(&b, 0), 1);
+
+   nir_loop *loop = nir_push_loop(&b);
+   {
+      nir_def *y = nir_load_var(&b, y_var);
+      nir_def *sum = nir_load_var(&b, sum_var);
+      nir_if *loop_check = nir_push_if(&b, nir_uge(&b, y, height));
+      nir_jump(&b, nir_jump_break);
+      nir_push_else(&b, loop_check);
+
+      nir_def *row_ptr =
+         nir_iadd(&b, rows, nir_u2u64(&b, nir_imul_imm(&b, y, 4)));
+      nir_def *row_size = nir_load_global(&b, row_ptr, 4, 1, 32);
+      nir_store_global(&b, row_ptr, 4, sum, 0x1);
+
+      nir_store_var(&b, sum_var, nir_iadd(&b, sum, row_size), 1);
+      nir_store_var(&b, y_var, nir_iadd_imm(&b, y, 1), 1);
+      nir_pop_if(&b, loop_check);
+   }
+   nir_pop_loop(&b, loop);
+
+   nir_store_global(&b, total, 4, nir_load_var(&b, sum_var), 0x1);
 
    return b.shader;
 }
@@ -253,9 +403,61 @@ panfrost_afbc_create_pack_shader(struct panfrost_screen *screen, unsigned align,
    nir_def *header_size =
       nir_u2u64(&b, panfrost_afbc_pack_get_info_field(&b, header_size));
    nir_def *metadata = panfrost_afbc_pack_get_info_field(&b, metadata);
+   nir_def *rows = panfrost_afbc_pack_get_info_field(&b, rows);
+   nir_def *row = nir_udiv(&b, dst_idx, dst_stride);
+   nir_def *row_base = nir_load_global(
+      &b, nir_iadd(&b, rows, nir_u2u64(&b, nir_imul_imm(&b, row, 4))), 4, 1,
+      32);
 
    copy_superblock(&b, dst, dst_idx, header_size, src, src_idx, metadata,
-                   src_idx, align);
+                   src_idx, row_base, align);
+
+   return b.shader;
+}
+
+#define panfrost_afbc_unpack_get_info_field(b, field)                          \
+   panfrost_afbc_get_info_field(unpack, b, field)
+
+static nir_shader *
+panfrost_afbc_create_unpack_shader(struct panfrost_screen *screen,
+                                   unsigned bpp, unsigned align, bool tiled)
+{
+   struct panfrost_device *dev = pan_device(&screen->base);
+
+   nir_builder b = nir_builder_init_simple_shader(
+      MESA_SHADER_COMPUTE, screen->vtbl.get_compiler_options(),
+      "panfrost_afbc_unpack(bpp=%d)", bpp);
+
+   panfrost_afbc_add_info_ubo(unpack, b);
+
+   nir_def *src_idx =
+      nir_channel(&b, nir_load_global_invocation_id(&b, 32), 0);
+   nir_def *src_stride = panfrost_afbc_unpack_get_info_field(&b, src_stride);
+   nir_def *dst_stride = panfrost_afbc_unpack_get_info_field(&b, dst_stride);
+   nir_def *x = nir_umod(&b, src_idx, src_stride);
+   nir_def *y = nir_udiv(&b, src_idx, src_stride);
+   nir_def *dst_idx = get_superblock_index(&b, x, y, dst_stride, tiled);
+   nir_def *src = panfrost_afbc_unpack_get_info_field(&b, src);
+   nir_def *dst = panfrost_afbc_unpack_get_info_field(&b, dst);
+   nir_def *header_size = panfrost_afbc_unpack_get_info_field(&b, header_size);
+
+   nir_def *hdr = read_afbc_header(&b, src, src_idx);
+   nir_def *src_bodyptr =
+      nir_iadd(&b, src, nir_u2u64(&b, nir_channel(&b, hdr, 0)));
+   nir_def *size = get_aligned_superblock_size(&b, dev->arch, hdr, bpp, align);
+
+   /* Sparse layouts give each superblock a slot big enough to hold it
+    * uncompressed, indexed like its header */
+   nir_def *dst_body_base_ptr = nir_iadd(
+      &b, header_size, nir_imul_imm(&b, dst_idx, 16 * 16 * bpp / 8));
+   nir_def *dst_bodyptr = nir_iadd(&b, dst, nir_u2u64(&b, dst_body_base_ptr));
+
+   /* Solid color superblocks have no body */
+   nir_def *hdr2 = nir_vector_insert_imm(&b, hdr, dst_body_base_ptr, 0);
+   hdr = nir_bcsel(&b, nir_ieq_imm(&b, size, 0), hdr, hdr2);
+   write_afbc_header(&b, dst, dst_idx, hdr);
+
+   copy_body(&b, dst_bodyptr, src_bodyptr, size, align);
 
    return b.shader;
 }
@@ -268,7 +470,7 @@ panfrost_afbc_get_shaders(struct panfrost_context *ctx,
    struct panfrost_screen *screen = pan_screen(ctx->base.screen);
    bool tiled = rsrc->image.layout.modifier & AFBC_FORMAT_MOD_TILED;
    struct pan_afbc_shader_key key = {
-      .bpp = util_format_get_blocksizebits(rsrc->base.format),
+      .bpp = util_format_get_blocksizebits(rsrc->base.b.format),
       .align = align,
       .tiled = tiled,
    };
@@ -289,13 +491,16 @@ panfrost_afbc_get_shaders(struct panfrost_context *ctx,
 #define COMPILE_SHADER(name, ...)                                              \
    {                                                                           \
       nir_shader *nir =                                                        \
-         panfrost_afbc_create_##name##_shader(screen, __VA_ARGS__);            \
+         panfrost_afbc_create_##name##_shader(__VA_ARGS__);                    \
       nir->info.num_ubos = 1;                                                  \
       shader->name##_cso = pipe_shader_from_nir(pctx, nir);                    \
    }
 
-   COMPILE_SHADER(size, key.bpp, key.align);
-   COMPILE_SHADER(pack, key.align, key.tiled);
+   COMPILE_SHADER(size, screen, key.bpp, key.align, key.tiled);
+   COMPILE_SHADER(scan_rows, screen, key.tiled);
+   COMPILE_SHADER(scan_total, screen);
+   COMPILE_SHADER(pack, screen, key.align, key.tiled);
+   COMPILE_SHADER(unpack, screen, key.bpp, key.align, key.tiled);
 
 #undef COMPILE_SHADER
 
@@ -324,6 +529,7 @@ panfrost_afbc_context_init(struct panfrost_context *ctx)
    ctx->afbc_shaders.shaders = _mesa_hash_table_create(
       NULL, panfrost_afbc_shader_key_hash, panfrost_afbc_shader_key_equal);
    pthread_mutex_init(&ctx->afbc_shaders.lock, NULL);
+   util_dynarray_init(&ctx->afbc_pack_pending, NULL);
 }
 
 void
@@ -331,4 +537,9 @@ panfrost_afbc_context_destroy(struct panfrost_context *ctx)
 {
    _mesa_hash_table_destroy(ctx->afbc_shaders.shaders, NULL);
    pthread_mutex_destroy(&ctx->afbc_shaders.lock);
+
+   util_dynarray_foreach(&ctx->afbc_pack_pending, struct pipe_resource *,
+                         rsrc)
+      pipe_resource_reference(rsrc, NULL);
+   util_dynarray_fini(&ctx->afbc_pack_pending);
 }
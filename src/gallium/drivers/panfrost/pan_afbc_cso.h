@@ -42,7 +42,10 @@ struct pan_afbc_shader_key {
 struct pan_afbc_shader_data {
    struct pan_afbc_shader_key key;
    void *size_cso;
+   void *scan_rows_cso;
+   void *scan_total_cso;
    void *pack_cso;
+   void *unpack_cso;
 };
 
 struct pan_afbc_shaders {
@@ -58,16 +61,46 @@ struct pan_afbc_block_info {
 struct panfrost_afbc_size_info {
    mali_ptr src;
    mali_ptr metadata;
+   uint32_t origin_x;
+   uint32_t origin_y;
+   uint32_t src_stride;
+   uint32_t padding;
+} PACKED;
+
+/* The offsets of the packed superblocks are an exclusive prefix sum of their
+ * sizes, in raster order. It is computed in two passes: one invocation per row
+ * computes offsets relative to its row and the size of the row, then a single
+ * invocation turns the row sizes into row offsets and the total body size. */
+struct panfrost_afbc_scan_info {
+   mali_ptr metadata;
+   mali_ptr rows;
+   mali_ptr total;
+   uint32_t src_stride;
+   uint32_t width;
+   uint32_t height;
+   uint32_t padding[3];
 } PACKED;
 
 struct panfrost_afbc_pack_info {
    mali_ptr src;
    mali_ptr dst;
    mali_ptr metadata;
+   mali_ptr rows;
+   uint32_t header_size;
+   uint32_t src_stride;
+   uint32_t dst_stride;
+   uint32_t padding;
+} PACKED;
+
+/* Inverse of the pack shader, copying a packed layout back to a sparse one
+ * without recompressing, so superblock sizes are preserved. */
+struct panfrost_afbc_unpack_info {
+   mali_ptr src;
+   mali_ptr dst;
    uint32_t header_size;
    uint32_t src_stride;
    uint32_t dst_stride;
-   uint32_t padding[3]; // FIXME
+   uint32_t padding;
 } PACKED;
 
 void panfrost_afbc_context_init(struct panfrost_context *ctx);
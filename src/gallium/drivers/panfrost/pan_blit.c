@@ -90,7 +90,11 @@ panfrost_blit_no_afbc_legalization(struct pipe_context *pipe,
    panfrost_blitter_save(ctx, info->render_condition_enable
                                  ? PAN_RENDER_BLIT_COND
                                  : PAN_RENDER_BLIT);
+
+   trace_start_blit(&ctx->trace);
    util_blitter_blit(ctx->blitter, info);
+   trace_end_blit(&ctx->trace, info->src.format, info->dst.format,
+                  info->dst.box.width, info->dst.box.height);
 }
 
 void
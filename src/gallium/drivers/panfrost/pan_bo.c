@@ -34,10 +34,15 @@
 #include "pan_util.h"
 #include "wrap.h"
 
+#include "util/os_misc.h"
 #include "util/os_mman.h"
+#include "util/os_time.h"
+#include "util/timespec.h"
 
 #include "util/u_inlines.h"
 #include "util/u_math.h"
+#include "util/u_memory.h"
+#include "util/u_thread.h"
 
 /* This file implements a userspace BO cache. Allocating and freeing
  * GPU-visible buffers is very expensive, and even the extra kernel roundtrips
@@ -52,6 +57,10 @@
  * BO and removing it from the bucket. We special case evicting all BOs from
  * the cache, since that's what helpful in practice and avoids extra logic
  * around the linked list.
+ *
+ * The cache is bounded by a byte budget, and BOs unused for more than
+ * PAN_BO_CACHE_MAX_AGE_NS are evicted, either when another BO is put in the
+ * cache or by a background reaper thread.
  */
 
 static uint32_t
@@ -137,6 +146,58 @@ panfrost_bo_free(struct panfrost_bo *bo)
    pan_kmod_bo_put(kmod_bo);
 }
 
+/* Batches queued on a context submit thread count themselves as pending on
+ * every BO they use, until the kernel has seen them.
+ */
+void
+panfrost_bo_add_pending_submit(struct panfrost_bo *bo)
+{
+   struct panfrost_device *dev = bo->dev;
+
+   pthread_mutex_lock(&dev->pending_submits.lock);
+   p_atomic_inc(&bo->pending_submits);
+   pthread_mutex_unlock(&dev->pending_submits.lock);
+}
+
+void
+panfrost_bo_remove_pending_submit(struct panfrost_bo *bo)
+{
+   struct panfrost_device *dev = bo->dev;
+
+   pthread_mutex_lock(&dev->pending_submits.lock);
+   assert(bo->pending_submits > 0);
+   if (p_atomic_dec_zero(&bo->pending_submits))
+      pthread_cond_broadcast(&dev->pending_submits.cond);
+   pthread_mutex_unlock(&dev->pending_submits.lock);
+}
+
+/* Wait until the batches using the BO that are queued on submit threads
+ * reached the kernel. Returns false without waiting if some are pending and
+ * the caller doesn't want to block.
+ */
+bool
+panfrost_bo_wait_pending_submits(struct panfrost_bo *bo, bool dontwait)
+{
+   struct panfrost_device *dev = bo->dev;
+
+   /* Accesses to suballocated BOs are tracked on the slab */
+   if (bo->parent)
+      bo = bo->parent;
+
+   if (!p_atomic_read(&bo->pending_submits))
+      return true;
+
+   if (dontwait)
+      return false;
+
+   pthread_mutex_lock(&dev->pending_submits.lock);
+   while (bo->pending_submits)
+      pthread_cond_wait(&dev->pending_submits.cond, &dev->pending_submits.lock);
+   pthread_mutex_unlock(&dev->pending_submits.lock);
+
+   return true;
+}
+
 /* Returns true if the BO is ready, false otherwise.
  * access_type is encoding the type of access one wants to ensure is done.
  * Waiting is always done for writers, but if wait_readers is set then readers
@@ -145,6 +206,10 @@ panfrost_bo_free(struct panfrost_bo *bo)
 bool
 panfrost_bo_wait(struct panfrost_bo *bo, int64_t timeout_ns, bool wait_readers)
 {
+   /* Accesses to suballocated BOs are tracked on the slab */
+   if (bo->parent)
+      bo = bo->parent;
+
    /* If the BO has been exported or imported we can't rely on the cached
     * state, we need to call the WAIT_BO ioctl.
     */
@@ -160,6 +225,12 @@ panfrost_bo_wait(struct panfrost_bo *bo, int64_t timeout_ns, bool wait_readers)
          return true;
    }
 
+   /* Accesses from batches still queued on a submit thread are invisible
+    * to the kernel until they're submitted.
+    */
+   if (!panfrost_bo_wait_pending_submits(bo, timeout_ns == 0))
+      return false;
+
    if (pan_kmod_bo_wait(bo->kmod_bo, timeout_ns, !wait_readers)) {
       /* Set gpu_access to 0 so that the next call to bo_wait()
        * doesn't have to call the WAIT_BO ioctl.
@@ -195,10 +266,24 @@ pan_bucket(struct panfrost_device *dev, unsigned size)
    return &dev->bo_cache.buckets[pan_bucket_index(size)];
 }
 
+static void
+panfrost_bo_cache_remove_locked(struct panfrost_device *dev,
+                                struct panfrost_bo *bo)
+{
+   list_del(&bo->bucket_link);
+   list_del(&bo->lru_link);
+   dev->bo_cache.size -= panfrost_bo_size(bo);
+}
+
 /* Tries to fetch a BO of sufficient size with the appropriate flags from the
  * BO cache. If it succeeds, it returns that BO and removes the BO from the
  * cache. If it fails, it returns NULL signaling the caller to allocate a new
- * BO. */
+ * BO.
+ *
+ * Without waiting, an idle BO of the exact size is preferred. Otherwise, we
+ * settle for the first idle BO that doesn't waste more than a quarter of its
+ * size, so big cached BOs are not burnt on small allocations. Blocking fetches
+ * come after an allocation failed, so they take any BO that fits. */
 
 static struct panfrost_bo *
 panfrost_bo_cache_fetch(struct panfrost_device *dev, size_t size,
@@ -206,11 +291,14 @@ panfrost_bo_cache_fetch(struct panfrost_device *dev, size_t size,
 {
    pthread_mutex_lock(&dev->bo_cache.lock);
    struct list_head *bucket = pan_bucket(dev, size);
-   struct panfrost_bo *bo = NULL;
+   struct panfrost_bo *bo = NULL, *fallback = NULL;
 
    /* Iterate the bucket looking for something suitable */
    list_for_each_entry_safe(struct panfrost_bo, entry, bucket, bucket_link) {
-      if (panfrost_bo_size(entry) < size || entry->flags != flags)
+      size_t entry_size = panfrost_bo_size(entry);
+
+      if (entry_size < size || entry->flags != flags ||
+          (dontwait && entry_size - size > entry_size / 4))
          continue;
 
       /* If the oldest BO in the cache is busy, likely so is
@@ -218,45 +306,58 @@ panfrost_bo_cache_fetch(struct panfrost_device *dev, size_t size,
       if (!panfrost_bo_wait(entry, dontwait ? 0 : INT64_MAX, true))
          break;
 
+      if (entry_size == size || !dontwait) {
+         bo = entry;
+         break;
+      }
+
+      if (!fallback)
+         fallback = entry;
+   }
+
+   if (!bo)
+      bo = fallback;
+
+   if (bo) {
       /* This one works, splice it out of the cache */
-      list_del(&entry->bucket_link);
-      list_del(&entry->lru_link);
+      panfrost_bo_cache_remove_locked(dev, bo);
 
-      if (!pan_kmod_bo_make_unevictable(entry->kmod_bo)) {
-         panfrost_bo_free(entry);
-         continue;
+      if (pan_kmod_bo_make_unevictable(bo->kmod_bo)) {
+         /* Let's go! */
+         bo->label = label;
+      } else {
+         panfrost_bo_free(bo);
+         bo = NULL;
       }
-      /* Let's go! */
-      bo = entry;
-      bo->label = label;
-      break;
    }
+
+   if (dontwait) {
+      if (bo)
+         dev->bo_cache.hits++;
+      else
+         dev->bo_cache.misses++;
+   }
+
    pthread_mutex_unlock(&dev->bo_cache.lock);
 
    return bo;
 }
 
+/* Drops BOs which haven't been used for a while, then the least recently used
+ * ones until the cache fits in its budget. */
+
 static void
 panfrost_bo_cache_evict_stale_bos(struct panfrost_device *dev)
 {
-   struct timespec time;
+   int64_t now = os_time_get_nano();
 
-   clock_gettime(CLOCK_MONOTONIC, &time);
    list_for_each_entry_safe(struct panfrost_bo, entry, &dev->bo_cache.lru,
                             lru_link) {
-      /* We want all entries that have been used more than 1 sec
-       * ago to be dropped, others can be kept.
-       * Note the <= 2 check and not <= 1. It's here to account for
-       * the fact that we're only testing ->tv_sec, not ->tv_nsec.
-       * That means we might keep entries that are between 1 and 2
-       * seconds old, but we don't really care, as long as unused BOs
-       * are dropped at some point.
-       */
-      if (time.tv_sec - entry->last_used <= 2)
+      if (now - entry->last_used <= PAN_BO_CACHE_MAX_AGE_NS &&
+          dev->bo_cache.size <= dev->bo_cache.max_size)
          break;
 
-      list_del(&entry->bucket_link);
-      list_del(&entry->lru_link);
+      panfrost_bo_cache_remove_locked(dev, entry);
       panfrost_bo_free(entry);
    }
 }
@@ -272,21 +373,28 @@ panfrost_bo_cache_put(struct panfrost_bo *bo)
    if (bo->flags & PAN_BO_SHARED || dev->debug & PAN_DBG_NO_CACHE)
       return false;
 
+   /* Don't bother caching BOs which would blow the budget on their own */
+   if (panfrost_bo_size(bo) > dev->bo_cache.max_size)
+      return false;
+
    /* Must be first */
    pthread_mutex_lock(&dev->bo_cache.lock);
 
    struct list_head *bucket = pan_bucket(dev, MAX2(panfrost_bo_size(bo), 4096));
-   struct timespec time;
 
    pan_kmod_bo_make_evictable(bo->kmod_bo);
 
+   /* Wake the reaper up if it was waiting for something to reap */
+   if (list_is_empty(&dev->bo_cache.lru))
+      pthread_cond_signal(&dev->bo_cache.reaper_cond);
+
    /* Add us to the bucket */
    list_addtail(&bo->bucket_link, bucket);
 
    /* Add us to the LRU list and update the last_used field. */
    list_addtail(&bo->lru_link, &dev->bo_cache.lru);
-   clock_gettime(CLOCK_MONOTONIC, &time);
-   bo->last_used = time.tv_sec;
+   bo->last_used = os_time_get_nano();
+   dev->bo_cache.size += panfrost_bo_size(bo);
 
    /* Let's do some cleanup in the BO cache while we hold the
     * lock.
@@ -315,27 +423,261 @@ panfrost_bo_cache_evict_all(struct panfrost_device *dev)
       struct list_head *bucket = &dev->bo_cache.buckets[i];
 
       list_for_each_entry_safe(struct panfrost_bo, entry, bucket, bucket_link) {
-         list_del(&entry->bucket_link);
-         list_del(&entry->lru_link);
+         panfrost_bo_cache_remove_locked(dev, entry);
          panfrost_bo_free(entry);
       }
    }
    pthread_mutex_unlock(&dev->bo_cache.lock);
 }
 
+/* Stale BOs are otherwise only evicted when another BO is released, so an idle
+ * application would keep its cache forever. The reaper thread wakes up
+ * periodically while the cache is not empty to drop them. */
+
+static void *
+panfrost_bo_cache_reaper(void *data)
+{
+   struct panfrost_device *dev = data;
+
+   u_thread_setname("pan_bo_reaper");
+
+   pthread_mutex_lock(&dev->bo_cache.lock);
+
+   while (!dev->bo_cache.reaper_stop) {
+      panfrost_bo_cache_evict_stale_bos(dev);
+
+      if (list_is_empty(&dev->bo_cache.lru)) {
+         pthread_cond_wait(&dev->bo_cache.reaper_cond, &dev->bo_cache.lock);
+      } else {
+         struct timespec deadline;
+
+         clock_gettime(CLOCK_MONOTONIC, &deadline);
+         timespec_add_nsec(&deadline, &deadline, PAN_BO_CACHE_MAX_AGE_NS);
+         pthread_cond_timedwait(&dev->bo_cache.reaper_cond,
+                                &dev->bo_cache.lock, &deadline);
+      }
+   }
+
+   pthread_mutex_unlock(&dev->bo_cache.lock);
+   return NULL;
+}
+
+void
+panfrost_bo_cache_init(struct panfrost_device *dev)
+{
+   uint64_t total_ram;
+
+   pthread_mutex_init(&dev->bo_cache.lock, NULL);
+   list_inithead(&dev->bo_cache.lru);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(dev->bo_cache.buckets); ++i)
+      list_inithead(&dev->bo_cache.buckets[i]);
+
+   /* Keep the cache small relative to the system memory, this matters on
+    * devices with a few GB of RAM shared with the GPU. */
+   dev->bo_cache.max_size = PAN_BO_CACHE_DEFAULT_MAX_SIZE;
+   if (os_get_total_physical_memory(&total_ram))
+      dev->bo_cache.max_size = MIN2(dev->bo_cache.max_size, total_ram / 32);
+
+   if (dev->debug & PAN_DBG_NO_CACHE)
+      return;
+
+   pthread_condattr_t attr;
+   pthread_condattr_init(&attr);
+   pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+   pthread_cond_init(&dev->bo_cache.reaper_cond, &attr);
+   pthread_condattr_destroy(&attr);
+
+   dev->bo_cache.has_reaper = !pthread_create(
+      &dev->bo_cache.reaper, NULL, panfrost_bo_cache_reaper, dev);
+}
+
+void
+panfrost_bo_cache_fini(struct panfrost_device *dev)
+{
+   if (dev->bo_cache.has_reaper) {
+      pthread_mutex_lock(&dev->bo_cache.lock);
+      dev->bo_cache.reaper_stop = true;
+      pthread_cond_signal(&dev->bo_cache.reaper_cond);
+      pthread_mutex_unlock(&dev->bo_cache.lock);
+
+      pthread_join(dev->bo_cache.reaper, NULL);
+   }
+
+   if (!(dev->debug & PAN_DBG_NO_CACHE))
+      pthread_cond_destroy(&dev->bo_cache.reaper_cond);
+
+   panfrost_bo_cache_evict_all(dev);
+   pthread_mutex_destroy(&dev->bo_cache.lock);
+}
+
+/* Small BOs are suballocated from slabs, using the generic pb_slab allocator.
+ * A slab is a regular BO from the cache, carved in power-of-two entries of a
+ * single size class. Fencing is done per slab: an entry can be reused once
+ * the whole slab is idle, which is cheap to check since GPU accesses are
+ * tracked on the slab BO itself.
+ */
+
+struct panfrost_bo_slab_entry {
+   struct pb_slab_entry base;
+   struct panfrost_bo bo;
+};
+
+struct panfrost_bo_slab {
+   struct pb_slab base;
+
+   /* BO backing the slab */
+   struct panfrost_bo *bo;
+
+   struct panfrost_bo_slab_entry *entries;
+};
+
+enum panfrost_bo_slab_heap {
+   PAN_BO_SLAB_HEAP_DATA = 0,
+   PAN_BO_SLAB_HEAP_EXECUTE,
+   PAN_BO_SLAB_NUM_HEAPS,
+};
+
+static bool
+panfrost_bo_slab_can_reclaim(void *priv, struct pb_slab_entry *entry)
+{
+   struct panfrost_bo_slab *slab = (struct panfrost_bo_slab *)entry->slab;
+
+   return panfrost_bo_wait(slab->bo, 0, true);
+}
+
+static struct pb_slab *
+panfrost_bo_slab_alloc(void *priv, unsigned heap, unsigned entry_size,
+                       unsigned group_index)
+{
+   struct panfrost_device *dev = priv;
+   struct panfrost_bo_slab *slab = CALLOC_STRUCT(panfrost_bo_slab);
+
+   if (!slab)
+      return NULL;
+
+   uint32_t flags = heap == PAN_BO_SLAB_HEAP_EXECUTE ? PAN_BO_EXECUTE : 0;
+   unsigned slab_size = MAX2(BO_SLAB_SIZE, entry_size);
+
+   slab->bo = panfrost_bo_create(dev, slab_size, flags, "BO slab");
+
+   if (!slab->bo) {
+      FREE(slab);
+      return NULL;
+   }
+
+   slab->base.num_entries = slab_size / entry_size;
+   slab->base.num_free = slab->base.num_entries;
+   slab->base.group_index = group_index;
+   slab->base.entry_size = entry_size;
+   slab->entries = CALLOC(slab->base.num_entries, sizeof(*slab->entries));
+
+   if (!slab->entries) {
+      panfrost_bo_unreference(slab->bo);
+      FREE(slab);
+      return NULL;
+   }
+
+   list_inithead(&slab->base.free);
+
+   for (unsigned i = 0; i < slab->base.num_entries; ++i) {
+      struct panfrost_bo_slab_entry *entry = &slab->entries[i];
+      unsigned offset = i * entry_size;
+
+      entry->base.slab = &slab->base;
+      entry->bo.dev = dev;
+      entry->bo.parent = slab->bo;
+      entry->bo.kmod_bo = slab->bo->kmod_bo;
+      entry->bo.flags = flags;
+      entry->bo.suballoc_size = entry_size;
+      entry->bo.ptr.gpu = slab->bo->ptr.gpu + offset;
+      entry->bo.ptr.cpu = slab->bo->ptr.cpu + offset;
+
+      list_addtail(&entry->base.head, &slab->base.free);
+   }
+
+   p_atomic_inc(&dev->bo_slab.slab_allocs);
+
+   return &slab->base;
+}
+
+static void
+panfrost_bo_slab_free(void *priv, struct pb_slab *pslab)
+{
+   struct panfrost_bo_slab *slab = (struct panfrost_bo_slab *)pslab;
+
+   panfrost_bo_unreference(slab->bo);
+   FREE(slab->entries);
+   FREE(slab);
+}
+
+void
+panfrost_bo_slabs_init(struct panfrost_device *dev)
+{
+   pb_slabs_init(&dev->bo_slab.slabs, MIN_BO_SLAB_ORDER, MAX_BO_SLAB_ORDER,
+                 PAN_BO_SLAB_NUM_HEAPS, false, dev,
+                 panfrost_bo_slab_can_reclaim, panfrost_bo_slab_alloc,
+                 panfrost_bo_slab_free);
+}
+
+void
+panfrost_bo_slabs_cleanup(struct panfrost_device *dev)
+{
+   pb_slabs_deinit(&dev->bo_slab.slabs);
+}
+
+/* Suballocations which didn't need a new slab */
+uint64_t
+panfrost_bo_slab_hits(struct panfrost_device *dev)
+{
+   uint64_t slab_allocs = p_atomic_read(&dev->bo_slab.slab_allocs);
+   uint64_t allocs = p_atomic_read(&dev->bo_slab.allocs);
+
+   return allocs - MIN2(slab_allocs, allocs);
+}
+
+static struct panfrost_bo *
+panfrost_bo_suballoc(struct panfrost_device *dev, size_t size, uint32_t flags,
+                     const char *label)
+{
+   unsigned heap = (flags & PAN_BO_EXECUTE) ? PAN_BO_SLAB_HEAP_EXECUTE
+                                            : PAN_BO_SLAB_HEAP_DATA;
+   struct pb_slab_entry *entry =
+      pb_slab_alloc(&dev->bo_slab.slabs, MAX2(size, 1), heap);
+
+   if (!entry)
+      return NULL;
+
+   struct panfrost_bo *bo =
+      &container_of(entry, struct panfrost_bo_slab_entry, base)->bo;
+
+   bo->label = label;
+   bo->flags = flags;
+   bo->gpu_access = 0;
+   p_atomic_set(&bo->refcnt, 1);
+   p_atomic_inc(&dev->bo_slab.allocs);
+
+   return bo;
+}
+
 void
 panfrost_bo_mmap(struct panfrost_bo *bo)
 {
-   if (bo->ptr.cpu)
+   if (p_atomic_read(&bo->ptr.cpu))
       return;
 
-   bo->ptr.cpu = pan_kmod_bo_mmap(bo->kmod_bo, 0, panfrost_bo_size(bo),
-                                  PROT_READ | PROT_WRITE, MAP_SHARED, NULL);
-   if (bo->ptr.cpu == MAP_FAILED) {
-      bo->ptr.cpu = NULL;
-      fprintf(stderr, "mmap failed: result=%p size=0x%llx\n", bo->ptr.cpu,
+   void *cpu = pan_kmod_bo_mmap(bo->kmod_bo, 0, panfrost_bo_size(bo),
+                                PROT_READ | PROT_WRITE, MAP_SHARED, NULL);
+   if (cpu == MAP_FAILED) {
+      fprintf(stderr, "mmap failed: result=%p size=0x%llx\n", cpu,
               (long long)panfrost_bo_size(bo));
+      return;
    }
+
+   /* Unsynchronized maps from a threaded context can race with the driver
+    * thread here. Only publish one mapping and drop the loser's. */
+   if (p_atomic_cmpxchg(&bo->ptr.cpu, NULL, cpu) != NULL)
+      os_munmap(cpu, panfrost_bo_size(bo));
 }
 
 static void
@@ -361,6 +703,19 @@ panfrost_bo_create(struct panfrost_device *dev, size_t size, uint32_t flags,
    /* Kernel will fail (confusingly) with EPERM otherwise */
    assert(size > 0);
 
+   if (flags & PAN_BO_SUBALLOC) {
+      assert(!(flags & (PAN_BO_GROWABLE | PAN_BO_INVISIBLE | PAN_BO_SHAREABLE)));
+
+      if (size <= (1 << MAX_BO_SLAB_ORDER) &&
+          !(dev->debug & (PAN_DBG_NO_CACHE | PAN_DBG_NO_SLAB))) {
+         bo = panfrost_bo_suballoc(dev, size, flags, label);
+         if (bo)
+            return bo;
+      }
+
+      flags &= ~PAN_BO_SUBALLOC;
+   }
+
    /* To maximize BO cache usage, don't allocate tiny BOs */
    size = ALIGN_POT(size, 4096);
 
@@ -431,6 +786,17 @@ panfrost_bo_unreference(struct panfrost_bo *bo)
 
    struct panfrost_device *dev = bo->dev;
 
+   /* Suballocated BOs can't be imported, so there is no race to handle. The
+    * entry is reused once the slab is idle.
+    */
+   if (bo->parent) {
+      struct panfrost_bo_slab_entry *entry =
+         container_of(bo, struct panfrost_bo_slab_entry, bo);
+
+      pb_slab_free(&dev->bo_slab.slabs, &entry->base);
+      return;
+   }
+
    pthread_mutex_lock(&dev->bo_map_lock);
 
    /* Someone might have imported this BO while we were waiting for the
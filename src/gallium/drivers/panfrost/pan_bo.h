@@ -58,6 +58,12 @@
  * PAN_BO_SHARED if the BO has not been exported yet */
 #define PAN_BO_SHAREABLE (1 << 5)
 
+/* Small BO which may be suballocated from a larger slab BO shared with other
+ * such allocations, saving a GEM object per allocation. Only valid for
+ * CPU-visible, non-shareable, non-growable BOs. Such a BO is busy as long as
+ * any BO of the slab is busy. */
+#define PAN_BO_SUBALLOC (1 << 6)
+
 /* GPU access flags */
 
 /* BO is either shared (can be accessed by more than one GPU batch) or private
@@ -76,6 +82,10 @@
 /* BO is accessed by the fragment job. */
 #define PAN_BO_ACCESS_FRAGMENT (1 << 4)
 
+/* Batch-private: the subresources of the resource accessed were not recorded,
+ * so any access from another batch conflicts. Not seen by the kernel. */
+#define PAN_BO_ACCESS_UNTRACKED (1 << 5)
+
 typedef uint8_t pan_bo_access;
 
 struct panfrost_device;
@@ -87,10 +97,10 @@ struct panfrost_bo {
    /* Used to link the BO to the BO cache LRU list. */
    struct list_head lru_link;
 
-   /* Store the time this BO was use last, so the BO cache logic can evict
-    * stale BOs.
+   /* Store the time this BO was use last (in nanoseconds), so the BO cache
+    * logic can evict stale BOs.
     */
-   time_t last_used;
+   int64_t last_used;
 
    /* Atomic reference count */
    int32_t refcnt;
@@ -111,14 +121,27 @@ struct panfrost_bo {
     */
    uint32_t gpu_access;
 
+   /* Number of batches using this BO that are queued on a context submit
+    * thread and haven't been handed to the kernel yet. The kernel can't see
+    * their accesses, so waits have to let them drain first. Protected by the
+    * device pending_submits lock, read atomically for busy checks.
+    */
+   uint32_t pending_submits;
+
    /* Human readable description of the BO for debugging. */
    const char *label;
+
+   /* For BOs suballocated from a slab, the BO backing the slab and the size
+    * of the suballocation. kmod_bo is then the one of the parent, and GPU
+    * accesses are tracked on the parent. */
+   struct panfrost_bo *parent;
+   size_t suballoc_size;
 };
 
 static inline size_t
 panfrost_bo_size(struct panfrost_bo *bo)
 {
-   return bo->kmod_bo->size;
+   return bo->parent ? bo->suballoc_size : bo->kmod_bo->size;
 }
 
 static inline size_t
@@ -137,8 +160,19 @@ void panfrost_bo_unreference(struct panfrost_bo *bo);
 struct panfrost_bo *panfrost_bo_create(struct panfrost_device *dev, size_t size,
                                        uint32_t flags, const char *label);
 void panfrost_bo_mmap(struct panfrost_bo *bo);
+
+void panfrost_bo_add_pending_submit(struct panfrost_bo *bo);
+
+void panfrost_bo_remove_pending_submit(struct panfrost_bo *bo);
+
+bool panfrost_bo_wait_pending_submits(struct panfrost_bo *bo, bool dontwait);
 struct panfrost_bo *panfrost_bo_import(struct panfrost_device *dev, int fd);
 int panfrost_bo_export(struct panfrost_bo *bo);
+void panfrost_bo_cache_init(struct panfrost_device *dev);
+void panfrost_bo_cache_fini(struct panfrost_device *dev);
 void panfrost_bo_cache_evict_all(struct panfrost_device *dev);
+void panfrost_bo_slabs_init(struct panfrost_device *dev);
+void panfrost_bo_slabs_cleanup(struct panfrost_device *dev);
+uint64_t panfrost_bo_slab_hits(struct panfrost_device *dev);
 
 #endif /* __PAN_BO_H__ */
@@ -1045,8 +1045,8 @@ panfrost_upload_ssbo_sysval(struct panfrost_batch *batch,
 
    panfrost_batch_write_rsrc(batch, rsrc, st);
 
-   util_range_add(&rsrc->base, &rsrc->valid_buffer_range, sb.buffer_offset,
-                  sb.buffer_size);
+   util_range_add(&rsrc->base.b, &rsrc->base.valid_buffer_range,
+                  sb.buffer_offset, sb.buffer_size);
 
    /* Upload address and size as sysval */
    uniform->du[0] = bo->ptr.gpu + sb.buffer_offset;
@@ -1203,7 +1203,7 @@ panfrost_upload_sysvals(struct panfrost_batch *batch, void *ptr_cpu,
          struct panfrost_resource *rsrc = pan_resource(target->buffer);
          unsigned offset = panfrost_xfb_offset(stride, target);
 
-         util_range_add(&rsrc->base, &rsrc->valid_buffer_range, offset,
+         util_range_add(&rsrc->base.b, &rsrc->base.valid_buffer_range, offset,
                         target->buffer_size - offset);
 
          panfrost_batch_write_rsrc(batch, rsrc, PIPE_SHADER_VERTEX);
@@ -1476,9 +1476,8 @@ panfrost_get_tex_desc(struct panfrost_batch *batch, enum pipe_shader_type st,
       return (mali_ptr)0;
 
    struct pipe_sampler_view *pview = &view->base;
-   struct panfrost_resource *rsrc = pan_resource(pview->texture);
 
-   panfrost_batch_read_rsrc(batch, rsrc, st);
+   panfrost_batch_read_view(batch, pview, st);
    panfrost_batch_add_bo(batch, view->state.bo, st);
 
    return view->state.gpu;
@@ -1499,7 +1498,7 @@ panfrost_create_sampler_view_bo(struct panfrost_sampler_view *so,
    /* Format to access the stencil/depth portion of a Z32_S8 texture */
    if (format == PIPE_FORMAT_X32_S8X24_UINT) {
       assert(prsrc->separate_stencil);
-      texture = &prsrc->separate_stencil->base;
+      texture = &prsrc->separate_stencil->base.b;
       prsrc = (struct panfrost_resource *)texture;
       format = texture->format;
    } else if (format == PIPE_FORMAT_Z32_FLOAT_S8X24_UINT) {
@@ -1558,8 +1557,10 @@ panfrost_create_sampler_view_bo(struct panfrost_sampler_view *so,
                    GENX(panfrost_estimate_texture_payload_size)(&iview);
 
    struct panfrost_pool *pool = so->pool ?: &ctx->descs;
+   simple_mtx_lock(&ctx->pool_lock);
    struct panfrost_ptr payload = pan_pool_alloc_aligned(&pool->base, size, 64);
    so->state = panfrost_pool_take_ref(&ctx->descs, payload.gpu);
+   simple_mtx_unlock(&ctx->pool_lock);
 
    void *tex = (PAN_ARCH >= 6) ? &so->bifrost_descriptor : payload.cpu;
 
@@ -1591,7 +1592,7 @@ panfrost_update_sampler_view(struct panfrost_sampler_view *view,
    if (view->texture_bo != rsrc->image.data.base ||
        view->modifier != rsrc->image.layout.modifier) {
       panfrost_bo_unreference(view->state.bo);
-      panfrost_create_sampler_view_bo(view, pctx, &rsrc->base);
+      panfrost_create_sampler_view_bo(view, pctx, &rsrc->base.b);
    }
 }
 
@@ -1645,12 +1646,11 @@ panfrost_emit_texture_descriptors(struct panfrost_batch *batch,
       }
 
       struct pipe_sampler_view *pview = &view->base;
-      struct panfrost_resource *rsrc = pan_resource(pview->texture);
 
       panfrost_update_sampler_view(view, &ctx->base);
       out[i] = view->bifrost_descriptor;
 
-      panfrost_batch_read_rsrc(batch, rsrc, stage);
+      panfrost_batch_read_view(batch, pview, stage);
       panfrost_batch_add_bo(batch, view->state.bo, stage);
    }
 
@@ -1776,8 +1776,8 @@ emit_image_bufs(struct panfrost_batch *batch, enum pipe_shader_type shader,
 
       bool is_msaa = image->resource->nr_samples > 1;
 
-      bool is_3d = rsrc->base.target == PIPE_TEXTURE_3D;
-      bool is_buffer = rsrc->base.target == PIPE_BUFFER;
+      bool is_3d = rsrc->base.b.target == PIPE_TEXTURE_3D;
+      bool is_buffer = rsrc->base.b.target == PIPE_BUFFER;
 
       unsigned offset = is_buffer ? image->u.buf.offset
                                   : panfrost_texture_offset(
@@ -1797,7 +1797,7 @@ emit_image_bufs(struct panfrost_batch *batch, enum pipe_shader_type shader,
       if (is_buffer) {
          pan_pack(bufs + (i * 2) + 1, ATTRIBUTE_BUFFER_CONTINUATION_3D, cfg) {
             cfg.s_dimension =
-               rsrc->base.width0 / util_format_get_blocksize(image->format);
+               rsrc->base.b.width0 / util_format_get_blocksize(image->format);
             cfg.t_dimension = cfg.r_dimension = 1;
          }
 
@@ -1809,23 +1809,23 @@ emit_image_bufs(struct panfrost_batch *batch, enum pipe_shader_type shader,
          unsigned r_dim;
 
          if (is_3d) {
-            r_dim = u_minify(rsrc->base.depth0, level);
+            r_dim = u_minify(rsrc->base.b.depth0, level);
          } else if (is_msaa) {
             r_dim = u_minify(image->resource->nr_samples, level);
          } else {
             r_dim = image->u.tex.last_layer - image->u.tex.first_layer + 1;
          }
-         cfg.s_dimension = u_minify(rsrc->base.width0, level);
-         cfg.t_dimension = u_minify(rsrc->base.height0, level);
+         cfg.s_dimension = u_minify(rsrc->base.b.width0, level);
+         cfg.t_dimension = u_minify(rsrc->base.b.height0, level);
          cfg.r_dimension = r_dim;
 
          cfg.row_stride = rsrc->image.layout.slices[level].row_stride;
 
          if (is_msaa) {
-            unsigned samples = rsrc->base.nr_samples;
+            unsigned samples = rsrc->base.b.nr_samples;
             cfg.slice_stride =
                panfrost_get_layer_stride(&rsrc->image.layout, level) / samples;
-         } else if (rsrc->base.target != PIPE_TEXTURE_2D) {
+         } else if (rsrc->base.b.target != PIPE_TEXTURE_2D) {
             cfg.slice_stride =
                panfrost_get_layer_stride(&rsrc->image.layout, level);
          }
@@ -1945,7 +1945,7 @@ panfrost_emit_vertex_data(struct panfrost_batch *batch, mali_ptr *buffers)
       /* Since we advanced the base pointer, we shrink the buffer
        * size, but add the offset we subtracted */
       unsigned size =
-         rsrc->base.width0 + (raw_addr - addr) - buf->buffer_offset;
+         rsrc->base.b.width0 + (raw_addr - addr) - buf->buffer_offset;
 
       /* When there is a divisor, the hardware-level divisor is
        * the product of the instance divisor and the padded count */
@@ -2414,7 +2414,13 @@ panfrost_emit_varying_descriptor(struct panfrost_batch *batch,
    if (!prelink || vs->linkage.bo == NULL) {
       struct panfrost_pool *pool = prelink ? &ctx->descs : &batch->pool;
 
+      if (prelink)
+         simple_mtx_lock(&ctx->pool_lock);
+
       panfrost_emit_varying_descs(pool, vs, fs, point_coord_mask, linkage);
+
+      if (prelink)
+         simple_mtx_unlock(&ctx->pool_lock);
    }
 
    unsigned present = linkage->present, stride = linkage->stride;
@@ -2878,6 +2884,20 @@ panfrost_direct_draw(struct panfrost_batch *batch,
 
    panfrost_update_active_prim(ctx, info);
 
+   /* Pick up variants that finished compiling in the background since the
+    * last draw. Until they do, we either draw with a stand-in variant or, if
+    * requested by driconf, skip the draw entirely.
+    */
+   if (unlikely(ctx->pending_variants)) {
+      u_foreach_bit(type, ctx->pending_variants)
+         panfrost_update_shader_variant(ctx, type);
+
+      if (!ctx->prog[PIPE_SHADER_VERTEX] ||
+          (ctx->uncompiled[PIPE_SHADER_FRAGMENT] &&
+           !ctx->prog[PIPE_SHADER_FRAGMENT]))
+         return;
+   }
+
    /* Take into account a negative bias */
    ctx->vertex_count =
       draw->count + (info->index_size ? abs(draw->index_bias) : 0);
@@ -2950,6 +2970,67 @@ panfrost_compatible_batch_state(struct panfrost_batch *batch,
       return pan_tristate_set(&batch->first_provoking_vertex, first);
 }
 
+/* Consecutive draws of a multi-draw that pick up where the previous one left
+ * off can be issued as a single draw, saving the jobs and descriptors of the
+ * merged ones. This requires list primitives made of whole primitives, so
+ * primitives don't straddle draws, a single instance so the primitive order
+ * is kept, and shaders that can't tell the draws apart. Returns the number
+ * of draws folded into merged.
+ */
+static unsigned
+panfrost_merge_draws(struct panfrost_context *ctx,
+                     const struct pipe_draw_info *info,
+                     const struct pipe_draw_start_count_bias *draws,
+                     unsigned num_draws,
+                     struct pipe_draw_start_count_bias *merged)
+{
+   *merged = draws[0];
+
+   if (num_draws == 1 || info->instance_count != 1 ||
+       info->primitive_restart)
+      return 1;
+
+   unsigned verts_per_prim;
+
+   switch (info->mode) {
+   case MESA_PRIM_POINTS:
+      verts_per_prim = 1;
+      break;
+   case MESA_PRIM_LINES:
+      verts_per_prim = 2;
+      break;
+   case MESA_PRIM_TRIANGLES:
+      verts_per_prim = 3;
+      break;
+   default:
+      return 1;
+   }
+
+   const nir_shader *vs = ctx->uncompiled[PIPE_SHADER_VERTEX]->nir;
+
+   if ((info->increment_draw_id &&
+        BITSET_TEST(vs->info.system_values_read, SYSTEM_VALUE_DRAW_ID)) ||
+       (!info->index_size &&
+        BITSET_TEST(vs->info.system_values_read, SYSTEM_VALUE_FIRST_VERTEX)))
+      return 1;
+
+   unsigned n = 1;
+
+   for (; n < num_draws; n++) {
+      const struct pipe_draw_start_count_bias *next = &draws[n];
+
+      if (merged->count % verts_per_prim ||
+          next->start != merged->start + merged->count ||
+          next->index_bias != merged->index_bias ||
+          next->count > UINT32_MAX - merged->count)
+         break;
+
+      merged->count += next->count;
+   }
+
+   return n;
+}
+
 static void
 panfrost_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
                   unsigned drawid_offset,
@@ -3011,12 +3092,17 @@ panfrost_draw_vbo(struct pipe_context *pipe, const struct pipe_draw_info *info,
    struct pipe_draw_info tmp_info = *info;
    unsigned drawid = drawid_offset;
 
-   for (unsigned i = 0; i < num_draws; i++) {
-      panfrost_direct_draw(batch, &tmp_info, drawid, &draws[i]);
+   for (unsigned i = 0; i < num_draws;) {
+      struct pipe_draw_start_count_bias draw;
+      unsigned merged =
+         panfrost_merge_draws(ctx, &tmp_info, &draws[i], num_draws - i, &draw);
+
+      panfrost_direct_draw(batch, &tmp_info, drawid, &draw);
+      i += merged;
 
       if (tmp_info.increment_draw_id) {
          ctx->dirty |= PAN_DIRTY_DRAWID;
-         drawid++;
+         drawid += merged;
       }
    }
 }
@@ -3065,7 +3151,11 @@ panfrost_launch_grid_on_batch(struct pipe_context *pipe,
    mali_ptr saved_tls = batch->tls.gpu;
    batch->tls.gpu = panfrost_emit_shared_memory(batch, info);
 
+   trace_start_compute(&ctx->trace);
    JOBX(launch_grid)(batch, info);
+   trace_end_compute(&ctx->trace, info->indirect != NULL, info->block[0],
+                     info->block[1], info->block[2], info->grid[0],
+                     info->grid[1], info->grid[2]);
    batch->compute_count++;
    batch->tls.gpu = saved_tls;
 }
@@ -3091,7 +3181,7 @@ panfrost_launch_grid(struct pipe_context *pipe,
 static void
 panfrost_launch_afbc_shader(struct panfrost_batch *batch, void *cso,
                             struct pipe_constant_buffer *cbuf,
-                            unsigned nr_blocks)
+                            unsigned nr_blocks_x, unsigned nr_blocks_y)
 {
    struct pipe_context *pctx = &batch->ctx->base;
    void *saved_cso = NULL;
@@ -3100,8 +3190,8 @@ panfrost_launch_afbc_shader(struct panfrost_batch *batch, void *cso,
       .block[0] = 1,
       .block[1] = 1,
       .block[2] = 1,
-      .grid[0] = nr_blocks,
-      .grid[1] = 1,
+      .grid[0] = nr_blocks_x,
+      .grid[1] = nr_blocks_y,
       .grid[2] = 1,
    };
 
@@ -3119,31 +3209,67 @@ panfrost_launch_afbc_shader(struct panfrost_batch *batch, void *cso,
    pctx->set_constant_buffer(pctx, PIPE_SHADER_COMPUTE, 0, true, &saved_const);
 }
 
-#define LAUNCH_AFBC_SHADER(name, batch, rsrc, consts, nr_blocks)               \
+#define LAUNCH_AFBC_SHADER(name, batch, rsrc, consts, nr_blocks_x,            \
+                           nr_blocks_y)                                        \
    struct pan_afbc_shader_data *shaders =                                      \
       panfrost_afbc_get_shaders(batch->ctx, rsrc, AFBC_BLOCK_ALIGN);           \
    struct pipe_constant_buffer constant_buffer = {                             \
       .buffer_size = sizeof(consts),                                           \
       .user_buffer = &consts};                                                 \
    panfrost_launch_afbc_shader(batch, shaders->name##_cso, &constant_buffer,   \
-                               nr_blocks);
+                               nr_blocks_x, nr_blocks_y);
 
 static void
 panfrost_afbc_size(struct panfrost_batch *batch, struct panfrost_resource *src,
                    struct panfrost_bo *metadata, unsigned offset,
-                   unsigned level)
+                   unsigned level, const struct pipe_scissor_state *blocks)
 {
    struct pan_image_slice_layout *slice = &src->image.layout.slices[level];
    struct panfrost_afbc_size_info consts = {
       .src =
          src->image.data.base + src->image.data.offset + slice->offset,
       .metadata = metadata->ptr.gpu + offset,
+      .origin_x = blocks->minx,
+      .origin_y = blocks->miny,
+      .src_stride = slice->afbc.stride,
    };
 
    panfrost_batch_read_rsrc(batch, src, PIPE_SHADER_COMPUTE);
    panfrost_batch_write_bo(batch, metadata, PIPE_SHADER_COMPUTE);
 
-   LAUNCH_AFBC_SHADER(size, batch, src, consts, slice->afbc.nr_blocks);
+   LAUNCH_AFBC_SHADER(size, batch, src, consts, blocks->maxx - blocks->minx,
+                      blocks->maxy - blocks->miny);
+}
+
+static void
+panfrost_afbc_scan(struct panfrost_batch *batch, struct panfrost_resource *src,
+                   struct panfrost_bo *metadata, unsigned offset,
+                   unsigned rows_offset, unsigned total_offset, unsigned level,
+                   bool rows)
+{
+   struct pan_image_slice_layout *slice = &src->image.layout.slices[level];
+   unsigned width = u_minify(src->base.b.width0, level);
+   unsigned height = u_minify(src->base.b.height0, level);
+   uint64_t modifier = src->image.layout.modifier;
+   struct panfrost_afbc_scan_info consts = {
+      .metadata = metadata->ptr.gpu + offset,
+      .rows = metadata->ptr.gpu + rows_offset,
+      .total = metadata->ptr.gpu + total_offset,
+      .src_stride = slice->afbc.stride,
+      .width = DIV_ROUND_UP(width, panfrost_afbc_superblock_width(modifier)),
+      .height = DIV_ROUND_UP(height, panfrost_afbc_superblock_height(modifier)),
+   };
+
+   /* Only the layout of the source is used, but this keeps the batch ordered
+    * with the other AFBC passes on the resource */
+   panfrost_batch_read_rsrc(batch, src, PIPE_SHADER_COMPUTE);
+   panfrost_batch_write_bo(batch, metadata, PIPE_SHADER_COMPUTE);
+
+   if (rows) {
+      LAUNCH_AFBC_SHADER(scan_rows, batch, src, consts, consts.height, 1);
+   } else {
+      LAUNCH_AFBC_SHADER(scan_total, batch, src, consts, 1, 1);
+   }
 }
 
 static void
@@ -3151,7 +3277,7 @@ panfrost_afbc_pack(struct panfrost_batch *batch, struct panfrost_resource *src,
                    struct panfrost_bo *dst,
                    struct pan_image_slice_layout *dst_slice,
                    struct panfrost_bo *metadata, unsigned metadata_offset,
-                   unsigned level)
+                   unsigned rows_offset, unsigned level)
 {
    struct pan_image_slice_layout *src_slice = &src->image.layout.slices[level];
    struct panfrost_afbc_pack_info consts = {
@@ -3159,6 +3285,7 @@ panfrost_afbc_pack(struct panfrost_batch *batch, struct panfrost_resource *src,
              src_slice->offset,
       .dst = dst->ptr.gpu + dst_slice->offset,
       .metadata = metadata->ptr.gpu + metadata_offset,
+      .rows = metadata->ptr.gpu + rows_offset,
       .header_size = dst_slice->afbc.header_size,
       .src_stride = src_slice->afbc.stride,
       .dst_stride = dst_slice->afbc.stride,
@@ -3168,7 +3295,27 @@ panfrost_afbc_pack(struct panfrost_batch *batch, struct panfrost_resource *src,
    panfrost_batch_write_bo(batch, dst, PIPE_SHADER_COMPUTE);
    panfrost_batch_add_bo(batch, metadata, PIPE_SHADER_COMPUTE);
 
-   LAUNCH_AFBC_SHADER(pack, batch, src, consts, dst_slice->afbc.nr_blocks);
+   LAUNCH_AFBC_SHADER(pack, batch, src, consts, dst_slice->afbc.nr_blocks, 1);
+}
+
+static void
+panfrost_afbc_unpack(struct panfrost_batch *batch, struct panfrost_bo *src,
+                     const struct pan_image_slice_layout *src_slice,
+                     struct panfrost_resource *dst, unsigned level)
+{
+   struct pan_image_slice_layout *dst_slice = &dst->image.layout.slices[level];
+   struct panfrost_afbc_unpack_info consts = {
+      .src = src->ptr.gpu + src_slice->offset,
+      .dst = dst->image.data.base + dst->image.data.offset + dst_slice->offset,
+      .header_size = dst_slice->afbc.header_size,
+      .src_stride = src_slice->afbc.stride,
+      .dst_stride = dst_slice->afbc.stride,
+   };
+
+   panfrost_batch_add_bo(batch, src, PIPE_SHADER_COMPUTE);
+   panfrost_batch_write_rsrc(batch, dst, PIPE_SHADER_COMPUTE);
+
+   LAUNCH_AFBC_SHADER(unpack, batch, dst, consts, src_slice->afbc.nr_blocks, 1);
 }
 
 static void *
@@ -3415,12 +3562,13 @@ panfrost_create_sampler_view(struct pipe_context *pctx,
                              struct pipe_resource *texture,
                              const struct pipe_sampler_view *template)
 {
-   struct panfrost_context *ctx = pan_context(pctx);
+   /* This may be called from the application thread of a threaded context,
+    * so only fill in the template here. AFBC legalization happens when the
+    * view is bound, and the descriptor is created lazily by
+    * panfrost_update_sampler_view() at draw time.
+    */
    struct panfrost_sampler_view *so =
-      rzalloc(pctx, struct panfrost_sampler_view);
-
-   pan_legalize_afbc_format(ctx, pan_resource(texture), template->format,
-                            false, false);
+      rzalloc(NULL, struct panfrost_sampler_view);
 
    pipe_reference(NULL, &texture->reference);
 
@@ -3429,8 +3577,6 @@ panfrost_create_sampler_view(struct pipe_context *pctx,
    so->base.reference.count = 1;
    so->base.context = pctx;
 
-   panfrost_create_sampler_view_bo(so, pctx, texture);
-
    return (struct pipe_sampler_view *)so;
 }
 
@@ -3648,6 +3794,14 @@ screen_destroy(struct pipe_screen *pscreen)
    GENX(pan_blitter_cache_cleanup)(&dev->blitter);
 }
 
+static void
+warm_up_blitter(void *job, void *gdata, int thread_index)
+{
+   struct panfrost_screen *screen = job;
+
+   GENX(pan_blitter_cache_warm_up)(&screen->dev.blitter);
+}
+
 static void
 panfrost_sampler_view_destroy(struct pipe_context *pctx,
                               struct pipe_sampler_view *pview)
@@ -3762,8 +3916,13 @@ submit_batch(struct panfrost_batch *batch, struct pan_fb_info *fb)
    emit_tls(batch);
 
    if (panfrost_has_fragment_job(batch)) {
+      struct panfrost_context *ctx = batch->ctx;
+
+      trace_start_fragment_job(&ctx->trace);
       emit_fbd(batch, fb);
       emit_fragment_job(batch, fb);
+      trace_end_fragment_job(&ctx->trace, batch->minx, batch->miny,
+                             batch->maxx, batch->maxy);
    }
 
    return JOBX(submit_batch)(batch);
@@ -3786,15 +3945,34 @@ GENX(panfrost_cmdstream_screen_init)(struct panfrost_screen *screen)
    screen->vtbl.get_compiler_options = GENX(pan_shader_get_compiler_options);
    screen->vtbl.compile_shader = GENX(pan_shader_compile);
    screen->vtbl.afbc_size = panfrost_afbc_size;
+   screen->vtbl.afbc_scan = panfrost_afbc_scan;
    screen->vtbl.afbc_pack = panfrost_afbc_pack;
+   screen->vtbl.afbc_unpack = panfrost_afbc_unpack;
 
    GENX(pan_blitter_cache_init)
    (&dev->blitter, panfrost_device_gpu_id(dev), &dev->blend_shaders,
-    &screen->blitter.bin_pool.base, &screen->blitter.desc_pool.base);
+    &screen->blitter.bin_pool.base, &screen->blitter.desc_pool.base,
+    screen->disk_cache);
 
 #if PAN_GPU_INDIRECTS
    pan_indirect_dispatch_meta_init(
       &dev->indirect_dispatch, panfrost_device_gpu_id(dev),
       &screen->blitter.bin_pool.base, &screen->blitter.desc_pool.base);
 #endif
+
+   /* Queued last, the blitter pools are not otherwise used from the
+    * compiler queue. The queue is drained before the screen is destroyed.
+    * The blitter allocates its shaders with its lock held, but indirect
+    * dispatch allocates from the same binary pool without it, so set it up
+    * before the warm-up can run.
+    */
+   if (screen->driconf.warm_up_blitter &&
+       util_queue_is_initialized(&screen->shader_compiler_queue)) {
+#if PAN_GPU_INDIRECTS
+      GENX(pan_indirect_dispatch_init)(&dev->indirect_dispatch);
+#endif
+
+      util_queue_add_job(&screen->shader_compiler_queue, screen, NULL,
+                         warm_up_blitter, NULL, 0);
+   }
 }
@@ -31,11 +31,13 @@
 #include "pan_bo.h"
 #include "pan_context.h"
 #include "pan_minmax_cache.h"
+#include "pan_perfcnt.h"
 
 #include "util/format/u_format.h"
 #include "util/half_float.h"
 #include "util/libsync.h"
 #include "util/macros.h"
+#include "util/os_time.h"
 #include "util/u_debug_cb.h"
 #include "util/u_helpers.h"
 #include "util/u_inlines.h"
@@ -107,6 +109,10 @@ panfrost_flush(struct pipe_context *pipe, struct pipe_fence_handle **fence,
    /* Submit all pending jobs */
    panfrost_flush_all_batches(ctx, NULL);
 
+   /* Pack the AFBC resources whose offsets have landed in the meantime */
+   if (ctx->afbc_pack_pending.size)
+      panfrost_pack_afbc_pending(ctx);
+
    if (fence) {
       struct pipe_fence_handle *f = panfrost_fence_create(ctx);
       pipe->screen->fence_reference(pipe->screen, fence, NULL);
@@ -132,6 +138,30 @@ panfrost_set_frontend_noop(struct pipe_context *pipe, bool enable)
    ctx->is_noop = enable;
 }
 
+/* Resets are detected and reported to the reset callback at submit time, this
+ * only returns the last one once. This can be called from the application
+ * thread of a threaded context.
+ */
+static enum pipe_reset_status
+panfrost_get_device_reset_status(struct pipe_context *pipe)
+{
+   struct panfrost_context *ctx = pan_context(pipe);
+
+   return p_atomic_xchg(&ctx->reset_status, PIPE_NO_RESET);
+}
+
+static void
+panfrost_set_device_reset_callback(struct pipe_context *pipe,
+                                   const struct pipe_device_reset_callback *cb)
+{
+   struct panfrost_context *ctx = pan_context(pipe);
+
+   if (cb)
+      ctx->reset = *cb;
+   else
+      memset(&ctx->reset, 0, sizeof(ctx->reset));
+}
+
 static void
 panfrost_generic_cso_delete(struct pipe_context *pctx, void *hwcso)
 {
@@ -387,9 +417,15 @@ panfrost_set_sampler_views(struct pipe_context *pctx,
       struct pipe_sampler_view *view = views ? views[i] : NULL;
       unsigned p = i + start_slot;
 
-      if (view)
+      if (view) {
          new_nr = p + 1;
 
+         /* Deferred from sampler view creation, see
+          * panfrost_create_sampler_view() */
+         pan_legalize_afbc_format(ctx, pan_resource(view->texture),
+                                  view->format, false, false);
+      }
+
       if (take_ownership) {
          pipe_sampler_view_reference(
             (struct pipe_sampler_view **)&ctx->sampler_views[shader][p], NULL);
@@ -550,6 +586,16 @@ panfrost_destroy(struct pipe_context *pipe)
 
    pan_screen(pipe->screen)->vtbl.context_cleanup(panfrost);
 
+   if (dev->debug & PAN_DBG_FLUSH_STATS)
+      panfrost_flush_stats_print(panfrost, stderr);
+
+   list_for_each_entry_safe(struct panfrost_query, query,
+                            &panfrost->perf_queries, perf.link)
+      panfrost_perfcnt_destroy_query(panfrost, query);
+
+   u_trace_fini(&panfrost->trace);
+   u_trace_context_fini(&panfrost->trace_context);
+
    _mesa_hash_table_destroy(panfrost->writers, NULL);
 
    if (panfrost->blitter)
@@ -560,6 +606,7 @@ panfrost_destroy(struct pipe_context *pipe)
 
    panfrost_pool_cleanup(&panfrost->descs);
    panfrost_pool_cleanup(&panfrost->shaders);
+   simple_mtx_destroy(&panfrost->pool_lock);
    panfrost_afbc_context_destroy(panfrost);
 
    drmSyncobjDestroy(panfrost_device_fd(dev), panfrost->in_sync_obj);
@@ -570,10 +617,21 @@ panfrost_destroy(struct pipe_context *pipe)
    ralloc_free(pipe);
 }
 
+static struct pipe_query *
+panfrost_create_batch_query(struct pipe_context *pipe, unsigned num_queries,
+                            unsigned *query_types)
+{
+   return (struct pipe_query *)panfrost_perfcnt_create_query(
+      pan_context(pipe), num_queries, query_types);
+}
+
 static struct pipe_query *
 panfrost_create_query(struct pipe_context *pipe, unsigned type, unsigned index)
 {
-   struct panfrost_query *q = rzalloc(pipe, struct panfrost_query);
+   if (type >= PAN_QUERY_FIRST_PERFCNT)
+      return panfrost_create_batch_query(pipe, 1, &type);
+
+   struct panfrost_query *q = rzalloc(NULL, struct panfrost_query);
 
    q->type = type;
    q->index = index;
@@ -586,12 +644,28 @@ panfrost_destroy_query(struct pipe_context *pipe, struct pipe_query *q)
 {
    struct panfrost_query *query = (struct panfrost_query *)q;
 
+   if (query->perf.counters)
+      panfrost_perfcnt_destroy_query(pan_context(pipe), query);
+
    if (query->rsrc)
       pipe_resource_reference(&query->rsrc, NULL);
 
    ralloc_free(q);
 }
 
+/* Batches are counted when submitted, the ones still recorded don't count */
+static uint64_t
+panfrost_flush_query_value(struct panfrost_context *ctx, unsigned type)
+{
+   STATIC_ASSERT(PAN_QUERY_FLUSHES_EVICTION - PAN_QUERY_FLUSHES_CONTEXT ==
+                 PAN_FLUSH_EVICTION - PAN_FLUSH_CONTEXT);
+
+   if (type == PAN_QUERY_FLUSHES)
+      return ctx->flush_stats.submits;
+
+   return ctx->flush_stats.by_class[type - PAN_QUERY_FLUSHES_CONTEXT];
+}
+
 static bool
 panfrost_begin_query(struct pipe_context *pipe, struct pipe_query *q)
 {
@@ -599,6 +673,9 @@ panfrost_begin_query(struct pipe_context *pipe, struct pipe_query *q)
    struct panfrost_device *dev = pan_device(ctx->base.screen);
    struct panfrost_query *query = (struct panfrost_query *)q;
 
+   if (query->perf.counters)
+      return panfrost_perfcnt_begin_query(ctx, query);
+
    switch (query->type) {
    case PIPE_QUERY_OCCLUSION_COUNTER:
    case PIPE_QUERY_OCCLUSION_PREDICATE:
@@ -636,6 +713,44 @@ panfrost_begin_query(struct pipe_context *pipe, struct pipe_query *q)
       query->start = ctx->draw_calls;
       break;
 
+   case PAN_QUERY_BO_SLAB_HITS:
+      query->start = panfrost_bo_slab_hits(dev);
+      break;
+
+   case PAN_QUERY_BO_SLAB_MISSES:
+      query->start = p_atomic_read(&dev->bo_slab.slab_allocs);
+      break;
+
+   case PAN_QUERY_BO_CACHE_HITS:
+      query->start = p_atomic_read(&dev->bo_cache.hits);
+      break;
+
+   case PAN_QUERY_BO_CACHE_MISSES:
+      query->start = p_atomic_read(&dev->bo_cache.misses);
+      break;
+
+   /* Tiles are counted when batches are submitted, so flush the ones
+    * recorded outside of the query.
+    */
+   case PAN_QUERY_CRC_CHECKED_TILES:
+      panfrost_flush_all_batches(ctx, "Transaction elimination query");
+      query->start = ctx->crc_stats.checked_tiles;
+      break;
+
+   case PAN_QUERY_CRC_REFRESHED_TILES:
+      panfrost_flush_all_batches(ctx, "Transaction elimination query");
+      query->start = ctx->crc_stats.refreshed_tiles;
+      break;
+
+   case PAN_QUERY_FLUSHES:
+   case PAN_QUERY_FLUSHES_CONTEXT:
+   case PAN_QUERY_FLUSHES_FBO:
+   case PAN_QUERY_FLUSHES_RESOURCE:
+   case PAN_QUERY_FLUSHES_DEPENDENCY:
+   case PAN_QUERY_FLUSHES_EVICTION:
+      query->start = panfrost_flush_query_value(ctx, query->type);
+      break;
+
    default:
       /* TODO: timestamp queries, etc? */
       break;
@@ -650,6 +765,11 @@ panfrost_end_query(struct pipe_context *pipe, struct pipe_query *q)
    struct panfrost_context *ctx = pan_context(pipe);
    struct panfrost_query *query = (struct panfrost_query *)q;
 
+   if (query->perf.counters) {
+      panfrost_perfcnt_end_query(ctx, query);
+      return true;
+   }
+
    switch (query->type) {
    case PIPE_QUERY_OCCLUSION_COUNTER:
    case PIPE_QUERY_OCCLUSION_PREDICATE:
@@ -666,6 +786,38 @@ panfrost_end_query(struct pipe_context *pipe, struct pipe_query *q)
    case PAN_QUERY_DRAW_CALLS:
       query->end = ctx->draw_calls;
       break;
+   case PAN_QUERY_BO_SLAB_HITS:
+      query->end = panfrost_bo_slab_hits(pan_device(pipe->screen));
+      break;
+   case PAN_QUERY_BO_SLAB_MISSES:
+      query->end =
+         p_atomic_read(&pan_device(pipe->screen)->bo_slab.slab_allocs);
+      break;
+   case PAN_QUERY_BO_CACHE_SIZE:
+      query->end = p_atomic_read(&pan_device(pipe->screen)->bo_cache.size);
+      break;
+   case PAN_QUERY_BO_CACHE_HITS:
+      query->end = p_atomic_read(&pan_device(pipe->screen)->bo_cache.hits);
+      break;
+   case PAN_QUERY_BO_CACHE_MISSES:
+      query->end = p_atomic_read(&pan_device(pipe->screen)->bo_cache.misses);
+      break;
+   case PAN_QUERY_CRC_CHECKED_TILES:
+      panfrost_flush_all_batches(ctx, "Transaction elimination query");
+      query->end = ctx->crc_stats.checked_tiles;
+      break;
+   case PAN_QUERY_CRC_REFRESHED_TILES:
+      panfrost_flush_all_batches(ctx, "Transaction elimination query");
+      query->end = ctx->crc_stats.refreshed_tiles;
+      break;
+   case PAN_QUERY_FLUSHES:
+   case PAN_QUERY_FLUSHES_CONTEXT:
+   case PAN_QUERY_FLUSHES_FBO:
+   case PAN_QUERY_FLUSHES_RESOURCE:
+   case PAN_QUERY_FLUSHES_DEPENDENCY:
+   case PAN_QUERY_FLUSHES_EVICTION:
+      query->end = panfrost_flush_query_value(ctx, query->type);
+      break;
    }
 
    return true;
@@ -680,6 +832,11 @@ panfrost_get_query_result(struct pipe_context *pipe, struct pipe_query *q,
    struct panfrost_device *dev = pan_device(ctx->base.screen);
    struct panfrost_resource *rsrc = pan_resource(query->rsrc);
 
+   if (query->perf.counters) {
+      panfrost_perfcnt_get_query_result(query, vresult);
+      return true;
+   }
+
    switch (query->type) {
    case PIPE_QUERY_OCCLUSION_COUNTER:
    case PIPE_QUERY_OCCLUSION_PREDICATE:
@@ -712,9 +869,26 @@ panfrost_get_query_result(struct pipe_context *pipe, struct pipe_query *q,
       break;
 
    case PAN_QUERY_DRAW_CALLS:
+   case PAN_QUERY_BO_SLAB_HITS:
+   case PAN_QUERY_BO_SLAB_MISSES:
+   case PAN_QUERY_BO_CACHE_HITS:
+   case PAN_QUERY_BO_CACHE_MISSES:
+   case PAN_QUERY_CRC_CHECKED_TILES:
+   case PAN_QUERY_CRC_REFRESHED_TILES:
+   case PAN_QUERY_FLUSHES:
+   case PAN_QUERY_FLUSHES_CONTEXT:
+   case PAN_QUERY_FLUSHES_FBO:
+   case PAN_QUERY_FLUSHES_RESOURCE:
+   case PAN_QUERY_FLUSHES_DEPENDENCY:
+   case PAN_QUERY_FLUSHES_EVICTION:
       vresult->u64 = query->end - query->start;
       break;
 
+   /* Not a counter, report the size at the end of the query */
+   case PAN_QUERY_BO_CACHE_SIZE:
+      vresult->u64 = query->end;
+      break;
+
    default:
       /* TODO: more queries */
       break;
@@ -756,7 +930,7 @@ panfrost_create_stream_output_target(struct pipe_context *pctx,
 {
    struct pipe_stream_output_target *target;
 
-   target = &rzalloc(pctx, struct panfrost_streamout_target)->base;
+   target = &rzalloc(NULL, struct panfrost_streamout_target)->base;
 
    if (!target)
       return NULL;
@@ -819,8 +993,8 @@ panfrost_set_global_binding(struct pipe_context *pctx, unsigned first,
       struct panfrost_resource *rsrc = pan_resource(resources[i]);
       panfrost_batch_write_rsrc(batch, rsrc, PIPE_SHADER_COMPUTE);
 
-      util_range_add(&rsrc->base, &rsrc->valid_buffer_range, 0,
-                     rsrc->base.width0);
+      util_range_add(&rsrc->base.b, &rsrc->base.valid_buffer_range, 0,
+                     rsrc->base.b.width0);
 
       /* The handle points to uint32_t, but space is allocated for 64
        * bits. We need to respect the offset passed in. This interface
@@ -867,6 +1041,74 @@ panfrost_fence_server_sync(struct pipe_context *pctx,
    close(fd);
 }
 
+/*
+ * u_trace timestamps are taken on the CPU: the kernel doesn't expose the
+ * frequency of the GPU timestamp counter nor its offset to the CPU clock, so
+ * values written by the GPU couldn't be put on the same timeline. The end of
+ * a batch is instead stamped once the BO passed as flush data went idle,
+ * which the trace queue thread waits for right after the batch is submitted.
+ */
+#define PAN_TRACE_TS_END_OF_PIPE UINT64_MAX
+
+static void *
+panfrost_trace_create_ts_buffer(struct u_trace_context *utctx,
+                                uint32_t size)
+{
+   return calloc(1, size);
+}
+
+static void
+panfrost_trace_delete_ts_buffer(struct u_trace_context *utctx, void *timestamps)
+{
+   free(timestamps);
+}
+
+static void
+panfrost_trace_record_ts(struct u_trace *ut, void *cs, void *timestamps,
+                         unsigned idx, bool end_of_pipe)
+{
+   uint64_t *ts = timestamps;
+
+   ts[idx] = end_of_pipe ? PAN_TRACE_TS_END_OF_PIPE : os_time_get_nano();
+}
+
+static uint64_t
+panfrost_trace_read_ts(struct u_trace_context *utctx, void *timestamps,
+                       unsigned idx, void *flush_data)
+{
+   uint64_t ts = ((uint64_t *)timestamps)[idx];
+   struct panfrost_bo *bo = flush_data;
+
+   if (ts != PAN_TRACE_TS_END_OF_PIPE)
+      return ts;
+
+   if (bo) {
+      /* Accesses to suballocated BOs are tracked on the slab */
+      if (bo->parent)
+         bo = bo->parent;
+
+      panfrost_bo_wait_pending_submits(bo, false);
+      pan_kmod_bo_wait(bo->kmod_bo, INT64_MAX, false);
+   }
+
+   return os_time_get_nano();
+}
+
+static void
+panfrost_trace_delete_flush_data(struct u_trace_context *utctx,
+                                 void *flush_data)
+{
+   panfrost_bo_unreference(flush_data);
+}
+
+#ifdef HAVE_PERFETTO
+struct pan_perfetto_state *
+panfrost_perfetto_state(struct pipe_context *pctx)
+{
+   return &pan_context(pctx)->perfetto;
+}
+#endif
+
 struct pipe_context *
 panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
 {
@@ -889,6 +1131,8 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
    gallium->clear_texture = u_default_clear_texture;
    gallium->texture_barrier = panfrost_texture_barrier;
    gallium->set_frontend_noop = panfrost_set_frontend_noop;
+   gallium->get_device_reset_status = panfrost_get_device_reset_status;
+   gallium->set_device_reset_callback = panfrost_set_device_reset_callback;
 
    gallium->set_vertex_buffers = panfrost_set_vertex_buffers;
    gallium->set_constant_buffer = panfrost_set_constant_buffer;
@@ -922,6 +1166,7 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
    gallium->render_condition = panfrost_render_condition;
 
    gallium->create_query = panfrost_create_query;
+   gallium->create_batch_query = panfrost_create_batch_query;
    gallium->destroy_query = panfrost_destroy_query;
    gallium->begin_query = panfrost_begin_query;
    gallium->end_query = panfrost_end_query;
@@ -955,6 +1200,8 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
    panfrost_pool_init(&ctx->shaders, ctx, dev, PAN_BO_EXECUTE, 4096, "Shaders",
                       true, false);
 
+   simple_mtx_init(&ctx->pool_lock, mtx_plain);
+
    ctx->blitter = util_blitter_create(gallium);
 
    ctx->writers = _mesa_hash_table_create(gallium, _mesa_hash_pointer,
@@ -967,6 +1214,16 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
    /* By default mask everything on */
    ctx->sample_mask = ~0;
    ctx->active_queries = true;
+   list_inithead(&ctx->perf_queries);
+   panfrost_flush_stats_init(ctx);
+
+   pan_gpu_tracepoint_config_variable();
+   u_trace_context_init(&ctx->trace_context, gallium,
+                        panfrost_trace_create_ts_buffer,
+                        panfrost_trace_delete_ts_buffer,
+                        panfrost_trace_record_ts, panfrost_trace_read_ts,
+                        panfrost_trace_delete_flush_data);
+   u_trace_init(&ctx->trace, &ctx->trace_context);
 
    int ASSERTED ret;
 
@@ -984,7 +1241,25 @@ panfrost_create_context(struct pipe_screen *screen, void *priv, unsigned flags)
 
    pan_screen(screen)->vtbl.context_init(ctx);
 
-   return gallium;
+   if (!(flags & PIPE_CONTEXT_PREFER_THREADED) ||
+       (flags & PIPE_CONTEXT_COMPUTE_ONLY))
+      return gallium;
+
+   struct pipe_context *tc = threaded_context_create(
+      gallium, &pan_screen(screen)->transfer_pool,
+      panfrost_replace_buffer_storage,
+      &(struct threaded_context_options){
+         .is_resource_busy = panfrost_resource_busy,
+         .driver_calls_flush_notify = true,
+         .unsynchronized_get_device_reset_status = true,
+      },
+      &ctx->tc);
+
+   if (tc && tc != gallium)
+      threaded_context_init_bytes_mapped_limit((struct threaded_context *)tc,
+                                               16);
+
+   return tc;
 }
 
 void
@@ -44,13 +44,18 @@
 #include "util/detect.h"
 #include "util/format/u_formats.h"
 #include "util/hash_table.h"
+#include "util/perf/u_trace.h"
 #include "util/simple_mtx.h"
 #include "util/u_blitter.h"
+#include "util/u_queue.h"
+#include "util/u_threaded_context.h"
 
 #include "compiler/shader_enums.h"
 #include "midgard/midgard_compile.h"
 
 #include "pan_csf.h"
+#include "pan_perfetto.h"
+#include "pan_tracepoints.h"
 
 #define SET_BIT(lval, bit, cond)                                               \
    if (cond)                                                                   \
@@ -92,7 +97,12 @@ struct panfrost_constant_buffer {
    uint32_t enabled_mask;
 };
 
+struct panfrost_perf_counter;
+
 struct panfrost_query {
+   /* Must be first for u_threaded_context */
+   struct threaded_query base;
+
    /* Passthrough from Gallium */
    unsigned type;
    unsigned index;
@@ -108,6 +118,16 @@ struct panfrost_query {
 
    /* Whether an occlusion query is for a MSAA framebuffer */
    bool msaa;
+
+   /* Hardware counters of a counter query, with their values summed over
+    * the batches submitted while the query is active */
+   struct {
+      struct list_head link;
+      bool active;
+      unsigned count;
+      const struct panfrost_perf_counter **counters;
+      uint64_t *values;
+   } perf;
 };
 
 struct panfrost_streamout_target {
@@ -133,9 +153,29 @@ struct panfrost_context {
    /* Unowned pools, so manage yourself. */
    struct panfrost_pool descs, shaders;
 
+   /* Protects descs and shaders, as CSO creation allocates from them on the
+    * application thread when running under a threaded context. */
+   simple_mtx_t pool_lock;
+
+   /* Threaded context wrapping this context, if any */
+   struct threaded_context *tc;
+
    /* Sync obj used to keep track of in-flight jobs. */
    uint32_t syncobj;
 
+   /* Thread handing batches over to the kernel, if submits are deferred.
+    * It is the one signalling syncobj, so anything looking at syncobj must
+    * call panfrost_wait_submits() first.
+    */
+   struct util_queue submit_queue;
+
+   /* Reset of the GPU context detected at submit time that hasn't been
+    * queried yet. The query may come from the application thread of the
+    * threaded context, so this is accessed atomically.
+    */
+   enum pipe_reset_status reset_status;
+   struct pipe_device_reset_callback reset;
+
    /* Set of 32 batches. When the set is full, the LRU entry (the batch
     * with the smallest seqnum) is flushed to free a slot.
     */
@@ -147,7 +187,7 @@ struct panfrost_context {
       BITSET_DECLARE(active, PAN_MAX_BATCHES);
    } batches;
 
-   /* Map from resources to panfrost_batches */
+   /* Map from resources to the mask of the batches writing them */
    struct hash_table *writers;
 
    /* Bound job batch */
@@ -163,8 +203,24 @@ struct panfrost_context {
    uint64_t prims_generated;
    uint64_t tf_prims_generated;
    uint64_t draw_calls;
+   struct pan_crc_stats crc_stats;
+   struct pan_flush_stats flush_stats;
    struct panfrost_query *occlusion_query;
 
+   /* Active hardware counter queries */
+   struct list_head perf_queries;
+
+   /* Tracepoints are recorded in CPU order on the context and flushed with
+    * every batch submitted, so each u_trace batch covers the work recorded
+    * since the previous submit.
+    */
+   struct u_trace_context trace_context;
+   struct u_trace trace;
+
+#ifdef HAVE_PERFETTO
+   struct pan_perfetto_state perfetto;
+#endif
+
    unsigned drawid;
    unsigned vertex_count;
    unsigned instance_count;
@@ -184,6 +240,11 @@ struct panfrost_context {
    struct panfrost_uncompiled_shader *uncompiled[PIPE_SHADER_TYPES];
    struct panfrost_compiled_shader *prog[PIPE_SHADER_TYPES];
 
+   /* Mask of stages whose wanted variant is still being compiled in the
+    * background. prog[] then holds a stand-in variant, or NULL if the draw
+    * should be skipped. */
+   uint32_t pending_variants;
+
    struct pipe_vertex_buffer vertex_buffers[PIPE_MAX_ATTRIBS];
    uint32_t vb_mask;
 
@@ -205,6 +266,9 @@ struct panfrost_context {
 
    struct pan_afbc_shaders afbc_shaders;
 
+   /* AFBC resources waiting on their packed offsets to be computed */
+   struct util_dynarray afbc_pack_pending;
+
    struct panfrost_blend_state *blend;
 
    /* On Valhall, does the current blend state use a blend shader for any
@@ -234,6 +298,7 @@ struct panfrost_context {
    uint32_t in_sync_obj;
 
    union {
+      struct panfrost_jm_context jm;
       struct panfrost_csf_context csf;
    };
 };
@@ -347,6 +412,22 @@ struct panfrost_shader_key {
 };
 
 struct panfrost_compiled_shader {
+   /* Link in panfrost_uncompiled_shader::variants */
+   struct list_head link;
+
+   /* Signalled once the (possibly asynchronous) compile has finished */
+   struct util_queue_fence ready;
+
+   /* Binary produced by a background compile, not uploaded yet. Uploading
+    * needs the pools of a context, so it is done by the first context using
+    * the variant, see panfrost_update_shader_variant(). */
+   struct panfrost_shader_binary *pending;
+
+   /* Debug messages of the background compile, such as shader statistics,
+    * replayed to the debug callback of the context uploading the variant.
+    * Array of struct panfrost_debug_message. */
+   struct util_dynarray pending_messages;
+
    /* Respectively, shader binary and Renderer State Descriptor */
    struct panfrost_pool_ref bin, state;
 
@@ -383,11 +464,14 @@ struct panfrost_uncompiled_shader {
    /* Stream output information */
    struct pipe_stream_output_info stream_output;
 
-   /** Lock for the variants array */
+   /** Lock for the variants list */
    simple_mtx_t lock;
 
-   /* Array of panfrost_compiled_shader */
-   struct util_dynarray variants;
+   /* List of panfrost_compiled_shader */
+   struct list_head variants;
+
+   /* panfrost_shader_key -> panfrost_compiled_shader, for the same variants */
+   struct hash_table *variant_ht;
 
    /* Compiled transform feedback program, if one is required */
    struct panfrost_compiled_shader *xfb;
@@ -418,19 +502,21 @@ struct panfrost_shader_binary {
 };
 
 void
-panfrost_disk_cache_store(struct disk_cache *cache,
+panfrost_disk_cache_store(struct panfrost_screen *screen,
                           const struct panfrost_uncompiled_shader *uncompiled,
                           const struct panfrost_shader_key *key,
                           const struct panfrost_shader_binary *binary);
 
 bool panfrost_disk_cache_retrieve(
-   struct disk_cache *cache,
+   struct panfrost_screen *screen,
    const struct panfrost_uncompiled_shader *uncompiled,
    const struct panfrost_shader_key *key,
    struct panfrost_shader_binary *binary);
 
 void panfrost_disk_cache_init(struct panfrost_screen *screen);
 
+void panfrost_disk_cache_fini(struct panfrost_screen *screen);
+
 bool panfrost_nir_remove_fragcolor_stores(nir_shader *s, unsigned nr_cbufs);
 
 bool panfrost_nir_lower_sysvals(nir_shader *s,
@@ -499,6 +585,8 @@ panfrost_get_index_buffer_bounded(struct panfrost_batch *batch,
 mali_ptr panfrost_vertex_buffer_address(struct panfrost_context *ctx,
                                         unsigned i);
 
+void panfrost_shader_screen_init(struct pipe_screen *pscreen);
+
 void panfrost_shader_context_init(struct pipe_context *pctx);
 
 static inline void
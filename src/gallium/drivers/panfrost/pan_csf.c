@@ -190,12 +190,10 @@ csf_submit_collect_wait_ops(struct panfrost_batch *batch,
     * time. We need to iterate over other BOs accessed by the batch though,
     * to add the corresponding wait operations.
     */
-   util_dynarray_foreach(&batch->bos, pan_bo_access, ptr) {
-      unsigned i = ptr - util_dynarray_element(&batch->bos, pan_bo_access, 0);
-      pan_bo_access flags = *ptr;
-
-      if (!flags)
-         continue;
+   util_dynarray_foreach(&batch->bo_handles, uint32_t, handle) {
+      unsigned i = *handle;
+      pan_bo_access flags =
+         *util_dynarray_element(&batch->bos, pan_bo_access, i);
 
       /* Update the BO access flags so that panfrost_bo_wait() knows
        * about all pending accesses.
@@ -295,12 +293,10 @@ csf_attach_sync_points(struct panfrost_batch *batch, uint32_t vm_sync_handle,
    }
 
    /* Attach the VM sync point to all resources accessed by the batch. */
-   util_dynarray_foreach(&batch->bos, pan_bo_access, ptr) {
-      unsigned i = ptr - util_dynarray_element(&batch->bos, pan_bo_access, 0);
-      pan_bo_access flags = *ptr;
-
-      if (!flags)
-         continue;
+   util_dynarray_foreach(&batch->bo_handles, uint32_t, handle) {
+      unsigned i = *handle;
+      pan_bo_access flags =
+         *util_dynarray_element(&batch->bos, pan_bo_access, i);
 
       struct panfrost_bo *bo = pan_lookup_bo(dev, i);
 
@@ -337,6 +333,11 @@ csf_check_ctx_state_and_reinit(struct panfrost_context *ctx)
    if (state.state == 0)
       return;
 
+   /* Our group timed out or faulted, so the rendering it carried is lost */
+   p_atomic_set(&ctx->reset_status, PIPE_GUILTY_CONTEXT_RESET);
+   if (ctx->reset.reset)
+      ctx->reset.reset(ctx->reset.data, PIPE_GUILTY_CONTEXT_RESET);
+
    /* If the VM is unusable, we can't do much, as this is shared between all
     * contexts, and restoring the VM state is non-trivial.
     */
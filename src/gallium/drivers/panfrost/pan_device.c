@@ -29,6 +29,7 @@
 #include "drm-uapi/panfrost_drm.h"
 #include "util/hash_table.h"
 #include "util/macros.h"
+#include "util/u_atomic.h"
 #include "util/u_math.h"
 #include "util/u_thread.h"
 #include "pan_bo.h"
@@ -105,11 +106,8 @@ panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
 
    util_sparse_array_init(&dev->bo_map, sizeof(struct panfrost_bo), 512);
 
-   pthread_mutex_init(&dev->bo_cache.lock, NULL);
-   list_inithead(&dev->bo_cache.lru);
-
-   for (unsigned i = 0; i < ARRAY_SIZE(dev->bo_cache.buckets); ++i)
-      list_inithead(&dev->bo_cache.buckets[i]);
+   panfrost_bo_cache_init(dev);
+   panfrost_bo_slabs_init(dev);
 
    /* Initialize pandecode before we start allocating */
    if (dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC))
@@ -129,6 +127,8 @@ panfrost_open_device(void *memctx, int fd, struct panfrost_device *dev)
    }
 
    pthread_mutex_init(&dev->submit_lock, NULL);
+   pthread_mutex_init(&dev->pending_submits.lock, NULL);
+   pthread_cond_init(&dev->pending_submits.cond, NULL);
 
    /* Done once on init */
    dev->sample_positions = panfrost_bo_create(
@@ -149,10 +149,12 @@ panfrost_close_device(struct panfrost_device *dev)
     */
    if (dev->model) {
       pthread_mutex_destroy(&dev->submit_lock);
+      pthread_mutex_destroy(&dev->pending_submits.lock);
+      pthread_cond_destroy(&dev->pending_submits.cond);
       panfrost_bo_unreference(dev->tiler_heap);
       panfrost_bo_unreference(dev->sample_positions);
-      panfrost_bo_cache_evict_all(dev);
-      pthread_mutex_destroy(&dev->bo_cache.lock);
+      panfrost_bo_slabs_cleanup(dev);
+      panfrost_bo_cache_fini(dev);
       util_sparse_array_finish(&dev->bo_map);
    }
 
@@ -31,6 +31,7 @@
 #define PAN_DEVICE_H
 
 #include <xf86drm.h>
+#include "pipebuffer/pb_slab.h"
 #include "renderonly/renderonly.h"
 #include "util/bitset.h"
 #include "util/list.h"
@@ -66,6 +67,18 @@ extern "C" {
 /* Fencepost problem, hence the off-by-one */
 #define NR_BO_CACHE_BUCKETS (MAX_BO_CACHE_BUCKET - MIN_BO_CACHE_BUCKET + 1)
 
+/* BOs unused for this long are evicted from the BO cache */
+#define PAN_BO_CACHE_MAX_AGE_NS (1000000000ll)
+
+/* Upper bound of the BO cache budget, lowered on devices with little RAM */
+#define PAN_BO_CACHE_DEFAULT_MAX_SIZE (256ull * 1024 * 1024)
+
+/* Size classes of the BO slab suballocator. Entries are naturally aligned,
+ * so the minimum is 64 bytes, the strictest alignment needed for buffers. */
+#define MIN_BO_SLAB_ORDER (6)  /* 2^6 = 64B */
+#define MAX_BO_SLAB_ORDER (14) /* 2^14 = 16KB */
+#define BO_SLAB_SIZE      (64 * 1024)
+
 struct panfrost_device {
    /* For ralloc */
    void *memctx;
@@ -134,8 +147,32 @@ struct panfrost_device {
        * Each bucket is a linked list of free panfrost_bo objects. */
 
       struct list_head buckets[NR_BO_CACHE_BUCKETS];
+
+      /* Total size of the cached BOs, and the budget it is trimmed to */
+      uint64_t size;
+      uint64_t max_size;
+
+      /* Number of allocations served by the cache, or not */
+      uint64_t hits;
+      uint64_t misses;
+
+      /* Thread evicting stale BOs when the application is idle */
+      pthread_t reaper;
+      pthread_cond_t reaper_cond;
+      bool reaper_stop;
+      bool has_reaper;
    } bo_cache;
 
+   /* Suballocator for PAN_BO_SUBALLOC BOs, on top of the BO cache */
+   struct {
+      struct pb_slabs slabs;
+
+      /* Number of suballocations, and how many of them needed a new slab.
+       * The difference is the number of slab hits. */
+      uint64_t allocs;
+      uint64_t slab_allocs;
+   } bo_slab;
+
    struct pan_blitter_cache blitter;
    struct pan_blend_shader_cache blend_shaders;
    struct pan_indirect_dispatch_meta indirect_dispatch;
@@ -156,6 +193,14 @@ struct panfrost_device {
     */
    pthread_mutex_t submit_lock;
 
+   /* Protects the pending_submits count of BOs, and is signalled when one
+    * drops to zero.
+    */
+   struct {
+      pthread_mutex_t lock;
+      pthread_cond_t cond;
+   } pending_submits;
+
    /* Sample positions are preloaded into a write-once constant buffer,
     * such that they can be referenced fore free later. Needed
     * unconditionally on Bifrost, and useful for sharing with Midgard */
@@ -31,6 +31,8 @@
 #include "util/build_id.h"
 #include "util/disk_cache.h"
 #include "util/mesa-sha1.h"
+#include "util/os_time.h"
+#include "util/u_process.h"
 
 #include "pan_context.h"
 
@@ -39,41 +41,169 @@ static bool debug = false;
 extern int midgard_debug;
 extern int bifrost_debug;
 
+/* Upper bound on the number of shaders preloaded at startup */
+#define PAN_DISK_CACHE_HOT_SET_MAX 4096
+
+/* Write the hot set again every time this many new shaders were used, so it
+ * survives processes that are killed rather than exiting cleanly.
+ */
+#define PAN_DISK_CACHE_HOT_SET_INTERVAL 64
+
+/* Preloaded shaders not used by then are assumed to be useless to this run */
+#define PAN_DISK_CACHE_WARM_UP_NS (60ll * 1000000000ll)
+
+struct panfrost_disk_cache_entry {
+   cache_key key;
+   size_t size;
+   void *data;
+};
+
+static uint32_t
+panfrost_disk_cache_key_hash(const void *key)
+{
+   /* Keys are SHA1 digests, any of their bits will do */
+   uint32_t hash;
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+panfrost_disk_cache_key_equal(const void *a, const void *b)
+{
+   return memcmp(a, b, sizeof(cache_key)) == 0;
+}
+
 /**
  * Compute a disk cache key for the given uncompiled shader and shader key.
+ * The disk cache itself mixes in the GPU name and the driver build-id.
  */
 static void
 panfrost_disk_cache_compute_key(
-   struct disk_cache *cache,
+   struct panfrost_screen *screen,
    const struct panfrost_uncompiled_shader *uncompiled,
    const struct panfrost_shader_key *shader_key, cache_key cache_key)
 {
-   uint8_t data[sizeof(uncompiled->nir_sha1) + sizeof(*shader_key)];
+   uint32_t gpu_id = panfrost_device_gpu_id(&screen->dev);
+   uint8_t data[sizeof(uncompiled->nir_sha1) + sizeof(*shader_key) +
+                sizeof(gpu_id)];
+   uint8_t *ptr = data;
+
+   memcpy(ptr, uncompiled->nir_sha1, sizeof(uncompiled->nir_sha1));
+   ptr += sizeof(uncompiled->nir_sha1);
+   memcpy(ptr, shader_key, sizeof(*shader_key));
+   ptr += sizeof(*shader_key);
+   memcpy(ptr, &gpu_id, sizeof(gpu_id));
+
+   disk_cache_compute_key(screen->disk_cache, data, sizeof(data), cache_key);
+}
+
+/* Write the keys used so far as the hot set of this process. The disk cache
+ * takes ownership of the copy and writes it from its own thread.
+ */
+static void
+panfrost_disk_cache_store_hot_set(struct panfrost_screen *screen)
+{
+   size_t size = util_dynarray_num_elements(&screen->disk_cache_preload.keys,
+                                            cache_key) *
+                 sizeof(cache_key);
+   void *data = malloc(size);
+
+   if (!data)
+      return;
+
+   memcpy(data, util_dynarray_begin(&screen->disk_cache_preload.keys), size);
+   disk_cache_put_nocopy(screen->disk_cache,
+                         screen->disk_cache_preload.hot_set_key, data, size,
+                         NULL);
+
+   screen->disk_cache_preload.stored_keys =
+      util_dynarray_num_elements(&screen->disk_cache_preload.keys, cache_key);
+}
+
+static void
+panfrost_disk_cache_free_entry(struct hash_entry *he)
+{
+   struct panfrost_disk_cache_entry *entry = he->data;
+
+   free(entry->data);
+   free(entry);
+}
+
+/* Free the preloaded shaders that weren't used, and stop the preload. Called
+ * with the preload lock held.
+ */
+static void
+panfrost_disk_cache_end_warm_up(struct panfrost_screen *screen)
+{
+   if (screen->disk_cache_preload.warm)
+      return;
+
+   if (debug && screen->disk_cache_preload.entries->entries) {
+      fprintf(stderr, "[mesa disk cache] dropping %u unused preloaded shaders\n",
+              screen->disk_cache_preload.entries->entries);
+   }
+
+   _mesa_hash_table_clear(screen->disk_cache_preload.entries,
+                          panfrost_disk_cache_free_entry);
+   screen->disk_cache_preload.warm = true;
+}
+
+/* Record a shader used by this run. Called with the preload lock held. */
+static void
+panfrost_disk_cache_use_key(struct panfrost_screen *screen, const cache_key key)
+{
+   unsigned count =
+      util_dynarray_num_elements(&screen->disk_cache_preload.keys, cache_key);
+   unsigned hot_set_size = screen->disk_cache_preload.hot_set_size;
+
+   /* Warm-up is over once this run used as many shaders as the previous
+    * one, or after a while */
+   if ((hot_set_size && count >= hot_set_size) ||
+       os_time_get_nano() >= screen->disk_cache_preload.warm_up_end)
+      panfrost_disk_cache_end_warm_up(screen);
 
-   memcpy(data, uncompiled->nir_sha1, sizeof(uncompiled->nir_sha1));
-   memcpy(data + sizeof(uncompiled->nir_sha1), shader_key, sizeof(*shader_key));
+   if (count >= PAN_DISK_CACHE_HOT_SET_MAX)
+      return;
+
+   /* Variants of identical shaders share a key, only record it once */
+   if (_mesa_set_search(screen->disk_cache_preload.used, key))
+      return;
+
+   _mesa_set_add(screen->disk_cache_preload.used,
+                 ralloc_memdup(screen->disk_cache_preload.used, key,
+                               sizeof(cache_key)));
+
+   void *slot = util_dynarray_grow_bytes(&screen->disk_cache_preload.keys, 1,
+                                         sizeof(cache_key));
+   if (!slot)
+      return;
+
+   memcpy(slot, key, sizeof(cache_key));
 
-   disk_cache_compute_key(cache, data, sizeof(data), cache_key);
+   if (count + 1 >= screen->disk_cache_preload.stored_keys +
+                       PAN_DISK_CACHE_HOT_SET_INTERVAL)
+      panfrost_disk_cache_store_hot_set(screen);
 }
 
 /**
  * Store the given compiled shader in the disk cache.
  *
  * This should only be called on newly compiled shaders.  No checking is
- * done to prevent repeated stores of the same shader.
+ * done to prevent repeated stores of the same shader. The write itself
+ * happens on the disk cache thread.
  */
 void
-panfrost_disk_cache_store(struct disk_cache *cache,
+panfrost_disk_cache_store(struct panfrost_screen *screen,
                           const struct panfrost_uncompiled_shader *uncompiled,
                           const struct panfrost_shader_key *key,
                           const struct panfrost_shader_binary *binary)
 {
 #ifdef ENABLE_SHADER_CACHE
-   if (!cache)
+   if (!screen->disk_cache)
       return;
 
    cache_key cache_key;
-   panfrost_disk_cache_compute_key(cache, uncompiled, key, cache_key);
+   panfrost_disk_cache_compute_key(screen, uncompiled, key, cache_key);
 
    if (debug) {
       char sha1[41];
@@ -96,8 +226,19 @@ panfrost_disk_cache_store(struct disk_cache *cache,
    blob_write_bytes(&blob, &binary->info, sizeof(binary->info));
    blob_write_bytes(&blob, &binary->sysvals, sizeof(binary->sysvals));
 
-   disk_cache_put(cache, cache_key, blob.data, blob.size, NULL);
-   blob_finish(&blob);
+   if (blob.out_of_memory) {
+      blob_finish(&blob);
+      return;
+   }
+
+   void *data;
+   size_t size;
+   blob_finish_get_buffer(&blob, &data, &size);
+   disk_cache_put_nocopy(screen->disk_cache, cache_key, data, size, NULL);
+
+   simple_mtx_lock(&screen->disk_cache_preload.lock);
+   panfrost_disk_cache_use_key(screen, cache_key);
+   simple_mtx_unlock(&screen->disk_cache_preload.lock);
 #endif
 }
 
@@ -105,17 +246,17 @@ panfrost_disk_cache_store(struct disk_cache *cache,
  * Search for a compiled shader in the disk cache.
  */
 bool
-panfrost_disk_cache_retrieve(struct disk_cache *cache,
+panfrost_disk_cache_retrieve(struct panfrost_screen *screen,
                              const struct panfrost_uncompiled_shader *uncompiled,
                              const struct panfrost_shader_key *key,
                              struct panfrost_shader_binary *binary)
 {
 #ifdef ENABLE_SHADER_CACHE
-   if (!cache)
+   if (!screen->disk_cache)
       return false;
 
    cache_key cache_key;
-   panfrost_disk_cache_compute_key(cache, uncompiled, key, cache_key);
+   panfrost_disk_cache_compute_key(screen, uncompiled, key, cache_key);
 
    if (debug) {
       char sha1[41];
@@ -123,11 +264,30 @@ panfrost_disk_cache_retrieve(struct disk_cache *cache,
       fprintf(stderr, "[mesa disk cache] retrieving %s: ", sha1);
    }
 
-   size_t size;
-   void *buffer = disk_cache_get(cache, cache_key, &size);
+   size_t size = 0;
+   void *buffer = NULL;
+
+   /* Preloaded entries are only ever used once, by the variant they
+    * describe, so take ownership of them */
+   simple_mtx_lock(&screen->disk_cache_preload.lock);
+   struct hash_entry *he =
+      _mesa_hash_table_search(screen->disk_cache_preload.entries, cache_key);
+
+   if (he) {
+      struct panfrost_disk_cache_entry *entry = he->data;
+
+      _mesa_hash_table_remove(screen->disk_cache_preload.entries, he);
+      buffer = entry->data;
+      size = entry->size;
+      free(entry);
+   }
+   simple_mtx_unlock(&screen->disk_cache_preload.lock);
+
+   if (!buffer)
+      buffer = disk_cache_get(screen->disk_cache, cache_key, &size);
 
    if (debug)
-      fprintf(stderr, "%s\n", buffer ? "found" : "missing");
+      fprintf(stderr, "%s\n", he ? "preloaded" : buffer ? "found" : "missing");
 
    if (!buffer)
       return false;
@@ -146,17 +306,167 @@ panfrost_disk_cache_retrieve(struct disk_cache *cache,
 
    free(buffer);
 
+   /* Don't trust truncated or corrupted entries, recompile instead */
+   if (blob.overrun || blob.current != blob.end) {
+      util_dynarray_fini(&binary->binary);
+      return false;
+   }
+
+   simple_mtx_lock(&screen->disk_cache_preload.lock);
+   panfrost_disk_cache_use_key(screen, cache_key);
+   simple_mtx_unlock(&screen->disk_cache_preload.lock);
+
    return true;
 #else
    return false;
 #endif
 }
 
+#ifdef ENABLE_SHADER_CACHE
+static void
+panfrost_disk_cache_preload(void *data, void *gdata, int thread_index)
+{
+   struct panfrost_screen *screen = data;
+   size_t size;
+   cache_key *keys = disk_cache_get(
+      screen->disk_cache, screen->disk_cache_preload.hot_set_key, &size);
+
+   if (!keys)
+      return;
+
+   unsigned count = size / sizeof(cache_key);
+
+   simple_mtx_lock(&screen->disk_cache_preload.lock);
+   screen->disk_cache_preload.hot_set_size = count;
+   simple_mtx_unlock(&screen->disk_cache_preload.lock);
+
+   for (unsigned i = 0; i < count; ++i) {
+      struct panfrost_disk_cache_entry *entry = malloc(sizeof(*entry));
+
+      if (!entry)
+         break;
+
+      memcpy(entry->key, keys[i], sizeof(cache_key));
+      entry->data =
+         disk_cache_get(screen->disk_cache, entry->key, &entry->size);
+
+      if (!entry->data) {
+         free(entry);
+         continue;
+      }
+
+      simple_mtx_lock(&screen->disk_cache_preload.lock);
+      bool warm = screen->disk_cache_preload.warm;
+
+      if (warm || _mesa_hash_table_search(screen->disk_cache_preload.entries,
+                                          entry->key)) {
+         free(entry->data);
+         free(entry);
+      } else {
+         _mesa_hash_table_insert(screen->disk_cache_preload.entries,
+                                 entry->key, entry);
+      }
+      simple_mtx_unlock(&screen->disk_cache_preload.lock);
+
+      if (warm)
+         break;
+   }
+
+   free(keys);
+}
+#endif
+
 /**
- * Initialize the on-disk shader cache.
+ * Initialize the on-disk shader cache, and start preloading the shaders
+ * this process used last time.
  */
 void
 panfrost_disk_cache_init(struct panfrost_screen *screen)
 {
-   printf("panfrost_disk_cache_init: de-implemented.");
+   simple_mtx_init(&screen->disk_cache_preload.lock, mtx_plain);
+   util_queue_fence_init(&screen->disk_cache_preload.fence);
+   util_dynarray_init(&screen->disk_cache_preload.keys, NULL);
+   screen->disk_cache_preload.entries = _mesa_hash_table_create(
+      NULL, panfrost_disk_cache_key_hash, panfrost_disk_cache_key_equal);
+   screen->disk_cache_preload.used = _mesa_set_create(
+      NULL, panfrost_disk_cache_key_hash, panfrost_disk_cache_key_equal);
+   screen->disk_cache_preload.warm_up_end =
+      os_time_get_nano() + PAN_DISK_CACHE_WARM_UP_NS;
+
+#ifdef ENABLE_SHADER_CACHE
+   const char *renderer = screen->base.get_name(&screen->base);
+
+   const struct build_id_note *note =
+      build_id_find_nhdr_for_addr(panfrost_disk_cache_init);
+   assert(note && build_id_length(note) == 20); /* sha1 */
+
+   const uint8_t *id_sha1 = build_id_data(note);
+   assert(id_sha1);
+
+   char timestamp[41];
+   _mesa_sha1_format(timestamp, id_sha1);
+
+   /* Consider any flags affecting the compile when caching */
+   uint64_t driver_flags = screen->dev.debug;
+   driver_flags |= ((uint64_t)(midgard_debug | bifrost_debug) << 32);
+
+   screen->disk_cache =
+      disk_cache_create_allow_android(renderer, timestamp, driver_flags);
+
+   if (!screen->disk_cache)
+      return;
+
+   /* The hot set is specific to the process */
+   const char *process = util_get_process_name();
+   char hot_set_name[128];
+
+   snprintf(hot_set_name, sizeof(hot_set_name), "panfrost-hot-set:%s",
+            process ? process : "");
+   disk_cache_compute_key(screen->disk_cache, hot_set_name,
+                          strlen(hot_set_name),
+                          screen->disk_cache_preload.hot_set_key);
+
+   /* Preload on a queue of its own, so the reads don't hold back background
+    * compiles of shaders the application actually needs right now.
+    */
+   if (util_queue_init(&screen->disk_cache_preload.queue, "pan_dcp", 1, 1,
+                       UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY, NULL)) {
+      util_queue_add_job(&screen->disk_cache_preload.queue, screen,
+                         &screen->disk_cache_preload.fence,
+                         panfrost_disk_cache_preload, NULL, 0);
+   }
+#endif
+}
+
+/**
+ * Save the hot set and release the on-disk shader cache.
+ */
+void
+panfrost_disk_cache_fini(struct panfrost_screen *screen)
+{
+   /* Stop the preload early */
+   simple_mtx_lock(&screen->disk_cache_preload.lock);
+   panfrost_disk_cache_end_warm_up(screen);
+   simple_mtx_unlock(&screen->disk_cache_preload.lock);
+
+   util_queue_fence_wait(&screen->disk_cache_preload.fence);
+
+   if (util_queue_is_initialized(&screen->disk_cache_preload.queue))
+      util_queue_destroy(&screen->disk_cache_preload.queue);
+
+   if (screen->disk_cache &&
+       util_dynarray_num_elements(&screen->disk_cache_preload.keys,
+                                  cache_key) !=
+          screen->disk_cache_preload.stored_keys)
+      panfrost_disk_cache_store_hot_set(screen);
+
+   disk_cache_destroy(screen->disk_cache);
+   screen->disk_cache = NULL;
+
+   _mesa_hash_table_destroy(screen->disk_cache_preload.entries,
+                            panfrost_disk_cache_free_entry);
+   _mesa_set_destroy(screen->disk_cache_preload.used, NULL);
+   util_dynarray_fini(&screen->disk_cache_preload.keys);
+   util_queue_fence_destroy(&screen->disk_cache_preload.fence);
+   simple_mtx_destroy(&screen->disk_cache_preload.lock);
 }
@@ -129,6 +129,9 @@ panfrost_fence_create(struct panfrost_context *ctx)
    struct panfrost_device *dev = pan_device(ctx->base.screen);
    int fd = -1, ret;
 
+   /* The syncobj only points to the last batch once it's submitted */
+   panfrost_wait_submits(ctx);
+
    /* Snapshot the last rendering out fence. We'd rather have another
     * syncobj instead of a sync file, but this is all we get.
     * (HandleToFD/FDToHandle just gives you another syncobj ID for the
@@ -21,7 +21,7 @@
  * SOFTWARE.
  */
 
-#include "util/u_vbuf.h"
+#include "util/u_inlines.h"
 #include "pan_context.h"
 
 void
@@ -139,17 +139,45 @@ panfrost_get_index_buffer_bounded(struct panfrost_batch *batch,
       needs_indices = false;
    } else if (!info->has_user_indices) {
       /* Check the cache */
+      simple_mtx_lock(&rsrc->index_cache_lock);
       needs_indices = !panfrost_minmax_cache_get(
-         rsrc->index_cache, draw->start, draw->count, min_index, max_index);
+         rsrc->index_cache, info->index_size, draw->start, draw->count,
+         min_index, max_index);
+      simple_mtx_unlock(&rsrc->index_cache_lock);
    }
 
    if (needs_indices) {
-      /* Fallback */
-      u_vbuf_get_minmax_index(&ctx->base, info, draw, min_index, max_index);
+      struct pipe_transfer *transfer = NULL;
+      const void *indices;
+
+      if (info->has_user_indices) {
+         indices = (const uint8_t *)info->index.user +
+                   draw->start * info->index_size;
+      } else {
+         indices = pipe_buffer_map_range(
+            &ctx->base, info->index.resource, draw->start * info->index_size,
+            draw->count * info->index_size, PIPE_MAP_READ, &transfer);
+      }
 
+      /* The per-block bounds of the resource are reused across slices, then
+       * the result for this exact slice is cached */
       if (!info->has_user_indices)
-         panfrost_minmax_cache_add(rsrc->index_cache, draw->start, draw->count,
-                                   *min_index, *max_index);
+         simple_mtx_lock(&rsrc->index_cache_lock);
+
+      panfrost_minmax_cache_compute(
+         info->has_user_indices ? NULL : rsrc->index_cache, indices,
+         info->index_size, draw->start, draw->count, info->primitive_restart,
+         info->restart_index, min_index, max_index);
+
+      if (!info->has_user_indices) {
+         panfrost_minmax_cache_add(rsrc->index_cache, info->index_size,
+                                   draw->start, draw->count, *min_index,
+                                   *max_index);
+         simple_mtx_unlock(&rsrc->index_cache_lock);
+      }
+
+      if (transfer)
+         pipe_buffer_unmap(&ctx->base, transfer);
    }
 
    return panfrost_get_index_buffer(batch, info, draw);
@@ -239,19 +267,35 @@ panfrost_track_image_access(struct panfrost_batch *batch,
                             struct pipe_image_view *image)
 {
    struct panfrost_resource *rsrc = pan_resource(image->resource);
+   bool is_buffer = rsrc->base.b.target == PIPE_BUFFER;
+   bool writes = image->shader_access & PIPE_IMAGE_ACCESS_WRITE;
+
+   /* Only a level and a range of layers are accessed, 3D images can access
+    * any slice */
+   if (is_buffer || rsrc->base.b.target == PIPE_TEXTURE_3D) {
+      if (writes)
+         panfrost_batch_write_rsrc(batch, rsrc, stage);
+      else
+         panfrost_batch_read_rsrc(batch, rsrc, stage);
+   } else if (writes) {
+      panfrost_batch_write_rsrc_range(
+         batch, rsrc, stage, image->u.tex.level, image->u.tex.level,
+         image->u.tex.first_layer, image->u.tex.last_layer);
+   } else {
+      panfrost_batch_read_rsrc_range(
+         batch, rsrc, stage, image->u.tex.level, image->u.tex.level,
+         image->u.tex.first_layer, image->u.tex.last_layer);
+   }
 
-   if (image->shader_access & PIPE_IMAGE_ACCESS_WRITE) {
-      panfrost_batch_write_rsrc(batch, rsrc, stage);
+   if (writes) {
+      pan_crc_invalidate_all(&rsrc->valid.crc);
 
-      bool is_buffer = rsrc->base.target == PIPE_BUFFER;
       unsigned level = is_buffer ? 0 : image->u.tex.level;
       BITSET_SET(rsrc->valid.data, level);
 
       if (is_buffer) {
-         util_range_add(&rsrc->base, &rsrc->valid_buffer_range, 0,
-                        rsrc->base.width0);
+         util_range_add(&rsrc->base.b, &rsrc->base.valid_buffer_range, 0,
+                        rsrc->base.b.width0);
       }
-   } else {
-      panfrost_batch_read_rsrc(batch, rsrc, stage);
    }
 }
@@ -70,60 +70,66 @@ GENX(jm_init_batch)(struct panfrost_batch *batch)
 #endif
 }
 
-static int
-jm_submit_jc(struct panfrost_batch *batch, mali_ptr first_job_desc,
-             uint32_t reqs, uint32_t out_sync)
-{
-   struct panfrost_context *ctx = batch->ctx;
-   struct pipe_context *gallium = (struct pipe_context *)ctx;
-   struct panfrost_device *dev = pan_device(gallium->screen);
-   struct drm_panfrost_submit submit = {
-      0,
-   };
-   uint32_t in_syncs[1];
+/* Everything needed to hand a batch over to the kernel once the batch itself
+ * is gone. Lives on the stack for immediate submits. When the submit is
+ * deferred to the context submit thread, it is heap-allocated and holds a
+ * reference to each BO in bo_handles.
+ */
+struct jm_submit {
+   struct panfrost_context *ctx;
    uint32_t *bo_handles;
-   int ret;
+   unsigned bo_handle_count;
+   mali_ptr vtc_jc;
+   mali_ptr frag_jc;
+   bool has_tiler;
+   bool is_noop;
+   uint32_t in_sync;
+   uint32_t out_sync;
+};
 
-   /* If we trace, we always need a syncobj, so make one of our own if we
-    * weren't given one to use. Remember that we did so, so we can free it
-    * after we're done but preventing double-frees if we were given a
-    * syncobj */
-
-   if (!out_sync && dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC))
-      out_sync = ctx->syncobj;
+void
+GENX(jm_init_context)(struct panfrost_context *ctx)
+{
+   struct panfrost_screen *screen = pan_screen(ctx->base.screen);
 
-   submit.out_sync = out_sync;
-   submit.jc = first_job_desc;
-   submit.requirements = reqs;
+   util_dynarray_init(&ctx->jm.bo_handles, ctx);
 
-   if (ctx->in_sync_fd >= 0) {
-      ret = drmSyncobjImportSyncFile(panfrost_device_fd(dev), ctx->in_sync_obj,
-                                     ctx->in_sync_fd);
-      assert(!ret);
+   /* A single thread keeps submits in order. The queue depth bounds how far
+    * ahead of the kernel the context can get.
+    */
+   if (screen->driconf.async_submit)
+      util_queue_init(&ctx->submit_queue, "pan_submit", 8, 1, 0, NULL);
+}
 
-      in_syncs[submit.in_sync_count++] = ctx->in_sync_obj;
-      close(ctx->in_sync_fd);
-      ctx->in_sync_fd = -1;
+void
+GENX(jm_cleanup_context)(struct panfrost_context *ctx)
+{
+   if (util_queue_is_initialized(&ctx->submit_queue)) {
+      /* Destroying the queue drops the jobs that haven't run yet */
+      util_queue_finish(&ctx->submit_queue);
+      util_queue_destroy(&ctx->submit_queue);
    }
 
-   if (submit.in_sync_count)
-      submit.in_syncs = (uintptr_t)in_syncs;
+   util_dynarray_fini(&ctx->jm.bo_handles);
+}
 
-   bo_handles = calloc(panfrost_pool_num_bos(&batch->pool) +
-                          panfrost_pool_num_bos(&batch->invisible_pool) +
-                          batch->num_bos + 2,
-                       sizeof(*bo_handles));
-   assert(bo_handles);
+static unsigned
+jm_batch_max_bo_handles(struct panfrost_batch *batch)
+{
+   return util_dynarray_num_elements(&batch->bo_handles, uint32_t) +
+          panfrost_pool_num_bos(&batch->pool) +
+          panfrost_pool_num_bos(&batch->invisible_pool) + 2;
+}
 
+static unsigned
+jm_batch_get_bo_handles(struct panfrost_batch *batch, uint32_t *bo_handles)
+{
+   struct panfrost_device *dev = pan_device(batch->ctx->base.screen);
    pan_bo_access *flags = util_dynarray_begin(&batch->bos);
-   unsigned end_bo = util_dynarray_num_elements(&batch->bos, pan_bo_access);
+   unsigned count = 0;
 
-   for (int i = 0; i < end_bo; ++i) {
-      if (!flags[i])
-         continue;
-
-      assert(submit.bo_handle_count < batch->num_bos);
-      bo_handles[submit.bo_handle_count++] = i;
+   util_dynarray_foreach(&batch->bo_handles, uint32_t, handle) {
+      bo_handles[count++] = *handle;
 
       /* Update the BO access flags so that panfrost_bo_wait() knows
        * about all pending accesses.
@@ -132,36 +138,63 @@ jm_submit_jc(struct panfrost_batch *batch, mali_ptr first_job_desc,
        * We also preserve existing flags as this batch might not
        * be the first one to access the BO.
        */
-      struct panfrost_bo *bo = pan_lookup_bo(dev, i);
+      struct panfrost_bo *bo = pan_lookup_bo(dev, *handle);
 
-      bo->gpu_access |= flags[i] & (PAN_BO_ACCESS_RW);
+      bo->gpu_access |= flags[*handle] & (PAN_BO_ACCESS_RW);
    }
 
-   panfrost_pool_get_bo_handles(&batch->pool,
-                                bo_handles + submit.bo_handle_count);
-   submit.bo_handle_count += panfrost_pool_num_bos(&batch->pool);
-   panfrost_pool_get_bo_handles(&batch->invisible_pool,
-                                bo_handles + submit.bo_handle_count);
-   submit.bo_handle_count += panfrost_pool_num_bos(&batch->invisible_pool);
+   panfrost_pool_get_bo_handles(&batch->pool, bo_handles + count);
+   count += panfrost_pool_num_bos(&batch->pool);
+   panfrost_pool_get_bo_handles(&batch->invisible_pool, bo_handles + count);
+   count += panfrost_pool_num_bos(&batch->invisible_pool);
 
    /* Add the tiler heap to the list of accessed BOs if the batch has at
     * least one tiler job. Tiler heap is written by tiler jobs and read
     * by fragment jobs (the polygon list is coming from this heap).
     */
    if (batch->jm.jobs.vtc_jc.first_tiler)
-      bo_handles[submit.bo_handle_count++] =
-         panfrost_bo_handle(dev->tiler_heap);
+      bo_handles[count++] = panfrost_bo_handle(dev->tiler_heap);
 
    /* Always used on Bifrost, occassionally used on Midgard */
-   bo_handles[submit.bo_handle_count++] =
-      panfrost_bo_handle(dev->sample_positions);
+   bo_handles[count++] = panfrost_bo_handle(dev->sample_positions);
+
+   return count;
+}
 
-   submit.bo_handles = (u64)(uintptr_t)bo_handles;
-   if (ctx->is_noop)
+static int
+jm_submit_jc(const struct jm_submit *s, mali_ptr first_job_desc,
+             uint32_t reqs, uint32_t in_sync, uint32_t out_sync)
+{
+   struct panfrost_device *dev = pan_device(s->ctx->base.screen);
+   struct drm_panfrost_submit submit = {
+      0,
+   };
+   int ret;
+
+   /* If we trace, we always need a syncobj, so make one of our own if we
+    * weren't given one to use. Remember that we did so, so we can free it
+    * after we're done but preventing double-frees if we were given a
+    * syncobj */
+
+   if (!out_sync && dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC))
+      out_sync = s->ctx->syncobj;
+
+   submit.out_sync = out_sync;
+   submit.jc = first_job_desc;
+   submit.requirements = reqs;
+
+   if (in_sync) {
+      submit.in_syncs = (uintptr_t)&in_sync;
+      submit.in_sync_count = 1;
+   }
+
+   submit.bo_handles = (u64)(uintptr_t)s->bo_handles;
+   submit.bo_handle_count = s->bo_handle_count;
+
+   if (s->is_noop)
       ret = 0;
    else
       ret = drmIoctl(panfrost_device_fd(dev), DRM_IOCTL_PANFROST_SUBMIT, &submit);
-   free(bo_handles);
 
    if (ret)
       return errno;
@@ -178,7 +211,7 @@ jm_submit_jc(struct panfrost_batch *batch, mali_ptr first_job_desc,
          pandecode_dump_mappings(dev->decode_ctx);
 
       /* Jobs won't be complete if blackhole rendering, that's ok */
-      if (!ctx->is_noop && dev->debug & PAN_DBG_SYNC)
+      if (!s->is_noop && dev->debug & PAN_DBG_SYNC)
          pandecode_abort_on_fault(dev->decode_ctx, submit.jc, panfrost_device_gpu_id(dev));
    }
 
@@ -189,46 +222,151 @@ jm_submit_jc(struct panfrost_batch *batch, mali_ptr first_job_desc,
  * outsync corresponding to the later of the two (since there will be an
  * implicit dep between them) */
 
-int
-GENX(jm_submit_batch)(struct panfrost_batch *batch)
+static int
+jm_submit(const struct jm_submit *s)
 {
-   struct pipe_screen *pscreen = batch->ctx->base.screen;
-   struct panfrost_device *dev = pan_device(pscreen);
-   bool has_draws = batch->jm.jobs.vtc_jc.first_job;
-   bool has_tiler = batch->jm.jobs.vtc_jc.first_tiler;
-   bool has_frag = panfrost_has_fragment_job(batch);
-   uint32_t out_sync = batch->ctx->syncobj;
+   struct panfrost_device *dev = pan_device(s->ctx->base.screen);
    int ret = 0;
 
    /* Take the submit lock to make sure no tiler jobs from other context
     * are inserted between our tiler and fragment jobs, failing to do that
     * might result in tiler heap corruption.
     */
-   if (has_tiler)
+   if (s->has_tiler)
       pthread_mutex_lock(&dev->submit_lock);
 
-   if (has_draws) {
-      ret = jm_submit_jc(batch, batch->jm.jobs.vtc_jc.first_job, 0,
-                         has_frag ? 0 : out_sync);
+   if (s->vtc_jc) {
+      ret = jm_submit_jc(s, s->vtc_jc, 0, s->in_sync,
+                         s->frag_jc ? 0 : s->out_sync);
 
       if (ret)
          goto done;
    }
 
-   if (has_frag) {
-      ret =
-         jm_submit_jc(batch, batch->jm.jobs.frag, PANFROST_JD_REQ_FS, out_sync);
+   if (s->frag_jc) {
+      ret = jm_submit_jc(s, s->frag_jc, PANFROST_JD_REQ_FS,
+                         s->vtc_jc ? 0 : s->in_sync, s->out_sync);
       if (ret)
          goto done;
    }
 
 done:
-   if (has_tiler)
+   if (s->has_tiler)
       pthread_mutex_unlock(&dev->submit_lock);
 
    return ret;
 }
 
+static void
+jm_submit_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct jm_submit *s = data;
+   struct panfrost_device *dev = pan_device(s->ctx->base.screen);
+   int ret = jm_submit(s);
+
+   if (ret)
+      panfrost_batch_submit_failed(s->ctx, ret);
+
+   for (unsigned i = 0; i < s->bo_handle_count; i++)
+      panfrost_bo_remove_pending_submit(pan_lookup_bo(dev, s->bo_handles[i]));
+}
+
+static void
+jm_submit_job_cleanup(void *data, void *gdata, int thread_index)
+{
+   struct jm_submit *s = data;
+   struct panfrost_device *dev = pan_device(s->ctx->base.screen);
+
+   for (unsigned i = 0; i < s->bo_handle_count; i++)
+      panfrost_bo_unreference(pan_lookup_bo(dev, s->bo_handles[i]));
+
+   free(s->bo_handles);
+   free(s);
+}
+
+/* Defer the submit to the context submit thread. The job keeps the BOs
+ * alive, since the batch is cleaned up as soon as we return.
+ */
+static int
+jm_queue_submit(struct panfrost_batch *batch, const struct jm_submit *s)
+{
+   struct panfrost_context *ctx = batch->ctx;
+   struct panfrost_device *dev = pan_device(ctx->base.screen);
+   struct jm_submit *job = malloc(sizeof(*job));
+
+   if (!job)
+      return ENOMEM;
+
+   *job = *s;
+   job->bo_handles = malloc(jm_batch_max_bo_handles(batch) * sizeof(uint32_t));
+   if (!job->bo_handles) {
+      free(job);
+      return ENOMEM;
+   }
+
+   job->bo_handle_count = jm_batch_get_bo_handles(batch, job->bo_handles);
+
+   /* Count the submit as pending on its BOs before advertising the accesses
+    * through gpu_access, so panfrost_bo_wait() never sees the latter alone.
+    */
+   for (unsigned i = 0; i < job->bo_handle_count; i++) {
+      struct panfrost_bo *bo = pan_lookup_bo(dev, job->bo_handles[i]);
+
+      panfrost_bo_reference(bo);
+      panfrost_bo_add_pending_submit(bo);
+   }
+
+   util_queue_add_job(&ctx->submit_queue, job, NULL, jm_submit_job_execute,
+                      jm_submit_job_cleanup, 0);
+   return 0;
+}
+
+int
+GENX(jm_submit_batch)(struct panfrost_batch *batch)
+{
+   struct panfrost_context *ctx = batch->ctx;
+   struct panfrost_device *dev = pan_device(ctx->base.screen);
+   struct jm_submit s = {
+      .ctx = ctx,
+      .vtc_jc = batch->jm.jobs.vtc_jc.first_job,
+      .frag_jc = panfrost_has_fragment_job(batch) ? batch->jm.jobs.frag : 0,
+      .has_tiler = batch->jm.jobs.vtc_jc.first_tiler != 0,
+      .is_noop = ctx->is_noop,
+      .out_sync = ctx->syncobj,
+   };
+
+   if (!s.vtc_jc && !s.frag_jc)
+      return 0;
+
+   /* Importing the in-fence and tracing both need the submit to happen now */
+   if (util_queue_is_initialized(&ctx->submit_queue) && ctx->in_sync_fd < 0 &&
+       !(dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC)))
+      return jm_queue_submit(batch, &s);
+
+   /* Don't overtake the batches still queued */
+   panfrost_wait_submits(ctx);
+
+   if (ctx->in_sync_fd >= 0) {
+      ASSERTED int ret = drmSyncobjImportSyncFile(
+         panfrost_device_fd(dev), ctx->in_sync_obj, ctx->in_sync_fd);
+      assert(!ret);
+
+      s.in_sync = ctx->in_sync_obj;
+      close(ctx->in_sync_fd);
+      ctx->in_sync_fd = -1;
+   }
+
+   util_dynarray_clear(&ctx->jm.bo_handles);
+   if (!util_dynarray_resize(&ctx->jm.bo_handles, uint32_t,
+                             jm_batch_max_bo_handles(batch)))
+      return ENOMEM;
+
+   s.bo_handles = util_dynarray_begin(&ctx->jm.bo_handles);
+   s.bo_handle_count = jm_batch_get_bo_handles(batch, s.bo_handles);
+
+   return jm_submit(&s);
+}
+
 void
 GENX(jm_preload_fb)(struct panfrost_batch *batch, struct pan_fb_info *fb)
 {
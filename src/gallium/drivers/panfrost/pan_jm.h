@@ -25,8 +25,15 @@
 #ifndef __PAN_JM_H__
 #define __PAN_JM_H__
 
+#include "util/u_dynarray.h"
 #include "pan_jc.h"
 
+struct panfrost_jm_context {
+   /* BO handle array passed to the submit ioctl, kept across submits to
+    * avoid an allocation per submit */
+   struct util_dynarray bo_handles;
+};
+
 struct panfrost_jm_batch {
    /* Job related fields. */
    struct {
@@ -49,15 +56,9 @@ struct pipe_draw_info;
 struct pipe_grid_info;
 struct pipe_draw_start_count_bias;
 
-static inline void
-GENX(jm_init_context)(struct panfrost_context *ctx)
-{
-}
+void GENX(jm_init_context)(struct panfrost_context *ctx);
 
-static inline void
-GENX(jm_cleanup_context)(struct panfrost_context *ctx)
-{
-}
+void GENX(jm_cleanup_context)(struct panfrost_context *ctx);
 
 void GENX(jm_init_batch)(struct panfrost_batch *batch);
 
@@ -30,10 +30,12 @@
 #include "util/hash_table.h"
 #include "util/ralloc.h"
 #include "util/rounding.h"
+#include "util/set.h"
 #include "util/u_framebuffer.h"
 #include "util/u_pack_color.h"
 #include "pan_bo.h"
 #include "pan_context.h"
+#include "pan_perfcnt.h"
 #include "pan_util.h"
 
 #define foreach_batch(ctx, idx)                                                \
@@ -57,6 +59,17 @@ panfrost_any_batch_other_than(struct panfrost_context *ctx, unsigned index)
    return false;
 }
 
+/* Batches writing to a resource, as a mask of batch indices */
+
+static uint32_t
+panfrost_rsrc_writers(struct panfrost_context *ctx,
+                      struct panfrost_resource *rsrc)
+{
+   struct hash_entry *entry = _mesa_hash_table_search(ctx->writers, rsrc);
+
+   return entry ? (uintptr_t)entry->data : 0;
+}
+
 /* Adds the BO backing surface to a batch if the surface is non-null */
 
 static void
@@ -66,7 +79,14 @@ panfrost_batch_add_surface(struct panfrost_batch *batch,
    if (surf) {
       struct panfrost_resource *rsrc = pan_resource(surf->texture);
       pan_legalize_afbc_format(batch->ctx, rsrc, surf->format, true, false);
-      panfrost_batch_write_rsrc(batch, rsrc, PIPE_SHADER_FRAGMENT);
+
+      if (surf->texture->target == PIPE_BUFFER) {
+         panfrost_batch_write_rsrc(batch, rsrc, PIPE_SHADER_FRAGMENT);
+      } else {
+         panfrost_batch_write_rsrc_range(
+            batch, rsrc, PIPE_SHADER_FRAGMENT, surf->u.tex.level,
+            surf->u.tex.level, surf->u.tex.first_layer, surf->u.tex.last_layer);
+      }
    }
 }
 
@@ -84,6 +104,7 @@ panfrost_batch_init(struct panfrost_context *ctx,
    batch->seqnum = ++ctx->batches.seqnum;
 
    util_dynarray_init(&batch->bos, NULL);
+   util_dynarray_init(&batch->bo_handles, NULL);
 
    batch->minx = batch->miny = ~0;
    batch->maxx = batch->maxy = 0;
@@ -125,21 +146,41 @@ panfrost_batch_cleanup(struct panfrost_context *ctx,
 
    unsigned batch_idx = panfrost_batch_idx(batch);
 
-   pan_bo_access *flags = util_dynarray_begin(&batch->bos);
-   unsigned end_bo = util_dynarray_num_elements(&batch->bos, pan_bo_access);
+   util_dynarray_foreach(&batch->bo_handles, uint32_t, handle) {
+      struct panfrost_bo *bo = pan_lookup_bo(dev, *handle);
+      panfrost_bo_unreference(bo);
+   }
 
-   for (int i = 0; i < end_bo; ++i) {
-      if (!flags[i])
-         continue;
+   if (batch->suballocs) {
+      set_foreach(batch->suballocs, entry)
+         panfrost_bo_unreference((struct panfrost_bo *)entry->key);
 
-      struct panfrost_bo *bo = pan_lookup_bo(dev, i);
-      panfrost_bo_unreference(bo);
+      _mesa_set_destroy(batch->suballocs, NULL);
    }
 
    /* There is no more writer for anything we wrote */
-   hash_table_foreach(ctx->writers, ent) {
-      if (ent->data == batch)
-         _mesa_hash_table_remove(ctx->writers, ent);
+   if (batch->rsrc_access) {
+      hash_table_foreach(batch->rsrc_access, ent) {
+         struct pan_rsrc_access *access = ent->data;
+
+         if (!access->write.levels)
+            continue;
+
+         struct hash_entry *writers =
+            _mesa_hash_table_search(ctx->writers, ent->key);
+
+         if (!writers)
+            continue;
+
+         uintptr_t mask = (uintptr_t)writers->data & ~BITFIELD_BIT(batch_idx);
+
+         if (mask)
+            writers->data = (void *)mask;
+         else
+            _mesa_hash_table_remove(ctx->writers, writers);
+      }
+
+      _mesa_hash_table_destroy(batch->rsrc_access, NULL);
    }
 
    panfrost_pool_cleanup(&batch->pool);
@@ -148,13 +189,16 @@ panfrost_batch_cleanup(struct panfrost_context *ctx,
    util_unreference_framebuffer_state(&batch->key);
 
    util_dynarray_fini(&batch->bos);
+   util_dynarray_fini(&batch->bo_handles);
 
    memset(batch, 0, sizeof(*batch));
    BITSET_CLEAR(ctx->batches.active, batch_idx);
 }
 
 static void panfrost_batch_submit(struct panfrost_context *ctx,
-                                  struct panfrost_batch *batch);
+                                  struct panfrost_batch *batch,
+                                  enum pan_flush_class cls,
+                                  const char *reason);
 
 static struct panfrost_batch *
 panfrost_get_batch(struct panfrost_context *ctx,
@@ -181,7 +225,7 @@ panfrost_get_batch(struct panfrost_context *ctx,
    /* The selected slot is used, we need to flush the batch */
    if (batch->seqnum) {
       perf_debug_ctx(ctx, "Flushing batch due to seqnum overflow");
-      panfrost_batch_submit(ctx, batch);
+      panfrost_batch_submit(ctx, batch, PAN_FLUSH_EVICTION, "Seqnum overflow");
    }
 
    panfrost_batch_init(ctx, key, batch);
@@ -231,7 +275,7 @@ panfrost_get_fresh_batch_for_fbo(struct panfrost_context *ctx,
 
    if (batch->draw_count + batch->compute_count > 0) {
       perf_debug_ctx(ctx, "Flushing the current FBO due to: %s", reason);
-      panfrost_batch_submit(ctx, batch);
+      panfrost_batch_submit(ctx, batch, PAN_FLUSH_FBO, reason);
       batch = panfrost_get_batch(ctx, &ctx->pipe_framebuffer);
    }
 
@@ -239,32 +283,117 @@ panfrost_get_fresh_batch_for_fbo(struct panfrost_context *ctx,
    return batch;
 }
 
+static pan_bo_access panfrost_batch_rsrc_flags(struct panfrost_batch *batch,
+                                               struct panfrost_resource *rsrc);
+
 static bool panfrost_batch_uses_resource(struct panfrost_batch *batch,
                                          struct panfrost_resource *rsrc);
 
+static void panfrost_batch_mark_untracked(struct panfrost_batch *batch,
+                                          struct panfrost_resource *rsrc);
+
+static struct pan_rsrc_access *
+panfrost_batch_get_rsrc_access(struct panfrost_batch *batch,
+                               struct panfrost_resource *rsrc)
+{
+   if (!batch->rsrc_access)
+      batch->rsrc_access = _mesa_pointer_hash_table_create(NULL);
+
+   struct hash_entry *entry =
+      _mesa_hash_table_search(batch->rsrc_access, rsrc);
+
+   if (entry)
+      return entry->data;
+
+   struct pan_rsrc_access *access =
+      rzalloc(batch->rsrc_access, struct pan_rsrc_access);
+
+   _mesa_hash_table_insert(batch->rsrc_access, rsrc, access);
+   return access;
+}
+
+/* Whether accessing the given subresources from another batch has to wait for
+ * this batch. Reads only conflict with writes, and resources used without a
+ * known footprint conflict with everything.
+ */
+static bool
+panfrost_batch_conflicts(struct panfrost_batch *batch,
+                         struct panfrost_resource *rsrc,
+                         struct pan_subres_range range, bool writes)
+{
+   if (panfrost_batch_rsrc_flags(batch, rsrc) & PAN_BO_ACCESS_UNTRACKED)
+      return true;
+
+   struct hash_entry *entry =
+      batch->rsrc_access ? _mesa_hash_table_search(batch->rsrc_access, rsrc)
+                         : NULL;
+
+   if (!entry)
+      return true;
+
+   struct pan_rsrc_access *access = entry->data;
+
+   return pan_subres_overlap(access->write, range) ||
+          (writes && pan_subres_overlap(access->read, range));
+}
+
+/* Record an access to subresources of a resource, and submit the other
+ * batches it depends on. Batches are submitted in order, so only the batches
+ * that have to execute first are flushed: the writers of the subresources for
+ * a read, and all their users for a write. Accesses to disjoint levels or
+ * layers don't need any flush.
+ */
 static void
 panfrost_batch_update_access(struct panfrost_batch *batch,
-                             struct panfrost_resource *rsrc, bool writes)
+                             struct panfrost_resource *rsrc, bool writes,
+                             struct pan_subres_range range)
 {
    struct panfrost_context *ctx = batch->ctx;
    uint32_t batch_idx = panfrost_batch_idx(batch);
+   bool others = panfrost_any_batch_other_than(ctx, batch_idx);
 
    if (writes) {
-      _mesa_hash_table_insert(ctx->writers, rsrc, batch);
+      _mesa_hash_table_insert(
+         ctx->writers, rsrc,
+         (void *)(uintptr_t)(panfrost_rsrc_writers(ctx, rsrc) |
+                             BITFIELD_BIT(batch_idx)));
+   }
+
+   /* Without other batches nothing can conflict yet, so skip recording the
+    * footprint of reads on the draw hot path. The BO is marked instead,
+    * making it conflict with any later access from another batch. Writes are
+    * still recorded, both for the writers cleanup and because render targets
+    * are what other batches usually access disjoint levels or layers of.
+    */
+   if (!others && !writes) {
+      panfrost_batch_mark_untracked(batch, rsrc);
+      return;
    }
 
+   struct pan_rsrc_access *access = panfrost_batch_get_rsrc_access(batch, rsrc);
+
+   if (writes)
+      pan_subres_union(&access->write, range);
+   else
+      pan_subres_union(&access->read, range);
+
    /* The rest of this routine is just about flushing other batches. If there
     * aren't any, we can skip a lot of work.
     */
-   if (!panfrost_any_batch_other_than(ctx, batch_idx))
+   if (!others)
       return;
 
-   struct hash_entry *entry = _mesa_hash_table_search(ctx->writers, rsrc);
-   struct panfrost_batch *writer = entry ? entry->data : NULL;
+   /* Both reads and writes flush the writers of the same subresources */
+   uint32_t writers = panfrost_rsrc_writers(ctx, rsrc) & ~BITFIELD_BIT(batch_idx);
+
+   u_foreach_bit(i, writers) {
+      struct panfrost_batch *writer = &ctx->batches.slots[i];
 
-   /* Both reads and writes flush the existing writer */
-   if (writer != NULL && writer != batch)
-      panfrost_batch_submit(ctx, writer);
+      if (panfrost_batch_conflicts(writer, rsrc, range, false)) {
+         panfrost_batch_submit(ctx, writer, PAN_FLUSH_DEPENDENCY,
+                               "Writer dependency");
+      }
+   }
 
    /* Writes (only) flush readers too */
    if (writes) {
@@ -276,9 +405,12 @@ panfrost_batch_update_access(struct panfrost_batch *batch,
          if (i == batch_idx)
             continue;
 
-         /* Submit if it's a user */
-         if (panfrost_batch_uses_resource(batch, rsrc))
-            panfrost_batch_submit(ctx, batch);
+         /* Submit if it's a user of the same subresources */
+         if (panfrost_batch_uses_resource(batch, rsrc) &&
+             panfrost_batch_conflicts(batch, rsrc, range, true)) {
+            panfrost_batch_submit(ctx, batch, PAN_FLUSH_DEPENDENCY,
+                                  "Reader dependency");
+         }
       }
    }
 }
@@ -298,9 +430,9 @@ panfrost_batch_get_bo_access(struct panfrost_batch *batch, unsigned handle)
    return util_dynarray_element(&batch->bos, pan_bo_access, handle);
 }
 
-static bool
-panfrost_batch_uses_resource(struct panfrost_batch *batch,
-                             struct panfrost_resource *rsrc)
+static pan_bo_access
+panfrost_batch_rsrc_flags(struct panfrost_batch *batch,
+                          struct panfrost_resource *rsrc)
 {
    /* A resource is used iff its current BO is used */
    uint32_t handle = panfrost_bo_handle(rsrc->bo);
@@ -308,10 +440,25 @@ panfrost_batch_uses_resource(struct panfrost_batch *batch,
 
    /* If out of bounds, certainly not used */
    if (handle >= size)
-      return false;
+      return 0;
+
+   return *util_dynarray_element(&batch->bos, pan_bo_access, handle);
+}
+
+static bool
+panfrost_batch_uses_resource(struct panfrost_batch *batch,
+                             struct panfrost_resource *rsrc)
+{
+   return panfrost_batch_rsrc_flags(batch, rsrc) != 0;
+}
 
-   /* Otherwise check if nonzero access */
-   return !!(*util_dynarray_element(&batch->bos, pan_bo_access, handle));
+static void
+panfrost_batch_mark_untracked(struct panfrost_batch *batch,
+                              struct panfrost_resource *rsrc)
+{
+   /* The BO was added by the caller, so the entry exists */
+   *panfrost_batch_get_bo_access(batch, panfrost_bo_handle(rsrc->bo)) |=
+      PAN_BO_ACCESS_UNTRACKED;
 }
 
 static void
@@ -321,12 +468,26 @@ panfrost_batch_add_bo_old(struct panfrost_batch *batch, struct panfrost_bo *bo,
    if (!bo)
       return;
 
-   pan_bo_access *entry =
-      panfrost_batch_get_bo_access(batch, panfrost_bo_handle(bo));
+   if (bo->parent) {
+      bool found;
+
+      if (!batch->suballocs)
+         batch->suballocs = _mesa_pointer_set_create(NULL);
+
+      _mesa_set_search_or_add(batch->suballocs, bo, &found);
+      if (!found)
+         panfrost_bo_reference(bo);
+
+      /* GPU accesses are tracked on the slab */
+      bo = bo->parent;
+   }
+
+   uint32_t handle = panfrost_bo_handle(bo);
+   pan_bo_access *entry = panfrost_batch_get_bo_access(batch, handle);
    pan_bo_access old_flags = *entry;
 
    if (!old_flags) {
-      batch->num_bos++;
+      util_dynarray_append(&batch->bo_handles, uint32_t, handle);
       panfrost_bo_reference(bo);
    }
 
@@ -360,19 +521,29 @@ panfrost_batch_write_bo(struct panfrost_batch *batch, struct panfrost_bo *bo,
       batch, bo, PAN_BO_ACCESS_WRITE | panfrost_access_for_stage(stage));
 }
 
-void
-panfrost_batch_read_rsrc(struct panfrost_batch *batch,
-                         struct panfrost_resource *rsrc,
-                         enum pipe_shader_type stage)
+static void
+panfrost_batch_access_rsrc(struct panfrost_batch *batch,
+                           struct panfrost_resource *rsrc,
+                           enum pipe_shader_type stage, bool writes,
+                           struct pan_subres_range range)
 {
-   uint32_t access = PAN_BO_ACCESS_READ | panfrost_access_for_stage(stage);
+   uint32_t access = (writes ? PAN_BO_ACCESS_WRITE : PAN_BO_ACCESS_READ) |
+                     panfrost_access_for_stage(stage);
 
    panfrost_batch_add_bo_old(batch, rsrc->bo, access);
 
    if (rsrc->separate_stencil)
       panfrost_batch_add_bo_old(batch, rsrc->separate_stencil->bo, access);
 
-   panfrost_batch_update_access(batch, rsrc, false);
+   panfrost_batch_update_access(batch, rsrc, writes, range);
+}
+
+void
+panfrost_batch_read_rsrc(struct panfrost_batch *batch,
+                         struct panfrost_resource *rsrc,
+                         enum pipe_shader_type stage)
+{
+   panfrost_batch_access_rsrc(batch, rsrc, stage, false, pan_subres_whole());
 }
 
 void
@@ -380,14 +551,50 @@ panfrost_batch_write_rsrc(struct panfrost_batch *batch,
                           struct panfrost_resource *rsrc,
                           enum pipe_shader_type stage)
 {
-   uint32_t access = PAN_BO_ACCESS_WRITE | panfrost_access_for_stage(stage);
+   panfrost_batch_access_rsrc(batch, rsrc, stage, true, pan_subres_whole());
+}
 
-   panfrost_batch_add_bo_old(batch, rsrc->bo, access);
+void
+panfrost_batch_read_rsrc_range(struct panfrost_batch *batch,
+                               struct panfrost_resource *rsrc,
+                               enum pipe_shader_type stage,
+                               unsigned first_level, unsigned last_level,
+                               unsigned first_layer, unsigned last_layer)
+{
+   panfrost_batch_access_rsrc(
+      batch, rsrc, stage, false,
+      pan_subres_range(first_level, last_level, first_layer, last_layer));
+}
 
-   if (rsrc->separate_stencil)
-      panfrost_batch_add_bo_old(batch, rsrc->separate_stencil->bo, access);
+void
+panfrost_batch_write_rsrc_range(struct panfrost_batch *batch,
+                                struct panfrost_resource *rsrc,
+                                enum pipe_shader_type stage,
+                                unsigned first_level, unsigned last_level,
+                                unsigned first_layer, unsigned last_layer)
+{
+   panfrost_batch_access_rsrc(
+      batch, rsrc, stage, true,
+      pan_subres_range(first_level, last_level, first_layer, last_layer));
+}
 
-   panfrost_batch_update_access(batch, rsrc, true);
+void
+panfrost_batch_read_view(struct panfrost_batch *batch,
+                         const struct pipe_sampler_view *view,
+                         enum pipe_shader_type stage)
+{
+   struct panfrost_resource *rsrc = pan_resource(view->texture);
+
+   if (view->target == PIPE_BUFFER) {
+      panfrost_batch_read_rsrc(batch, rsrc, stage);
+      return;
+   }
+
+   panfrost_batch_access_rsrc(
+      batch, rsrc, stage, false,
+      pan_subres_texture(view->texture->target, view->u.tex.first_level,
+                         view->u.tex.last_level, view->u.tex.first_layer,
+                         view->u.tex.last_layer));
 }
 
 struct panfrost_bo *
@@ -471,6 +678,7 @@ panfrost_batch_to_fb_info(const struct panfrost_batch *batch,
    fb->rt_count = batch->key.nr_cbufs;
    fb->sprite_coord_origin = pan_tristate_get(batch->sprite_coord_origin);
    fb->first_provoking_vertex = pan_tristate_get(batch->first_provoking_vertex);
+   fb->crc_stats = &batch->ctx->crc_stats;
 
    static const unsigned char id_swz[] = {
       PIPE_SWIZZLE_X,
@@ -518,7 +726,7 @@ panfrost_batch_to_fb_info(const struct panfrost_batch *batch,
       rts[i].nr_samples =
          surf->nr_samples ?: MAX2(surf->texture->nr_samples, 1);
       memcpy(rts[i].swizzle, id_swz, sizeof(rts[i].swizzle));
-      fb->rts[i].crc_valid = &prsrc->valid.crc;
+      fb->rts[i].crc = &prsrc->valid.crc;
       fb->rts[i].view = &rts[i];
 
       /* Preload if the RT is read or updated */
@@ -623,9 +831,45 @@ panfrost_emit_tile_map(struct panfrost_batch *batch, struct pan_fb_info *fb)
    }
 }
 
+/* Hand the tracepoints recorded so far to u_trace. The end of the batch is
+ * timestamped once the batch pool went idle, so keep it alive until then.
+ */
+static void
+panfrost_batch_flush_trace(struct panfrost_context *ctx,
+                           struct panfrost_batch *batch)
+{
+   if (!u_trace_has_points(&ctx->trace))
+      return;
+
+   struct panfrost_bo *bo = batch->pool.transient_bo;
+
+   if (bo)
+      panfrost_bo_reference(bo);
+
+   u_trace_flush(&ctx->trace, bo, bo != NULL);
+   u_trace_context_process(&ctx->trace_context, false);
+}
+
+static void
+panfrost_flush_stats_add(struct panfrost_context *ctx, enum pan_flush_class cls,
+                         const char *reason)
+{
+   struct pan_flush_stats *stats = &ctx->flush_stats;
+   struct hash_entry *entry = _mesa_hash_table_search(stats->by_reason, reason);
+
+   stats->submits++;
+   stats->by_class[cls]++;
+
+   if (entry)
+      entry->data = (void *)((uintptr_t)entry->data + 1);
+   else
+      _mesa_hash_table_insert(stats->by_reason, reason, (void *)(uintptr_t)1);
+}
+
 static void
 panfrost_batch_submit(struct panfrost_context *ctx,
-                      struct panfrost_batch *batch)
+                      struct panfrost_batch *batch, enum pan_flush_class cls,
+                      const char *reason)
 {
    struct pipe_screen *pscreen = ctx->base.screen;
    struct panfrost_screen *screen = pan_screen(pscreen);
@@ -636,13 +880,15 @@ panfrost_batch_submit(struct panfrost_context *ctx,
    if (!has_frag && batch->compute_count == 0)
       goto out;
 
+   panfrost_flush_stats_add(ctx, cls, reason);
+
    if (batch->key.zsbuf && has_frag) {
       struct pipe_surface *surf = batch->key.zsbuf;
       struct panfrost_resource *z_rsrc = pan_resource(surf->texture);
 
       /* Shared depth/stencil resources are not supported, and would
        * break this optimisation. */
-      assert(!(z_rsrc->base.bind & PAN_BIND_SHARED_MASK));
+      assert(!(z_rsrc->base.b.bind & PAN_BIND_SHARED_MASK));
 
       if (batch->clear & PIPE_CLEAR_STENCIL) {
          z_rsrc->stencil_value = batch->clear_stencil;
@@ -662,9 +908,51 @@ panfrost_batch_submit(struct panfrost_context *ctx,
    panfrost_batch_to_fb_info(batch, &fb, rts, &zs, &s, false);
    panfrost_emit_tile_map(batch, &fb);
 
+   bool sample_perfcnt = !list_is_empty(&ctx->perf_queries);
+
+   if (sample_perfcnt)
+      panfrost_perfcnt_begin_batch(ctx);
+
+   trace_start_batch(&ctx->trace);
+
    ret = screen->vtbl.submit_batch(batch, &fb);
    if (ret)
-      fprintf(stderr, "panfrost_batch_submit failed: %d\n", ret);
+      panfrost_batch_submit_failed(ctx, ret);
+
+   trace_end_batch(&ctx->trace, reason, batch->draw_count,
+                   batch->compute_count, has_frag, batch->key.width,
+                   batch->key.height, batch->key.nr_cbufs,
+                   batch->key.nr_cbufs && batch->key.cbufs[0]
+                      ? batch->key.cbufs[0]->format
+                      : PIPE_FORMAT_NONE,
+                   batch->key.zsbuf ? batch->key.zsbuf->format
+                                    : PIPE_FORMAT_NONE);
+   panfrost_batch_flush_trace(ctx, batch);
+
+   if (sample_perfcnt)
+      panfrost_perfcnt_end_batch(ctx);
+
+   /* Superblocks of AFBC render targets written by this batch have to be
+    * measured again before the next pack */
+   if (has_frag) {
+      for (unsigned i = 0; i < batch->key.nr_cbufs; i++) {
+         struct pipe_surface *surf = batch->key.cbufs[i];
+
+         if (surf && (batch->resolve & (PIPE_CLEAR_COLOR0 << i))) {
+            panfrost_afbc_add_damage(pan_resource(surf->texture),
+                                     surf->u.tex.level, batch->minx,
+                                     batch->miny, batch->maxx, batch->maxy);
+         }
+      }
+
+      if (batch->key.zsbuf && (batch->resolve & PIPE_CLEAR_DEPTHSTENCIL)) {
+         struct pipe_surface *surf = batch->key.zsbuf;
+
+         panfrost_afbc_add_damage(pan_resource(surf->texture),
+                                  surf->u.tex.level, batch->minx, batch->miny,
+                                  batch->maxx, batch->maxy);
+      }
+   }
 
    /* We must reset the damage info of our render targets here even
     * though a damage reset normally happens when the DRI layer swaps
@@ -695,24 +983,58 @@ panfrost_flush_all_batches(struct panfrost_context *ctx, const char *reason)
    if (reason)
       perf_debug_ctx(ctx, "Flushing everything due to: %s", reason);
 
+   if (!reason)
+      reason = "Context flush";
+
+   trace_start_flush(&ctx->trace);
+
    struct panfrost_batch *batch = panfrost_get_batch_for_fbo(ctx);
-   panfrost_batch_submit(ctx, batch);
+   panfrost_batch_submit(ctx, batch, PAN_FLUSH_CONTEXT, reason);
 
    for (unsigned i = 0; i < PAN_MAX_BATCHES; i++) {
-      if (ctx->batches.slots[i].seqnum)
-         panfrost_batch_submit(ctx, &ctx->batches.slots[i]);
+      if (ctx->batches.slots[i].seqnum) {
+         panfrost_batch_submit(ctx, &ctx->batches.slots[i], PAN_FLUSH_CONTEXT,
+                               reason);
+      }
    }
+
+   trace_end_flush(&ctx->trace, reason);
+
+   /* Everything the threaded context handed us is now in flight */
+   if (ctx->tc)
+      tc_driver_internal_flush_notify(ctx->tc);
+}
+
+/* Report a failed submit. Called from the submit thread for deferred
+ * submits. GPU faults and hangs are reported separately, as a context reset,
+ * by the backends that can detect them.
+ */
+
+void
+panfrost_batch_submit_failed(struct panfrost_context *ctx, int ret)
+{
+   fprintf(stderr, "panfrost_batch_submit failed: %d\n", ret);
+}
+
+/* Wait for the batches queued on the submit thread to reach the kernel */
+
+void
+panfrost_wait_submits(struct panfrost_context *ctx)
+{
+   if (util_queue_is_initialized(&ctx->submit_queue))
+      util_queue_finish(&ctx->submit_queue);
 }
 
 void
 panfrost_flush_writer(struct panfrost_context *ctx,
                       struct panfrost_resource *rsrc, const char *reason)
 {
-   struct hash_entry *entry = _mesa_hash_table_search(ctx->writers, rsrc);
+   uint32_t writers = panfrost_rsrc_writers(ctx, rsrc);
 
-   if (entry) {
+   u_foreach_bit(i, writers) {
       perf_debug_ctx(ctx, "Flushing writer due to: %s", reason);
-      panfrost_batch_submit(ctx, entry->data);
+      panfrost_batch_submit(ctx, &ctx->batches.slots[i], PAN_FLUSH_RESOURCE,
+                            reason);
    }
 }
 
@@ -729,7 +1051,7 @@ panfrost_flush_batches_accessing_rsrc(struct panfrost_context *ctx,
          continue;
 
       perf_debug_ctx(ctx, "Flushing user due to: %s", reason);
-      panfrost_batch_submit(ctx, batch);
+      panfrost_batch_submit(ctx, batch, PAN_FLUSH_RESOURCE, reason);
    }
 }
 
@@ -752,7 +1074,67 @@ bool
 panfrost_any_batch_writes_rsrc(struct panfrost_context *ctx,
                                struct panfrost_resource *rsrc)
 {
-   return _mesa_hash_table_search(ctx->writers, rsrc) != NULL;
+   return panfrost_rsrc_writers(ctx, rsrc) != 0;
+}
+
+void
+panfrost_flush_stats_init(struct panfrost_context *ctx)
+{
+   ctx->flush_stats.by_reason =
+      _mesa_hash_table_create(ctx, _mesa_hash_string, _mesa_key_string_equal);
+}
+
+static int
+panfrost_cmp_reason_count(const void *a, const void *b)
+{
+   const struct hash_entry *ea = *(const struct hash_entry **)a;
+   const struct hash_entry *eb = *(const struct hash_entry **)b;
+   uintptr_t ca = (uintptr_t)ea->data, cb = (uintptr_t)eb->data;
+
+   if (ca != cb)
+      return ca < cb ? 1 : -1;
+
+   return strcmp(ea->key, eb->key);
+}
+
+void
+panfrost_flush_stats_print(struct panfrost_context *ctx, FILE *fp)
+{
+   static const char *class_names[PAN_FLUSH_CLASS_COUNT] = {
+      [PAN_FLUSH_CONTEXT] = "context",
+      [PAN_FLUSH_FBO] = "fbo",
+      [PAN_FLUSH_RESOURCE] = "resource",
+      [PAN_FLUSH_DEPENDENCY] = "dependency",
+      [PAN_FLUSH_EVICTION] = "eviction",
+   };
+   struct pan_flush_stats *stats = &ctx->flush_stats;
+   unsigned nr_reasons = stats->by_reason->entries;
+   struct hash_entry **reasons = malloc(nr_reasons * sizeof(*reasons));
+   unsigned i = 0;
+
+   hash_table_foreach(stats->by_reason, entry)
+      reasons[i++] = entry;
+
+   qsort(reasons, nr_reasons, sizeof(*reasons), panfrost_cmp_reason_count);
+
+   fprintf(fp, "panfrost: %" PRIu64 " batches submitted by context %p\n",
+           stats->submits, ctx);
+
+   fprintf(fp, "  %-40s %10s\n", "class", "batches");
+
+   for (unsigned c = 0; c < PAN_FLUSH_CLASS_COUNT; ++c) {
+      fprintf(fp, "  %-40s %10" PRIu64 "\n", class_names[c],
+              stats->by_class[c]);
+   }
+
+   fprintf(fp, "  %-40s %10s\n", "reason", "batches");
+
+   for (i = 0; i < nr_reasons; ++i) {
+      fprintf(fp, "  %-40s %10" PRIuPTR "\n", (const char *)reasons[i]->key,
+              (uintptr_t)reasons[i]->data);
+   }
+
+   free(reasons);
 }
 
 void
@@ -33,6 +33,7 @@
 #include "pan_jm.h"
 #include "pan_mempool.h"
 #include "pan_resource.h"
+#include "pan_subres.h"
 
 /* Simple tri-state data structure. In the default "don't care" state, the value
  * may be set to true or false. However, once the value is set, it must not be
@@ -80,6 +81,43 @@ pan_tristate_get(struct pan_tristate state)
    return (state.v == PAN_TRISTATE_TRUE);
 }
 
+/* Why a batch was submitted. Every flush also carries a free-form reason
+ * string, the class only tells which path led to it.
+ */
+enum pan_flush_class {
+   /* panfrost_flush_all_batches() */
+   PAN_FLUSH_CONTEXT,
+
+   /* panfrost_get_fresh_batch_for_fbo() */
+   PAN_FLUSH_FBO,
+
+   /* panfrost_flush_writer() and panfrost_flush_batches_accessing_rsrc() */
+   PAN_FLUSH_RESOURCE,
+
+   /* Another batch accessed subresources this batch wrote, or wrote
+    * subresources this batch accessed */
+   PAN_FLUSH_DEPENDENCY,
+
+   /* All batch slots are used */
+   PAN_FLUSH_EVICTION,
+
+   PAN_FLUSH_CLASS_COUNT,
+};
+
+struct pan_flush_stats {
+   /* Batches submitted, in total and by class */
+   uint64_t submits;
+   uint64_t by_class[PAN_FLUSH_CLASS_COUNT];
+
+   /* Batches submitted by reason, keyed by the reason string */
+   struct hash_table *by_reason;
+};
+
+struct pan_rsrc_access {
+   struct pan_subres_range read;
+   struct pan_subres_range write;
+};
+
 /* A panfrost_batch corresponds to a bound FBO we're rendering to,
  * collecting over multiple draws. */
 
@@ -127,9 +165,21 @@ struct panfrost_batch {
    /* Acts as a rasterizer discard */
    bool scissor_culls_everything;
 
-   /* BOs referenced not in the pool */
-   unsigned num_bos;
+   /* Access flags of the BOs referenced not in the pool, indexed by GEM
+    * handle. This is sparse, so the handles of the referenced BOs are also
+    * kept in a compact array to iterate over them. */
    struct util_dynarray bos;
+   struct util_dynarray bo_handles;
+
+   /* Subresources of the resources read and written by the batch, mapping
+    * panfrost_resource to pan_rsrc_access. Used to tell whether accesses by
+    * other batches conflict with this one. */
+   struct hash_table *rsrc_access;
+
+   /* Suballocated BOs referenced by the batch. Only their slab is tracked in
+    * bos, but they must stay alive until the batch is submitted, lest their
+    * memory is reused before the slab is known to be busy. */
+   struct set *suballocs;
 
    /* Pool owned by this batch (released when the batch is released) used for
     * temporary descriptors */
@@ -246,6 +296,23 @@ void panfrost_batch_write_rsrc(struct panfrost_batch *batch,
                                struct panfrost_resource *rsrc,
                                enum pipe_shader_type stage);
 
+void panfrost_batch_read_rsrc_range(struct panfrost_batch *batch,
+                                    struct panfrost_resource *rsrc,
+                                    enum pipe_shader_type stage,
+                                    unsigned first_level, unsigned last_level,
+                                    unsigned first_layer, unsigned last_layer);
+
+void panfrost_batch_write_rsrc_range(struct panfrost_batch *batch,
+                                     struct panfrost_resource *rsrc,
+                                     enum pipe_shader_type stage,
+                                     unsigned first_level, unsigned last_level,
+                                     unsigned first_layer,
+                                     unsigned last_layer);
+
+void panfrost_batch_read_view(struct panfrost_batch *batch,
+                              const struct pipe_sampler_view *view,
+                              enum pipe_shader_type stage);
+
 bool panfrost_any_batch_reads_rsrc(struct panfrost_context *ctx,
                                    struct panfrost_resource *rsrc);
 
@@ -264,9 +331,17 @@ void panfrost_flush_batches_accessing_rsrc(struct panfrost_context *ctx,
                                            struct panfrost_resource *rsrc,
                                            const char *reason);
 
+void panfrost_wait_submits(struct panfrost_context *ctx);
+
+void panfrost_batch_submit_failed(struct panfrost_context *ctx, int ret);
+
 void panfrost_flush_writer(struct panfrost_context *ctx,
                            struct panfrost_resource *rsrc, const char *reason);
 
+void panfrost_flush_stats_init(struct panfrost_context *ctx);
+
+void panfrost_flush_stats_print(struct panfrost_context *ctx, FILE *fp);
+
 void panfrost_batch_adjust_stack_size(struct panfrost_batch *batch);
 
 struct panfrost_bo *panfrost_batch_get_scratchpad(struct panfrost_batch *batch,
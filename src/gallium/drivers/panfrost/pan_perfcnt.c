@@ -0,0 +1,320 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Mali hardware counters as Gallium driver queries.
+ *
+ * The counters are global to the GPU and cleared every time they are dumped.
+ * When a context has counter queries active, each of its batches is sampled
+ * on its own: the context waits for its previous work, dumps the counters to
+ * discard whatever came before, submits the batch, waits for it and dumps the
+ * counters again into the active queries. This serializes the context with the
+ * GPU, which is fine for profiling. Work submitted by other contexts at the
+ * same time is counted as well.
+ */
+
+#include "pan_perfcnt.h"
+#include "perf/pan_perf.h"
+#include "util/list.h"
+#include "util/ralloc.h"
+#include "pan_context.h"
+#include "pan_screen.h"
+
+void
+panfrost_perfcnt_screen_init(struct panfrost_screen *screen)
+{
+   struct panfrost_device *dev = &screen->dev;
+
+   simple_mtx_init(&screen->perfcnt.lock, mtx_plain);
+
+   /* Counters are only exposed by the JM kernel driver */
+   if (dev->arch >= 10 || !dev->model->performance_counters)
+      return;
+
+   const struct panfrost_perf_config *cfg =
+      panfrost_perf_lookup_config(dev->model->performance_counters);
+
+   if (!cfg)
+      return;
+
+   /* Enabling the counters needs unstable ioctls, and fails while another
+    * process owns them. Only expose them if they can be enabled now.
+    */
+   struct panfrost_perf *perf = rzalloc(NULL, struct panfrost_perf);
+   panfrost_perf_init(perf, panfrost_device_fd(dev));
+
+   if (panfrost_perf_enable(perf) < 0) {
+      pan_kmod_dev_destroy(perf->dev);
+      ralloc_free(perf);
+      return;
+   }
+
+   panfrost_perf_disable(perf);
+
+   screen->perfcnt.cfg = cfg;
+   screen->perfcnt.perf = perf;
+}
+
+void
+panfrost_perfcnt_screen_fini(struct panfrost_screen *screen)
+{
+   struct panfrost_perf *perf = screen->perfcnt.perf;
+
+   if (perf) {
+      if (screen->perfcnt.users)
+         panfrost_perf_disable(perf);
+
+      pan_kmod_dev_destroy(perf->dev);
+      ralloc_free(perf);
+   }
+
+   simple_mtx_destroy(&screen->perfcnt.lock);
+}
+
+unsigned
+panfrost_perfcnt_num_queries(struct panfrost_screen *screen)
+{
+   if (!screen->perfcnt.cfg)
+      return 0;
+
+   return panfrost_perf_num_counters(screen->perfcnt.cfg);
+}
+
+int
+panfrost_perfcnt_get_query_info(struct panfrost_screen *screen, unsigned index,
+                                struct pipe_driver_query_info *info)
+{
+   const struct panfrost_perf_config *cfg = screen->perfcnt.cfg;
+
+   if (!cfg || index >= panfrost_perf_num_counters(cfg))
+      return 0;
+
+   const struct panfrost_perf_counter *counter =
+      panfrost_perf_get_counter(cfg, index);
+
+   *info = (struct pipe_driver_query_info){
+      .name = counter->symbol_name,
+      .query_type = PAN_QUERY_FIRST_PERFCNT + index,
+      .type = PIPE_DRIVER_QUERY_TYPE_UINT64,
+      .result_type = PIPE_DRIVER_QUERY_RESULT_TYPE_CUMULATIVE,
+      .group_id = counter->category_index,
+      .flags = PIPE_DRIVER_QUERY_FLAG_BATCH,
+   };
+
+   return 1;
+}
+
+/* One group per counter block. All counters are dumped together, so any
+ * number of them can be active at once.
+ */
+int
+panfrost_get_driver_query_group_info(struct pipe_screen *pscreen,
+                                     unsigned index,
+                                     struct pipe_driver_query_group_info *info)
+{
+   const struct panfrost_perf_config *cfg = pan_screen(pscreen)->perfcnt.cfg;
+   unsigned num_groups = cfg ? cfg->n_categories : 0;
+
+   if (!info)
+      return num_groups;
+
+   if (index >= num_groups)
+      return 0;
+
+   const struct panfrost_perf_category *cat = &cfg->categories[index];
+
+   info->name = cat->name;
+   info->max_active_queries = cat->n_counters;
+   info->num_queries = cat->n_counters;
+
+   return 1;
+}
+
+struct panfrost_query *
+panfrost_perfcnt_create_query(struct panfrost_context *ctx,
+                              unsigned num_queries, unsigned *query_types)
+{
+   struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+   const struct panfrost_perf_config *cfg = screen->perfcnt.cfg;
+
+   if (!cfg || !num_queries)
+      return NULL;
+
+   struct panfrost_query *q = rzalloc(NULL, struct panfrost_query);
+
+   q->type = query_types[0];
+   q->perf.count = num_queries;
+   q->perf.counters =
+      ralloc_array(q, const struct panfrost_perf_counter *, num_queries);
+   q->perf.values = rzalloc_array(q, uint64_t, num_queries);
+
+   for (unsigned i = 0; i < num_queries; ++i) {
+      if (query_types[i] < PAN_QUERY_FIRST_PERFCNT)
+         goto fail;
+
+      unsigned index = query_types[i] - PAN_QUERY_FIRST_PERFCNT;
+      q->perf.counters[i] = panfrost_perf_get_counter(cfg, index);
+
+      if (!q->perf.counters[i])
+         goto fail;
+   }
+
+   return q;
+
+fail:
+   ralloc_free(q);
+   return NULL;
+}
+
+/* The kernel lets a single file own the counters, so they are enabled once
+ * for the screen while any query uses them.
+ */
+static bool
+panfrost_perfcnt_get(struct panfrost_screen *screen)
+{
+   bool ok = true;
+
+   simple_mtx_lock(&screen->perfcnt.lock);
+
+   if (screen->perfcnt.users == 0 &&
+       panfrost_perf_enable(screen->perfcnt.perf) < 0) {
+      mesa_logw("panfrost: failed to enable performance counters, "
+                "are they used by another process?");
+      ok = false;
+   }
+
+   if (ok)
+      screen->perfcnt.users++;
+
+   simple_mtx_unlock(&screen->perfcnt.lock);
+   return ok;
+}
+
+static void
+panfrost_perfcnt_put(struct panfrost_screen *screen)
+{
+   simple_mtx_lock(&screen->perfcnt.lock);
+
+   assert(screen->perfcnt.users > 0);
+   if (--screen->perfcnt.users == 0)
+      panfrost_perf_disable(screen->perfcnt.perf);
+
+   simple_mtx_unlock(&screen->perfcnt.lock);
+}
+
+void
+panfrost_perfcnt_destroy_query(struct panfrost_context *ctx,
+                               struct panfrost_query *query)
+{
+   if (query->perf.active) {
+      list_del(&query->perf.link);
+      query->perf.active = false;
+      panfrost_perfcnt_put(pan_screen(ctx->base.screen));
+   }
+}
+
+bool
+panfrost_perfcnt_begin_query(struct panfrost_context *ctx,
+                             struct panfrost_query *query)
+{
+   if (query->perf.active)
+      return true;
+
+   /* Don't count the work recorded before the query */
+   panfrost_flush_all_batches(ctx, "Performance counter query");
+
+   if (!panfrost_perfcnt_get(pan_screen(ctx->base.screen)))
+      return false;
+
+   memset(query->perf.values, 0, sizeof(uint64_t) * query->perf.count);
+   list_addtail(&query->perf.link, &ctx->perf_queries);
+   query->perf.active = true;
+   return true;
+}
+
+void
+panfrost_perfcnt_end_query(struct panfrost_context *ctx,
+                           struct panfrost_query *query)
+{
+   if (!query->perf.active)
+      return;
+
+   /* Sample the work recorded during the query */
+   panfrost_flush_all_batches(ctx, "Performance counter query");
+
+   list_del(&query->perf.link);
+   query->perf.active = false;
+   panfrost_perfcnt_put(pan_screen(ctx->base.screen));
+}
+
+/* Batches are waited for when sampled, so results are always available */
+void
+panfrost_perfcnt_get_query_result(struct panfrost_query *query,
+                                  union pipe_query_result *vresult)
+{
+   for (unsigned i = 0; i < query->perf.count; ++i)
+      vresult->batch[i].u64 = query->perf.values[i];
+}
+
+static void
+panfrost_perfcnt_wait_idle(struct panfrost_context *ctx)
+{
+   panfrost_wait_submits(ctx);
+   drmSyncobjWait(panfrost_device_fd(pan_device(ctx->base.screen)),
+                  &ctx->syncobj, 1, INT64_MAX, 0, NULL);
+}
+
+void
+panfrost_perfcnt_begin_batch(struct panfrost_context *ctx)
+{
+   struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+
+   panfrost_perfcnt_wait_idle(ctx);
+
+   simple_mtx_lock(&screen->perfcnt.lock);
+   panfrost_perf_dump(screen->perfcnt.perf);
+   simple_mtx_unlock(&screen->perfcnt.lock);
+}
+
+void
+panfrost_perfcnt_end_batch(struct panfrost_context *ctx)
+{
+   struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+   struct panfrost_perf *perf = screen->perfcnt.perf;
+
+   panfrost_perfcnt_wait_idle(ctx);
+
+   simple_mtx_lock(&screen->perfcnt.lock);
+
+   if (panfrost_perf_dump(perf) == 0) {
+      list_for_each_entry(struct panfrost_query, query, &ctx->perf_queries,
+                          perf.link) {
+         for (unsigned i = 0; i < query->perf.count; ++i) {
+            query->perf.values[i] +=
+               panfrost_perf_counter_read(query->perf.counters[i], perf);
+         }
+      }
+   }
+
+   simple_mtx_unlock(&screen->perfcnt.lock);
+}
@@ -0,0 +1,76 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_PERFCNT_H
+#define __PAN_PERFCNT_H
+
+#include "pipe/p_defines.h"
+
+struct panfrost_context;
+struct panfrost_query;
+struct panfrost_screen;
+struct pipe_screen;
+
+/* Hardware counters are exposed as driver queries following the software
+ * ones. Each counter has a query type of its own, numbered as in pan_perf.
+ */
+#define PAN_QUERY_FIRST_PERFCNT (PIPE_QUERY_DRIVER_SPECIFIC + 256)
+
+void panfrost_perfcnt_screen_init(struct panfrost_screen *screen);
+
+void panfrost_perfcnt_screen_fini(struct panfrost_screen *screen);
+
+unsigned panfrost_perfcnt_num_queries(struct panfrost_screen *screen);
+
+int panfrost_perfcnt_get_query_info(struct panfrost_screen *screen,
+                                    unsigned index,
+                                    struct pipe_driver_query_info *info);
+
+int panfrost_get_driver_query_group_info(
+   struct pipe_screen *pscreen, unsigned index,
+   struct pipe_driver_query_group_info *info);
+
+struct panfrost_query *
+panfrost_perfcnt_create_query(struct panfrost_context *ctx,
+                              unsigned num_queries, unsigned *query_types);
+
+void panfrost_perfcnt_destroy_query(struct panfrost_context *ctx,
+                                    struct panfrost_query *query);
+
+bool panfrost_perfcnt_begin_query(struct panfrost_context *ctx,
+                                  struct panfrost_query *query);
+
+void panfrost_perfcnt_end_query(struct panfrost_context *ctx,
+                                struct panfrost_query *query);
+
+void panfrost_perfcnt_get_query_result(struct panfrost_query *query,
+                                       union pipe_query_result *vresult);
+
+/* Sample the counters around the submission of a batch, when the context has
+ * counter queries active.
+ */
+void panfrost_perfcnt_begin_batch(struct panfrost_context *ctx);
+
+void panfrost_perfcnt_end_batch(struct panfrost_context *ctx);
+
+#endif
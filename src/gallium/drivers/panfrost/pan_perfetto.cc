@@ -0,0 +1,252 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <perfetto.h>
+
+#include "util/perf/u_perfetto.h"
+#include "util/perf/u_perfetto_renderpass.h"
+#include "util/macros.h"
+#include "util/u_call_once.h"
+
+#include "pan_perfetto.h"
+#include "pan_tracepoints.h"
+#include "pan_tracepoints_perfetto.h"
+
+/* Tracepoints are timestamped with os_time_get_nano() */
+#define PAN_CLOCK_ID perfetto::protos::pbzero::BUILTIN_CLOCK_MONOTONIC
+
+/**
+ * Queue-id's
+ */
+enum pan_queue_id {
+   GPU_QUEUE_ID,
+   DRIVER_QUEUE_ID,
+
+   PAN_NUM_QUEUES
+};
+
+/* Order must match the enum! */
+static const struct {
+   const char *name;
+   const char *desc;
+} queues[PAN_NUM_QUEUES] = {
+   {"GPU", "Batches, from their submission to their completion"},
+   {"Driver", "Work recorded on the CPU"},
+};
+
+/* Order must match the enum! */
+static const struct {
+   const char *name;
+   const char *desc;
+   enum pan_queue_id queue;
+} stages[PAN_NUM_STAGES] = {
+   {"Batch", "Batch, named after the reason it was flushed", GPU_QUEUE_ID},
+   {"Flush", "Flush of all batches, named after its reason", DRIVER_QUEUE_ID},
+   {"Fragment job", "Framebuffer and fragment job emission", DRIVER_QUEUE_ID},
+   {"Blit", "Blit recorded with the blitter", DRIVER_QUEUE_ID},
+   {"AFBC", "AFBC pack, unpack or superblock size pass", DRIVER_QUEUE_ID},
+   {"Compute", "Compute dispatch", DRIVER_QUEUE_ID},
+};
+
+/* Interned ids of the queues and stages, 0 being reserved */
+static uint64_t
+queue_iid(enum pan_queue_id queue)
+{
+   return 1 + queue;
+}
+
+static uint64_t
+stage_iid(enum pan_stage_id stage)
+{
+   return 1 + PAN_NUM_QUEUES + stage;
+}
+
+struct PanRenderpassIncrementalState {
+   bool was_cleared = true;
+};
+
+struct PanRenderpassTraits : public perfetto::DefaultDataSourceTraits {
+   using IncrementalStateType = PanRenderpassIncrementalState;
+};
+
+class PanRenderpassDataSource
+    : public MesaRenderpassDataSource<PanRenderpassDataSource,
+                                      PanRenderpassTraits> {};
+
+PERFETTO_DECLARE_DATA_SOURCE_STATIC_MEMBERS(PanRenderpassDataSource);
+PERFETTO_DEFINE_DATA_SOURCE_STATIC_MEMBERS(PanRenderpassDataSource);
+
+static void
+send_descriptors(PanRenderpassDataSource::TraceContext &ctx)
+{
+   PERFETTO_LOG("Sending renderstage descriptors");
+
+   auto packet = ctx.NewTracePacket();
+
+   packet->set_timestamp(perfetto::base::GetBootTimeNs().count());
+   packet->set_sequence_flags(
+      perfetto::protos::pbzero::TracePacket::SEQ_INCREMENTAL_STATE_CLEARED);
+
+   auto interned_data = packet->set_interned_data();
+
+   for (unsigned i = 0; i < PAN_NUM_QUEUES; i++) {
+      auto desc = interned_data->add_gpu_specifications();
+
+      desc->set_iid(queue_iid((enum pan_queue_id)i));
+      desc->set_name(queues[i].name);
+      desc->set_description(queues[i].desc);
+   }
+
+   for (unsigned i = 0; i < PAN_NUM_STAGES; i++) {
+      auto desc = interned_data->add_gpu_specifications();
+
+      desc->set_iid(stage_iid((enum pan_stage_id)i));
+      desc->set_name(stages[i].name);
+      desc->set_description(stages[i].desc);
+   }
+}
+
+static void
+stage_start(struct pipe_context *pctx, uint64_t ts_ns, enum pan_stage_id stage)
+{
+   struct pan_perfetto_state *p = panfrost_perfetto_state(pctx);
+   unsigned depth = p->depth[stage]++;
+
+   if (depth < PAN_PERFETTO_MAX_DEPTH)
+      p->start_ts[stage][depth] = ts_ns;
+}
+
+/* Emit the event of a stage, named after the marker if there is one. The
+ * payload of the end tracepoint is attached as extra data.
+ */
+template <typename Payload>
+static void
+stage_end(struct pipe_context *pctx, uint64_t ts_ns, enum pan_stage_id stage,
+          const char *marker, const Payload *payload,
+          void (*payload_as_extra)(perfetto::protos::pbzero::GpuRenderStageEvent *,
+                                   const Payload *))
+{
+   struct pan_perfetto_state *p = panfrost_perfetto_state(pctx);
+
+   if (!p->depth[stage])
+      return;
+
+   unsigned depth = --p->depth[stage];
+
+   if (depth >= PAN_PERFETTO_MAX_DEPTH)
+      return;
+
+   uint64_t start_ts = p->start_ts[stage][depth];
+
+   if (stage == BATCH_STAGE_ID) {
+      start_ts = MAX2(start_ts, p->last_batch_end_ts);
+      p->last_batch_end_ts = ts_ns;
+   }
+
+   if (start_ts > ts_ns)
+      return;
+
+   uint32_t submission_id = p->submission_id;
+
+   if (stage == BATCH_STAGE_ID)
+      p->submission_id++;
+
+   PanRenderpassDataSource::Trace([=](PanRenderpassDataSource::TraceContext tctx) {
+      if (auto state = tctx.GetIncrementalState(); state->was_cleared) {
+         send_descriptors(tctx);
+         state->was_cleared = false;
+      }
+
+      uint64_t iid =
+         marker ? tctx.GetDataSourceLocked()->debug_marker_stage(tctx, marker)
+                : stage_iid(stage);
+
+      auto packet = tctx.NewTracePacket();
+
+      packet->set_timestamp(start_ts);
+      packet->set_timestamp_clock_id(PAN_CLOCK_ID);
+
+      auto event = packet->set_gpu_render_stage_event();
+      event->set_event_id(0);
+      event->set_hw_queue_iid(queue_iid(stages[stage].queue));
+      event->set_stage_iid(iid);
+      event->set_duration(ts_ns - start_ts);
+      event->set_context((uintptr_t)pctx);
+      event->set_submission_id(submission_id);
+
+      payload_as_extra(event, payload);
+   });
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static void
+pan_perfetto_init_once(void)
+{
+   util_perfetto_init();
+
+   perfetto::DataSourceDescriptor dsd;
+   dsd.set_name("gpu.renderstages.panfrost");
+   PanRenderpassDataSource::Register(dsd);
+}
+
+void
+pan_perfetto_init(void)
+{
+   static util_once_flag once = UTIL_ONCE_FLAG_INIT;
+   util_call_once(&once, pan_perfetto_init_once);
+}
+
+/*
+ * Trace callbacks, called from u_trace once the timestamps have been
+ * collected.
+ */
+
+#define PAN_STAGE_CALLBACKS(name, stage, marker)                               \
+   void pan_start_##name(struct pipe_context *pctx, uint64_t ts_ns,           \
+                         uint16_t tp_idx, const void *flush_data,             \
+                         const struct trace_start_##name *payload)            \
+   {                                                                           \
+      stage_start(pctx, ts_ns, stage);                                         \
+   }                                                                           \
+                                                                               \
+   void pan_end_##name(struct pipe_context *pctx, uint64_t ts_ns,             \
+                       uint16_t tp_idx, const void *flush_data,               \
+                       const struct trace_end_##name *payload)                \
+   {                                                                           \
+      stage_end(pctx, ts_ns, stage, marker, payload,                           \
+                trace_payload_as_extra_end_##name);                            \
+   }
+
+PAN_STAGE_CALLBACKS(batch, BATCH_STAGE_ID, payload->reason)
+PAN_STAGE_CALLBACKS(flush, FLUSH_STAGE_ID, payload->reason)
+PAN_STAGE_CALLBACKS(fragment_job, FRAGMENT_JOB_STAGE_ID, NULL)
+PAN_STAGE_CALLBACKS(blit, BLIT_STAGE_ID, NULL)
+PAN_STAGE_CALLBACKS(afbc, AFBC_STAGE_ID, NULL)
+PAN_STAGE_CALLBACKS(compute, COMPUTE_STAGE_ID, NULL)
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,80 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_PERFETTO_H
+#define __PAN_PERFETTO_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifdef HAVE_PERFETTO
+
+/**
+ * Render-stage id's
+ */
+enum pan_stage_id {
+   BATCH_STAGE_ID,
+   FLUSH_STAGE_ID,
+   FRAGMENT_JOB_STAGE_ID,
+   BLIT_STAGE_ID,
+   AFBC_STAGE_ID,
+   COMPUTE_STAGE_ID,
+
+   PAN_NUM_STAGES
+};
+
+/* Deepest nesting of a stage within itself */
+#define PAN_PERFETTO_MAX_DEPTH 4
+
+/**
+ * Per-context state accumulated between the start and end tracepoints of a
+ * stage, the render-stage event being emitted at the end.
+ */
+struct pan_perfetto_state {
+   uint64_t start_ts[PAN_NUM_STAGES][PAN_PERFETTO_MAX_DEPTH];
+   unsigned depth[PAN_NUM_STAGES];
+
+   /* Batches of a context run in order, so a batch can't have started on the
+    * GPU before the previous one completed.
+    */
+   uint64_t last_batch_end_ts;
+
+   uint32_t submission_id;
+};
+
+struct pipe_context;
+
+void pan_perfetto_init(void);
+
+struct pan_perfetto_state *panfrost_perfetto_state(struct pipe_context *pctx);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -45,6 +45,7 @@
 #include "util/u_surface.h"
 #include "util/u_transfer.h"
 #include "util/u_transfer_helper.h"
+#include "util/u_upload_mgr.h"
 
 #include "decode.h"
 #include "pan_bo.h"
@@ -105,13 +106,17 @@ panfrost_resource_from_handle(struct pipe_screen *pscreen,
    if (!rsc)
       return NULL;
 
-   prsc = &rsc->base;
+   prsc = &rsc->base.b;
 
    *prsc = *templat;
 
    pipe_reference_init(&prsc->reference, 1);
    prsc->screen = pscreen;
 
+   threaded_resource_init(prsc, false);
+   rsc->base.is_shared = true;
+   simple_mtx_init(&rsc->index_cache_lock, mtx_plain);
+
    uint64_t mod = whandle->modifier == DRM_FORMAT_MOD_INVALID
                      ? DRM_FORMAT_MOD_LINEAR
                      : whandle->modifier;
@@ -156,7 +161,7 @@ panfrost_resource_from_handle(struct pipe_screen *pscreen,
    rsc->modifier_constant = true;
 
    BITSET_SET(rsc->valid.data, 0);
-   panfrost_resource_set_damage_region(pscreen, &rsc->base, 0, NULL);
+   panfrost_resource_set_damage_region(pscreen, &rsc->base.b, 0, NULL);
 
    if (dev->ro) {
       rsc->scanout =
@@ -167,6 +172,46 @@ panfrost_resource_from_handle(struct pipe_screen *pscreen,
    return prsc;
 }
 
+/* A suballocated buffer shares the GEM object of its slab, which must not be
+ * handed out. Move the buffer to a BO of its own before exporting it.
+ */
+static bool
+panfrost_resource_unsuballoc(struct pipe_context *pctx,
+                             struct panfrost_resource *rsrc)
+{
+   struct panfrost_bo *old = rsrc->bo;
+   size_t size = rsrc->image.layout.data_size;
+
+   if (!old->parent)
+      return true;
+
+   struct panfrost_bo *bo = panfrost_bo_create(
+      pan_device(rsrc->base.b.screen), size, PAN_BO_SHAREABLE, old->label);
+
+   if (!bo)
+      return false;
+
+   /* Pending writes must land before the contents are copied */
+   if (pctx) {
+      pctx = threaded_context_unwrap_sync(pctx);
+      panfrost_flush_writer(pan_context(pctx), rsrc, "Buffer export");
+   }
+
+   panfrost_bo_wait(old, INT64_MAX, false);
+   panfrost_bo_mmap(bo);
+   memcpy(bo->ptr.cpu, old->ptr.cpu, size);
+
+   panfrost_bo_unreference(old);
+   rsrc->bo = bo;
+   rsrc->image.data.base = bo->ptr.gpu;
+
+   /* Descriptors pointing at the old BO must be re-emitted */
+   if (pctx)
+      panfrost_dirty_state_all(pan_context(pctx));
+
+   return true;
+}
+
 static bool
 panfrost_resource_get_handle(struct pipe_screen *pscreen,
                              struct pipe_context *ctx, struct pipe_resource *pt,
@@ -189,8 +234,12 @@ panfrost_resource_get_handle(struct pipe_screen *pscreen,
    rsrc = pan_resource(cur);
    scanout = rsrc->scanout;
 
+   if (!panfrost_resource_unsuballoc(ctx, rsrc))
+      return false;
+
    handle->modifier = rsrc->image.layout.modifier;
    rsrc->modifier_constant = true;
+   rsrc->base.is_shared = true;
 
    if (handle->type == WINSYS_HANDLE_TYPE_KMS && dev->ro) {
       return renderonly_get_handle(scanout, handle);
@@ -297,8 +346,8 @@ panfrost_surface_destroy(struct pipe_context *pipe, struct pipe_surface *surf)
 static inline bool
 panfrost_is_2d(const struct panfrost_resource *pres)
 {
-   return (pres->base.target == PIPE_TEXTURE_2D) ||
-          (pres->base.target == PIPE_TEXTURE_RECT);
+   return (pres->base.b.target == PIPE_TEXTURE_2D) ||
+          (pres->base.b.target == PIPE_TEXTURE_RECT);
 }
 
 /* Based on the usage, determine if it makes sense to use u-inteleaved tiling.
@@ -319,7 +368,7 @@ panfrost_should_afbc(struct panfrost_device *dev,
       PIPE_BIND_SAMPLER_VIEW | PIPE_BIND_DISPLAY_TARGET | PIPE_BIND_SCANOUT |
       PIPE_BIND_SHARED;
 
-   if (pres->base.bind & ~valid_binding)
+   if (pres->base.b.bind & ~valid_binding)
       return false;
 
    /* AFBC support is optional */
@@ -327,11 +376,11 @@ panfrost_should_afbc(struct panfrost_device *dev,
       return false;
 
    /* AFBC<-->staging is expensive */
-   if (pres->base.usage == PIPE_USAGE_STREAM)
+   if (pres->base.b.usage == PIPE_USAGE_STREAM)
       return false;
 
    /* If constant (non-data-dependent) format is requested, don't AFBC: */
-   if (pres->base.bind & PIPE_BIND_CONST_BW)
+   if (pres->base.b.bind & PIPE_BIND_CONST_BW)
       return false;
 
    /* Only a small selection of formats are AFBC'able */
@@ -340,10 +389,10 @@ panfrost_should_afbc(struct panfrost_device *dev,
 
    /* AFBC does not support layered (GLES3 style) multisampling. Use
     * EXT_multisampled_render_to_texture instead */
-   if (pres->base.nr_samples > 1)
+   if (pres->base.b.nr_samples > 1)
       return false;
 
-   switch (pres->base.target) {
+   switch (pres->base.b.target) {
    case PIPE_TEXTURE_2D:
    case PIPE_TEXTURE_RECT:
    case PIPE_TEXTURE_2D_ARRAY:
@@ -364,7 +413,7 @@ panfrost_should_afbc(struct panfrost_device *dev,
    }
 
    /* For one tile, AFBC is a loss compared to u-interleaved */
-   if (pres->base.width0 <= 16 && pres->base.height0 <= 16)
+   if (pres->base.b.width0 <= 16 && pres->base.b.height0 <= 16)
       return false;
 
    /* Otherwise, we'd prefer AFBC as it is dramatically more efficient
@@ -381,8 +430,8 @@ static bool
 panfrost_should_tile_afbc(const struct panfrost_device *dev,
                           const struct panfrost_resource *pres)
 {
-   return panfrost_afbc_can_tile(dev->arch) && pres->base.width0 >= 128 &&
-          pres->base.height0 >= 128 && !(dev->debug & PAN_DBG_FORCE_PACK);
+   return panfrost_afbc_can_tile(dev->arch) && pres->base.b.width0 >= 128 &&
+          pres->base.b.height0 >= 128 && !(dev->debug & PAN_DBG_FORCE_PACK);
 }
 
 bool
@@ -393,12 +442,13 @@ panfrost_should_pack_afbc(struct panfrost_device *dev,
                                   PIPE_BIND_RENDER_TARGET |
                                   PIPE_BIND_SAMPLER_VIEW;
 
-   return panfrost_afbc_can_pack(prsrc->base.format) && panfrost_is_2d(prsrc) &&
+   return panfrost_afbc_can_pack(prsrc->base.b.format) &&
+          panfrost_is_2d(prsrc) &&
           drm_is_afbc(prsrc->image.layout.modifier) &&
           (prsrc->image.layout.modifier & AFBC_FORMAT_MOD_SPARSE) &&
-          (prsrc->base.bind & ~valid_binding) == 0 &&
-          !prsrc->modifier_constant && prsrc->base.width0 >= 32 &&
-          prsrc->base.height0 >= 32;
+          (prsrc->base.b.bind & ~valid_binding) == 0 &&
+          !prsrc->modifier_constant && prsrc->base.b.width0 >= 32 &&
+          prsrc->base.b.height0 >= 32;
 }
 
 static bool
@@ -415,13 +465,13 @@ panfrost_should_tile(struct panfrost_device *dev,
     * tiling does not make sense; using a linear layout instead is optimal
     * for both memory usage and performance.
     */
-   if (MIN2(pres->base.width0, pres->base.height0) < 2)
+   if (MIN2(pres->base.b.width0, pres->base.b.height0) < 2)
       return false;
 
-   bool can_tile = (pres->base.target != PIPE_BUFFER) &&
-                   ((pres->base.bind & ~valid_binding) == 0);
+   bool can_tile = (pres->base.b.target != PIPE_BUFFER) &&
+                   ((pres->base.b.bind & ~valid_binding) == 0);
 
-   return can_tile && (pres->base.usage != PIPE_USAGE_STREAM);
+   return can_tile && (pres->base.b.usage != PIPE_USAGE_STREAM);
 }
 
 static uint64_t
@@ -436,7 +486,7 @@ panfrost_best_modifier(struct panfrost_device *dev,
    if (panfrost_should_afbc(dev, pres, fmt)) {
       uint64_t afbc = AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 | AFBC_FORMAT_MOD_SPARSE;
 
-      if (panfrost_afbc_can_ytr(pres->base.format))
+      if (panfrost_afbc_can_ytr(pres->base.b.format))
          afbc |= AFBC_FORMAT_MOD_YTR;
 
       if (panfrost_should_tile_afbc(dev, pres))
@@ -453,8 +503,16 @@ static bool
 panfrost_should_checksum(const struct panfrost_device *dev,
                          const struct panfrost_resource *pres)
 {
-   /* Checksumming is disabled by default due to fundamental unsoundness */
-   if (!(dev->debug & PAN_DBG_CRC))
+   /* Checksums are only sound as long as all writes to the resource go
+    * through this screen, which can't be known for resources shared with
+    * other APIs or processes.
+    */
+   if (pres->base.b.bind & PAN_BIND_SHARED_MASK)
+      return false;
+
+   /* Even then, applications opt in through driconf */
+   if (!(dev->debug & PAN_DBG_CRC) &&
+       !pan_screen(pres->base.b.screen)->driconf.transaction_elimination)
       return false;
 
    /* When checksumming is enabled, the tile data must fit in the
@@ -463,11 +521,12 @@ panfrost_should_checksum(const struct panfrost_device *dev,
 
    unsigned bytes_per_pixel_max = (dev->arch == 6) ? 6 : 4;
 
-   unsigned bytes_per_pixel = MAX2(pres->base.nr_samples, 1) *
-                              util_format_get_blocksize(pres->base.format);
+   unsigned bytes_per_pixel = MAX2(pres->base.b.nr_samples, 1) *
+                              util_format_get_blocksize(pres->base.b.format);
 
-   return pres->base.bind & PIPE_BIND_RENDER_TARGET && panfrost_is_2d(pres) &&
-          bytes_per_pixel <= bytes_per_pixel_max && pres->base.last_level == 0;
+   return pres->base.b.bind & PIPE_BIND_RENDER_TARGET && panfrost_is_2d(pres) &&
+          bytes_per_pixel <= bytes_per_pixel_max &&
+          pres->base.b.last_level == 0;
 }
 
 static void
@@ -479,7 +538,7 @@ panfrost_resource_setup(struct panfrost_device *dev,
                             ? modifier
                             : panfrost_best_modifier(dev, pres, fmt);
    enum mali_texture_dimension dim =
-      panfrost_translate_texture_dimension(pres->base.target);
+      panfrost_translate_texture_dimension(pres->base.b.target);
 
    /* We can only switch tiled->linear if the resource isn't already
     * linear and if we control the modifier */
@@ -496,29 +555,43 @@ panfrost_resource_setup(struct panfrost_device *dev,
       .modifier = chosen_mod,
       .format = fmt,
       .dim = dim,
-      .width = pres->base.width0,
-      .height = pres->base.height0,
-      .depth = pres->base.depth0,
-      .array_size = pres->base.array_size,
-      .nr_samples = MAX2(pres->base.nr_samples, 1),
-      .nr_slices = pres->base.last_level + 1,
+      .width = pres->base.b.width0,
+      .height = pres->base.b.height0,
+      .depth = pres->base.b.depth0,
+      .array_size = pres->base.b.array_size,
+      .nr_samples = MAX2(pres->base.b.nr_samples, 1),
+      .nr_slices = pres->base.b.last_level + 1,
       .crc = panfrost_should_checksum(dev, pres),
    };
 
+   /* The checksums of the new layout are uninitialized */
+   pan_crc_invalidate_all(&pres->valid.crc);
+
    ASSERTED bool valid =
       pan_image_layout_init(dev->arch, &pres->image.layout, NULL);
    assert(valid);
 }
 
+static void
+panfrost_afbc_pack_invalidate(struct panfrost_resource *rsrc)
+{
+   if (rsrc->afbc_pack.metadata) {
+      panfrost_bo_unreference(rsrc->afbc_pack.metadata);
+      rsrc->afbc_pack.metadata = NULL;
+   }
+
+   rsrc->afbc_pack.pending = false;
+}
+
 static void
 panfrost_resource_init_afbc_headers(struct panfrost_resource *pres)
 {
    panfrost_bo_mmap(pres->bo);
 
-   unsigned nr_samples = MAX2(pres->base.nr_samples, 1);
+   unsigned nr_samples = MAX2(pres->base.b.nr_samples, 1);
 
-   for (unsigned i = 0; i < pres->base.array_size; ++i) {
-      for (unsigned l = 0; l <= pres->base.last_level; ++l) {
+   for (unsigned i = 0; i < pres->base.b.array_size; ++i) {
+      for (unsigned l = 0; l <= pres->base.b.last_level; ++l) {
          struct pan_image_slice_layout *slice = &pres->image.layout.slices[l];
 
          for (unsigned s = 0; s < nr_samples; ++s) {
@@ -637,12 +710,12 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
    struct panfrost_device *dev = pan_device(screen);
 
    struct panfrost_resource *so = CALLOC_STRUCT(panfrost_resource);
-   so->base = *template;
-   so->base.screen = screen;
+   so->base.b = *template;
+   so->base.b.screen = screen;
 
-   pipe_reference_init(&so->base.reference, 1);
+   pipe_reference_init(&so->base.b.reference, 1);
 
-   util_range_init(&so->valid_buffer_range);
+   threaded_resource_init(&so->base.b, false);
 
    if (template->bind & PAN_BIND_SHARED_MASK) {
       /* For compatibility with older consumers that may not be
@@ -712,7 +785,7 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
       unsigned effective_rows = DIV_ROUND_UP(size, stride);
 
       struct pipe_resource scanout_tmpl = {
-         .target = so->base.target,
+         .target = so->base.b.target,
          .format = template->format,
          .width0 = width,
          .height0 = effective_rows,
@@ -742,9 +815,19 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
        * care to map e.g. FBOs which the CPU probably won't touch */
       uint32_t flags = PAN_BO_DELAY_MMAP;
 
-      /* If the resource is never exported, we can make the BO private. */
-      if (template->bind & PIPE_BIND_SHARED)
+      /* If the resource is never exported, we can make the BO private.
+       * Buffers exported without PIPE_BIND_SHARED are moved out of their
+       * slab at export time.
+       *
+       * Busy checks and waits apply to the whole slab, so buffers that are
+       * likely to be mapped while the GPU uses them get their own BO.
+       */
+      if (template->bind & (PIPE_BIND_SHARED | PIPE_BIND_SCANOUT))
          flags |= PAN_BO_SHAREABLE;
+      else if (template->target == PIPE_BUFFER &&
+               template->usage != PIPE_USAGE_STREAM &&
+               template->usage != PIPE_USAGE_DYNAMIC)
+         flags |= PAN_BO_SUBALLOC;
 
       so->bo =
          panfrost_bo_create(dev, so->image.layout.data_size, flags, label);
@@ -756,11 +839,18 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
    if (drm_is_afbc(so->image.layout.modifier))
       panfrost_resource_init_afbc_headers(so);
 
-   panfrost_resource_set_damage_region(screen, &so->base, 0, NULL);
+   panfrost_resource_set_damage_region(screen, &so->base.b, 0, NULL);
 
    if (template->bind & PIPE_BIND_INDEX_BUFFER)
       so->index_cache = CALLOC_STRUCT(panfrost_minmax_cache);
 
+   simple_mtx_init(&so->index_cache_lock, mtx_plain);
+
+   if (template->target == PIPE_BUFFER) {
+      so->base.buffer_id_unique =
+         util_idalloc_mt_alloc(&pan_screen(screen)->buffer_ids);
+   }
+
    return (struct pipe_resource *)so;
 }
 
@@ -806,10 +896,19 @@ panfrost_resource_destroy(struct pipe_screen *screen, struct pipe_resource *pt)
    if (rsrc->bo)
       panfrost_bo_unreference(rsrc->bo);
 
+   if (rsrc->afbc_pack.metadata)
+      panfrost_bo_unreference(rsrc->afbc_pack.metadata);
+
+   panfrost_minmax_cache_fini(rsrc->index_cache);
    free(rsrc->index_cache);
+   simple_mtx_destroy(&rsrc->index_cache_lock);
    free(rsrc->damage.tile_map.data);
 
-   util_range_destroy(&rsrc->valid_buffer_range);
+   if (rsrc->base.buffer_id_unique)
+      util_idalloc_mt_free(&pan_screen(screen)->buffer_ids,
+                           rsrc->base.buffer_id_unique);
+
+   threaded_resource_deinit(pt);
    free(rsrc);
 }
 
@@ -822,7 +921,7 @@ pan_alloc_staging(struct panfrost_context *ctx, struct panfrost_resource *rsc,
                   unsigned level, const struct pipe_box *box)
 {
    struct pipe_context *pctx = &ctx->base;
-   struct pipe_resource tmpl = rsc->base;
+   struct pipe_resource tmpl = rsc->base.b;
 
    tmpl.width0 = box->width;
    tmpl.height0 = box->height;
@@ -850,17 +949,112 @@ pan_alloc_staging(struct panfrost_context *ctx, struct panfrost_resource *rsc,
    return pan_resource(pstaging);
 }
 
+static bool
+panfrost_box_covers_resource(const struct pipe_resource *resource,
+                             const struct pipe_box *box)
+{
+   return resource->last_level == 0 &&
+          util_texrange_covers_whole_level(resource, 0, box->x, box->y, box->z,
+                                           box->width, box->height, box->depth);
+}
+
+static bool
+panfrost_can_discard(struct pipe_resource *resource, const struct pipe_box *box,
+                     unsigned usage)
+{
+   struct panfrost_resource *rsrc = pan_resource(resource);
+
+   return ((usage & PIPE_MAP_DISCARD_RANGE) &&
+           !(usage & PIPE_MAP_UNSYNCHRONIZED) &&
+           !(resource->flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT) &&
+           panfrost_box_covers_resource(resource, box) &&
+           !(rsrc->bo->flags & PAN_BO_SHARED));
+}
+
+/* Writes to a busy tiled resource are staged in a linear streaming texture,
+ * and tiled by the GPU at unmap time. Staging textures come from the BO cache,
+ * which only hands back BOs the GPU is done with. */
+
+static bool
+pan_can_stream_tiled_write(struct panfrost_context *ctx,
+                           struct panfrost_resource *rsrc,
+                           const struct pipe_box *box, unsigned usage)
+{
+   struct pipe_screen *pscreen = ctx->base.screen;
+   struct pipe_resource *prsrc = &rsrc->base.b;
+
+   if (rsrc->image.layout.modifier !=
+       DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED)
+      return false;
+
+   /* Only blind writes, the rest needs the current contents */
+   if ((usage & (PIPE_MAP_WRITE | PIPE_MAP_READ)) != PIPE_MAP_WRITE ||
+       (usage & (PIPE_MAP_UNSYNCHRONIZED | PIPE_MAP_PERSISTENT |
+                 PIPE_MAP_COHERENT | PIPE_MAP_DISCARD_WHOLE_RESOURCE)) ||
+       (prsrc->flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT))
+      return false;
+
+   /* Discarding the whole resource just swaps in a fresh BO, tiling on the CPU
+    * is cheaper than a blit then */
+   if (panfrost_can_discard(prsrc, box, usage))
+      return false;
+
+   /* The GPU copy is a blit, so we need to be able to render to it */
+   if (box->depth != 1 || prsrc->nr_samples > 1 ||
+       util_format_is_depth_or_stencil(prsrc->format) ||
+       !pscreen->is_format_supported(pscreen, prsrc->format, prsrc->target, 0,
+                                     0, PIPE_BIND_RENDER_TARGET))
+      return false;
+
+   /* Idle resources are cheaper to tile on the CPU */
+   return panfrost_any_batch_reads_rsrc(ctx, rsrc) ||
+          !panfrost_bo_wait(rsrc->bo, 0, true);
+}
+
+static struct panfrost_resource *
+pan_alloc_streaming_staging(struct panfrost_context *ctx,
+                            struct panfrost_resource *rsc,
+                            const struct pipe_box *box, void **cpu)
+{
+   struct pipe_screen *pscreen = ctx->base.screen;
+   struct pipe_resource tmpl = {
+      .target = PIPE_TEXTURE_2D,
+      .format = rsc->base.b.format,
+      .width0 = box->width,
+      .height0 = box->height,
+      .depth0 = 1,
+      .array_size = 1,
+      .usage = PIPE_USAGE_STREAM,
+      .bind = PIPE_BIND_SAMPLER_VIEW | PIPE_BIND_LINEAR,
+   };
+
+   struct pipe_resource *pstaging = pscreen->resource_create(pscreen, &tmpl);
+   if (!pstaging)
+      return NULL;
+
+   struct panfrost_resource *so = pan_resource(pstaging);
+
+   panfrost_bo_mmap(so->bo);
+   if (!so->bo->ptr.cpu) {
+      pipe_resource_reference(&pstaging, NULL);
+      return NULL;
+   }
+
+   *cpu = so->bo->ptr.cpu;
+   return so;
+}
+
 static void
 pan_blit_from_staging(struct pipe_context *pctx,
                       struct panfrost_transfer *trans)
 {
-   struct pipe_resource *dst = trans->base.resource;
+   struct pipe_resource *dst = trans->base.b.resource;
    struct pipe_blit_info blit = {0};
 
    blit.dst.resource = dst;
    blit.dst.format = dst->format;
-   blit.dst.level = trans->base.level;
-   blit.dst.box = trans->base.box;
+   blit.dst.level = trans->base.b.level;
+   blit.dst.box = trans->base.b.box;
    blit.src.resource = trans->staging.rsrc;
    blit.src.format = trans->staging.rsrc->format;
    blit.src.level = 0;
@@ -874,13 +1068,13 @@ pan_blit_from_staging(struct pipe_context *pctx,
 static void
 pan_blit_to_staging(struct pipe_context *pctx, struct panfrost_transfer *trans)
 {
-   struct pipe_resource *src = trans->base.resource;
+   struct pipe_resource *src = trans->base.b.resource;
    struct pipe_blit_info blit = {0};
 
    blit.src.resource = src;
    blit.src.format = src->format;
-   blit.src.level = trans->base.level;
-   blit.src.box = trans->base.box;
+   blit.src.level = trans->base.b.level;
+   blit.src.box = trans->base.b.box;
    blit.dst.resource = trans->staging.rsrc;
    blit.dst.format = trans->staging.rsrc->format;
    blit.dst.level = 0;
@@ -895,7 +1089,7 @@ static void
 panfrost_load_tiled_images(struct panfrost_transfer *transfer,
                            struct panfrost_resource *rsrc)
 {
-   struct pipe_transfer *ptrans = &transfer->base;
+   struct pipe_transfer *ptrans = &transfer->base.b;
    unsigned level = ptrans->level;
 
    /* If the requested level of the image is uninitialized, it's not
@@ -989,7 +1183,7 @@ void
 pan_dump_resource(struct panfrost_context *ctx, struct panfrost_resource *rsc)
 {
    struct pipe_context *pctx = &ctx->base;
-   struct pipe_resource tmpl = rsc->base;
+   struct pipe_resource tmpl = rsc->base.b;
    struct pipe_resource *plinear = NULL;
    struct panfrost_resource *linear = rsc;
    struct pipe_blit_info blit = {0};
@@ -1053,7 +1247,7 @@ panfrost_store_tiled_images(struct panfrost_transfer *transfer,
                             struct panfrost_resource *rsrc)
 {
    struct panfrost_bo *bo = rsrc->bo;
-   struct pipe_transfer *ptrans = &transfer->base;
+   struct pipe_transfer *ptrans = &transfer->base.b;
    unsigned level = ptrans->level;
    unsigned stride = panfrost_get_layer_stride(&rsrc->image.layout, level);
 
@@ -1072,26 +1266,134 @@ panfrost_store_tiled_images(struct panfrost_transfer *transfer,
    }
 }
 
-static bool
-panfrost_box_covers_resource(const struct pipe_resource *resource,
-                             const struct pipe_box *box)
+/* Superblocks of an AFBC transfer accessed by the CPU */
+static void
+pan_afbc_transfer_superblocks(const struct pipe_box *box, unsigned *sx0,
+                              unsigned *sy0, unsigned *sx1, unsigned *sy1)
 {
-   return resource->last_level == 0 &&
-          util_texrange_covers_whole_level(resource, 0, box->x, box->y, box->z,
-                                           box->width, box->height, box->depth);
+   *sx0 = box->x / 16;
+   *sy0 = box->y / 16;
+   *sx1 = DIV_ROUND_UP(box->x + box->width, 16);
+   *sy1 = DIV_ROUND_UP(box->y + box->height, 16);
 }
 
-static bool
-panfrost_can_discard(struct pipe_resource *resource, const struct pipe_box *box,
-                     unsigned usage)
+static struct pan_afbc_surface
+pan_afbc_transfer_surface(struct panfrost_device *dev,
+                          struct panfrost_resource *rsrc,
+                          const struct pipe_transfer *transfer)
 {
-   struct panfrost_resource *rsrc = pan_resource(resource);
+   struct pan_afbc_surface surf;
+   const struct pan_image_layout *layout = &rsrc->image.layout;
+
+   pan_afbc_surface_init(&surf, dev->arch, layout, transfer->level,
+                         rsrc->bo->ptr.cpu +
+                            layout->slices[transfer->level].offset +
+                            (transfer->box.z * layout->array_stride));
+   return surf;
+}
 
-   return ((usage & PIPE_MAP_DISCARD_RANGE) &&
-           !(usage & PIPE_MAP_UNSYNCHRONIZED) &&
-           !(resource->flags & PIPE_RESOURCE_FLAG_MAP_PERSISTENT) &&
-           panfrost_box_covers_resource(resource, box) &&
-           !(rsrc->bo->flags & PAN_BO_SHARED));
+/* Small updates of sparse AFBC resources can be served by the CPU, as long as
+ * the superblocks to be read back are solid colour or uncompressed, which is
+ * the case for freshly created resources and anything written that way. This
+ * saves the staging blit and the wait that comes with it. Whole-level
+ * uploads keep going through the GPU to get compressed.
+ *
+ * Returns NULL if the CPU can't be used.
+ */
+static void *
+pan_afbc_cpu_map(struct panfrost_context *ctx,
+                 struct panfrost_transfer *transfer)
+{
+   struct panfrost_device *dev = pan_device(ctx->base.screen);
+   struct pipe_transfer *ptrans = &transfer->base.b;
+   struct panfrost_resource *rsrc = pan_resource(ptrans->resource);
+   const struct pipe_box *box = &ptrans->box;
+   unsigned usage = ptrans->usage;
+   unsigned unsupported_usage =
+      PIPE_MAP_UNSYNCHRONIZED | PIPE_MAP_PERSISTENT | PIPE_MAP_COHERENT;
+
+   if (!pan_afbc_can_access_cpu(dev->arch, rsrc->image.layout.modifier,
+                                rsrc->image.layout.format) ||
+       rsrc->base.b.target == PIPE_TEXTURE_3D || rsrc->base.b.nr_samples > 1 ||
+       box->depth != 1 || (usage & unsupported_usage))
+      return NULL;
+
+   if ((usage & PIPE_MAP_WRITE) &&
+       util_texrange_covers_whole_level(&rsrc->base.b, ptrans->level, box->x,
+                                        box->y, box->z, box->width,
+                                        box->height, box->depth))
+      return NULL;
+
+   /* Waiting for the GPU would be worse than a pipelined staging blit */
+   if (panfrost_any_batch_reads_rsrc(ctx, rsrc) ||
+       panfrost_any_batch_writes_rsrc(ctx, rsrc) ||
+       !panfrost_bo_wait(rsrc->bo, 0, true))
+      return NULL;
+
+   panfrost_bo_mmap(rsrc->bo);
+
+   struct pan_afbc_surface surf = pan_afbc_transfer_surface(dev, rsrc, ptrans);
+   unsigned sx0, sy0, sx1, sy1;
+   pan_afbc_transfer_superblocks(box, &sx0, &sy0, &sx1, &sy1);
+
+   /* Superblocks only partially overwritten need to be read back too */
+   for (unsigned sy = sy0; sy < sy1; ++sy) {
+      for (unsigned sx = sx0; sx < sx1; ++sx) {
+         bool partial = (sx * 16) < box->x || (sy * 16) < box->y ||
+                        ((sx + 1) * 16) > (box->x + box->width) ||
+                        ((sy + 1) * 16) > (box->y + box->height);
+
+         if (((usage & PIPE_MAP_READ) || partial) &&
+             !pan_afbc_superblock_is_decodable(&surf, sx, sy)) {
+            perf_debug(dev, "AFBC map of compressed superblocks, using a "
+                            "staging blit");
+            return NULL;
+         }
+      }
+   }
+
+   /* The CPU copy covers whole superblocks */
+   unsigned stride = (sx1 - sx0) * 16 * surf.bpp;
+
+   ptrans->stride = stride;
+   ptrans->layer_stride = stride * (sy1 - sy0) * 16;
+   transfer->map = ralloc_size(transfer, ptrans->layer_stride);
+
+   for (unsigned sy = sy0; sy < sy1; ++sy) {
+      for (unsigned sx = sx0; sx < sx1; ++sx) {
+         uint8_t *dst = transfer->map + ((sy - sy0) * 16 * stride) +
+                        ((sx - sx0) * 16 * surf.bpp);
+
+         if (pan_afbc_superblock_is_decodable(&surf, sx, sy))
+            pan_afbc_decode_superblock(&surf, sx, sy, dst, stride);
+      }
+   }
+
+   return transfer->map + ((box->y - (sy0 * 16)) * stride) +
+          ((box->x - (sx0 * 16)) * surf.bpp);
+}
+
+static void
+pan_afbc_cpu_unmap(struct panfrost_context *ctx,
+                   struct panfrost_transfer *transfer)
+{
+   struct panfrost_device *dev = pan_device(ctx->base.screen);
+   struct pipe_transfer *ptrans = &transfer->base.b;
+   struct panfrost_resource *rsrc = pan_resource(ptrans->resource);
+   struct pan_afbc_surface surf = pan_afbc_transfer_surface(dev, rsrc, ptrans);
+   unsigned sx0, sy0, sx1, sy1;
+
+   pan_afbc_transfer_superblocks(&ptrans->box, &sx0, &sy0, &sx1, &sy1);
+
+   for (unsigned sy = sy0; sy < sy1; ++sy) {
+      for (unsigned sx = sx0; sx < sx1; ++sx) {
+         const uint8_t *src = transfer->map +
+                              ((sy - sy0) * 16 * ptrans->stride) +
+                              ((sx - sx0) * 16 * surf.bpp);
+
+         pan_afbc_encode_superblock(&surf, sx, sy, src, ptrans->stride);
+      }
+   }
 }
 
 static void *
@@ -1113,19 +1415,31 @@ panfrost_ptr_map(struct pipe_context *pctx, struct pipe_resource *resource,
        rsrc->image.layout.modifier != DRM_FORMAT_MOD_LINEAR)
       return NULL;
 
-   struct panfrost_transfer *transfer = rzalloc(pctx, struct panfrost_transfer);
-   transfer->base.level = level;
-   transfer->base.usage = usage;
-   transfer->base.box = *box;
+   /* With a threaded context, unsynchronized maps are performed from the
+    * application thread, so the transfer must not be parented to the context.
+    */
+   struct panfrost_transfer *transfer = rzalloc(NULL, struct panfrost_transfer);
+   transfer->base.b.level = level;
+   transfer->base.b.usage = usage;
+   transfer->base.b.box = *box;
 
-   pipe_resource_reference(&transfer->base.resource, resource);
-   *out_transfer = &transfer->base;
+   pipe_resource_reference(&transfer->base.b.resource, resource);
+   *out_transfer = &transfer->base.b;
 
    if (usage & PIPE_MAP_WRITE)
       rsrc->constant_stencil = false;
 
-   /* We don't have s/w routines for AFBC, so use a staging texture */
+   /* Persistent mappings can be written at any time */
+   if ((usage & PIPE_MAP_WRITE) && (usage & PIPE_MAP_PERSISTENT))
+      pan_crc_invalidate_all(&rsrc->valid.crc);
+
    if (drm_is_afbc(rsrc->image.layout.modifier)) {
+      void *map = pan_afbc_cpu_map(ctx, transfer);
+
+      if (map)
+         return map;
+
+      /* Otherwise, use a staging texture and let the GPU (de)compress */
       struct panfrost_resource *staging =
          pan_alloc_staging(ctx, rsrc, level, box);
       assert(staging);
@@ -1133,11 +1447,11 @@ panfrost_ptr_map(struct pipe_context *pctx, struct pipe_resource *resource,
       /* Staging resources have one LOD: level 0. Query the strides
        * on this LOD.
        */
-      transfer->base.stride = staging->image.layout.slices[0].row_stride;
-      transfer->base.layer_stride =
+      transfer->base.b.stride = staging->image.layout.slices[0].row_stride;
+      transfer->base.b.layer_stride =
          panfrost_get_layer_stride(&staging->image.layout, 0);
 
-      transfer->staging.rsrc = &staging->base;
+      transfer->staging.rsrc = &staging->base.b;
 
       transfer->staging.box = *box;
       transfer->staging.box.x = 0;
@@ -1159,17 +1473,43 @@ panfrost_ptr_map(struct pipe_context *pctx, struct pipe_resource *resource,
       return staging->bo->ptr.cpu;
    }
 
+   if (pan_can_stream_tiled_write(ctx, rsrc, box, usage)) {
+      void *cpu;
+      struct panfrost_resource *staging =
+         pan_alloc_streaming_staging(ctx, rsrc, box, &cpu);
+
+      if (staging) {
+         perf_debug(dev, "Deferring write to a busy tiled resource");
+
+         transfer->base.b.stride = staging->image.layout.slices[0].row_stride;
+         transfer->base.b.layer_stride =
+            panfrost_get_layer_stride(&staging->image.layout, 0);
+
+         transfer->staging.rsrc = &staging->base.b;
+         transfer->staging.box = *box;
+         transfer->staging.box.x = 0;
+         transfer->staging.box.y = 0;
+         transfer->staging.box.z = 0;
+
+         return cpu;
+      }
+   }
+
    /* If we haven't already mmaped, now's the time */
    panfrost_bo_mmap(bo);
 
-   if (dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC)) {
+   /* Slabs are always mapped, and already known to pandecode */
+   if ((dev->debug & (PAN_DBG_TRACE | PAN_DBG_SYNC)) && !bo->parent) {
       pandecode_inject_mmap(dev->decode_ctx, bo->ptr.gpu, bo->ptr.cpu,
                             panfrost_bo_size(bo), NULL);
    }
 
-   /* Upgrade writes to uninitialized ranges to UNSYNCHRONIZED */
+   /* Upgrade writes to uninitialized ranges to UNSYNCHRONIZED, unless the
+    * threaded context already did the tracking for us.
+    */
    if ((usage & PIPE_MAP_WRITE) && resource->target == PIPE_BUFFER &&
-       !util_ranges_intersect(&rsrc->valid_buffer_range, box->x,
+       !(usage & TC_TRANSFER_MAP_NO_INFER_UNSYNCHRONIZED) &&
+       !util_ranges_intersect(&rsrc->base.valid_buffer_range, box->x,
                               box->x + box->width)) {
 
       usage |= PIPE_MAP_UNSYNCHRONIZED;
@@ -1245,8 +1585,13 @@ panfrost_ptr_map(struct pipe_context *pctx, struct pipe_resource *resource,
             rsrc->bo = newbo;
             rsrc->image.data.base = newbo->ptr.gpu;
 
-            if (!copy_resource && drm_is_afbc(rsrc->image.layout.modifier))
+            if (!copy_resource)
+               pan_crc_invalidate_all(&rsrc->valid.crc);
+
+            if (!copy_resource && drm_is_afbc(rsrc->image.layout.modifier)) {
                panfrost_resource_init_afbc_headers(rsrc);
+               panfrost_afbc_pack_invalidate(rsrc);
+            }
 
             bo = newbo;
          } else {
@@ -1278,10 +1623,11 @@ panfrost_ptr_map(struct pipe_context *pctx, struct pipe_resource *resource,
 
    if (rsrc->image.layout.modifier ==
        DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED) {
-      transfer->base.stride = box_blocks.width * bytes_per_block;
-      transfer->base.layer_stride = transfer->base.stride * box_blocks.height;
+      transfer->base.b.stride = box_blocks.width * bytes_per_block;
+      transfer->base.b.layer_stride =
+         transfer->base.b.stride * box_blocks.height;
       transfer->map =
-         ralloc_size(transfer, transfer->base.layer_stride * box->depth);
+         ralloc_size(transfer, transfer->base.b.layer_stride * box->depth);
 
       if (usage & PIPE_MAP_READ)
          panfrost_load_tiled_images(transfer, rsrc);
@@ -1299,8 +1645,8 @@ panfrost_ptr_map(struct pipe_context *pctx, struct pipe_resource *resource,
       if ((usage & dpw) == dpw && rsrc->index_cache)
          return NULL;
 
-      transfer->base.stride = rsrc->image.layout.slices[level].row_stride;
-      transfer->base.layer_stride =
+      transfer->base.b.stride = rsrc->image.layout.slices[level].row_stride;
+      transfer->base.b.layer_stride =
          panfrost_get_layer_stride(&rsrc->image.layout, level);
 
       /* By mapping direct-write, we're implicitly already
@@ -1308,11 +1654,13 @@ panfrost_ptr_map(struct pipe_context *pctx, struct pipe_resource *resource,
 
       if (usage & PIPE_MAP_WRITE) {
          BITSET_SET(rsrc->valid.data, level);
-         panfrost_minmax_cache_invalidate(rsrc->index_cache, &transfer->base);
+         simple_mtx_lock(&rsrc->index_cache_lock);
+         panfrost_minmax_cache_invalidate(rsrc->index_cache, &transfer->base.b);
+         simple_mtx_unlock(&rsrc->index_cache_lock);
       }
 
       return bo->ptr.cpu + rsrc->image.layout.slices[level].offset +
-             box->z * transfer->base.layer_stride +
+             box->z * transfer->base.b.layer_stride +
              box_blocks.y * rsrc->image.layout.slices[level].row_stride +
              box_blocks.x * bytes_per_block;
    }
@@ -1325,30 +1673,33 @@ pan_resource_modifier_convert(struct panfrost_context *ctx,
 {
    assert(!rsrc->modifier_constant);
 
+   /* The contents get recompressed, superblock sizes are lost */
+   panfrost_afbc_pack_invalidate(rsrc);
+
    struct pipe_resource *tmp_prsrc = panfrost_resource_create_with_modifier(
-      ctx->base.screen, &rsrc->base, modifier);
+      ctx->base.screen, &rsrc->base.b, modifier);
    struct panfrost_resource *tmp_rsrc = pan_resource(tmp_prsrc);
 
    if (copy_resource) {
       struct pipe_blit_info blit = {
-         .dst.resource = &tmp_rsrc->base,
-         .dst.format = tmp_rsrc->base.format,
-         .src.resource = &rsrc->base,
-         .src.format = rsrc->base.format,
-         .mask = util_format_get_mask(tmp_rsrc->base.format),
+         .dst.resource = &tmp_rsrc->base.b,
+         .dst.format = tmp_rsrc->base.b.format,
+         .src.resource = &rsrc->base.b,
+         .src.format = rsrc->base.b.format,
+         .mask = util_format_get_mask(tmp_rsrc->base.b.format),
          .filter = PIPE_TEX_FILTER_NEAREST,
       };
 
       /* data_valid is not valid until flushed */
       panfrost_flush_writer(ctx, rsrc, "AFBC decompressing blit");
 
-      for (int i = 0; i <= rsrc->base.last_level; i++) {
+      for (int i = 0; i <= rsrc->base.b.last_level; i++) {
          if (BITSET_TEST(rsrc->valid.data, i)) {
             blit.dst.level = blit.src.level = i;
 
-            u_box_3d(0, 0, 0, u_minify(rsrc->base.width0, i),
-                     u_minify(rsrc->base.height0, i),
-                     util_num_layers(&rsrc->base, i), &blit.dst.box);
+            u_box_3d(0, 0, 0, u_minify(rsrc->base.b.width0, i),
+                     u_minify(rsrc->base.b.height0, i),
+                     util_num_layers(&rsrc->base.b, i), &blit.dst.box);
             blit.src.box = blit.dst.box;
 
             panfrost_blit_no_afbc_legalization(&ctx->base, &blit);
@@ -1368,7 +1719,7 @@ pan_resource_modifier_convert(struct panfrost_context *ctx,
    panfrost_bo_reference(rsrc->bo);
 
    panfrost_resource_setup(pan_device(ctx->base.screen), rsrc, modifier,
-                           tmp_rsrc->base.format);
+                           tmp_rsrc->base.b.format);
    /* panfrost_resource_setup will force the modifier to stay constant when
     * called with a specific modifier. We don't want that here, we want to
     * be able to convert back to another modifier if needed */
@@ -1390,7 +1741,7 @@ pan_legalize_afbc_format(struct panfrost_context *ctx,
    if (!drm_is_afbc(rsrc->image.layout.modifier))
       return;
 
-   if (panfrost_afbc_format(dev->arch, rsrc->base.format) !=
+   if (panfrost_afbc_format(dev->arch, rsrc->base.b.format) !=
        panfrost_afbc_format(dev->arch, format)) {
       pan_resource_modifier_convert(
          ctx, rsrc, DRM_FORMAT_MOD_ARM_16X16_BLOCK_U_INTERLEAVED, !discard,
@@ -1424,9 +1775,9 @@ panfrost_should_linear_convert(struct panfrost_device *dev,
     */
 
    bool entire_overwrite = panfrost_is_2d(prsrc) &&
-                           prsrc->base.last_level == 0 &&
-                           transfer->box.width == prsrc->base.width0 &&
-                           transfer->box.height == prsrc->base.height0 &&
+                           prsrc->base.b.last_level == 0 &&
+                           transfer->box.width == prsrc->base.b.width0 &&
+                           transfer->box.height == prsrc->base.b.height0 &&
                            transfer->box.x == 0 && transfer->box.y == 0;
 
    if (entire_overwrite)
@@ -1440,93 +1791,189 @@ panfrost_should_linear_convert(struct panfrost_device *dev,
    }
 }
 
-struct panfrost_bo *
-panfrost_get_afbc_superblock_sizes(struct panfrost_context *ctx,
-                                   struct panfrost_resource *rsrc,
-                                   unsigned first_level, unsigned last_level,
-                                   unsigned *out_offsets)
+static void
+panfrost_afbc_superblock_rect(uint64_t modifier, unsigned width,
+                              unsigned height, struct pipe_scissor_state *rect)
+{
+   rect->minx = rect->miny = 0;
+   rect->maxx = DIV_ROUND_UP(width, panfrost_afbc_superblock_width(modifier));
+   rect->maxy = DIV_ROUND_UP(height, panfrost_afbc_superblock_height(modifier));
+}
+
+/* Record that the pixels [minx, maxx) x [miny, maxy) of a level were written,
+ * so the size of the superblocks covering them must be recomputed before the
+ * next pack */
+
+void
+panfrost_afbc_add_damage(struct panfrost_resource *rsrc, unsigned level,
+                         unsigned minx, unsigned miny, unsigned maxx,
+                         unsigned maxy)
+{
+   uint64_t modifier = rsrc->image.layout.modifier;
+
+   if (!rsrc->afbc_pack.metadata || minx >= maxx || miny >= maxy)
+      return;
+
+   /* Only sparse layouts can be written to. Anything else means the resource
+    * was replaced without going through us, so forget what we know. */
+   if (modifier != rsrc->afbc_pack.sparse_modifier) {
+      panfrost_afbc_pack_invalidate(rsrc);
+      return;
+   }
+
+   struct pipe_scissor_state level_rect;
+   panfrost_afbc_superblock_rect(modifier, u_minify(rsrc->base.b.width0, level),
+                                 u_minify(rsrc->base.b.height0, level),
+                                 &level_rect);
+
+   unsigned sb_width = panfrost_afbc_superblock_width(modifier);
+   unsigned sb_height = panfrost_afbc_superblock_height(modifier);
+   struct pipe_scissor_state *damage = &rsrc->afbc_pack.damage[level];
+   struct pipe_scissor_state rect = {
+      .minx = minx / sb_width,
+      .miny = miny / sb_height,
+      .maxx = MIN2(DIV_ROUND_UP(maxx, sb_width), level_rect.maxx),
+      .maxy = MIN2(DIV_ROUND_UP(maxy, sb_height), level_rect.maxy),
+   };
+
+   if (damage->minx >= damage->maxx || damage->miny >= damage->maxy) {
+      *damage = rect;
+   } else {
+      damage->minx = MIN2(damage->minx, rect.minx);
+      damage->miny = MIN2(damage->miny, rect.miny);
+      damage->maxx = MAX2(damage->maxx, rect.maxx);
+      damage->maxy = MAX2(damage->maxy, rect.maxy);
+   }
+
+   /* Offsets in flight don't describe the contents anymore */
+   rsrc->afbc_pack.pending = false;
+}
+
+/* Compute the superblock sizes of the damaged regions and the packed offsets
+ * of all superblocks on the GPU. Nothing is waited on: the resource is packed
+ * by panfrost_pack_afbc_pending() once the results have landed. */
+
+static void
+panfrost_afbc_compute_offsets(struct panfrost_context *ctx,
+                              struct panfrost_resource *rsrc)
 {
    struct panfrost_screen *screen = pan_screen(ctx->base.screen);
    struct panfrost_device *dev = pan_device(ctx->base.screen);
+   uint64_t modifier = rsrc->image.layout.modifier;
+   unsigned last_level = rsrc->base.b.last_level;
    struct panfrost_batch *batch;
-   struct panfrost_bo *bo;
-   unsigned metadata_size = 0;
-
-   for (int level = first_level; level <= last_level; ++level) {
-      struct pan_image_slice_layout *slice = &rsrc->image.layout.slices[level];
-      unsigned sz = slice->afbc.nr_blocks * sizeof(struct pan_afbc_block_info);
-      out_offsets[level - first_level] = metadata_size;
-      metadata_size += sz;
+
+   if (rsrc->afbc_pack.metadata &&
+       rsrc->afbc_pack.sparse_modifier != modifier)
+      panfrost_afbc_pack_invalidate(rsrc);
+
+   if (!rsrc->afbc_pack.metadata) {
+      /* The packed body size of each level goes first */
+      unsigned metadata_size = MAX_MIP_LEVELS * sizeof(uint32_t);
+
+      for (unsigned level = 0; level <= last_level; ++level) {
+         struct pan_image_slice_layout *slice =
+            &rsrc->image.layout.slices[level];
+         struct pipe_scissor_state *damage = &rsrc->afbc_pack.damage[level];
+
+         panfrost_afbc_superblock_rect(
+            modifier, u_minify(rsrc->base.b.width0, level),
+            u_minify(rsrc->base.b.height0, level), damage);
+
+         rsrc->afbc_pack.blocks_offset[level] = metadata_size;
+         metadata_size +=
+            slice->afbc.nr_blocks * sizeof(struct pan_afbc_block_info);
+         rsrc->afbc_pack.rows_offset[level] = metadata_size;
+         metadata_size += damage->maxy * sizeof(uint32_t);
+      }
+
+      rsrc->afbc_pack.metadata =
+         panfrost_bo_create(dev, metadata_size, 0, "AFBC superblock sizes");
+      rsrc->afbc_pack.sparse_modifier = modifier;
    }
 
+   struct panfrost_bo *metadata = rsrc->afbc_pack.metadata;
+
+   trace_start_afbc(&ctx->trace);
    panfrost_flush_batches_accessing_rsrc(ctx, rsrc, "AFBC before size flush");
    batch = panfrost_get_fresh_batch_for_fbo(ctx, "AFBC superblock sizes");
-   bo = panfrost_bo_create(dev, metadata_size, 0, "AFBC superblock sizes");
 
-   for (int level = first_level; level <= last_level; ++level) {
-      unsigned offset = out_offsets[level - first_level];
-      screen->vtbl.afbc_size(batch, rsrc, bo, offset, level);
+   for (unsigned level = 0; level <= last_level; ++level) {
+      struct pipe_scissor_state *damage = &rsrc->afbc_pack.damage[level];
+
+      if (damage->minx >= damage->maxx || damage->miny >= damage->maxy)
+         continue;
+
+      screen->vtbl.afbc_size(batch, rsrc, metadata,
+                             rsrc->afbc_pack.blocks_offset[level], level,
+                             damage);
+      *damage = (struct pipe_scissor_state){0};
    }
 
    panfrost_flush_batches_accessing_rsrc(ctx, rsrc, "AFBC after size flush");
 
-   return bo;
+   /* Each pass of the prefix sum depends on the previous one, so they go in
+    * separate batches */
+   for (unsigned pass = 0; pass < 2; ++pass) {
+      batch = panfrost_get_fresh_batch_for_fbo(ctx, "AFBC offsets");
+
+      for (unsigned level = 0; level <= last_level; ++level) {
+         screen->vtbl.afbc_scan(batch, rsrc, metadata,
+                                rsrc->afbc_pack.blocks_offset[level],
+                                rsrc->afbc_pack.rows_offset[level],
+                                level * sizeof(uint32_t), level, pass == 0);
+      }
+
+      panfrost_flush_batches_accessing_rsrc(ctx, rsrc, "AFBC offsets flush");
+   }
+
+   trace_end_afbc(&ctx->trace, "offsets", last_level + 1);
+
+   if (!rsrc->afbc_pack.pending) {
+      struct pipe_resource *prsrc = NULL;
+      pipe_resource_reference(&prsrc, &rsrc->base.b);
+      util_dynarray_append(&ctx->afbc_pack_pending, struct pipe_resource *,
+                           prsrc);
+   }
+
+   rsrc->afbc_pack.pending = true;
 }
 
-void
-panfrost_pack_afbc(struct panfrost_context *ctx,
-                   struct panfrost_resource *prsrc)
+/* Pack a resource whose offsets have been computed, if they have landed.
+ * Returns false if the resource is still waiting on the GPU. */
+
+static bool
+panfrost_afbc_pack_finish(struct panfrost_context *ctx,
+                          struct panfrost_resource *prsrc)
 {
    struct panfrost_screen *screen = pan_screen(ctx->base.screen);
    struct panfrost_device *dev = pan_device(ctx->base.screen);
-   struct panfrost_bo *metadata_bo;
-   unsigned metadata_offsets[PIPE_MAX_TEXTURE_LEVELS];
+   struct panfrost_bo *metadata_bo = prsrc->afbc_pack.metadata;
+
+   if (panfrost_any_batch_writes_rsrc(ctx, prsrc) ||
+       !panfrost_bo_wait(metadata_bo, 0, false))
+      return false;
 
    uint64_t src_modifier = prsrc->image.layout.modifier;
    uint64_t dst_modifier =
       src_modifier & ~(AFBC_FORMAT_MOD_TILED | AFBC_FORMAT_MOD_SPARSE);
-   bool is_tiled = src_modifier & AFBC_FORMAT_MOD_TILED;
-   unsigned last_level = prsrc->base.last_level;
+   unsigned last_level = prsrc->base.b.last_level;
    struct pan_image_slice_layout slice_infos[PIPE_MAX_TEXTURE_LEVELS] = {0};
+   const uint32_t *body_sizes = metadata_bo->ptr.cpu;
    unsigned total_size = 0;
 
-   /* It doesn't make sense to pack everything if we need to unpack right
-    * away to upload data to another level */
-   for (int i = 0; i <= last_level; i++) {
-      if (!BITSET_TEST(prsrc->valid.data, i))
-         return;
-   }
-
-   metadata_bo = panfrost_get_afbc_superblock_sizes(ctx, prsrc, 0, last_level,
-                                                    metadata_offsets);
-   panfrost_bo_wait(metadata_bo, INT64_MAX, false);
+   prsrc->afbc_pack.pending = false;
 
    for (unsigned level = 0; level <= last_level; ++level) {
-      struct pan_image_slice_layout *src_slice =
-         &prsrc->image.layout.slices[level];
       struct pan_image_slice_layout *dst_slice = &slice_infos[level];
 
-      unsigned width = u_minify(prsrc->base.width0, level);
-      unsigned height = u_minify(prsrc->base.height0, level);
-      unsigned src_stride =
-         pan_afbc_stride_blocks(src_modifier, src_slice->row_stride);
+      unsigned width = u_minify(prsrc->base.b.width0, level);
+      unsigned height = u_minify(prsrc->base.b.height0, level);
       unsigned dst_stride =
          DIV_ROUND_UP(width, panfrost_afbc_superblock_width(dst_modifier));
       unsigned dst_height =
          DIV_ROUND_UP(height, panfrost_afbc_superblock_height(dst_modifier));
-
-      uint32_t offset = 0;
-      struct pan_afbc_block_info *meta =
-         metadata_bo->ptr.cpu + metadata_offsets[level];
-
-      for (unsigned y = 0, i = 0; y < dst_height; ++y) {
-         for (unsigned x = 0; x < dst_stride; ++x, ++i) {
-            unsigned idx = is_tiled ? get_morton_index(x, y, src_stride) : i;
-            uint32_t size = meta[idx].size;
-            meta[idx].offset = offset; /* write the start offset */
-            offset += size;
-         }
-      }
+      uint32_t offset = body_sizes[level];
 
       total_size = ALIGN_POT(total_size, pan_slice_align(dst_modifier));
       {
@@ -1551,11 +1998,13 @@ panfrost_pack_afbc(struct panfrost_context *ctx,
    unsigned ratio = 100 * new_size / old_size;
 
    if (ratio > screen->max_afbc_packing_ratio)
-      return;
+      return true;
 
    perf_debug(dev, "%i%%: %i KB -> %i KB\n", ratio, old_size / 1024,
               new_size / 1024);
 
+   trace_start_afbc(&ctx->trace);
+
    struct panfrost_bo *dst =
       panfrost_bo_create(dev, new_size, 0, "AFBC compact texture");
    struct panfrost_batch *batch =
@@ -1564,17 +2013,107 @@ panfrost_pack_afbc(struct panfrost_context *ctx,
    for (unsigned level = 0; level <= last_level; ++level) {
       struct pan_image_slice_layout *slice = &slice_infos[level];
       screen->vtbl.afbc_pack(batch, prsrc, dst, slice, metadata_bo,
-                             metadata_offsets[level], level);
+                             prsrc->afbc_pack.blocks_offset[level],
+                             prsrc->afbc_pack.rows_offset[level], level);
       prsrc->image.layout.slices[level] = *slice;
    }
 
    panfrost_flush_batches_accessing_rsrc(ctx, prsrc, "AFBC compaction flush");
+   trace_end_afbc(&ctx->trace, "pack", last_level + 1);
 
    prsrc->image.layout.modifier = dst_modifier;
    panfrost_bo_unreference(prsrc->bo);
    prsrc->bo = dst;
    prsrc->image.data.base = dst->ptr.gpu;
-   panfrost_bo_unreference(metadata_bo);
+   pan_crc_invalidate_all(&prsrc->valid.crc);
+   return true;
+}
+
+void
+panfrost_pack_afbc(struct panfrost_context *ctx,
+                   struct panfrost_resource *prsrc)
+{
+   unsigned last_level = prsrc->base.b.last_level;
+   bool damaged = !prsrc->afbc_pack.metadata;
+
+   /* It doesn't make sense to pack everything if we need to unpack right
+    * away to upload data to another level */
+   for (int i = 0; i <= last_level; i++) {
+      if (!BITSET_TEST(prsrc->valid.data, i))
+         return;
+   }
+
+   for (unsigned i = 0; i <= last_level; i++) {
+      struct pipe_scissor_state *damage = &prsrc->afbc_pack.damage[i];
+      damaged |= damage->minx < damage->maxx && damage->miny < damage->maxy;
+   }
+
+   if (damaged)
+      panfrost_afbc_compute_offsets(ctx, prsrc);
+   else if (prsrc->afbc_pack.pending)
+      panfrost_afbc_pack_finish(ctx, prsrc);
+}
+
+/* Pack the resources whose offsets have landed. Called at flush time, so the
+ * GPU had a chance to catch up since the offsets were requested. */
+
+void
+panfrost_pack_afbc_pending(struct panfrost_context *ctx)
+{
+   struct util_dynarray *pending = &ctx->afbc_pack_pending;
+   unsigned count = util_dynarray_num_elements(pending, struct pipe_resource *);
+   struct pipe_resource **rsrcs = util_dynarray_begin(pending);
+   unsigned kept = 0;
+
+   for (unsigned i = 0; i < count; ++i) {
+      struct panfrost_resource *rsrc = pan_resource(rsrcs[i]);
+
+      if (rsrc->afbc_pack.pending && !panfrost_afbc_pack_finish(ctx, rsrc)) {
+         rsrcs[kept++] = rsrcs[i];
+         continue;
+      }
+
+      /* A pending pack that was cancelled will be requested again by the
+       * next write */
+      pipe_resource_reference(&rsrcs[i], NULL);
+   }
+
+   util_dynarray_resize(pending, struct pipe_resource *, kept);
+}
+
+/* Copy a resource packed by us back to its sparse layout, so it can be written
+ * to. Unlike a decompressing blit, superblocks are copied verbatim, so their
+ * sizes remain valid and only what gets written next needs to be measured
+ * again. */
+
+static void
+panfrost_unpack_afbc(struct panfrost_context *ctx,
+                     struct panfrost_resource *prsrc)
+{
+   struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+   struct panfrost_device *dev = pan_device(ctx->base.screen);
+   struct pan_image_layout packed = prsrc->image.layout;
+   struct panfrost_bo *src = prsrc->bo;
+
+   trace_start_afbc(&ctx->trace);
+   panfrost_flush_writer(ctx, prsrc, "AFBC before unpack");
+
+   panfrost_resource_setup(dev, prsrc, prsrc->afbc_pack.sparse_modifier,
+                           packed.format);
+   prsrc->modifier_constant = false;
+   prsrc->bo = panfrost_bo_create(dev, prsrc->image.layout.data_size, 0,
+                                  "AFBC unpacked texture");
+   prsrc->image.data.base = prsrc->bo->ptr.gpu;
+
+   struct panfrost_batch *batch =
+      panfrost_get_fresh_batch_for_fbo(ctx, "AFBC unpack");
+
+   for (unsigned level = 0; level <= prsrc->base.b.last_level; ++level)
+      screen->vtbl.afbc_unpack(batch, src, &packed.slices[level], prsrc, level);
+
+   panfrost_flush_batches_accessing_rsrc(ctx, prsrc, "AFBC unpack flush");
+   trace_end_afbc(&ctx->trace, "unpack", prsrc->base.b.last_level + 1);
+   panfrost_bo_unreference(src);
 }
 
 static void
@@ -1588,8 +2127,11 @@ panfrost_ptr_unmap(struct pipe_context *pctx, struct pipe_transfer *transfer)
       (struct panfrost_resource *)transfer->resource;
    struct panfrost_device *dev = pan_device(pctx->screen);
 
-   if (transfer->usage & PIPE_MAP_WRITE)
-      prsrc->valid.crc = false;
+   if (transfer->usage & PIPE_MAP_WRITE) {
+      pan_crc_invalidate(&prsrc->valid.crc, transfer->box.x, transfer->box.y,
+                         transfer->box.x + transfer->box.width - 1,
+                         transfer->box.y + transfer->box.height - 1);
+   }
 
    /* AFBC will use a staging resource. `initialized` will be set when the
     * fragment job is created; this is deferred to prevent useless surface
@@ -1597,10 +2139,30 @@ panfrost_ptr_unmap(struct pipe_context *pctx, struct pipe_transfer *transfer)
     * malformed AFBC data if uninitialized */
 
    if (trans->staging.rsrc) {
-      if (transfer->usage & PIPE_MAP_WRITE) {
+      if (!drm_is_afbc(prsrc->image.layout.modifier)) {
+         if (panfrost_should_linear_convert(dev, prsrc, transfer)) {
+            /* The whole level was written, so the staging texture has
+             * the contents and layout of the linear resource */
+            panfrost_bo_unreference(prsrc->bo);
+
+            panfrost_resource_setup(dev, prsrc, DRM_FORMAT_MOD_LINEAR,
+                                    prsrc->image.layout.format);
+
+            prsrc->bo = pan_resource(trans->staging.rsrc)->bo;
+            prsrc->image.data.base = prsrc->bo->ptr.gpu;
+            panfrost_bo_reference(prsrc->bo);
+            BITSET_SET(prsrc->valid.data, transfer->level);
+         } else {
+            /* Streamed write to a busy tiled resource. The blit is queued
+             * behind the batches still using the resource, and ends up in
+             * a batch of its own, so nothing waits here. */
+            pan_blit_from_staging(pctx, trans);
+         }
+      } else if (transfer->usage & PIPE_MAP_WRITE) {
          if (panfrost_should_linear_convert(dev, prsrc, transfer)) {
 
             panfrost_bo_unreference(prsrc->bo);
+            panfrost_afbc_pack_invalidate(prsrc);
 
             panfrost_resource_setup(dev, prsrc, DRM_FORMAT_MOD_LINEAR,
                                     prsrc->image.layout.format);
@@ -1609,8 +2171,16 @@ panfrost_ptr_unmap(struct pipe_context *pctx, struct pipe_transfer *transfer)
             prsrc->image.data.base = prsrc->bo->ptr.gpu;
             panfrost_bo_reference(prsrc->bo);
          } else {
-            bool discard = panfrost_can_discard(&prsrc->base, &transfer->box,
+            bool discard = panfrost_can_discard(&prsrc->base.b, &transfer->box,
                                                 transfer->usage);
+
+            /* Writing to a resource we packed only needs the sparse layout
+             * back, not a round trip through the pixels */
+            if (!discard && prsrc->afbc_pack.metadata &&
+                drm_is_afbc(prsrc->image.layout.modifier) &&
+                !(prsrc->image.layout.modifier & AFBC_FORMAT_MOD_SPARSE))
+               panfrost_unpack_afbc(ctx, prsrc);
+
             pan_legalize_afbc_format(ctx, prsrc, prsrc->image.layout.format,
                                      true, discard);
             pan_blit_from_staging(pctx, trans);
@@ -1651,20 +2221,29 @@ panfrost_ptr_unmap(struct pipe_context *pctx, struct pipe_transfer *transfer)
 
                util_copy_rect(
                   bo->ptr.cpu + prsrc->image.layout.slices[0].offset,
-                  prsrc->base.format, prsrc->image.layout.slices[0].row_stride,
-                  0, 0, transfer->box.width, transfer->box.height, trans->map,
+                  prsrc->base.b.format,
+                  prsrc->image.layout.slices[0].row_stride, 0, 0,
+                  transfer->box.width, transfer->box.height, trans->map,
                   transfer->stride, 0, 0);
             } else {
                panfrost_store_tiled_images(trans, prsrc);
             }
+         } else if (drm_is_afbc(prsrc->image.layout.modifier)) {
+            pan_afbc_cpu_unmap(ctx, trans);
+            panfrost_afbc_add_damage(
+               prsrc, transfer->level, transfer->box.x, transfer->box.y,
+               transfer->box.x + transfer->box.width,
+               transfer->box.y + transfer->box.height);
          }
       }
    }
 
-   util_range_add(&prsrc->base, &prsrc->valid_buffer_range, transfer->box.x,
-                  transfer->box.x + transfer->box.width);
+   util_range_add(&prsrc->base.b, &prsrc->base.valid_buffer_range,
+                  transfer->box.x, transfer->box.x + transfer->box.width);
 
+   simple_mtx_lock(&prsrc->index_cache_lock);
    panfrost_minmax_cache_invalidate(prsrc->index_cache, transfer);
+   simple_mtx_unlock(&prsrc->index_cache_lock);
 
    /* Derefence the resource */
    pipe_resource_reference(&transfer->resource, NULL);
@@ -1681,7 +2260,7 @@ panfrost_ptr_flush_region(struct pipe_context *pctx,
    struct panfrost_resource *rsc = pan_resource(transfer->resource);
 
    if (transfer->resource->target == PIPE_BUFFER) {
-      util_range_add(&rsc->base, &rsc->valid_buffer_range,
+      util_range_add(&rsc->base.b, &rsc->base.valid_buffer_range,
                      transfer->box.x + box->x,
                      transfer->box.x + box->x + box->width);
    } else {
@@ -1689,6 +2268,80 @@ panfrost_ptr_flush_region(struct pipe_context *pctx,
    }
 }
 
+/* Called by u_threaded_context when a busy buffer is invalidated from the
+ * application thread: the storage of src (a freshly allocated buffer) is
+ * moved into dst, which keeps its identity for the bindings. Batches that
+ * are still in flight hold their own reference to the old BO. */
+
+void
+panfrost_replace_buffer_storage(struct pipe_context *pctx,
+                                struct pipe_resource *dst,
+                                struct pipe_resource *src,
+                                unsigned num_rebinds, uint32_t rebind_mask,
+                                uint32_t delete_buffer_id)
+{
+   struct panfrost_context *ctx = pan_context(pctx);
+   struct panfrost_screen *screen = pan_screen(pctx->screen);
+   struct panfrost_resource *dst_rsrc = pan_resource(dst);
+   struct panfrost_resource *src_rsrc = pan_resource(src);
+
+   assert(dst->target == PIPE_BUFFER && src->target == PIPE_BUFFER);
+   assert(!dst_rsrc->base.is_shared && !dst_rsrc->scanout);
+
+   panfrost_bo_reference(src_rsrc->bo);
+   panfrost_bo_unreference(dst_rsrc->bo);
+   dst_rsrc->bo = src_rsrc->bo;
+   dst_rsrc->image.data.base = dst_rsrc->bo->ptr.gpu;
+
+   /* The new storage has different contents */
+   if (dst_rsrc->index_cache) {
+      simple_mtx_lock(&dst_rsrc->index_cache_lock);
+      panfrost_minmax_cache_reset(dst_rsrc->index_cache);
+      simple_mtx_unlock(&dst_rsrc->index_cache_lock);
+   }
+
+   if (delete_buffer_id)
+      util_idalloc_mt_free(&screen->buffer_ids, delete_buffer_id);
+
+   /* Descriptors pointing at the old BO must be re-emitted */
+   if (num_rebinds)
+      panfrost_dirty_state_all(ctx);
+}
+
+/* Side-effect free variant of panfrost_bo_wait(), as this is called from the
+ * application thread of a threaded context. Batches which have not been
+ * flushed yet are tracked by u_threaded_context itself. */
+
+bool
+panfrost_resource_busy(struct pipe_screen *pscreen,
+                       struct pipe_resource *prsrc, unsigned usage)
+{
+   struct panfrost_bo *bo = pan_resource(prsrc)->bo;
+   bool wait_readers = usage & PIPE_MAP_WRITE;
+
+   /* Accesses to suballocated BOs are tracked on the slab */
+   if (bo->parent)
+      bo = bo->parent;
+
+   /* Batches flushed to the submit thread are no longer tracked by
+    * u_threaded_context, but the kernel doesn't know about them yet.
+    */
+   if (p_atomic_read(&bo->pending_submits))
+      return true;
+
+   if (!(bo->flags & PAN_BO_SHARED)) {
+      uint32_t gpu_access = p_atomic_read(&bo->gpu_access);
+
+      if (!gpu_access)
+         return false;
+
+      if (!wait_readers && !(gpu_access & PAN_BO_ACCESS_WRITE))
+         return false;
+   }
+
+   return !pan_kmod_bo_wait(bo->kmod_bo, 0, !wait_readers);
+}
+
 static void
 panfrost_invalidate_resource(struct pipe_context *pctx,
                              struct pipe_resource *prsrc)
@@ -1726,7 +2379,7 @@ panfrost_set_image_view_planes(struct pan_image_view *iview,
 
    for (int i = 0; i < MAX_IMAGE_PLANES && prsrc_plane; i++) {
       iview->planes[i] = &prsrc_plane->image;
-      prsrc_plane = (struct panfrost_resource *)prsrc_plane->base.next;
+      prsrc_plane = (struct panfrost_resource *)prsrc_plane->base.b.next;
    }
 }
 
@@ -1770,7 +2423,7 @@ panfrost_resource_get_stencil(struct pipe_resource *prsrc)
    if (!pan_resource(prsrc)->separate_stencil)
       return NULL;
 
-   return &pan_resource(prsrc)->separate_stencil->base;
+   return &pan_resource(prsrc)->separate_stencil->base.b;
 }
 
 static const struct u_transfer_vtbl transfer_vtbl = {
@@ -1787,6 +2440,8 @@ static const struct u_transfer_vtbl transfer_vtbl = {
 void
 panfrost_resource_screen_init(struct pipe_screen *pscreen)
 {
+   struct panfrost_screen *screen = pan_screen(pscreen);
+
    pscreen->resource_create_with_modifiers =
       panfrost_resource_create_with_modifiers;
    pscreen->resource_create = u_transfer_helper_resource_create;
@@ -1797,11 +2452,20 @@ panfrost_resource_screen_init(struct pipe_screen *pscreen)
    pscreen->transfer_helper = u_transfer_helper_create(
       &transfer_vtbl,
       U_TRANSFER_HELPER_SEPARATE_Z32S8 | U_TRANSFER_HELPER_MSAA_MAP);
+
+   slab_create_parent(&screen->transfer_pool, sizeof(struct threaded_transfer),
+                      16);
+   util_idalloc_mt_init_tc(&screen->buffer_ids);
 }
+
 void
 panfrost_resource_screen_destroy(struct pipe_screen *pscreen)
 {
+   struct panfrost_screen *screen = pan_screen(pscreen);
+
    u_transfer_helper_destroy(pscreen->transfer_helper);
+   slab_destroy_parent(&screen->transfer_pool);
+   util_idalloc_mt_fini(&screen->buffer_ids);
 }
 
 void
@@ -26,7 +26,10 @@
 #define PAN_RESOURCE_H
 
 #include "drm-uapi/drm.h"
+#include "util/simple_mtx.h"
 #include "util/u_range.h"
+#include "util/u_threaded_context.h"
+#include "pan_desc.h"
 #include "pan_minmax_cache.h"
 #include "pan_screen.h"
 #include "pan_texture.h"
@@ -38,7 +41,7 @@
    (PIPE_BIND_DISPLAY_TARGET | PIPE_BIND_SCANOUT | PIPE_BIND_SHARED)
 
 struct panfrost_resource {
-   struct pipe_resource base;
+   struct threaded_resource base;
    struct {
       struct pipe_scissor_state extent;
       struct {
@@ -53,17 +56,15 @@ struct panfrost_resource {
 
    struct panfrost_resource *separate_stencil;
 
-   struct util_range valid_buffer_range;
-
    /* Description of the resource layout */
    struct pan_image image;
 
    struct panfrost_bo *bo;
 
    struct {
-      /* Is the checksum for this image valid? Implicitly refers to
+      /* Which checksums of this image are valid? Implicitly refers to
        * the first slice; we only checksum non-mipmapped 2D images */
-      bool crc;
+      struct pan_crc_state crc;
 
       /* Has anything been written to this slice? */
       BITSET_DECLARE(data, MAX_MIP_LEVELS);
@@ -81,8 +82,31 @@ struct panfrost_resource {
    /* The stencil value if constant_stencil is set */
    uint8_t stencil_value;
 
-   /* Cached min/max values for index buffers */
+   /* AFBC packing is incremental: superblock sizes are kept across packs
+    * and only recomputed where the resource was written since. */
+   struct {
+      /* Per-level superblock sizes and offsets, row offsets and total body
+       * size, or NULL if the sizes are unknown */
+      struct panfrost_bo *metadata;
+      unsigned blocks_offset[MAX_MIP_LEVELS];
+      unsigned rows_offset[MAX_MIP_LEVELS];
+
+      /* Superblocks written since their size was computed, per level */
+      struct pipe_scissor_state damage[MAX_MIP_LEVELS];
+
+      /* Sparse modifier the sizes were computed for */
+      uint64_t sparse_modifier;
+
+      /* Offsets for the current contents are in flight, the resource is
+       * packed once they land */
+      bool pending;
+   } afbc_pack;
+
+   /* Cached min/max values for index buffers. The lock is needed since
+    * unsynchronized maps from a threaded context invalidate the cache from
+    * the application thread. */
    struct panfrost_minmax_cache *index_cache;
+   simple_mtx_t index_cache_lock;
 };
 
 static inline struct panfrost_resource *
@@ -92,7 +116,7 @@ pan_resource(struct pipe_resource *p)
 }
 
 struct panfrost_transfer {
-   struct pipe_transfer base;
+   struct threaded_transfer base;
    void *map;
    struct {
       struct pipe_resource *rsrc;
@@ -112,6 +136,16 @@ void panfrost_resource_screen_destroy(struct pipe_screen *screen);
 
 void panfrost_resource_context_init(struct pipe_context *pctx);
 
+void panfrost_replace_buffer_storage(struct pipe_context *pctx,
+                                     struct pipe_resource *dst,
+                                     struct pipe_resource *src,
+                                     unsigned num_rebinds,
+                                     uint32_t rebind_mask,
+                                     uint32_t delete_buffer_id);
+
+bool panfrost_resource_busy(struct pipe_screen *pscreen,
+                            struct pipe_resource *prsrc, unsigned usage);
+
 /* Blitting */
 
 enum panfrost_blitter_op /* bitmask */
@@ -179,16 +213,18 @@ panfrost_resource_create_with_modifier(struct pipe_screen *screen,
                                        const struct pipe_resource *template,
                                        uint64_t modifier);
 
-struct panfrost_bo *panfrost_get_afbc_superblock_sizes(
-   struct panfrost_context *ctx, struct panfrost_resource *rsrc,
-   unsigned first_level, unsigned last_level, unsigned *out_offsets);
-
 bool panfrost_should_pack_afbc(struct panfrost_device *dev,
                                const struct panfrost_resource *rsrc);
 
 void panfrost_pack_afbc(struct panfrost_context *ctx,
                         struct panfrost_resource *prsrc);
 
+void panfrost_pack_afbc_pending(struct panfrost_context *ctx);
+
+void panfrost_afbc_add_damage(struct panfrost_resource *rsrc, unsigned level,
+                              unsigned minx, unsigned miny, unsigned maxx,
+                              unsigned maxy);
+
 void pan_resource_modifier_convert(struct panfrost_context *ctx,
                                    struct panfrost_resource *rsrc,
                                    uint64_t modifier, bool copy_resource,
@@ -32,11 +32,13 @@
 #include "util/format/u_format.h"
 #include "util/format/u_format_s3tc.h"
 #include "util/os_time.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_debug.h"
 #include "util/u_memory.h"
 #include "util/u_process.h"
 #include "util/u_screen.h"
 #include "util/u_video.h"
+#include "util/xmlconfig.h"
 
 #include <fcntl.h>
 
@@ -46,6 +48,8 @@
 #include "decode.h"
 #include "pan_bo.h"
 #include "pan_fence.h"
+#include "pan_perfcnt.h"
+#include "pan_perfetto.h"
 #include "pan_public.h"
 #include "pan_resource.h"
 #include "pan_screen.h"
@@ -69,12 +73,14 @@ static const struct debug_named_value panfrost_debug_options[] = {
    {"msaa16",     PAN_DBG_MSAA16,   "Enable MSAA 8x and 16x support"},
    {"linear",     PAN_DBG_LINEAR,   "Force linear textures"},
    {"nocache",    PAN_DBG_NO_CACHE, "Disable BO cache"},
+   {"noslab",     PAN_DBG_NO_SLAB,  "Disable suballocation of small buffers"},
    {"dump",       PAN_DBG_DUMP,     "Dump all graphics memory"},
 #ifdef PAN_DBG_OVERFLOW
    {"overflow",   PAN_DBG_OVERFLOW, "Check for buffer overflows in pool uploads"},
 #endif
    {"yuv",        PAN_DBG_YUV,      "Tint YUV textures with blue for 1-plane and green for 2-plane"},
    {"forcepack",  PAN_DBG_FORCE_PACK,  "Force packing of AFBC textures on upload"},
+   {"flushstats", PAN_DBG_FLUSH_STATS, "Print the batches submitted by flush reason on context destruction"},
    DEBUG_NAMED_VALUE_END
 };
 /* clang-format on */
@@ -222,6 +228,9 @@ panfrost_get_param(struct pipe_screen *screen, enum pipe_cap param)
    case PIPE_CAP_QUERY_TIMESTAMP:
       return is_gl3;
 
+   case PIPE_CAP_PERFORMANCE_MONITOR:
+      return pan_screen(screen)->perfcnt.cfg != NULL;
+
    /* The hardware requires element alignment for data conversion to work
     * as expected. If data conversion is not required, this restriction is
     * lifted on Midgard at a performance penalty. We conservatively
@@ -769,6 +778,16 @@ panfrost_destroy_screen(struct pipe_screen *pscreen)
    struct panfrost_device *dev = pan_device(pscreen);
    struct panfrost_screen *screen = pan_screen(pscreen);
 
+   /* Background compiles may still be using the disk cache */
+   if (util_queue_is_initialized(&screen->shader_compiler_queue))
+      util_queue_finish(&screen->shader_compiler_queue);
+
+   panfrost_disk_cache_fini(screen);
+   panfrost_perfcnt_screen_fini(screen);
+
+   if (util_queue_is_initialized(&screen->shader_compiler_queue))
+      util_queue_destroy(&screen->shader_compiler_queue);
+
    panfrost_resource_screen_destroy(pscreen);
    panfrost_pool_cleanup(&screen->blitter.bin_pool);
    panfrost_pool_cleanup(&screen->blitter.desc_pool);
@@ -781,7 +800,6 @@ panfrost_destroy_screen(struct pipe_screen *pscreen)
       dev->ro->destroy(dev->ro);
    panfrost_close_device(dev);
 
-   disk_cache_destroy(screen->disk_cache);
    ralloc_free(pscreen);
 }
 
@@ -809,16 +827,21 @@ int
 panfrost_get_driver_query_info(struct pipe_screen *pscreen, unsigned index,
                                struct pipe_driver_query_info *info)
 {
-   int num_queries = ARRAY_SIZE(panfrost_driver_query_list);
+   struct panfrost_screen *screen = pan_screen(pscreen);
+   unsigned num_sw_queries = ARRAY_SIZE(panfrost_driver_query_list);
 
    if (!info)
-      return num_queries;
+      return num_sw_queries + panfrost_perfcnt_num_queries(screen);
 
-   if (index >= num_queries)
-      return 0;
+   if (index >= num_sw_queries)
+      return panfrost_perfcnt_get_query_info(screen, index - num_sw_queries,
+                                             info);
 
    *info = panfrost_driver_query_list[index];
 
+   /* Software queries are not part of any performance monitor group */
+   info->group_id = ~0;
+
    return 1;
 }
 
@@ -854,6 +877,24 @@ panfrost_create_screen(int fd, const struct pipe_screen_config *config,
 
    dev->ro = ro;
 
+   if (config) {
+      driParseConfigFiles(config->options, config->options_info, 0,
+                          "panfrost", NULL, NULL, NULL, 0, NULL, 0);
+      screen->driconf.skip_draws_while_compiling =
+         driQueryOptionb(config->options, "pan_skip_draws_while_compiling");
+      screen->driconf.async_submit =
+         driQueryOptionb(config->options, "pan_async_submit");
+      screen->driconf.warm_up_blitter =
+         driQueryOptionb(config->options, "pan_warm_up_blitter");
+      screen->driconf.transaction_elimination =
+         driQueryOptionb(config->options, "pan_transaction_elimination");
+
+      int bo_cache_max_size =
+         driQueryOptioni(config->options, "pan_bo_cache_max_size");
+      if (bo_cache_max_size > 0)
+         dev->bo_cache.max_size = (uint64_t)bo_cache_max_size * 1024 * 1024;
+   }
+
    screen->base.destroy = panfrost_destroy_screen;
 
    screen->base.get_screen_fd = panfrost_get_screen_fd;
@@ -861,6 +902,8 @@ panfrost_create_screen(int fd, const struct pipe_screen_config *config,
    screen->base.get_vendor = panfrost_get_vendor;
    screen->base.get_device_vendor = panfrost_get_device_vendor;
    screen->base.get_driver_query_info = panfrost_get_driver_query_info;
+   screen->base.get_driver_query_group_info =
+      panfrost_get_driver_query_group_info;
    screen->base.get_param = panfrost_get_param;
    screen->base.get_shader_param = panfrost_get_shader_param;
    screen->base.get_compute_param = panfrost_get_compute_param;
@@ -879,10 +922,36 @@ panfrost_create_screen(int fd, const struct pipe_screen_config *config,
    screen->base.set_damage_region = panfrost_resource_set_damage_region;
 
    panfrost_resource_screen_init(&screen->base);
-   pan_blend_shader_cache_init(&dev->blend_shaders,
-                               panfrost_device_gpu_id(dev));
+
+   /* Leave some cores to the application and the driver thread */
+   unsigned hw_threads = util_get_cpu_caps()->nr_cpus;
+   unsigned compiler_threads = 1;
+
+   if (hw_threads >= 12)
+      compiler_threads = hw_threads * 3 / 4;
+   else if (hw_threads >= 6)
+      compiler_threads = hw_threads - 2;
+   else if (hw_threads >= 2)
+      compiler_threads = hw_threads - 1;
+
+   /* If the queue can't be created, variants are compiled synchronously */
+   util_queue_init(&screen->shader_compiler_queue, "pan_sh", 64,
+                   compiler_threads,
+                   UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                      UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY,
+                   NULL);
 
    panfrost_disk_cache_init(screen);
+   panfrost_perfcnt_screen_init(screen);
+
+#ifdef HAVE_PERFETTO
+   pan_perfetto_init();
+#endif
+
+   pan_blend_shader_cache_init(&dev->blend_shaders,
+                               panfrost_device_gpu_id(dev), screen->disk_cache);
+
+   panfrost_shader_screen_init(&screen->base);
 
    panfrost_pool_init(&screen->blitter.bin_pool, NULL, dev, PAN_BO_EXECUTE,
                       4096, "Blitter shaders", false, true);
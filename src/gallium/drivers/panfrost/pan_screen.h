@@ -35,22 +35,58 @@
 #include "renderonly/renderonly.h"
 #include "util/bitset.h"
 #include "util/disk_cache.h"
+#include "util/hash_table.h"
 #include "util/log.h"
 #include "util/set.h"
+#include "util/simple_mtx.h"
+#include "util/slab.h"
 #include "util/u_dynarray.h"
+#include "util/u_idalloc.h"
+#include "util/u_queue.h"
 
 #include "pan_device.h"
 #include "pan_mempool.h"
 #include "pan_texture.h"
 
-#define PAN_QUERY_DRAW_CALLS (PIPE_QUERY_DRIVER_SPECIFIC + 0)
+#define PAN_QUERY_DRAW_CALLS      (PIPE_QUERY_DRIVER_SPECIFIC + 0)
+#define PAN_QUERY_BO_SLAB_HITS    (PIPE_QUERY_DRIVER_SPECIFIC + 1)
+#define PAN_QUERY_BO_SLAB_MISSES  (PIPE_QUERY_DRIVER_SPECIFIC + 2)
+#define PAN_QUERY_BO_CACHE_SIZE   (PIPE_QUERY_DRIVER_SPECIFIC + 3)
+#define PAN_QUERY_BO_CACHE_HITS   (PIPE_QUERY_DRIVER_SPECIFIC + 4)
+#define PAN_QUERY_BO_CACHE_MISSES (PIPE_QUERY_DRIVER_SPECIFIC + 5)
+#define PAN_QUERY_CRC_CHECKED_TILES   (PIPE_QUERY_DRIVER_SPECIFIC + 6)
+#define PAN_QUERY_CRC_REFRESHED_TILES (PIPE_QUERY_DRIVER_SPECIFIC + 7)
+#define PAN_QUERY_FLUSHES             (PIPE_QUERY_DRIVER_SPECIFIC + 8)
+
+/* One query per pan_flush_class, in order */
+#define PAN_QUERY_FLUSHES_CONTEXT     (PIPE_QUERY_DRIVER_SPECIFIC + 9)
+#define PAN_QUERY_FLUSHES_FBO         (PIPE_QUERY_DRIVER_SPECIFIC + 10)
+#define PAN_QUERY_FLUSHES_RESOURCE    (PIPE_QUERY_DRIVER_SPECIFIC + 11)
+#define PAN_QUERY_FLUSHES_DEPENDENCY  (PIPE_QUERY_DRIVER_SPECIFIC + 12)
+#define PAN_QUERY_FLUSHES_EVICTION    (PIPE_QUERY_DRIVER_SPECIFIC + 13)
 
 static const struct pipe_driver_query_info panfrost_driver_query_list[] = {
    {"draw-calls", PAN_QUERY_DRAW_CALLS, {0}},
+   {"bo-slab-hits", PAN_QUERY_BO_SLAB_HITS, {0}},
+   {"bo-slab-misses", PAN_QUERY_BO_SLAB_MISSES, {0}},
+   {"bo-cache-size", PAN_QUERY_BO_CACHE_SIZE, {0}, PIPE_DRIVER_QUERY_TYPE_BYTES,
+    PIPE_DRIVER_QUERY_RESULT_TYPE_AVERAGE},
+   {"bo-cache-hits", PAN_QUERY_BO_CACHE_HITS, {0}},
+   {"bo-cache-misses", PAN_QUERY_BO_CACHE_MISSES, {0}},
+   {"crc-checked-tiles", PAN_QUERY_CRC_CHECKED_TILES, {0}},
+   {"crc-refreshed-tiles", PAN_QUERY_CRC_REFRESHED_TILES, {0}},
+   {"flushes", PAN_QUERY_FLUSHES, {0}},
+   {"flushes-context", PAN_QUERY_FLUSHES_CONTEXT, {0}},
+   {"flushes-fbo", PAN_QUERY_FLUSHES_FBO, {0}},
+   {"flushes-resource", PAN_QUERY_FLUSHES_RESOURCE, {0}},
+   {"flushes-dependency", PAN_QUERY_FLUSHES_DEPENDENCY, {0}},
+   {"flushes-eviction", PAN_QUERY_FLUSHES_EVICTION, {0}},
 };
 
 struct panfrost_batch;
 struct panfrost_context;
+struct panfrost_perf;
+struct panfrost_perf_config;
 struct panfrost_resource;
 struct panfrost_compiled_shader;
 struct pan_fb_info;
@@ -92,18 +128,33 @@ struct panfrost_vtable {
                           struct util_dynarray *binary,
                           struct pan_shader_info *info);
 
-   /* Run a compute shader to get the compressed size of each superblock */
+   /* Run a compute shader to get the compressed size of each superblock in
+    * a rectangle of superblocks */
    void (*afbc_size)(struct panfrost_batch *batch,
                      struct panfrost_resource *src,
                      struct panfrost_bo *metadata, unsigned offset,
-                     unsigned level);
+                     unsigned level, const struct pipe_scissor_state *blocks);
+
+   /* Run one pass of the prefix sum turning superblock sizes into packed
+    * offsets: per-row if rows is set, across rows otherwise */
+   void (*afbc_scan)(struct panfrost_batch *batch,
+                     struct panfrost_resource *src,
+                     struct panfrost_bo *metadata, unsigned offset,
+                     unsigned rows_offset, unsigned total_offset,
+                     unsigned level, bool rows);
 
    /* Run a compute shader to compact a sparse layout afbc resource */
    void (*afbc_pack)(struct panfrost_batch *batch,
                      struct panfrost_resource *src, struct panfrost_bo *dst,
                      struct pan_image_slice_layout *slice,
                      struct panfrost_bo *metadata, unsigned metadata_offset,
-                     unsigned level);
+                     unsigned rows_offset, unsigned level);
+
+   /* Run a compute shader to copy a packed afbc layout back to the sparse
+    * layout of a resource */
+   void (*afbc_unpack)(struct panfrost_batch *batch, struct panfrost_bo *src,
+                       const struct pan_image_slice_layout *src_slice,
+                       struct panfrost_resource *dst, unsigned level);
 };
 
 struct panfrost_screen {
@@ -116,7 +167,56 @@ struct panfrost_screen {
 
    struct panfrost_vtable vtbl;
    struct disk_cache *disk_cache;
+
+   /* Shaders this process used on its previous runs are read from the disk
+    * cache in the background at screen creation, so retrieving them later
+    * doesn't touch the disk. Keys used by this run are recorded to form the
+    * set preloaded by the next one.
+    */
+   struct {
+      simple_mtx_t lock;
+      struct util_queue queue;
+      struct util_queue_fence fence;
+      struct hash_table *entries;
+      struct util_dynarray keys;
+      struct set *used;
+      unsigned stored_keys;
+      unsigned hot_set_size;
+      cache_key hot_set_key;
+
+      /* Once warm-up is over, preloaded shaders that are still unused are
+       * freed and the preload stops.
+       */
+      int64_t warm_up_end;
+      bool warm;
+   } disk_cache_preload;
    unsigned max_afbc_packing_ratio;
+
+   /* Transfer pool shared by the threaded contexts of this screen */
+   struct slab_parent_pool transfer_pool;
+
+   /* Unique buffer IDs, used by u_threaded_context to track rebinds */
+   struct util_idalloc_mt buffer_ids;
+
+   /* Queue for background compilation of shader variants */
+   struct util_queue shader_compiler_queue;
+
+   /* Hardware counters, enabled while counter queries are active. The
+    * config is NULL if the kernel driver doesn't expose them, or if they
+    * couldn't be enabled at screen creation. */
+   struct {
+      simple_mtx_t lock;
+      const struct panfrost_perf_config *cfg;
+      struct panfrost_perf *perf;
+      unsigned users;
+   } perfcnt;
+
+   struct {
+      bool skip_draws_while_compiling;
+      bool async_submit;
+      bool warm_up_blitter;
+      bool transaction_elimination;
+   } driconf;
 };
 
 static inline struct panfrost_screen *
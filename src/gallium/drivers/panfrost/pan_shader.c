@@ -37,6 +37,18 @@
 #include "pan_bo.h"
 #include "pan_context.h"
 
+static uint32_t
+panfrost_shader_key_hash(const void *key)
+{
+   return _mesa_hash_data(key, sizeof(struct panfrost_shader_key));
+}
+
+static bool
+panfrost_shader_key_equal(const void *a, const void *b)
+{
+   return memcmp(a, b, sizeof(struct panfrost_shader_key)) == 0;
+}
+
 static struct panfrost_uncompiled_shader *
 panfrost_alloc_shader(const nir_shader *nir)
 {
@@ -44,7 +56,9 @@ panfrost_alloc_shader(const nir_shader *nir)
       rzalloc(NULL, struct panfrost_uncompiled_shader);
 
    simple_mtx_init(&so->lock, mtx_plain);
-   util_dynarray_init(&so->variants, so);
+   list_inithead(&so->variants);
+   so->variant_ht = _mesa_hash_table_create(so, panfrost_shader_key_hash,
+                                            panfrost_shader_key_equal);
 
    so->nir = nir;
 
@@ -63,9 +77,29 @@ panfrost_alloc_shader(const nir_shader *nir)
 }
 
 static struct panfrost_compiled_shader *
-panfrost_alloc_variant(struct panfrost_uncompiled_shader *so)
+panfrost_alloc_variant(struct panfrost_uncompiled_shader *so,
+                       const struct panfrost_shader_key *key, uint32_t hash)
 {
-   return util_dynarray_grow(&so->variants, struct panfrost_compiled_shader, 1);
+   struct panfrost_compiled_shader *v =
+      rzalloc(so, struct panfrost_compiled_shader);
+
+   v->key = *key;
+   util_queue_fence_init(&v->ready);
+   list_addtail(&v->link, &so->variants);
+   _mesa_hash_table_insert_pre_hashed(so->variant_ht, hash, &v->key, v);
+
+   return v;
+}
+
+static struct panfrost_compiled_shader *
+panfrost_lookup_variant_locked(struct panfrost_uncompiled_shader *so,
+                               const struct panfrost_shader_key *key,
+                               uint32_t hash)
+{
+   struct hash_entry *he =
+      _mesa_hash_table_search_pre_hashed(so->variant_ht, hash, key);
+
+   return he ? he->data : NULL;
 }
 
 static void
@@ -179,44 +213,51 @@ panfrost_shader_compile(struct panfrost_screen *screen, const nir_shader *ir,
    ralloc_free(s);
 }
 
+/* Only touches CPU-side state, so this may run on the shader compiler queue */
 static void
-panfrost_shader_get(struct pipe_screen *pscreen,
-                    struct panfrost_pool *shader_pool,
-                    struct panfrost_pool *desc_pool,
-                    struct panfrost_uncompiled_shader *uncompiled,
-                    struct util_debug_callback *dbg,
-                    struct panfrost_compiled_shader *state,
-                    unsigned req_local_mem)
+panfrost_shader_compile_binary(struct panfrost_screen *screen,
+                               struct panfrost_uncompiled_shader *uncompiled,
+                               struct util_debug_callback *dbg,
+                               struct panfrost_shader_key *key,
+                               unsigned req_local_mem,
+                               struct panfrost_shader_binary *res)
 {
-   struct panfrost_screen *screen = pan_screen(pscreen);
-   struct panfrost_device *dev = pan_device(pscreen);
-
-   struct panfrost_shader_binary res = {0};
-
    /* Try to retrieve the variant from the disk cache. If that fails,
     * compile a new variant and store in the disk cache for later reuse.
     */
-   if (!panfrost_disk_cache_retrieve(screen->disk_cache, uncompiled,
-                                     &state->key, &res)) {
-      panfrost_shader_compile(screen, uncompiled->nir, dbg, &state->key,
-                              req_local_mem, uncompiled->fixed_varying_mask,
-                              &res);
-
-      panfrost_disk_cache_store(screen->disk_cache, uncompiled, &state->key,
-                                &res);
+   if (!panfrost_disk_cache_retrieve(screen, uncompiled, key, res)) {
+      panfrost_shader_compile(screen, uncompiled->nir, dbg, key, req_local_mem,
+                              uncompiled->fixed_varying_mask, res);
+
+      panfrost_disk_cache_store(screen, uncompiled, key, res);
    }
+}
+
+static void
+panfrost_shader_upload(struct pipe_screen *pscreen,
+                       struct panfrost_pool *shader_pool,
+                       struct panfrost_pool *desc_pool,
+                       simple_mtx_t *pool_lock,
+                       struct panfrost_uncompiled_shader *uncompiled,
+                       struct panfrost_shader_binary *res,
+                       struct panfrost_compiled_shader *state)
+{
+   struct panfrost_screen *screen = pan_screen(pscreen);
+   struct panfrost_device *dev = pan_device(pscreen);
 
-   state->info = res.info;
-   state->sysvals = res.sysvals;
+   state->info = res->info;
+   state->sysvals = res->sysvals;
 
-   if (res.binary.size) {
+   simple_mtx_lock(pool_lock);
+
+   if (res->binary.size) {
       state->bin = panfrost_pool_take_ref(
          shader_pool,
-         pan_pool_upload_aligned(&shader_pool->base, res.binary.data,
-                                 res.binary.size, 128));
+         pan_pool_upload_aligned(&shader_pool->base, res->binary.data,
+                                 res->binary.size, 128));
    }
 
-   util_dynarray_fini(&res.binary);
+   util_dynarray_fini(&res->binary);
 
    /* Don't upload RSD for fragment shaders since they need draw-time
     * merging for e.g. depth/stencil/alpha. RSDs are replaced by simpler
@@ -226,9 +267,153 @@ panfrost_shader_get(struct pipe_screen *pscreen,
       !(uncompiled->nir->info.stage == MESA_SHADER_FRAGMENT && dev->arch <= 7);
    screen->vtbl.prepare_shader(state, desc_pool, upload);
 
+   simple_mtx_unlock(pool_lock);
+
    panfrost_analyze_sysvals(state);
 }
 
+static void
+panfrost_shader_get(struct pipe_screen *pscreen,
+                    struct panfrost_pool *shader_pool,
+                    struct panfrost_pool *desc_pool, simple_mtx_t *pool_lock,
+                    struct panfrost_uncompiled_shader *uncompiled,
+                    struct util_debug_callback *dbg,
+                    struct panfrost_compiled_shader *state,
+                    unsigned req_local_mem)
+{
+   struct panfrost_shader_binary res = {0};
+
+   panfrost_shader_compile_binary(pan_screen(pscreen), uncompiled, dbg,
+                                  &state->key, req_local_mem, &res);
+   panfrost_shader_upload(pscreen, shader_pool, desc_pool, pool_lock,
+                          uncompiled, &res, state);
+}
+
+struct panfrost_compile_job {
+   struct panfrost_screen *screen;
+   struct panfrost_uncompiled_shader *uncompiled;
+   struct panfrost_compiled_shader *variant;
+
+   /* Records the debug messages of the compile, if the scheduling context
+    * has a debug callback */
+   struct util_debug_callback debug;
+};
+
+struct panfrost_debug_message {
+   unsigned *id;
+   enum util_debug_type type;
+   char *text;
+};
+
+static void
+panfrost_compile_job_debug_message(void *data, unsigned *id,
+                                   enum util_debug_type type, const char *fmt,
+                                   va_list args)
+{
+   struct panfrost_compiled_shader *variant = data;
+   struct panfrost_debug_message msg = {
+      .id = id,
+      .type = type,
+   };
+
+   if (vasprintf(&msg.text, fmt, args) >= 0)
+      util_dynarray_append(&variant->pending_messages,
+                           struct panfrost_debug_message, msg);
+}
+
+static void
+panfrost_compile_job_execute(void *data, void *gdata, int thread_index)
+{
+   struct panfrost_compile_job *job = data;
+   struct panfrost_compiled_shader *variant = job->variant;
+   struct panfrost_shader_binary *res = calloc(1, sizeof(*res));
+   struct util_debug_callback *dbg =
+      job->debug.debug_message ? &job->debug : NULL;
+
+   panfrost_shader_compile_binary(job->screen, job->uncompiled, dbg,
+                                  &variant->key, 0, res);
+
+   /* Published by the ready fence */
+   variant->pending = res;
+}
+
+static void
+panfrost_compile_job_delete(void *data, void *gdata, int thread_index)
+{
+   free(data);
+}
+
+/* Messages of background compiles are only replayed once the variant is
+ * used, which is fine for asynchronous callbacks. Synchronous callbacks
+ * expect them right away, in particular shader-db wants the statistics of
+ * every variant, so compile synchronously for those. */
+static bool
+panfrost_can_compile_async(struct panfrost_context *ctx)
+{
+   struct util_debug_callback *dbg = &ctx->base.debug;
+
+   if (!util_queue_is_initialized(
+          &pan_screen(ctx->base.screen)->shader_compiler_queue))
+      return false;
+
+   return !dbg->debug_message || dbg->async;
+}
+
+static void
+panfrost_schedule_compile(struct panfrost_context *ctx,
+                          struct panfrost_uncompiled_shader *uncompiled,
+                          struct panfrost_compiled_shader *variant)
+{
+   struct panfrost_screen *screen = pan_screen(ctx->base.screen);
+   struct panfrost_compile_job *job = malloc(sizeof(*job));
+
+   *job = (struct panfrost_compile_job){
+      .screen = screen,
+      .uncompiled = uncompiled,
+      .variant = variant,
+   };
+
+   if (ctx->base.debug.debug_message) {
+      job->debug = (struct util_debug_callback){
+         .debug_message = panfrost_compile_job_debug_message,
+         .data = variant,
+      };
+   }
+
+   util_queue_add_job(&screen->shader_compiler_queue, job, &variant->ready,
+                      panfrost_compile_job_execute, panfrost_compile_job_delete,
+                      0);
+}
+
+/* Upload a variant compiled in the background to the pools of this context.
+ * Must be called with the uncompiled shader lock held, once the ready fence
+ * is signalled. */
+static void
+panfrost_finish_variant_locked(struct panfrost_context *ctx,
+                               struct panfrost_uncompiled_shader *uncompiled,
+                               struct panfrost_compiled_shader *variant)
+{
+   if (!variant->pending)
+      return;
+
+   panfrost_shader_upload(ctx->base.screen, &ctx->shaders, &ctx->descs,
+                          &ctx->pool_lock, uncompiled, variant->pending,
+                          variant);
+   variant->earlyzs = pan_earlyzs_analyze(&variant->info);
+
+   free(variant->pending);
+   variant->pending = NULL;
+
+   util_dynarray_foreach(&variant->pending_messages,
+                         struct panfrost_debug_message, msg) {
+      _util_debug_message(&ctx->base.debug, msg->id, msg->type, "%s",
+                          msg->text);
+      free(msg->text);
+   }
+
+   util_dynarray_fini(&variant->pending_messages);
+}
+
 static void
 panfrost_build_key(struct panfrost_context *ctx,
                    struct panfrost_shader_key *key,
@@ -287,17 +472,21 @@ panfrost_build_key(struct panfrost_context *ctx,
 static struct panfrost_compiled_shader *
 panfrost_new_variant_locked(struct panfrost_context *ctx,
                             struct panfrost_uncompiled_shader *uncompiled,
-                            struct panfrost_shader_key *key)
+                            struct panfrost_shader_key *key, uint32_t hash,
+                            bool async)
 {
-   struct panfrost_compiled_shader *prog = panfrost_alloc_variant(uncompiled);
+   struct panfrost_compiled_shader *prog =
+      panfrost_alloc_variant(uncompiled, key, hash);
 
-   *prog = (struct panfrost_compiled_shader){
-      .key = *key,
-      .stream_output = uncompiled->stream_output,
-   };
+   prog->stream_output = uncompiled->stream_output;
 
-   panfrost_shader_get(ctx->base.screen, &ctx->shaders, &ctx->descs, uncompiled,
-                       &ctx->base.debug, prog, 0);
+   if (async && panfrost_can_compile_async(ctx)) {
+      panfrost_schedule_compile(ctx, uncompiled, prog);
+      return prog;
+   }
+
+   panfrost_shader_get(ctx->base.screen, &ctx->shaders, &ctx->descs,
+                       &ctx->pool_lock, uncompiled, &ctx->base.debug, prog, 0);
 
    prog->earlyzs = pan_earlyzs_analyze(&prog->info);
 
@@ -312,6 +501,9 @@ panfrost_bind_shader_state(struct pipe_context *pctx, void *hwcso,
    ctx->uncompiled[type] = hwcso;
    ctx->prog[type] = NULL;
 
+   /* Whatever was compiling for the previous shader is no longer wanted */
+   ctx->pending_variants &= ~BITFIELD_BIT(type);
+
    ctx->dirty |= PAN_DIRTY_TLS_SIZE;
    ctx->dirty_shader[type] |= PAN_DIRTY_STAGE_SHADER;
 
@@ -319,6 +511,29 @@ panfrost_bind_shader_state(struct pipe_context *pctx, void *hwcso,
       panfrost_update_shader_variant(ctx, type);
 }
 
+/* While a variant is compiled in the background, a ready variant that only
+ * differs by line smoothing is good enough: lines are drawn aliased for a
+ * few frames. Other key bits affect correctness and have no stand-in. */
+static struct panfrost_compiled_shader *
+panfrost_find_stand_in_locked(struct panfrost_uncompiled_shader *uncompiled,
+                              const struct panfrost_shader_key *key)
+{
+   if (uncompiled->nir->info.stage != MESA_SHADER_FRAGMENT ||
+       !key->fs.line_smooth)
+      return NULL;
+
+   struct panfrost_shader_key relaxed = *key;
+   relaxed.fs.line_smooth = false;
+
+   struct panfrost_compiled_shader *so = panfrost_lookup_variant_locked(
+      uncompiled, &relaxed, panfrost_shader_key_hash(&relaxed));
+
+   if (so && util_queue_fence_is_signalled(&so->ready))
+      return so;
+
+   return NULL;
+}
+
 void
 panfrost_update_shader_variant(struct panfrost_context *ctx,
                                enum pipe_shader_type type)
@@ -336,24 +551,56 @@ panfrost_update_shader_variant(struct panfrost_context *ctx,
       return;
 
    /* Match the appropriate variant */
+   struct panfrost_screen *screen = pan_screen(ctx->base.screen);
    struct panfrost_uncompiled_shader *uncompiled = ctx->uncompiled[type];
-   struct panfrost_compiled_shader *compiled = NULL;
-
-   simple_mtx_lock(&uncompiled->lock);
+   struct panfrost_compiled_shader *last = ctx->prog[type];
 
+   /* The key only depends on context state and on immutable parts of the
+    * uncompiled shader, so it can be built without the lock.
+    */
    struct panfrost_shader_key key = {0};
    panfrost_build_key(ctx, &key, uncompiled);
 
-   util_dynarray_foreach(&uncompiled->variants, struct panfrost_compiled_shader,
-                         so) {
-      if (memcmp(&key, &so->key, sizeof(key)) == 0) {
-         compiled = so;
-         break;
+   /* Fast path: the variant bound last time is still the right one. It was
+    * finished by this context when it was bound, so nothing else to do.
+    */
+   if (last && !(ctx->pending_variants & BITFIELD_BIT(type)) &&
+       memcmp(&key, &last->key, sizeof(key)) == 0)
+      return;
+
+   ctx->pending_variants &= ~BITFIELD_BIT(type);
+
+   uint32_t hash = panfrost_shader_key_hash(&key);
+
+   simple_mtx_lock(&uncompiled->lock);
+
+   struct panfrost_compiled_shader *compiled =
+      panfrost_lookup_variant_locked(uncompiled, &key, hash);
+
+   if (compiled == NULL)
+      compiled = panfrost_new_variant_locked(ctx, uncompiled, &key, hash, true);
+
+   if (!util_queue_fence_is_signalled(&compiled->ready)) {
+      struct panfrost_compiled_shader *stand_in =
+         panfrost_find_stand_in_locked(uncompiled, &key);
+
+      if (stand_in || screen->driconf.skip_draws_while_compiling) {
+         perf_debug_ctx(ctx, "Shader variant still compiling, %s",
+                        stand_in ? "using a stand-in" : "skipping draws");
+         ctx->pending_variants |= BITFIELD_BIT(type);
+         compiled = stand_in;
+      } else {
+         util_queue_fence_wait(&compiled->ready);
       }
    }
 
-   if (compiled == NULL)
-      compiled = panfrost_new_variant_locked(ctx, uncompiled, &key);
+   if (compiled)
+      panfrost_finish_variant_locked(ctx, uncompiled, compiled);
+
+   if (ctx->prog[type] != compiled) {
+      ctx->dirty |= PAN_DIRTY_TLS_SIZE;
+      ctx->dirty_shader[type] |= PAN_DIRTY_STAGE_SHADER;
+   }
 
    ctx->prog[type] = compiled;
 
@@ -426,8 +673,8 @@ panfrost_create_shader_state(struct pipe_context *pctx,
       so->xfb = calloc(1, sizeof(struct panfrost_compiled_shader));
       so->xfb->key.vs_is_xfb = true;
 
-      panfrost_shader_get(ctx->base.screen, &ctx->shaders, &ctx->descs, so,
-                          &ctx->base.debug, so->xfb, 0);
+      panfrost_shader_get(ctx->base.screen, &ctx->shaders, &ctx->descs,
+                          &ctx->pool_lock, so, &ctx->base.debug, so->xfb, 0);
 
       /* Since transform feedback is handled via the transform
        * feedback program, the original program no longer uses XFB
@@ -454,9 +701,11 @@ panfrost_create_shader_state(struct pipe_context *pctx,
 
    /* Creating a CSO is single-threaded, so it's ok to use the
     * locked function without explicitly taking the lock. Creating a
-    * default variant acts as a precompile.
+    * default variant acts as a precompile, which happens in the background
+    * and is waited on at first use.
     */
-   panfrost_new_variant_locked(ctx, so, &key);
+   panfrost_new_variant_locked(ctx, so, &key, panfrost_shader_key_hash(&key),
+                               true);
 
    return so;
 }
@@ -464,10 +713,32 @@ panfrost_create_shader_state(struct pipe_context *pctx,
 static void
 panfrost_delete_shader_state(struct pipe_context *pctx, void *so)
 {
+   struct panfrost_context *ctx = pan_context(pctx);
    struct panfrost_uncompiled_shader *cso =
       (struct panfrost_uncompiled_shader *)so;
 
-   util_dynarray_foreach(&cso->variants, struct panfrost_compiled_shader, so) {
+   /* Don't keep waiting for a variant of a shader that is going away */
+   for (unsigned type = 0; type < PIPE_SHADER_TYPES; ++type) {
+      if (ctx->uncompiled[type] == cso)
+         ctx->pending_variants &= ~BITFIELD_BIT(type);
+   }
+
+   list_for_each_entry(struct panfrost_compiled_shader, so, &cso->variants,
+                       link) {
+      util_queue_fence_wait(&so->ready);
+      util_queue_fence_destroy(&so->ready);
+
+      if (so->pending) {
+         util_dynarray_fini(&so->pending->binary);
+         free(so->pending);
+      }
+
+      util_dynarray_foreach(&so->pending_messages,
+                            struct panfrost_debug_message, msg)
+         free(msg->text);
+
+      util_dynarray_fini(&so->pending_messages);
+
       panfrost_bo_unreference(so->bin.bo);
       panfrost_bo_unreference(so->state.bo);
       panfrost_bo_unreference(so->linkage.bo);
@@ -495,13 +766,15 @@ panfrost_create_compute_state(struct pipe_context *pctx,
 {
    struct panfrost_context *ctx = pan_context(pctx);
    struct panfrost_uncompiled_shader *so = panfrost_alloc_shader(cso->prog);
-   struct panfrost_compiled_shader *v = panfrost_alloc_variant(so);
-   memset(v, 0, sizeof *v);
+   struct panfrost_shader_key key = {0};
+   struct panfrost_compiled_shader *v =
+      panfrost_alloc_variant(so, &key, panfrost_shader_key_hash(&key));
 
    assert(cso->ir_type == PIPE_SHADER_IR_NIR && "TGSI kernels unsupported");
 
-   panfrost_shader_get(pctx->screen, &ctx->shaders, &ctx->descs, so,
-                       &ctx->base.debug, v, cso->static_shared_mem);
+   panfrost_shader_get(pctx->screen, &ctx->shaders, &ctx->descs,
+                       &ctx->pool_lock, so, &ctx->base.debug, v,
+                       cso->static_shared_mem);
 
    /* The NIR becomes invalid after this. For compute kernels, we never
     * need to access it again. Don't keep a dangling pointer around.
@@ -521,7 +794,9 @@ panfrost_bind_compute_state(struct pipe_context *pipe, void *cso)
    ctx->uncompiled[PIPE_SHADER_COMPUTE] = uncompiled;
 
    ctx->prog[PIPE_SHADER_COMPUTE] =
-      uncompiled ? util_dynarray_begin(&uncompiled->variants) : NULL;
+      uncompiled ? list_first_entry(&uncompiled->variants,
+                                    struct panfrost_compiled_shader, link)
+                 : NULL;
 }
 
 static void
@@ -530,8 +805,8 @@ panfrost_get_compute_state_info(struct pipe_context *pipe, void *cso,
 {
    struct panfrost_device *dev = pan_device(pipe->screen);
    struct panfrost_uncompiled_shader *uncompiled = cso;
-   struct panfrost_compiled_shader *cs =
-      util_dynarray_begin(&uncompiled->variants);
+   struct panfrost_compiled_shader *cs = list_first_entry(
+      &uncompiled->variants, struct panfrost_compiled_shader, link);
 
    info->max_threads = panfrost_compute_max_thread_count(
       &dev->kmod.props, cs->info.work_reg_count);
@@ -540,6 +815,48 @@ panfrost_get_compute_state_info(struct pipe_context *pipe, void *cso,
    info->preferred_simd_size = info->simd_sizes;
 }
 
+static void
+panfrost_set_max_shader_compiler_threads(struct pipe_screen *pscreen,
+                                         unsigned max_threads)
+{
+   struct panfrost_screen *screen = pan_screen(pscreen);
+
+   util_queue_adjust_num_threads(&screen->shader_compiler_queue, max_threads,
+                                 false);
+}
+
+static bool
+panfrost_is_parallel_shader_compilation_finished(struct pipe_screen *pscreen,
+                                                 void *cso,
+                                                 enum pipe_shader_type type)
+{
+   struct panfrost_uncompiled_shader *uncompiled = cso;
+   bool finished = true;
+
+   simple_mtx_lock(&uncompiled->lock);
+
+   list_for_each_entry(struct panfrost_compiled_shader, so,
+                       &uncompiled->variants, link) {
+      if (!util_queue_fence_is_signalled(&so->ready)) {
+         finished = false;
+         break;
+      }
+   }
+
+   simple_mtx_unlock(&uncompiled->lock);
+
+   return finished;
+}
+
+void
+panfrost_shader_screen_init(struct pipe_screen *pscreen)
+{
+   pscreen->set_max_shader_compiler_threads =
+      panfrost_set_max_shader_compiler_threads;
+   pscreen->is_parallel_shader_compilation_finished =
+      panfrost_is_parallel_shader_compilation_finished;
+}
+
 void
 panfrost_shader_context_init(struct pipe_context *pctx)
 {
@@ -0,0 +1,148 @@
+#
+# Copyright 2026 agent <agent@local>
+#
+# Permission is hereby granted, free of charge, to any person obtaining a
+# copy of this software and associated documentation files (the "Software"),
+# to deal in the Software without restriction, including without limitation
+# the rights to use, copy, modify, merge, publish, distribute, sublicense,
+# and/or sell copies of the Software, and to permit persons to whom the
+# Software is furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice (including the next
+# paragraph) shall be included in all copies or substantial portions of the
+# Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+# THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+# FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+# IN THE SOFTWARE.
+#
+
+import argparse
+import sys
+
+parser = argparse.ArgumentParser()
+parser.add_argument('-p', '--import-path', required=True)
+parser.add_argument('-C', '--src', required=True)
+parser.add_argument('-H', '--hdr', required=True)
+parser.add_argument('--perfetto-hdr', required=True)
+args = parser.parse_args()
+sys.path.insert(0, args.import_path)
+
+
+from u_trace import Header
+from u_trace import HeaderScope
+from u_trace import Tracepoint
+from u_trace import TracepointArg as Arg
+from u_trace import utrace_generate
+from u_trace import utrace_generate_perfetto_utils
+
+# List of the default tracepoints enabled. By default tracepoints are enabled,
+# set tp_default_enabled=False to disable them by default.
+pan_default_tps = []
+
+#
+# Tracepoint definitions:
+#
+
+Header('util/format/u_formats.h')
+Header('util/format/u_format.h',
+       scope=HeaderScope.SOURCE | HeaderScope.PERFETTO)
+
+
+# Timestamps are taken on the CPU when the tracepoint is recorded, except for
+# end_of_pipe tracepoints, which get the time the batch was seen completing.
+# String arguments are kept by pointer, so they must be static.
+def begin_end_tp(name, args=[], tp_print=None, tp_default_enabled=True,
+                 end_of_pipe=False):
+    global pan_default_tps
+    if tp_default_enabled:
+        pan_default_tps.append(name)
+    Tracepoint('start_{0}'.format(name),
+               toggle_name=name,
+               tp_perfetto='pan_start_{0}'.format(name),
+               need_cs_param=False)
+    Tracepoint('end_{0}'.format(name),
+               toggle_name=name,
+               args=args,
+               tp_perfetto='pan_end_{0}'.format(name),
+               tp_print=tp_print,
+               end_of_pipe=end_of_pipe,
+               need_cs_param=False)
+
+
+# From the submission of a batch to its completion on the GPU
+begin_end_tp('batch',
+    args=[Arg(type='const char *',     var='reason',       c_format='%s'),
+          Arg(type='uint32_t',         var='draws',        c_format='%u'),
+          Arg(type='uint32_t',         var='computes',     c_format='%u'),
+          Arg(type='uint8_t',          var='fragment',     c_format='%u'),
+          Arg(type='uint16_t',         var='width',        c_format='%u'),
+          Arg(type='uint16_t',         var='height',       c_format='%u'),
+          Arg(type='uint8_t',          var='cbufs',        c_format='%u'),
+          Arg(type='enum pipe_format', var='cbuf0_format', c_format='%s', to_prim_type='util_format_short_name({})'),
+          Arg(type='enum pipe_format', var='zs_format',    c_format='%s', to_prim_type='util_format_short_name({})')],
+    tp_print=['reason=%s, draws=%u, computes=%u, fragment=%u, %ux%u, cbufs=%u, cbuf0=%s, zs=%s',
+        '__entry->reason', '__entry->draws', '__entry->computes',
+        '__entry->fragment', '__entry->width', '__entry->height',
+        '__entry->cbufs', 'util_format_short_name(__entry->cbuf0_format)',
+        'util_format_short_name(__entry->zs_format)'],
+    end_of_pipe=True,
+)
+
+# Everything below covers the CPU side of the work
+
+begin_end_tp('flush',
+    args=[Arg(type='const char *', var='reason', c_format='%s')],
+    tp_print=['reason=%s', '__entry->reason'],
+)
+
+begin_end_tp('fragment_job',
+    args=[Arg(type='uint16_t', var='minx', c_format='%u'),
+          Arg(type='uint16_t', var='miny', c_format='%u'),
+          Arg(type='uint16_t', var='maxx', c_format='%u'),
+          Arg(type='uint16_t', var='maxy', c_format='%u')],
+    tp_print=['(%u, %u) -> (%u, %u)', '__entry->minx', '__entry->miny',
+        '__entry->maxx', '__entry->maxy'],
+)
+
+begin_end_tp('blit',
+    args=[Arg(type='enum pipe_format', var='src_format', c_format='%s', to_prim_type='util_format_short_name({})'),
+          Arg(type='enum pipe_format', var='dst_format', c_format='%s', to_prim_type='util_format_short_name({})'),
+          Arg(type='uint16_t',         var='width',      c_format='%u'),
+          Arg(type='uint16_t',         var='height',     c_format='%u')],
+    tp_print=['%s -> %s, %ux%u',
+        'util_format_short_name(__entry->src_format)',
+        'util_format_short_name(__entry->dst_format)',
+        '__entry->width', '__entry->height'],
+)
+
+begin_end_tp('afbc',
+    args=[Arg(type='const char *', var='op',     c_format='%s'),
+          Arg(type='uint8_t',      var='levels', c_format='%u')],
+    tp_print=['%s, levels=%u', '__entry->op', '__entry->levels'],
+)
+
+begin_end_tp('compute',
+    args=[Arg(type='uint8_t',  var='indirect', c_format='%u'),
+          Arg(type='uint16_t', var='block_x',  c_format='%u'),
+          Arg(type='uint16_t', var='block_y',  c_format='%u'),
+          Arg(type='uint16_t', var='block_z',  c_format='%u'),
+          Arg(type='uint32_t', var='grid_x',   c_format='%u'),
+          Arg(type='uint32_t', var='grid_y',   c_format='%u'),
+          Arg(type='uint32_t', var='grid_z',   c_format='%u')],
+    tp_print=['indirect=%u, block=%ux%ux%u, grid=%ux%ux%u',
+        '__entry->indirect', '__entry->block_x', '__entry->block_y',
+        '__entry->block_z', '__entry->grid_x', '__entry->grid_y',
+        '__entry->grid_z'],
+)
+
+utrace_generate(cpath=args.src,
+                hpath=args.hdr,
+                ctx_param='struct pipe_context *pctx',
+                trace_toggle_name='pan_gpu_tracepoint',
+                trace_toggle_defaults=pan_default_tps)
+utrace_generate_perfetto_utils(hpath=args.perfetto_hdr)
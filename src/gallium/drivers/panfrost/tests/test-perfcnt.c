@@ -0,0 +1,350 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Test the counter queries of the Gallium driver against a fake counter
+ * source, which fills every counter of block N with (N + 1) times the dump
+ * number. pan_perfcnt.c is built on its own, with the batch code below
+ * standing in for pan_job.c.
+ */
+
+#include "perf/pan_perf.h"
+#include "util/ralloc.h"
+#include "pan_context.h"
+#include "pan_perfcnt.h"
+#include "pan_screen.h"
+
+#define L2_SLICES     2
+#define CORE_ID_RANGE 4
+
+static unsigned flushes;
+static unsigned dumps;
+static bool enabled;
+
+void
+panfrost_flush_all_batches(struct panfrost_context *ctx, const char *reason)
+{
+   flushes++;
+}
+
+void
+panfrost_wait_submits(struct panfrost_context *ctx)
+{
+}
+
+static int
+fake_enable(struct panfrost_perf *perf)
+{
+   enabled = true;
+   return 0;
+}
+
+static int
+fake_disable(struct panfrost_perf *perf)
+{
+   enabled = false;
+   return 0;
+}
+
+static int
+fake_dump(struct panfrost_perf *perf)
+{
+   if (!enabled)
+      return -1;
+
+   dumps++;
+
+   for (unsigned i = 0; i < perf->n_counter_values; ++i)
+      perf->counter_values[i] = (i / 64 + 1) * dumps;
+
+   return 0;
+}
+
+static const struct panfrost_perf_source fake_source = {
+   .enable = fake_enable,
+   .disable = fake_disable,
+   .dump = fake_dump,
+};
+
+struct fixture {
+   struct panfrost_screen *screen;
+   struct panfrost_context *ctx;
+   struct pan_kmod_dev kdev;
+};
+
+static void
+setup(struct fixture *f)
+{
+   flushes = 0;
+   dumps = 0;
+   enabled = false;
+
+   f->screen = calloc(1, sizeof(*f->screen));
+   f->ctx = calloc(1, sizeof(*f->ctx));
+
+   /* Waiting on the context syncobj fails harmlessly without a device */
+   f->kdev = (struct pan_kmod_dev){.fd = -1};
+   f->screen->dev.kmod.dev = &f->kdev;
+
+   simple_mtx_init(&f->screen->perfcnt.lock, mtx_plain);
+   f->screen->perfcnt.cfg = panfrost_perf_lookup_config("TGOx");
+   f->screen->perfcnt.perf = rzalloc(NULL, struct panfrost_perf);
+   panfrost_perf_init_layout(f->screen->perfcnt.perf, f->screen->perfcnt.cfg,
+                             L2_SLICES, CORE_ID_RANGE);
+   f->screen->perfcnt.perf->source = &fake_source;
+
+   f->ctx->base.screen = &f->screen->base;
+   list_inithead(&f->ctx->perf_queries);
+}
+
+static void
+teardown(struct fixture *f)
+{
+   ralloc_free(f->screen->perfcnt.perf);
+   simple_mtx_destroy(&f->screen->perfcnt.lock);
+   free(f->ctx);
+   free(f->screen);
+}
+
+/* Query type of the first counter of a category */
+static unsigned
+counter_type(const struct panfrost_perf_config *cfg, unsigned category)
+{
+   unsigned index = 0;
+
+   for (unsigned i = 0; i < category; ++i)
+      index += cfg->categories[i].n_counters;
+
+   return PAN_QUERY_FIRST_PERFCNT + index;
+}
+
+static unsigned nr_pass = 0, nr_fail = 0;
+
+#define CHECK(cond)                                                            \
+   do {                                                                        \
+      if (cond) {                                                              \
+         nr_pass++;                                                            \
+      } else {                                                                 \
+         nr_fail++;                                                            \
+         fprintf(stderr, "%s:%u: check failed: %s\n", __func__, __LINE__,      \
+                 #cond);                                                       \
+      }                                                                        \
+   } while (0)
+
+static void
+test_query_info(void)
+{
+   struct fixture f;
+   setup(&f);
+
+   const struct panfrost_perf_config *cfg = f.screen->perfcnt.cfg;
+   struct pipe_driver_query_info info;
+   struct pipe_driver_query_group_info group;
+
+   CHECK(panfrost_perfcnt_num_queries(f.screen) ==
+         panfrost_perf_num_counters(cfg));
+
+   CHECK(panfrost_perfcnt_get_query_info(f.screen, 0, &info) == 1);
+   CHECK(info.query_type == PAN_QUERY_FIRST_PERFCNT);
+   CHECK(info.flags & PIPE_DRIVER_QUERY_FLAG_BATCH);
+   CHECK(info.group_id == 0);
+   CHECK(panfrost_perfcnt_get_query_info(
+            f.screen, panfrost_perf_num_counters(cfg), &info) == 0);
+
+   CHECK(panfrost_get_driver_query_group_info(&f.screen->base, 0, NULL) ==
+         cfg->n_categories);
+   CHECK(panfrost_get_driver_query_group_info(&f.screen->base, 1, &group) ==
+         1);
+   CHECK(group.num_queries == cfg->categories[1].n_counters);
+   CHECK(panfrost_get_driver_query_group_info(&f.screen->base,
+                                              cfg->n_categories, &group) == 0);
+
+   teardown(&f);
+}
+
+static void
+test_create_query(void)
+{
+   struct fixture f;
+   setup(&f);
+
+   const struct panfrost_perf_config *cfg = f.screen->perfcnt.cfg;
+   unsigned types[] = {counter_type(cfg, 0), counter_type(cfg, 3)};
+   struct panfrost_query *q =
+      panfrost_perfcnt_create_query(f.ctx, ARRAY_SIZE(types), types);
+
+   CHECK(q != NULL);
+   CHECK(q->perf.count == 2);
+   CHECK(q->perf.counters[0] == &cfg->categories[0].counters[0]);
+   CHECK(q->perf.counters[1] == &cfg->categories[3].counters[0]);
+   ralloc_free(q);
+
+   /* Software queries and unknown counters can't be batched */
+   unsigned sw[] = {counter_type(cfg, 0), PIPE_QUERY_DRIVER_SPECIFIC};
+   CHECK(panfrost_perfcnt_create_query(f.ctx, ARRAY_SIZE(sw), sw) == NULL);
+
+   unsigned oob[] = {PAN_QUERY_FIRST_PERFCNT +
+                     panfrost_perf_num_counters(cfg)};
+   CHECK(panfrost_perfcnt_create_query(f.ctx, 1, oob) == NULL);
+
+   /* Nothing to batch without counters */
+   f.screen->perfcnt.cfg = NULL;
+   CHECK(panfrost_perfcnt_create_query(f.ctx, 1, types) == NULL);
+
+   teardown(&f);
+}
+
+static void
+test_begin_end_query(void)
+{
+   struct fixture f;
+   setup(&f);
+
+   const struct panfrost_perf_config *cfg = f.screen->perfcnt.cfg;
+   unsigned types[] = {counter_type(cfg, 1)};
+   struct panfrost_query *a = panfrost_perfcnt_create_query(f.ctx, 1, types);
+   struct panfrost_query *b = panfrost_perfcnt_create_query(f.ctx, 1, types);
+
+   /* Work recorded before the query isn't counted */
+   CHECK(panfrost_perfcnt_begin_query(f.ctx, a));
+   CHECK(flushes == 1);
+   CHECK(enabled);
+   CHECK(a->perf.active);
+   CHECK(list_length(&f.ctx->perf_queries) == 1);
+
+   /* Beginning twice is harmless */
+   CHECK(panfrost_perfcnt_begin_query(f.ctx, a));
+   CHECK(list_length(&f.ctx->perf_queries) == 1);
+
+   CHECK(panfrost_perfcnt_begin_query(f.ctx, b));
+   CHECK(f.screen->perfcnt.users == 2);
+
+   /* Counters stay enabled until the last query ends */
+   panfrost_perfcnt_end_query(f.ctx, a);
+   CHECK(!a->perf.active);
+   CHECK(enabled);
+
+   panfrost_perfcnt_destroy_query(f.ctx, b);
+   CHECK(!enabled);
+   CHECK(f.screen->perfcnt.users == 0);
+   CHECK(list_is_empty(&f.ctx->perf_queries));
+
+   ralloc_free(a);
+   ralloc_free(b);
+   teardown(&f);
+}
+
+static void
+test_batch_accumulation(void)
+{
+   struct fixture f;
+   setup(&f);
+
+   const struct panfrost_perf_config *cfg = f.screen->perfcnt.cfg;
+   unsigned tiler[] = {counter_type(cfg, 1)};
+   unsigned both[] = {counter_type(cfg, 0), counter_type(cfg, 2)};
+   struct panfrost_query *a = panfrost_perfcnt_create_query(f.ctx, 1, tiler);
+   struct panfrost_query *b = panfrost_perfcnt_create_query(f.ctx, 2, both);
+   struct panfrost_query *idle = panfrost_perfcnt_create_query(f.ctx, 1, tiler);
+
+   panfrost_perfcnt_begin_query(f.ctx, a);
+   panfrost_perfcnt_begin_query(f.ctx, b);
+
+   /* Two batches: dumps 1 and 3 clear the counters, 2 and 4 are read */
+   for (unsigned i = 0; i < 2; ++i) {
+      panfrost_perfcnt_begin_batch(f.ctx);
+      panfrost_perfcnt_end_batch(f.ctx);
+   }
+
+   CHECK(dumps == 4);
+
+   /* Job manager, tiler and first L2 slice are blocks 0, 1 and 2 */
+   CHECK(a->perf.values[0] == 2 * (2 + 4));
+   CHECK(b->perf.values[0] == 1 * (2 + 4));
+   CHECK(b->perf.values[1] == 3 * (2 + 4));
+
+   /* Only active queries accumulate */
+   CHECK(idle->perf.values[0] == 0);
+
+   panfrost_perfcnt_end_query(f.ctx, b);
+
+   panfrost_perfcnt_begin_batch(f.ctx);
+   panfrost_perfcnt_end_batch(f.ctx);
+
+   CHECK(a->perf.values[0] == 2 * (2 + 4 + 6));
+   CHECK(b->perf.values[0] == 1 * (2 + 4));
+
+   union pipe_query_result result;
+   panfrost_perfcnt_get_query_result(b, &result);
+   CHECK(result.batch[0].u64 == 6);
+   CHECK(result.batch[1].u64 == 18);
+
+   /* Beginning again starts from zero */
+   panfrost_perfcnt_begin_query(f.ctx, b);
+   CHECK(b->perf.values[0] == 0 && b->perf.values[1] == 0);
+
+   panfrost_perfcnt_end_query(f.ctx, a);
+   panfrost_perfcnt_end_query(f.ctx, b);
+
+   ralloc_free(a);
+   ralloc_free(b);
+   ralloc_free(idle);
+   teardown(&f);
+}
+
+static void
+test_failed_dump(void)
+{
+   struct fixture f;
+   setup(&f);
+
+   const struct panfrost_perf_config *cfg = f.screen->perfcnt.cfg;
+   unsigned tiler[] = {counter_type(cfg, 1)};
+   struct panfrost_query *q = panfrost_perfcnt_create_query(f.ctx, 1, tiler);
+
+   panfrost_perfcnt_begin_query(f.ctx, q);
+
+   /* Counters taken away behind our back don't produce garbage */
+   enabled = false;
+   panfrost_perfcnt_begin_batch(f.ctx);
+   panfrost_perfcnt_end_batch(f.ctx);
+
+   CHECK(q->perf.values[0] == 0);
+
+   panfrost_perfcnt_end_query(f.ctx, q);
+   ralloc_free(q);
+   teardown(&f);
+}
+
+int
+main(int argc, const char **argv)
+{
+   test_query_info();
+   test_create_query();
+   test_begin_end_query();
+   test_batch_accumulation();
+   test_failed_dump();
+
+   printf("Passed %u/%u\n", nr_pass, nr_pass + nr_fail);
+   return nr_fail ? 1 : 0;
+}
@@ -0,0 +1,283 @@
+/**************************************************************************
+ *
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+/*
+ * Measures the CPU cost of submitting a batch as a function of the number of
+ * BOs it references. Each submit draws a triangle out of each of N vertex
+ * buffers, then flushes and waits.
+ *
+ * This is meant to be run against a drm-shim no-op device, so only driver
+ * overhead is measured, e.g. for panfrost:
+ *
+ *   LD_PRELOAD=libpanfrost_noop_drm_shim.so ./bo-submit [max-bos] [iterations] [ballast]
+ *
+ * "ballast" BOs are allocated upfront and never used, to check the cost does
+ * not depend on the GEM handle numbers in use by the process.
+ *
+ * Setting pan_async_submit=true in the environment exercises the panfrost
+ * submit thread instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define WIDTH 64
+#define HEIGHT 64
+
+/* Big enough to not be suballocated, so each buffer is its own BO */
+#define VBUF_SIZE (64 * 1024)
+
+#include "pipe/p_state.h"
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_defines.h"
+#include "pipe/p_shader_tokens.h"
+#include "util/u_inlines.h"
+
+#include "cso_cache/cso_context.h"
+
+#include "util/os_time.h"
+#include "util/u_draw_quad.h"
+#include "util/u_memory.h"
+#include "util/u_simple_shaders.h"
+#include "pipe-loader/pipe_loader.h"
+
+struct program
+{
+	struct pipe_loader_device *dev;
+	struct pipe_screen *screen;
+	struct pipe_context *pipe;
+	struct cso_context *cso;
+
+	struct pipe_blend_state blend;
+	struct pipe_depth_stencil_alpha_state depthstencil;
+	struct pipe_rasterizer_state rasterizer;
+	struct pipe_viewport_state viewport;
+	struct pipe_framebuffer_state framebuffer;
+	struct cso_velems_state velem;
+
+	void *vs;
+	void *fs;
+
+	unsigned num_vbufs;
+	struct pipe_resource **vbufs;
+
+	unsigned num_ballast;
+	struct pipe_resource **ballast;
+
+	struct pipe_resource *target;
+};
+
+static void init_prog(struct program *p)
+{
+	struct pipe_surface surf_tmpl;
+	ASSERTED int ret;
+
+	ret = pipe_loader_probe(&p->dev, 1, false);
+	assert(ret);
+
+	p->screen = pipe_loader_create_screen(p->dev);
+	assert(p->screen);
+
+	p->pipe = p->screen->context_create(p->screen, NULL, 0);
+	p->cso = cso_create_context(p->pipe, 0);
+
+	/* Allocate the ballast first so the vertex buffers get high handles */
+	p->ballast = CALLOC(p->num_ballast, sizeof(*p->ballast));
+	for (unsigned i = 0; i < p->num_ballast; ++i) {
+		p->ballast[i] = pipe_buffer_create(p->screen, PIPE_BIND_VERTEX_BUFFER,
+						   PIPE_USAGE_DEFAULT, VBUF_SIZE);
+	}
+
+	{
+		float vertices[3][2][4] = {
+			{ { 0.0f, -0.9f, 0.0f, 1.0f }, { 1.0f, 0.0f, 0.0f, 1.0f } },
+			{ { -0.9f, 0.9f, 0.0f, 1.0f }, { 0.0f, 1.0f, 0.0f, 1.0f } },
+			{ { 0.9f, 0.9f, 0.0f, 1.0f }, { 0.0f, 0.0f, 1.0f, 1.0f } },
+		};
+
+		p->vbufs = CALLOC(p->num_vbufs, sizeof(*p->vbufs));
+		for (unsigned i = 0; i < p->num_vbufs; ++i) {
+			p->vbufs[i] = pipe_buffer_create(p->screen, PIPE_BIND_VERTEX_BUFFER,
+							 PIPE_USAGE_DEFAULT, VBUF_SIZE);
+			pipe_buffer_write(p->pipe, p->vbufs[i], 0, sizeof(vertices), vertices);
+		}
+	}
+
+	{
+		struct pipe_resource tmplt;
+		memset(&tmplt, 0, sizeof(tmplt));
+		tmplt.target = PIPE_TEXTURE_2D;
+		tmplt.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+		tmplt.width0 = WIDTH;
+		tmplt.height0 = HEIGHT;
+		tmplt.depth0 = 1;
+		tmplt.array_size = 1;
+		tmplt.last_level = 0;
+		tmplt.bind = PIPE_BIND_RENDER_TARGET;
+
+		p->target = p->screen->resource_create(p->screen, &tmplt);
+	}
+
+	memset(&p->blend, 0, sizeof(p->blend));
+	p->blend.rt[0].colormask = PIPE_MASK_RGBA;
+
+	memset(&p->depthstencil, 0, sizeof(p->depthstencil));
+
+	memset(&p->rasterizer, 0, sizeof(p->rasterizer));
+	p->rasterizer.cull_face = PIPE_FACE_NONE;
+	p->rasterizer.half_pixel_center = 1;
+	p->rasterizer.bottom_edge_rule = 1;
+	p->rasterizer.depth_clip_near = 1;
+	p->rasterizer.depth_clip_far = 1;
+
+	surf_tmpl.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+	surf_tmpl.u.tex.level = 0;
+	surf_tmpl.u.tex.first_layer = 0;
+	surf_tmpl.u.tex.last_layer = 0;
+
+	memset(&p->framebuffer, 0, sizeof(p->framebuffer));
+	p->framebuffer.width = WIDTH;
+	p->framebuffer.height = HEIGHT;
+	p->framebuffer.nr_cbufs = 1;
+	p->framebuffer.cbufs[0] = p->pipe->create_surface(p->pipe, p->target, &surf_tmpl);
+
+	p->viewport.scale[0] = WIDTH / 2.0f;
+	p->viewport.scale[1] = HEIGHT / 2.0f;
+	p->viewport.scale[2] = 0.5f;
+	p->viewport.translate[0] = WIDTH / 2.0f;
+	p->viewport.translate[1] = HEIGHT / 2.0f;
+	p->viewport.translate[2] = 0.5f;
+	p->viewport.swizzle_x = PIPE_VIEWPORT_SWIZZLE_POSITIVE_X;
+	p->viewport.swizzle_y = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Y;
+	p->viewport.swizzle_z = PIPE_VIEWPORT_SWIZZLE_POSITIVE_Z;
+	p->viewport.swizzle_w = PIPE_VIEWPORT_SWIZZLE_POSITIVE_W;
+
+	memset(&p->velem, 0, sizeof(p->velem));
+	p->velem.count = 2;
+
+	p->velem.velems[0].src_offset = 0 * 4 * sizeof(float);
+	p->velem.velems[0].vertex_buffer_index = 0;
+	p->velem.velems[0].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+	p->velem.velems[0].src_stride = 2 * 4 * sizeof(float);
+
+	p->velem.velems[1].src_offset = 1 * 4 * sizeof(float);
+	p->velem.velems[1].vertex_buffer_index = 0;
+	p->velem.velems[1].src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+	p->velem.velems[1].src_stride = 2 * 4 * sizeof(float);
+
+	{
+		const enum tgsi_semantic semantic_names[] =
+			{ TGSI_SEMANTIC_POSITION, TGSI_SEMANTIC_COLOR };
+		const uint semantic_indexes[] = { 0, 0 };
+		p->vs = util_make_vertex_passthrough_shader(p->pipe, 2, semantic_names, semantic_indexes, false);
+	}
+
+	p->fs = util_make_fragment_passthrough_shader(p->pipe,
+		    TGSI_SEMANTIC_COLOR, TGSI_INTERPOLATE_PERSPECTIVE, true);
+
+	cso_set_framebuffer(p->cso, &p->framebuffer);
+	cso_set_blend(p->cso, &p->blend);
+	cso_set_depth_stencil_alpha(p->cso, &p->depthstencil);
+	cso_set_rasterizer(p->cso, &p->rasterizer);
+	cso_set_viewport(p->cso, &p->viewport);
+	cso_set_fragment_shader_handle(p->cso, p->fs);
+	cso_set_vertex_shader_handle(p->cso, p->vs);
+	cso_set_vertex_elements(p->cso, &p->velem);
+}
+
+static void close_prog(struct program *p)
+{
+	cso_destroy_context(p->cso);
+
+	p->pipe->delete_vs_state(p->pipe, p->vs);
+	p->pipe->delete_fs_state(p->pipe, p->fs);
+
+	pipe_surface_reference(&p->framebuffer.cbufs[0], NULL);
+	pipe_resource_reference(&p->target, NULL);
+
+	for (unsigned i = 0; i < p->num_vbufs; ++i)
+		pipe_resource_reference(&p->vbufs[i], NULL);
+
+	for (unsigned i = 0; i < p->num_ballast; ++i)
+		pipe_resource_reference(&p->ballast[i], NULL);
+
+	FREE(p->vbufs);
+	FREE(p->ballast);
+
+	p->pipe->destroy(p->pipe);
+	p->screen->destroy(p->screen);
+	pipe_loader_release(&p->dev, 1);
+
+	FREE(p);
+}
+
+static void submit(struct program *p, unsigned num_bos)
+{
+	struct pipe_fence_handle *fence = NULL;
+
+	for (unsigned i = 0; i < num_bos; ++i) {
+		util_draw_vertex_buffer(p->pipe, p->cso, p->vbufs[i], 0, false,
+					MESA_PRIM_TRIANGLES, 3, 2);
+	}
+
+	p->pipe->flush(p->pipe, &fence, 0);
+	p->screen->fence_finish(p->screen, NULL, fence, OS_TIMEOUT_INFINITE);
+	p->screen->fence_reference(p->screen, &fence, NULL);
+}
+
+int main(int argc, char** argv)
+{
+	struct program *p = CALLOC_STRUCT(program);
+	unsigned iterations;
+
+	p->num_vbufs = argc > 1 ? atoi(argv[1]) : 4096;
+	iterations = argc > 2 ? atoi(argv[2]) : 100;
+	p->num_ballast = argc > 3 ? atoi(argv[3]) : 0;
+
+	init_prog(p);
+
+	/* Warm up caches and shader variants */
+	submit(p, 1);
+
+	printf("%8s %14s %14s\n", "BOs", "us/submit", "ns/BO");
+
+	for (unsigned num_bos = 1; num_bos <= p->num_vbufs; num_bos *= 4) {
+		int64_t start = os_time_get_nano();
+
+		for (unsigned i = 0; i < iterations; ++i)
+			submit(p, num_bos);
+
+		int64_t elapsed = os_time_get_nano() - start;
+
+		printf("%8u %14.2f %14.2f\n", num_bos,
+		       elapsed / (iterations * 1000.0),
+		       elapsed / ((double)iterations * num_bos));
+	}
+
+	close_prog(p);
+
+	return 0;
+}
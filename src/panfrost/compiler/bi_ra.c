@@ -86,6 +86,56 @@ lcra_free(struct lcra_state *l)
    free(l);
 }
 
+/* Incremental spilling adds nodes to an existing set of equations. New nodes
+ * start out unconstrained and unsolved. */
+
+static void
+lcra_grow(struct lcra_state *l, unsigned node_count)
+{
+   unsigned old_count = l->node_count;
+
+   if (node_count <= old_count)
+      return;
+
+   l->linear = realloc(l->linear, sizeof(l->linear[0]) * node_count);
+   l->solutions = realloc(l->solutions, sizeof(l->solutions[0]) * node_count);
+   l->affinity = realloc(l->affinity, sizeof(l->affinity[0]) * node_count);
+
+   for (unsigned i = old_count; i < node_count; ++i) {
+      nodearray_init(&l->linear[i]);
+      l->solutions[i] = ~0;
+      l->affinity[i] = 0;
+   }
+
+   for (unsigned i = 0; i < old_count; ++i)
+      nodearray_grow(&l->linear[i], node_count);
+
+   l->node_count = node_count;
+}
+
+/* Drop every constraint involving a node, used once it has been spilled and
+ * no longer appears in the program */
+
+static void
+lcra_remove_node(struct lcra_state *l, unsigned i)
+{
+   nodearray *row = &l->linear[i];
+
+   if (nodearray_is_sparse(row)) {
+      nodearray_sparse_foreach(row, elem)
+         nodearray_clear(&l->linear[nodearray_sparse_key(elem)], i);
+   } else {
+      for (unsigned j = 0; j < l->node_count; ++j) {
+         if (row->dense[j])
+            nodearray_clear(&l->linear[j], i);
+      }
+   }
+
+   nodearray_reset(row);
+   l->affinity[i] = 0;
+   l->solutions[i] = ~0;
+}
+
 static void
 lcra_add_node_interference(struct lcra_state *l, unsigned i, unsigned cmask_i,
                            unsigned j, unsigned cmask_j)
@@ -341,10 +391,15 @@ bi_make_affinity(uint64_t clobber, unsigned count, bool split_file)
    return ~clobbered;
 }
 
+/* Interference between nodes below first_node is assumed to be already known,
+ * so only constraints involving a node at or above first_node are added. Pass
+ * zero to mark every interference in the block. */
+
 static void
 bi_mark_interference(bi_block *block, struct lcra_state *l, uint8_t *live,
-                     uint64_t preload_live, unsigned node_count, bool is_blend,
-                     bool split_file, bool aligned_sr)
+                     uint64_t preload_live, unsigned node_count,
+                     unsigned first_node, bool is_blend, bool split_file,
+                     bool aligned_sr)
 {
    bi_foreach_instr_in_block_rev(block, ins) {
       /* Mark all registers live after the instruction as
@@ -369,7 +424,9 @@ bi_mark_interference(bi_block *block, struct lcra_state *l, uint8_t *live,
 
          l->affinity[node] &= affinity;
 
-         for (unsigned i = 0; i < node_count; ++i) {
+         unsigned first = node >= first_node ? 0 : first_node;
+
+         for (unsigned i = first; i < node_count; ++i) {
             uint8_t r = live[i];
 
             /* Nodes only interfere if they occupy
@@ -432,18 +489,67 @@ bi_compute_interference(bi_context *ctx, struct lcra_state *l, bool full_regs)
    bi_foreach_block_rev(ctx, blk) {
       uint8_t *live = mem_dup(blk->live_out, ctx->ssa_alloc);
 
-      bi_mark_interference(blk, l, live, blk->reg_live_out, ctx->ssa_alloc,
+      bi_mark_interference(blk, l, live, blk->reg_live_out, ctx->ssa_alloc, 0,
                            ctx->inputs->is_blend, !full_regs, ctx->arch >= 9);
 
       free(live);
    }
 }
 
-static struct lcra_state *
-bi_allocate_registers(bi_context *ctx, bool *success, bool full_regs)
+/* After spilling, liveness and interference are updated in place rather than
+ * recomputed. Spilling rewrites every access to a spilled node to use a fresh
+ * temporary, which is only live within its block between the access and the
+ * inserted load or store. Block liveness is therefore unchanged except for the
+ * spilled nodes, which are dead everywhere, and interference only changes in
+ * the blocks that were rewritten. Nodes from first_node on were created by
+ * spilling.
+ */
+
+static void
+bi_update_interference(bi_context *ctx, struct lcra_state *l, bool full_regs,
+                       uint64_t default_affinity, const unsigned *spilled,
+                       unsigned nr_spilled, const BITSET_WORD *touched,
+                       unsigned first_node)
 {
-   struct lcra_state *l = lcra_alloc_equations(ctx->ssa_alloc);
+   unsigned old_count = l->node_count;
+
+   lcra_grow(l, ctx->ssa_alloc);
+
+   for (unsigned i = 0; i < nr_spilled; ++i)
+      lcra_remove_node(l, spilled[i]);
+
+   for (unsigned i = first_node; i < ctx->ssa_alloc; ++i)
+      l->affinity[i] = default_affinity;
+
+   bi_foreach_block(ctx, blk) {
+      blk->live_in =
+         rerzalloc(blk, blk->live_in, uint8_t, old_count, ctx->ssa_alloc);
+      blk->live_out =
+         rerzalloc(blk, blk->live_out, uint8_t, old_count, ctx->ssa_alloc);
+
+      for (unsigned i = 0; i < nr_spilled; ++i) {
+         blk->live_in[spilled[i]] = 0;
+         blk->live_out[spilled[i]] = 0;
+      }
+   }
+
+   bi_foreach_block_rev(ctx, blk) {
+      if (!BITSET_TEST(touched, blk->index))
+         continue;
+
+      uint8_t *live = mem_dup(blk->live_out, ctx->ssa_alloc);
 
+      bi_mark_interference(blk, l, live, blk->reg_live_out, ctx->ssa_alloc,
+                           first_node, ctx->inputs->is_blend, !full_regs,
+                           ctx->arch >= 9);
+
+      free(live);
+   }
+}
+
+static uint64_t
+bi_default_affinity(bi_context *ctx, bool full_regs)
+{
    /* Blend shaders are restricted to R0-R15. Other shaders at full
     * occupancy also can access R48-R63. At half occupancy they can access
     * the whole file. */
@@ -457,10 +563,18 @@ bi_allocate_registers(bi_context *ctx, bool *success, bool full_regs)
    if (bifrost_debug & BIFROST_DBG_SPILL && !ctx->inputs->is_blend)
       default_affinity &= BITFIELD64_MASK(48) << 8;
 
-   bi_foreach_instr_global(ctx, ins) {
-      bi_foreach_dest(ins, d)
-         l->affinity[ins->dest[d].value] = default_affinity;
+   return default_affinity;
+}
+
+/* Solve the equations built by bi_allocate_registers, starting over from the
+ * registers forced by the ABI. */
+
+static bool
+bi_solve_registers(bi_context *ctx, struct lcra_state *l)
+{
+   memset(l->solutions, ~0, sizeof(l->solutions[0]) * l->node_count);
 
+   bi_foreach_instr_global(ctx, ins) {
       /* Blend shaders expect the src colour to be in r0-r3 */
       if (ins->op == BI_OPCODE_BLEND && !ctx->inputs->is_blend) {
          assert(bi_is_ssa(ins->src[0]));
@@ -492,8 +606,6 @@ bi_allocate_registers(bi_context *ctx, bool *success, bool full_regs)
       }
    }
 
-   bi_compute_interference(ctx, l, full_regs);
-
    /* Coalesce register moves if we're allowed. We need to be careful due
     * to the restricted affinity induced by the blend shader ABI.
     */
@@ -526,7 +638,24 @@ bi_allocate_registers(bi_context *ctx, bool *success, bool full_regs)
       }
    }
 
-   *success = lcra_solve(l);
+   ctx->ra_iterations++;
+   return lcra_solve(l);
+}
+
+static struct lcra_state *
+bi_allocate_registers(bi_context *ctx, bool *success, bool full_regs)
+{
+   struct lcra_state *l = lcra_alloc_equations(ctx->ssa_alloc);
+   uint64_t default_affinity = bi_default_affinity(ctx, full_regs);
+
+   bi_foreach_instr_global(ctx, ins) {
+      bi_foreach_dest(ins, d)
+         l->affinity[ins->dest[d].value] = default_affinity;
+   }
+
+   bi_compute_interference(ctx, l, full_regs);
+
+   *success = bi_solve_registers(ctx, l);
 
    return l;
 }
@@ -605,12 +734,11 @@ bi_rewrite_index_src_single(bi_instr *ins, bi_index old, bi_index new)
    }
 }
 
-/* If register allocation fails, find the best spill node */
+/* Find the nodes not satisfying bi_spill_register's preconditions */
 
-static signed
-bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
+static BITSET_WORD *
+bi_find_no_spill(bi_context *ctx, struct lcra_state *l)
 {
-   /* Pick a node satisfying bi_spill_register's preconditions */
    BITSET_WORD *no_spill =
       calloc(sizeof(BITSET_WORD), BITSET_WORDS(l->node_count));
 
@@ -630,6 +758,14 @@ bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
       }
    }
 
+   return no_spill;
+}
+
+/* If register allocation fails, find the best spill node */
+
+static signed
+bi_choose_spill_node(struct lcra_state *l, const BITSET_WORD *no_spill)
+{
    unsigned best_benefit = 0.0;
    signed best_node = -1;
 
@@ -674,10 +810,155 @@ bi_choose_spill_node(bi_context *ctx, struct lcra_state *l)
       }
    }
 
-   free(no_spill);
    return best_node;
 }
 
+/* Whether a node is among the first nr_dests destinations or the first
+ * nr_srcs SSA sources of an instruction */
+
+static bool
+bi_instr_accesses_node(const bi_instr *I, unsigned node, unsigned nr_dests,
+                       unsigned nr_srcs)
+{
+   for (unsigned d = 0; d < nr_dests; ++d) {
+      if (I->dest[d].value == node)
+         return true;
+   }
+
+   for (unsigned s = 0; s < nr_srcs; ++s) {
+      if (I->src[s].type == BI_INDEX_NORMAL && I->src[s].value == node)
+         return true;
+   }
+
+   return false;
+}
+
+/* Sum of the live registers of the nodes accessed by an instruction, counting
+ * nodes accessed several times once */
+
+static unsigned
+bi_instr_live_count(const uint8_t *live, const bi_instr *I)
+{
+   unsigned count = 0;
+
+   bi_foreach_dest(I, d) {
+      unsigned node = I->dest[d].value;
+
+      if (!bi_instr_accesses_node(I, node, d, 0))
+         count += util_bitcount(live[node]);
+   }
+
+   bi_foreach_ssa_src(I, s) {
+      unsigned node = I->src[s].value;
+
+      if (!bi_instr_accesses_node(I, node, I->nr_dests, s))
+         count += util_bitcount(live[node]);
+   }
+
+   return count;
+}
+
+/* Maximum number of nodes spilled in a single round of register allocation */
+#define BI_MAX_SPILL_BATCH 8
+
+/*
+ * Choose a batch of nodes to spill at once, so that shaders with high register
+ * pressure do not need a round of register allocation for every node spilled.
+ * The node chosen by bi_choose_spill_node is spilled first, as when spilling a
+ * single node. The register pressure profile then estimates how many more
+ * registers are missing at the worst point of the program. Further nodes are
+ * chosen until that is covered, preferring nodes live across many points with
+ * too much pressure but accessed by few instructions, as every access needs a
+ * load or a store once spilled.
+ *
+ * Returns the number of nodes written to batch.
+ */
+static unsigned
+bi_choose_spill_batch(bi_context *ctx, struct lcra_state *l, unsigned reg_count,
+                      unsigned *batch)
+{
+   unsigned node_count = l->node_count;
+   BITSET_WORD *no_spill = bi_find_no_spill(ctx, l);
+   signed first = bi_choose_spill_node(l, no_spill);
+
+   if (first < 0) {
+      free(no_spill);
+      return 0;
+   }
+
+   unsigned *points = calloc(node_count, sizeof(unsigned));
+   unsigned *accesses = calloc(node_count, sizeof(unsigned));
+   uint8_t *width = calloc(node_count, sizeof(uint8_t));
+   unsigned max_pressure = 0;
+
+   bi_foreach_block(ctx, blk) {
+      uint8_t *live = mem_dup(blk->live_out, node_count);
+      unsigned pressure = 0;
+
+      for (unsigned i = 0; i < node_count; ++i)
+         pressure += util_bitcount(live[i]);
+
+      bi_foreach_instr_in_block_rev(blk, I) {
+         if (pressure > reg_count) {
+            for (unsigned i = 0; i < node_count; ++i) {
+               if (!live[i])
+                  continue;
+
+               points[i]++;
+               width[i] = MAX2(width[i], util_bitcount(live[i]));
+            }
+         }
+
+         max_pressure = MAX2(max_pressure, pressure);
+
+         bi_foreach_dest(I, d)
+            accesses[I->dest[d].value]++;
+
+         bi_foreach_ssa_src(I, s)
+            accesses[I->src[s].value]++;
+
+         pressure -= bi_instr_live_count(live, I);
+         bi_liveness_ins_update_ra(live, I);
+         pressure += bi_instr_live_count(live, I);
+      }
+
+      free(live);
+   }
+
+   unsigned nr = 0;
+   batch[nr++] = first;
+   BITSET_SET(no_spill, first);
+
+   signed excess =
+      (signed)max_pressure - (signed)reg_count - MAX2(width[first], 1);
+
+   while (excess > 0 && nr < BI_MAX_SPILL_BATCH) {
+      signed best = -1;
+
+      for (unsigned i = 0; i < node_count; ++i) {
+         if (!points[i] || BITSET_TEST(no_spill, i))
+            continue;
+
+         if (best < 0 || (uint64_t)points[i] * accesses[best] >
+                            (uint64_t)points[best] * accesses[i])
+            best = i;
+      }
+
+      if (best < 0)
+         break;
+
+      batch[nr++] = best;
+      BITSET_SET(no_spill, best);
+      excess -= width[best];
+   }
+
+   free(points);
+   free(accesses);
+   free(width);
+   free(no_spill);
+   return nr;
+}
+
 static unsigned
 bi_count_read_index(bi_instr *I, bi_index index)
 {
@@ -727,46 +1008,54 @@ bi_store_tl(bi_builder *b, unsigned bits, bi_index src, unsigned offset)
    }
 }
 
-/* Once we've chosen a spill node, spill it and returns bytes spilled */
+/* Once we've chosen a spill node, spill it and returns bytes spilled. Blocks
+ * rewritten are marked in touched. */
 
 static unsigned
-bi_spill_register(bi_context *ctx, bi_index index, uint32_t offset)
+bi_spill_register(bi_context *ctx, bi_index index, uint32_t offset,
+                  BITSET_WORD *touched)
 {
    bi_builder b = {.shader = ctx};
    unsigned channels = 0;
 
    /* Spill after every store, fill before every load */
-   bi_foreach_instr_global_safe(ctx, I) {
-      bi_foreach_dest(I, d) {
-         if (!bi_is_equiv(I->dest[d], index))
-            continue;
+   bi_foreach_block(ctx, block) {
+      bi_foreach_instr_in_block_safe(block, I) {
+         bi_foreach_dest(I, d) {
+            if (!bi_is_equiv(I->dest[d], index))
+               continue;
 
-         unsigned extra = I->dest[d].offset;
-         bi_index tmp = bi_temp(ctx);
+            BITSET_SET(touched, block->index);
 
-         I->dest[d] = bi_replace_index(I->dest[d], tmp);
-         I->no_spill = true;
+            unsigned extra = I->dest[d].offset;
+            bi_index tmp = bi_temp(ctx);
 
-         unsigned count = bi_count_write_registers(I, d);
-         unsigned bits = count * 32;
+            I->dest[d] = bi_replace_index(I->dest[d], tmp);
+            I->no_spill = true;
 
-         b.cursor = bi_after_instr(I);
-         bi_store_tl(&b, bits, tmp, offset + 4 * extra);
+            unsigned count = bi_count_write_registers(I, d);
+            unsigned bits = count * 32;
 
-         ctx->spills++;
-         channels = MAX2(channels, extra + count);
-      }
+            b.cursor = bi_after_instr(I);
+            bi_store_tl(&b, bits, tmp, offset + 4 * extra);
+
+            ctx->spills++;
+            channels = MAX2(channels, extra + count);
+         }
 
-      if (bi_has_arg(I, index)) {
-         b.cursor = bi_before_instr(I);
-         bi_index tmp = bi_temp(ctx);
+         if (bi_has_arg(I, index)) {
+            b.cursor = bi_before_instr(I);
+            bi_index tmp = bi_temp(ctx);
 
-         unsigned bits = bi_count_read_index(I, index) * 32;
-         bi_rewrite_index_src_single(I, index, tmp);
+            unsigned bits = bi_count_read_index(I, index) * 32;
+            bi_rewrite_index_src_single(I, index, tmp);
 
-         bi_instr *ld = bi_load_tl(&b, bits, tmp, offset);
-         ld->no_spill = true;
-         ctx->fills++;
+            bi_instr *ld = bi_load_tl(&b, bits, tmp, offset);
+            ld->no_spill = true;
+            ctx->fills++;
+
+            BITSET_SET(touched, block->index);
+         }
       }
    }
 
@@ -886,6 +1175,10 @@ bi_coalesce_tied(bi_context *ctx)
       if (!bi_is_tied(I))
          continue;
 
+      /* Already coalesced, unless spilling rewrote it since */
+      if (bi_is_equiv(I->src[0], I->dest[0]))
+         continue;
+
       bi_builder b = bi_init_builder(ctx, bi_before_instr(I));
       unsigned n = bi_count_read_registers(I, 0);
 
@@ -1075,6 +1368,118 @@ bi_out_of_ssa(bi_context *ctx)
    return first_reg;
 }
 
+static void
+bi_lower_for_ra(bi_context *ctx)
+{
+   if (ctx->arch >= 9)
+      va_lower_split_64bit(ctx);
+
+   /* Lower tied operands. SSA is broken from here on. */
+   unsigned first_reg = bi_out_of_ssa(ctx);
+   bi_lower_vector(ctx, first_reg);
+   bi_coalesce_tied(ctx);
+   squeeze_index(ctx);
+}
+
+/* Spill nodes to thread local storage from spill_count on, returning the new
+ * amount of storage used. If l is not NULL, its interference graph is updated
+ * in place to match the new program. */
+
+static unsigned
+bi_spill_nodes(bi_context *ctx, struct lcra_state *l, uint64_t default_affinity,
+               const unsigned *nodes, unsigned nr_nodes, unsigned spill_count)
+{
+   unsigned first_node = ctx->ssa_alloc;
+   BITSET_WORD *touched =
+      calloc(sizeof(BITSET_WORD), BITSET_WORDS(ctx->num_blocks));
+
+   for (unsigned i = 0; i < nr_nodes; ++i) {
+      /* By default, we use packed TLS addressing on Valhall.
+       * We cannot cross 16 byte boundaries with packed TLS
+       * addressing. Align to ensure this doesn't happen. This
+       * could be optimized a bit.
+       */
+      if (ctx->arch >= 9)
+         spill_count = ALIGN_POT(spill_count, 16);
+
+      spill_count +=
+         bi_spill_register(ctx, bi_get_index(nodes[i]), spill_count, touched);
+   }
+
+   /* In case the spill affected an instruction with tied
+    * operands, we need to fix up.
+    */
+   bi_coalesce_tied(ctx);
+
+   if (l) {
+      bi_update_interference(ctx, l, true, default_affinity, nodes, nr_nodes,
+                             touched, first_node);
+   }
+
+   free(touched);
+   return spill_count;
+}
+
+static bool
+lcra_equal(const struct lcra_state *a, const struct lcra_state *b)
+{
+   if (a->node_count != b->node_count)
+      return false;
+
+   for (unsigned i = 0; i < a->node_count; ++i) {
+      if (a->affinity[i] != b->affinity[i])
+         return false;
+
+      for (unsigned j = 0; j < a->node_count; ++j) {
+         if (nodearray_get(&a->linear[i], j) != nodearray_get(&b->linear[i], j))
+            return false;
+      }
+   }
+
+   return true;
+}
+
+/* For unit tests: allocate registers for a shader that needs to spill, spill
+ * a batch of nodes and check that the interference graph updated in place
+ * matches the one computed from scratch for the new program. */
+
+bool
+bi_test_spill_interference(bi_context *ctx)
+{
+   uint64_t default_affinity = bi_default_affinity(ctx, true);
+   unsigned reg_count = util_bitcount64(default_affinity);
+   unsigned spill_nodes[BI_MAX_SPILL_BATCH];
+   bool success;
+
+   bi_lower_for_ra(ctx);
+
+   struct lcra_state *l = bi_allocate_registers(ctx, &success, true);
+   unsigned nr_spill =
+      success ? 0 : bi_choose_spill_batch(ctx, l, reg_count, spill_nodes);
+
+   if (!nr_spill) {
+      lcra_free(l);
+      return false;
+   }
+
+   bi_spill_nodes(ctx, l, default_affinity, spill_nodes, nr_spill, 0);
+
+   struct lcra_state *full = lcra_alloc_equations(ctx->ssa_alloc);
+
+   bi_foreach_instr_global(ctx, ins) {
+      bi_foreach_dest(ins, d)
+         full->affinity[ins->dest[d].value] = default_affinity;
+   }
+
+   bi_compute_interference(ctx, full, true);
+
+   bool equal = lcra_equal(l, full);
+
+   lcra_free(l);
+   lcra_free(full);
+   return equal;
+}
+
 void
 bi_register_allocate(bi_context *ctx)
 {
@@ -1086,14 +1491,7 @@ bi_register_allocate(bi_context *ctx)
    /* Number of bytes of memory we've spilled into */
    unsigned spill_count = ctx->info.tls_size;
 
-   if (ctx->arch >= 9)
-      va_lower_split_64bit(ctx);
-
-   /* Lower tied operands. SSA is broken from here on. */
-   unsigned first_reg = bi_out_of_ssa(ctx);
-   bi_lower_vector(ctx, first_reg);
-   bi_coalesce_tied(ctx);
-   squeeze_index(ctx);
+   bi_lower_for_ra(ctx);
 
    /* Try with reduced register pressure to improve thread count */
    if (ctx->arch >= 7) {
@@ -1107,38 +1505,51 @@ bi_register_allocate(bi_context *ctx)
       }
    }
 
-   /* Otherwise, use the register file and spill until we succeed */
+   /* Otherwise, use the register file and spill until we succeed. Unless
+    * debugging, several nodes are spilled per round and the interference
+    * graph is updated incrementally instead of being rebuilt.
+    */
+   bool batch = !(bifrost_debug & BIFROST_DBG_NOBATCHSPILL);
+   uint64_t default_affinity = bi_default_affinity(ctx, true);
+   unsigned reg_count = util_bitcount64(default_affinity);
+
    while (!success && ((iter_count--) > 0)) {
-      l = bi_allocate_registers(ctx, &success, true);
+      if (!l) {
+         l = bi_allocate_registers(ctx, &success, true);
+      } else {
+         success = bi_solve_registers(ctx, l);
+      }
 
       if (success) {
          ctx->info.work_reg_count = 64;
       } else {
-         signed spill_node = bi_choose_spill_node(ctx, l);
-         lcra_free(l);
-         l = NULL;
+         unsigned spill_nodes[BI_MAX_SPILL_BATCH];
+         unsigned nr_spill;
+
+         if (batch) {
+            nr_spill = bi_choose_spill_batch(ctx, l, reg_count, spill_nodes);
+         } else {
+            BITSET_WORD *no_spill = bi_find_no_spill(ctx, l);
+            signed spill_node = bi_choose_spill_node(l, no_spill);
+            free(no_spill);
+
+            spill_nodes[0] = spill_node;
+            nr_spill = spill_node >= 0 ? 1 : 0;
+         }
 
-         if (spill_node == -1)
+         if (nr_spill == 0)
             unreachable("Failed to choose spill node\n");
 
          if (ctx->inputs->is_blend)
             unreachable("Blend shaders may not spill");
 
-         /* By default, we use packed TLS addressing on Valhall.
-          * We cannot cross 16 byte boundaries with packed TLS
-          * addressing. Align to ensure this doesn't happen. This
-          * could be optimized a bit.
-          */
-         if (ctx->arch >= 9)
-            spill_count = ALIGN_POT(spill_count, 16);
+         spill_count = bi_spill_nodes(ctx, batch ? l : NULL, default_affinity,
+                                      spill_nodes, nr_spill, spill_count);
 
-         spill_count +=
-            bi_spill_register(ctx, bi_get_index(spill_node), spill_count);
-
-         /* In case the spill affected an instruction with tied
-          * operands, we need to fix up.
-          */
-         bi_coalesce_tied(ctx);
+         if (!batch) {
+            lcra_free(l);
+            l = NULL;
+         }
       }
    }
 
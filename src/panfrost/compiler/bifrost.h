@@ -49,6 +49,9 @@ extern "C" {
 #define BIFROST_DBG_NOPRELOAD  0x0800
 #define BIFROST_DBG_SPILL      0x1000
 #define BIFROST_DBG_NOPSCHED   0x2000
+#define BIFROST_DBG_NOBATCHSPILL 0x4000
+#define BIFROST_DBG_PASSTIME   0x8000
+#define BIFROST_DBG_NOTHREADS  0x10000
 
 extern int bifrost_debug;
 
@@ -28,7 +28,11 @@
 #include "compiler/glsl_types.h"
 #include "compiler/glsl/glsl_to_nir.h"
 #include "compiler/nir/nir_builder.h"
+#include "panfrost/util/pan_pass_time.h"
+#include "util/u_call_once.h"
+#include "util/u_cpu_detect.h"
 #include "util/u_debug.h"
+#include "util/u_queue.h"
 
 #include "bifrost/disassemble.h"
 #include "valhall/disassemble.h"
@@ -55,6 +59,9 @@ static const struct debug_named_value bifrost_debug_options[] = {
    {"nosb",       BIFROST_DBG_NOSB,       "Disable scoreboarding"},
    {"nopreload",  BIFROST_DBG_NOPRELOAD,  "Disable message preloading"},
    {"spill",      BIFROST_DBG_SPILL,      "Test register spilling"},
+   {"nobatchspill", BIFROST_DBG_NOBATCHSPILL, "Spill one node per register allocation round"},
+   {"passtime",   BIFROST_DBG_PASSTIME,   "Print the time spent in each pass at exit"},
+   {"nothreads",  BIFROST_DBG_NOTHREADS,  "Compile IDVS variants serially"},
    DEBUG_NAMED_VALUE_END
 };
 /* clang-format on */
@@ -68,6 +75,19 @@ DEBUG_GET_ONCE_FLAGS_OPTION(bifrost_debug, "BIFROST_MESA_DEBUG",
 
 int bifrost_debug = 0;
 
+static struct pan_pass_timer bi_pass_timer = PAN_PASS_TIMER_INIT("bifrost");
+
+#define BI_TIME_PASS(name, pass) PAN_TIME_PASS(&bi_pass_timer, name, pass)
+
+static void
+bi_read_debug(void)
+{
+   bifrost_debug = debug_get_option_bifrost_debug();
+
+   if (bifrost_debug & BIFROST_DBG_PASSTIME)
+      pan_pass_timer_enable(&bi_pass_timer);
+}
+
 #define DBG(fmt, ...)                                                          \
    do {                                                                        \
       if (bifrost_debug & BIFROST_DBG_MSGS)                                    \
@@ -4085,6 +4105,7 @@ bi_print_stats(bi_context *ctx, unsigned size)
 
    ralloc_asprintf_append(&str, ", %u loops, %u:%u spills:fills",
                           ctx->loop_count, ctx->spills, ctx->fills);
+   ralloc_asprintf_append(&str, ", %u RA iterations", ctx->ra_iterations);
 
    return str;
 }
@@ -4130,11 +4151,11 @@ va_print_stats(bi_context *ctx, unsigned size)
                           "%s shader: "
                           "%u inst, %f cycles, %f fma, %f cvt, %f sfu, %f v, "
                           "%f t, %f ls, %u quadwords, %u threads, %u loops, "
-                          "%u:%u spills:fills",
+                          "%u:%u spills:fills, %u RA iterations",
                           bi_shader_stage_name(ctx), nr_ins, cycles, cycles_fma,
                           cycles_cvt, cycles_sfu, cycles_v, cycles_t, cycles_ls,
                           size / 16, nr_threads, ctx->loop_count, ctx->spills,
-                          ctx->fills);
+                          ctx->fills, ctx->ra_iterations);
 }
 
 static int
@@ -4621,8 +4642,8 @@ bifrost_nir_lower_load_output(nir_shader *nir)
       nir_metadata_block_index | nir_metadata_dominance, NULL);
 }
 
-void
-bifrost_preprocess_nir(nir_shader *nir, unsigned gpu_id)
+static void
+bi_lower_nir(nir_shader *nir, unsigned gpu_id)
 {
    /* Lower gl_Position pre-optimisation, but after lowering vars to ssa
     * (so we don't accidentally duplicate the epilogue since mesa/st has
@@ -4729,63 +4750,21 @@ bifrost_preprocess_nir(nir_shader *nir, unsigned gpu_id)
    NIR_PASS_V(nir, nir_lower_frag_coord_to_pixel_coord);
 }
 
-static bi_context *
-bi_compile_variant_nir(nir_shader *nir,
-                       const struct panfrost_compile_inputs *inputs,
-                       struct util_dynarray *binary, struct bi_shader_info info,
-                       enum bi_idvs_mode idvs)
+void
+bifrost_preprocess_nir(nir_shader *nir, unsigned gpu_id)
 {
-   bi_context *ctx = rzalloc(NULL, bi_context);
-
-   /* There may be another program in the dynarray, start at the end */
-   unsigned offset = binary->size;
-
-   ctx->inputs = inputs;
-   ctx->nir = nir;
-   ctx->stage = nir->info.stage;
-   ctx->quirks = bifrost_get_quirks(inputs->gpu_id);
-   ctx->arch = inputs->gpu_id >> 12;
-   ctx->info = info;
-   ctx->idvs = idvs;
-   ctx->malloc_idvs = (ctx->arch >= 9) && !inputs->no_idvs;
-
-   if (idvs != BI_IDVS_NONE) {
-      /* Specializing shaders for IDVS is destructive, so we need to
-       * clone. However, the last (second) IDVS shader does not need
-       * to be preserved so we can skip cloning that one.
-       */
-      if (offset == 0)
-         ctx->nir = nir = nir_shader_clone(ctx, nir);
-
-      NIR_PASS_V(nir, nir_shader_instructions_pass, bifrost_nir_specialize_idvs,
-                 nir_metadata_block_index | nir_metadata_dominance, &idvs);
-
-      /* After specializing, clean up the mess */
-      bool progress = true;
-
-      while (progress) {
-         progress = false;
-
-         NIR_PASS(progress, nir, nir_opt_dce);
-         NIR_PASS(progress, nir, nir_opt_dead_cf);
-      }
-   }
-
-   /* If nothing is pushed, all UBOs need to be uploaded */
-   ctx->ubo_mask = ~0;
-
-   list_inithead(&ctx->blocks);
+   bi_read_debug();
 
-   bool skip_internal = nir->info.internal;
-   skip_internal &= !(bifrost_debug & BIFROST_DBG_INTERNAL);
-
-   if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal) {
-      nir_print_shader(nir, stdout);
-   }
+   BI_TIME_PASS("nir_lower", bi_lower_nir(nir, gpu_id));
+}
 
+/* Translate NIR to BIR */
+static void
+bi_emit_program(bi_context *ctx)
+{
    ctx->allocated_vec = _mesa_hash_table_u64_create(ctx);
 
-   nir_foreach_function_impl(impl, nir) {
+   nir_foreach_function_impl(impl, ctx->nir) {
       nir_index_blocks(impl);
 
       ctx->indexed_nir_blocks =
@@ -4815,7 +4794,11 @@ bi_compile_variant_nir(nir_shader *nir,
       bi_builder b = bi_init_builder(ctx, bi_after_block(end));
       bi_emit_atest(&b, bi_zero());
    }
+}
 
+static void
+bi_optimize_program(bi_context *ctx)
+{
    bool optimize = !(bifrost_debug & BIFROST_DBG_NOOPT);
 
    /* Runs before constant folding */
@@ -4854,37 +4837,38 @@ bi_compile_variant_nir(nir_shader *nir,
    }
 
    bi_lower_opt_instructions(ctx);
+}
 
-   if (ctx->arch >= 9) {
-      va_optimize(ctx);
-      va_lower_isel(ctx);
-
-      bi_foreach_instr_global_safe(ctx, I) {
-         /* Phis become single moves so shouldn't be affected */
-         if (I->op == BI_OPCODE_PHI)
-            continue;
-
-         va_lower_constants(ctx, I);
+static void
+bi_lower_valhall(bi_context *ctx)
+{
+   va_optimize(ctx);
+   va_lower_isel(ctx);
 
-         bi_builder b = bi_init_builder(ctx, bi_before_instr(I));
-         va_repair_fau(&b, I);
-      }
+   bi_foreach_instr_global_safe(ctx, I) {
+      /* Phis become single moves so shouldn't be affected */
+      if (I->op == BI_OPCODE_PHI)
+         continue;
 
-      /* We need to clean up after constant lowering */
-      if (likely(optimize)) {
-         bi_opt_cse(ctx);
-         bi_opt_dead_code_eliminate(ctx);
-      }
+      va_lower_constants(ctx, I);
 
-      bi_validate(ctx, "Valhall passes");
+      bi_builder b = bi_init_builder(ctx, bi_before_instr(I));
+      va_repair_fau(&b, I);
    }
 
-   bi_foreach_block(ctx, block) {
-      bi_lower_branch(ctx, block);
+   /* We need to clean up after constant lowering */
+   if (likely(!(bifrost_debug & BIFROST_DBG_NOOPT))) {
+      bi_opt_cse(ctx);
+      bi_opt_dead_code_eliminate(ctx);
    }
 
-   if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal)
-      bi_print_shader(ctx, stdout);
+   bi_validate(ctx, "Valhall passes");
+}
+
+static void
+bi_lower_late(bi_context *ctx)
+{
+   bool optimize = !(bifrost_debug & BIFROST_DBG_NOOPT);
 
    /* Analyze before register allocation to avoid false dependencies. The
     * skip bit is a function of only the data flow graph and is invariant
@@ -4914,20 +4898,11 @@ bi_compile_variant_nir(nir_shader *nir,
    }
 
    bi_validate(ctx, "Late lowering");
+}
 
-   if (likely(!(bifrost_debug & BIFROST_DBG_NOPSCHED))) {
-      bi_pressure_schedule(ctx);
-      bi_validate(ctx, "Pre-RA scheduling");
-   }
-
-   bi_register_allocate(ctx);
-
-   if (likely(optimize))
-      bi_opt_post_ra(ctx);
-
-   if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal)
-      bi_print_shader(ctx, stdout);
-
+static void
+bi_schedule_post_ra(bi_context *ctx)
+{
    if (ctx->arch >= 9) {
       va_assign_slots(ctx);
       va_insert_flow_control_nops(ctx);
@@ -4944,16 +4919,125 @@ bi_compile_variant_nir(nir_shader *nir,
       bi_analyze_helper_terminate(ctx);
       bi_mark_clauses_td(ctx);
    }
+}
+
+/* Front end of a variant: specialize the NIR for the variant and translate it
+ * to optimized IR. Pushed uniforms are picked here, appending to the push
+ * table shared by the variants.
+ */
+static bi_context *
+bi_compile_variant_nir(nir_shader *nir,
+                       const struct panfrost_compile_inputs *inputs,
+                       struct bi_shader_info info, enum bi_idvs_mode idvs)
+{
+   bi_context *ctx = rzalloc(NULL, bi_context);
+
+   ctx->inputs = inputs;
+   ctx->nir = nir;
+   ctx->stage = nir->info.stage;
+   ctx->quirks = bifrost_get_quirks(inputs->gpu_id);
+   ctx->arch = inputs->gpu_id >> 12;
+   ctx->info = info;
+   ctx->idvs = idvs;
+   ctx->malloc_idvs = (ctx->arch >= 9) && !inputs->no_idvs;
+
+   if (idvs != BI_IDVS_NONE) {
+      /* Specializing shaders for IDVS is destructive, so we need to
+       * clone. However, the last (varying) IDVS shader does not need
+       * to be preserved so we can skip cloning that one.
+       */
+      if (idvs == BI_IDVS_POSITION)
+         ctx->nir = nir = nir_shader_clone(ctx, nir);
+
+      NIR_PASS_V(nir, nir_shader_instructions_pass, bifrost_nir_specialize_idvs,
+                 nir_metadata_block_index | nir_metadata_dominance, &idvs);
+
+      /* After specializing, clean up the mess */
+      bool progress = true;
+
+      while (progress) {
+         progress = false;
+
+         NIR_PASS(progress, nir, nir_opt_dce);
+         NIR_PASS(progress, nir, nir_opt_dead_cf);
+      }
+   }
+
+   /* If nothing is pushed, all UBOs need to be uploaded */
+   ctx->ubo_mask = ~0;
+
+   list_inithead(&ctx->blocks);
+
+   bool skip_internal = nir->info.internal;
+   skip_internal &= !(bifrost_debug & BIFROST_DBG_INTERNAL);
+
+   if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal) {
+      nir_print_shader(nir, stdout);
+   }
+
+   BI_TIME_PASS("bi_emit", bi_emit_program(ctx));
+   BI_TIME_PASS("bi_optimize", bi_optimize_program(ctx));
+
+   return ctx;
+}
+
+/* Back end of a variant, from optimized IR to scheduled IR ready to be packed.
+ * Only the context is touched, so variants may go through it concurrently.
+ */
+static void
+bi_compile_variant_late(bi_context *ctx)
+{
+   bool skip_internal = ctx->nir->info.internal;
+   skip_internal &= !(bifrost_debug & BIFROST_DBG_INTERNAL);
+
+   if (ctx->arch >= 9)
+      BI_TIME_PASS("va_lower", bi_lower_valhall(ctx));
+
+   bi_foreach_block(ctx, block) {
+      bi_lower_branch(ctx, block);
+   }
 
    if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal)
       bi_print_shader(ctx, stdout);
 
-   if (ctx->arch <= 8) {
-      bi_pack_clauses(ctx, binary, offset);
-   } else {
-      bi_pack_valhall(ctx, binary);
+   BI_TIME_PASS("bi_lower_late", bi_lower_late(ctx));
+
+   if (likely(!(bifrost_debug & BIFROST_DBG_NOPSCHED))) {
+      BI_TIME_PASS("bi_pressure_schedule", bi_pressure_schedule(ctx));
+      bi_validate(ctx, "Pre-RA scheduling");
    }
 
+   BI_TIME_PASS("bi_register_allocate", bi_register_allocate(ctx));
+
+   if (likely(!(bifrost_debug & BIFROST_DBG_NOOPT)))
+      BI_TIME_PASS("bi_opt_post_ra", bi_opt_post_ra(ctx));
+
+   if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal)
+      bi_print_shader(ctx, stdout);
+
+   BI_TIME_PASS("bi_schedule", bi_schedule_post_ra(ctx));
+
+   if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal)
+      bi_print_shader(ctx, stdout);
+}
+
+/* Pack a scheduled variant at the end of the binary */
+static void
+bi_pack_variant(bi_context *ctx, struct util_dynarray *binary)
+{
+   const struct panfrost_compile_inputs *inputs = ctx->inputs;
+
+   /* There may be another program in the dynarray, start at the end */
+   unsigned offset = binary->size;
+
+   bool skip_internal = ctx->nir->info.internal;
+   skip_internal &= !(bifrost_debug & BIFROST_DBG_INTERNAL);
+
+   if (ctx->arch <= 8)
+      BI_TIME_PASS("bi_pack", bi_pack_clauses(ctx, binary, offset));
+   else
+      BI_TIME_PASS("bi_pack", bi_pack_valhall(ctx, binary));
+
    if (bifrost_debug & BIFROST_DBG_SHADERS && !skip_internal) {
       if (ctx->arch <= 8) {
          disassemble_bifrost(stdout, binary->data + offset,
@@ -4986,39 +5070,22 @@ bi_compile_variant_nir(nir_shader *nir,
 
       ralloc_free(shaderdb);
    }
-
-   return ctx;
 }
 
+/* Pack a compiled variant and fill in the shader info it accounts for */
 static void
-bi_compile_variant(nir_shader *nir,
-                   const struct panfrost_compile_inputs *inputs,
-                   struct util_dynarray *binary, struct pan_shader_info *info,
-                   enum bi_idvs_mode idvs)
+bi_finish_variant(bi_context *ctx, struct util_dynarray *binary,
+                  struct pan_shader_info *info)
 {
-   struct bi_shader_info local_info = {
-      .push = &info->push,
-      .bifrost = &info->bifrost,
-      .tls_size = info->tls_size,
-      .push_offset = info->push.count,
-   };
-
+   nir_shader *nir = ctx->nir;
+   enum bi_idvs_mode idvs = ctx->idvs;
    unsigned offset = binary->size;
 
-   /* If there is no position shader (gl_Position is not written), then
-    * there is no need to build a varying shader either. This case is hit
-    * for transform feedback only vertex shaders which only make sense with
-    * rasterizer discard.
-    */
-   if ((offset == 0) && (idvs == BI_IDVS_VARYING))
-      return;
-
    /* Software invariant: Only a secondary shader can appear at a nonzero
     * offset, to keep the ABI simple. */
    assert((offset == 0) ^ (idvs == BI_IDVS_VARYING));
 
-   bi_context *ctx =
-      bi_compile_variant_nir(nir, inputs, binary, local_info, idvs);
+   bi_pack_variant(ctx, binary);
 
    /* A register is preloaded <==> it is live before the first block */
    bi_block *first_block = list_first_entry(&ctx->blocks, bi_block, link);
@@ -5075,12 +5142,172 @@ bi_compile_variant(nir_shader *nir,
       bi_remove_instruction(write);
 
       info->vs.no_psiz_offset = binary->size;
-      bi_pack_valhall(ctx, binary);
+      BI_TIME_PASS("bi_pack", bi_pack_valhall(ctx, binary));
    }
+}
 
+static void
+bi_compile_variant(nir_shader *nir,
+                   const struct panfrost_compile_inputs *inputs,
+                   struct util_dynarray *binary, struct pan_shader_info *info,
+                   enum bi_idvs_mode idvs)
+{
+   struct bi_shader_info local_info = {
+      .push = &info->push,
+      .bifrost = &info->bifrost,
+      .tls_size = info->tls_size,
+      .push_offset = info->push.count,
+   };
+
+   bi_context *ctx = bi_compile_variant_nir(nir, inputs, local_info, idvs);
+   bi_compile_variant_late(ctx);
+   bi_finish_variant(ctx, binary, info);
    ralloc_free(ctx);
 }
 
+/* Variant compiled off the calling thread, up to packing */
+struct bi_variant_job {
+   struct util_queue_fence fence;
+
+   nir_shader *nir;
+   const struct panfrost_compile_inputs *inputs;
+   struct bi_shader_info info;
+   enum bi_idvs_mode idvs;
+
+   /* Output */
+   bi_context *ctx;
+
+   /* Pass times, if the calling thread captures them */
+   bool capture_times;
+   struct pan_pass_times pass_times;
+};
+
+static void
+bi_compile_variant_job(void *data, void *gdata, int thread_index)
+{
+   struct bi_variant_job *job = data;
+   struct pan_pass_times *prev =
+      pan_pass_times_capture(job->capture_times ? &job->pass_times : NULL);
+
+   job->ctx = bi_compile_variant_nir(job->nir, job->inputs, job->info,
+                                     job->idvs);
+   bi_compile_variant_late(job->ctx);
+
+   pan_pass_times_capture(prev);
+}
+
+/* Worker threads shared by all compiles of the process */
+static struct util_queue bi_variant_queue;
+static bool bi_variant_queue_ready;
+
+static void
+bi_init_variant_queue(void)
+{
+   /* At most one job is queued per compile, the calling thread doing the
+    * other half of the work */
+   unsigned nr_threads = MIN2(util_get_cpu_caps()->nr_cpus - 1, 8);
+
+   if (nr_threads > 0) {
+      bi_variant_queue_ready = util_queue_init(
+         &bi_variant_queue, "bi_variant", 16, nr_threads,
+         UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL);
+   }
+}
+
+/* Returns NULL if variants are to be compiled serially */
+static struct util_queue *
+bi_get_variant_queue(void)
+{
+   static util_once_flag once = UTIL_ONCE_FLAG_INIT;
+
+   /* Keep the dumps of the variants apart */
+   if (bifrost_debug & (BIFROST_DBG_SHADERS | BIFROST_DBG_NOTHREADS))
+      return NULL;
+
+   util_call_once(&once, bi_init_variant_queue);
+   return bi_variant_queue_ready ? &bi_variant_queue : NULL;
+}
+
+/*
+ * Compile the position and varying shaders of an IDVS vertex shader. Both are
+ * compiled from the same NIR and only meet in the push table and the binary,
+ * so the varying shader is compiled on a worker thread while the position
+ * shader goes through the back end. The varying shader picks its pushed
+ * uniforms after the position shader's, so it is only started once the
+ * position shader's front end is done, and variants are packed in order, so
+ * the output does not depend on threading.
+ */
+static void
+bi_compile_idvs(nir_shader *nir, const struct panfrost_compile_inputs *inputs,
+                struct util_dynarray *binary, struct pan_shader_info *info)
+{
+   /* Spilling starts past the scratch space. The two shaders never run
+    * as the same thread, so their spill slots may overlap.
+    */
+   struct bi_shader_info local_info = {
+      .push = &info->push,
+      .bifrost = &info->bifrost,
+      .tls_size = info->tls_size,
+      .push_offset = info->push.count,
+   };
+
+   bi_context *ctx =
+      bi_compile_variant_nir(nir, inputs, local_info, BI_IDVS_POSITION);
+
+   local_info.push_offset = info->push.count;
+
+   struct bi_variant_job job = {
+      .nir = nir,
+      .inputs = inputs,
+      .info = local_info,
+      .idvs = BI_IDVS_VARYING,
+      .capture_times = pan_pass_times_current() != NULL,
+   };
+
+   /* Without a position write the position shader may be empty, and then
+    * there is no varying shader. Only compile it ahead when it is known to
+    * be needed, lest it takes push constants a serial compile wouldn't.
+    */
+   struct util_queue *queue = NULL;
+   if (nir->info.outputs_written & VARYING_BIT_POS)
+      queue = bi_get_variant_queue();
+
+   if (queue) {
+      util_queue_fence_init(&job.fence);
+      util_queue_add_job(queue, &job, &job.fence, bi_compile_variant_job,
+                         NULL, 0);
+   }
+
+   bi_compile_variant_late(ctx);
+
+   if (queue) {
+      util_queue_fence_wait(&job.fence);
+      util_queue_fence_destroy(&job.fence);
+   }
+
+   bi_finish_variant(ctx, binary, info);
+   ralloc_free(ctx);
+
+   /* If there is no position shader (gl_Position is not written), then
+    * there is no need for a varying shader either. This case is hit
+    * for transform feedback only vertex shaders which only make sense with
+    * rasterizer discard.
+    */
+   if (binary->size == 0) {
+      assert(!queue && "position shaders are not empty");
+      return;
+   }
+
+   if (!queue)
+      bi_compile_variant_job(&job, NULL, 0);
+
+   if (job.capture_times)
+      pan_pass_times_merge(pan_pass_times_current(), &job.pass_times);
+
+   bi_finish_variant(job.ctx, binary, info);
+   ralloc_free(job.ctx);
+}
+
 /* Decide if Index-Driven Vertex Shading should be used for a given shader */
 static bool
 bi_should_idvs(nir_shader *nir, const struct panfrost_compile_inputs *inputs)
@@ -5108,26 +5335,25 @@ bifrost_compile_shader_nir(nir_shader *nir,
                            struct util_dynarray *binary,
                            struct pan_shader_info *info)
 {
-   bifrost_debug = debug_get_option_bifrost_debug();
+   bi_read_debug();
 
    /* Combine stores late, to give the driver a chance to lower dual-source
     * blending as regular store_output intrinsics.
     */
    NIR_PASS_V(nir, pan_nir_lower_zs_store);
 
-   bi_optimize_nir(nir, inputs->gpu_id, inputs->is_blend);
+   BI_TIME_PASS("nir_optimize",
+                bi_optimize_nir(nir, inputs->gpu_id, inputs->is_blend));
 
    info->tls_size = nir->scratch_size;
    info->vs.idvs = bi_should_idvs(nir, inputs);
 
    pan_nir_collect_varyings(nir, info);
 
-   if (info->vs.idvs) {
-      bi_compile_variant(nir, inputs, binary, info, BI_IDVS_POSITION);
-      bi_compile_variant(nir, inputs, binary, info, BI_IDVS_VARYING);
-   } else {
+   if (info->vs.idvs)
+      bi_compile_idvs(nir, inputs, binary, info);
+   else
       bi_compile_variant(nir, inputs, binary, info, BI_IDVS_NONE);
-   }
 
    if (gl_shader_stage_is_compute(nir->info.stage)) {
       /* Workgroups may be merged if the structure of the workgroup is
@@ -874,6 +874,7 @@ typedef struct {
    unsigned loop_count;
    unsigned spills;
    unsigned fills;
+   unsigned ra_iterations;
 } bi_context;
 
 static inline void
@@ -1138,6 +1139,7 @@ void bi_lower_swizzle(bi_context *ctx);
 void bi_lower_fau(bi_context *ctx);
 void bi_assign_scoreboard(bi_context *ctx);
 void bi_register_allocate(bi_context *ctx);
+bool bi_test_spill_interference(bi_context *ctx);
 void va_optimize(bi_context *ctx);
 void va_lower_split_64bit(bi_context *ctx);
 
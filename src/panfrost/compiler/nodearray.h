@@ -245,6 +245,63 @@ nodearray_orr(nodearray *a, unsigned key, nodearray_value value,
    a->dense[key] |= value;
 }
 
+/* Clear the element for key, if present. Sparse elements are kept with a zero
+ * value, which is treated the same as a nonexistent element.
+ */
+static inline void
+nodearray_clear(nodearray *a, unsigned key)
+{
+   if (nodearray_is_sparse(a)) {
+      if (!a->size)
+         return;
+
+      nodearray_sparse *elem;
+      nodearray_sparse_search(a, key, &elem);
+
+      if (nodearray_sparse_key(elem) == key)
+         *elem &= ~(nodearray_sparse)NODEARRAY_MAX_VALUE;
+   } else if (key < a->size) {
+      a->dense[key] = 0;
+   }
+}
+
+/* Value of the element for key, zero if not present */
+static inline nodearray_value
+nodearray_get(const nodearray *a, unsigned key)
+{
+   if (nodearray_is_sparse(a)) {
+      if (!a->size)
+         return 0;
+
+      nodearray_sparse *elem;
+      nodearray_sparse_search(a, key, &elem);
+
+      return nodearray_sparse_key(elem) == key ? nodearray_sparse_value(elem)
+                                               : 0;
+   } else {
+      return key < a->size ? a->dense[key] : 0;
+   }
+}
+
+/* Grow the range of keys the nodearray may hold to max. Only dense arrays are
+ * sized by the maximum, sparse arrays need no change.
+ */
+static inline void
+nodearray_grow(nodearray *a, unsigned max)
+{
+   if (nodearray_is_sparse(a) || max <= a->size)
+      return;
+
+   nodearray_value *data = (nodearray_value *)calloc(
+      NODEARRAY_DENSE_ALIGN(max), sizeof(nodearray_value));
+
+   memcpy(data, a->dense, a->size * sizeof(nodearray_value));
+   free(a->dense);
+
+   a->dense = data;
+   a->size = max;
+}
+
 #ifdef __cplusplus
 } /* extern C */
 #endif
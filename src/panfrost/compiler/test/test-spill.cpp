@@ -0,0 +1,79 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "bi_builder.h"
+#include "bi_test.h"
+#include "compiler.h"
+
+#include <gtest/gtest.h>
+
+/* Register allocation spills several nodes per round and updates the
+ * interference graph in place. Check that the result is the same as
+ * rebuilding the graph for the spilled program.
+ */
+class Spill : public testing::Test {
+ protected:
+   Spill()
+   {
+      mem_ctx = ralloc_context(NULL);
+   }
+
+   ~Spill()
+   {
+      ralloc_free(mem_ctx);
+   }
+
+   bi_builder *build(unsigned arch, unsigned nr_values)
+   {
+      bi_builder *b = bit_builder(mem_ctx);
+      bi_context *ctx = b->shader;
+      bi_block *first = bi_start_block(&ctx->blocks);
+
+      ctx->arch = arch;
+      ctx->info.bifrost = rzalloc(mem_ctx, struct bifrost_shader_info);
+
+      bi_index *values = rzalloc_array(mem_ctx, bi_index, nr_values);
+
+      for (unsigned i = 0; i < nr_values; ++i)
+         values[i] = bi_mov_i32(b, bi_imm_u32(i));
+
+      /* Half the values are used in each of two more blocks, so spilling
+       * leaves some blocks untouched */
+      bi_block *second = bit_block(ctx);
+      bi_block *third = bit_block(ctx);
+      bi_block_add_successor(first, second);
+      bi_block_add_successor(second, third);
+
+      b->cursor = bi_after_block(second);
+      bi_index sum = bi_imm_u32(0);
+      for (unsigned i = 0; i < nr_values / 2; ++i)
+         sum = bi_iadd_u32(b, sum, values[i], false);
+
+      b->cursor = bi_after_block(third);
+      for (unsigned i = nr_values / 2; i < nr_values; ++i)
+         sum = bi_iadd_u32(b, sum, values[i], false);
+
+      /* Keep everything alive through a store */
+      sum = bi_iadd_u32(b, sum, values[0], false);
+      bi_store_i32(b, sum, bi_zero(), bi_zero(), BI_SEG_NONE, 0);
+      return b;
+   }
+
+   void *mem_ctx;
+};
+
+TEST_F(Spill, IncrementalInterferenceBifrost)
+{
+   bi_builder *b = build(7, 96);
+
+   EXPECT_TRUE(bi_test_spill_interference(b->shader));
+}
+
+TEST_F(Spill, IncrementalInterferenceValhall)
+{
+   bi_builder *b = build(9, 96);
+
+   EXPECT_TRUE(bi_test_spill_interference(b->shader));
+}
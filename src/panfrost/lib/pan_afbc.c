@@ -57,13 +57,20 @@
  * body.
  *
  * From userspace, Panfrost needs to be able to calculate these sizes. It
- * explicitly does not and can not know the format of the data contained within
- * this header and body. The GPU has native support for AFBC encode/decode. For
- * an internal FBO or a framebuffer used for scanout with an AFBC-compatible
+ * does not know how to decode the compressed data contained within the body.
+ * The GPU has native support for AFBC encode/decode. For an internal FBO or a
+ * framebuffer used for scanout with an AFBC-compatible
  * winsys/display-controller, the buffer is maintained AFBC throughout flight,
  * and the driver never needs to know the internal data. For edge cases where
  * the driver really does need to read/write from the AFBC resource, we
  * generate a linear staging buffer and use the GPU to blit AFBC<--->linear.
+ *
+ * There are two superblock encodings the CPU can handle, though: solid colour
+ * superblocks, and superblocks made of uncompressed subblocks. That covers
+ * freshly initialized resources (zeroed headers are solid black) as well as
+ * anything written by the CPU, which is enough to serve small partial
+ * updates of sparse resources without the GPU. See pan_afbc_encode_superblock
+ * and friends below.
  */
 
 static enum pipe_format
@@ -187,3 +194,255 @@ panfrost_afbc_can_pack(enum pipe_format format)
 
    return desc->colorspace == UTIL_FORMAT_COLORSPACE_RGB;
 }
+
+/* Bits of the header after the 32-bit body offset hold the size of the 16
+ * subblocks, 6 bits each, in subblock order. A size of 1 means the subblock is
+ * stored uncompressed, and a first size of 0 means the whole superblock is a
+ * solid colour, given by the second half of the header.
+ */
+#define AFBC_SUBBLOCK_SIZE_BITS     6
+#define AFBC_SUBBLOCK_UNCOMPRESSED  1
+#define AFBC_SOLID_COLOUR_OFFSET    8
+
+/* Size fields of a superblock made of uncompressed subblocks only */
+static const uint32_t afbc_uncompressed_sizes[3] = {
+   0x41041041,
+   0x10410410,
+   0x04104104,
+};
+
+/* Position (x, y) of each 4x4 subblock in a 16x16 superblock, in the order
+ * the subblocks are stored in the body.
+ */
+static const uint8_t afbc_subblock_order[16][2] = {
+   {1, 1}, {1, 0}, {0, 0}, {0, 1}, {0, 2}, {0, 3}, {1, 3}, {1, 2},
+   {2, 2}, {2, 3}, {3, 3}, {3, 2}, {3, 1}, {3, 0}, {2, 0}, {2, 1},
+};
+
+bool
+pan_afbc_can_access_cpu(unsigned arch, uint64_t modifier,
+                        enum pipe_format format)
+{
+   /* Whether the colour transform also applies to uncompressed and solid
+    * colour superblocks isn't known, so leave YTR resources to the GPU */
+   uint64_t unsupported = AFBC_FORMAT_MOD_SPLIT | AFBC_FORMAT_MOD_DB |
+                          AFBC_FORMAT_MOD_BCH | AFBC_FORMAT_MOD_USM |
+                          AFBC_FORMAT_MOD_YTR;
+
+   /* The body of each superblock must have room for uncompressed data */
+   return drm_is_afbc(modifier) && (modifier & AFBC_FORMAT_MOD_SPARSE) &&
+          !(modifier & unsupported) &&
+          (modifier & AFBC_FORMAT_MOD_BLOCK_SIZE_MASK) ==
+             AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 &&
+          panfrost_format_supports_afbc(arch, format);
+}
+
+void
+pan_afbc_surface_init(struct pan_afbc_surface *surf, unsigned arch,
+                      const struct pan_image_layout *layout, unsigned level,
+                      void *header)
+{
+   const struct pan_image_slice_layout *slice = &layout->slices[level];
+
+   *surf = (struct pan_afbc_surface){
+      .header = header,
+      .body_offset = slice->afbc.header_size,
+      .stride = slice->afbc.stride,
+      .modifier = layout->modifier,
+      .bpp = util_format_get_blocksize(layout->format),
+      .arch = arch,
+   };
+}
+
+static unsigned
+pan_afbc_header_index(const struct pan_afbc_surface *surf, unsigned sx,
+                      unsigned sy)
+{
+   if (!(surf->modifier & AFBC_FORMAT_MOD_TILED))
+      return (sy * surf->stride) + sx;
+
+   /* Tiled headers are grouped in 8x8 tiles of superblocks, in Morton order
+    * within a tile. This matches the AFBC pack shader. */
+   unsigned x = sx & 7, y = sy & 7;
+
+   x = (x | (x << 2)) & 0x13;
+   x = (x | (x << 1)) & 0x15;
+   y = (y | (y << 2)) & 0x13;
+   y = (y | (y << 1)) & 0x15;
+
+   return ((sy & ~7) * surf->stride) + ((sx >> 3) << 6) + (x | (y << 1));
+}
+
+static uint8_t *
+pan_afbc_header(const struct pan_afbc_surface *surf, unsigned sx, unsigned sy)
+{
+   return surf->header +
+          (pan_afbc_header_index(surf, sx, sy) * AFBC_HEADER_BYTES_PER_TILE);
+}
+
+static unsigned
+pan_afbc_header_subblock_size(const uint32_t *words, unsigned i)
+{
+   unsigned bitoffset = 32 + (i * AFBC_SUBBLOCK_SIZE_BITS);
+   unsigned start = bitoffset / 32;
+   unsigned end = (bitoffset + AFBC_SUBBLOCK_SIZE_BITS - 1) / 32;
+   unsigned offset = bitoffset % 32;
+   uint32_t size = words[start] >> offset;
+
+   if (start != end)
+      size |= words[end] << (32 - offset);
+
+   return size & BITFIELD_MASK(AFBC_SUBBLOCK_SIZE_BITS);
+}
+
+static bool
+pan_afbc_header_is_solid(const struct pan_afbc_surface *surf,
+                         const uint32_t *words)
+{
+   /* Solid colour superblocks are a v7 addition */
+   return surf->arch >= 7 && pan_afbc_header_subblock_size(words, 0) == 0;
+}
+
+bool
+pan_afbc_superblock_is_decodable(const struct pan_afbc_surface *surf,
+                                 unsigned sx, unsigned sy)
+{
+   uint32_t words[4];
+
+   memcpy(words, pan_afbc_header(surf, sx, sy), sizeof(words));
+
+   if (pan_afbc_header_is_solid(surf, words))
+      return true;
+
+   return words[1] == afbc_uncompressed_sizes[0] &&
+          words[2] == afbc_uncompressed_sizes[1] &&
+          words[3] == afbc_uncompressed_sizes[2];
+}
+
+/* The pixel size is a constant in each specialization, so the 4-pixel row
+ * copies below compile to single vector loads and stores on aarch64.
+ */
+static ALWAYS_INLINE void
+pan_afbc_unpack_body(const uint8_t *body, uint8_t *dst, unsigned dst_stride,
+                     unsigned bpp)
+{
+   for (unsigned i = 0; i < 16; ++i) {
+      unsigned x = afbc_subblock_order[i][0] * 4;
+      unsigned y = afbc_subblock_order[i][1] * 4;
+
+      for (unsigned r = 0; r < 4; ++r) {
+         memcpy(dst + ((y + r) * dst_stride) + (x * bpp), body, 4 * bpp);
+         body += 4 * bpp;
+      }
+   }
+}
+
+static ALWAYS_INLINE void
+pan_afbc_pack_body(uint8_t *body, const uint8_t *src, unsigned src_stride,
+                   unsigned bpp)
+{
+   for (unsigned i = 0; i < 16; ++i) {
+      unsigned x = afbc_subblock_order[i][0] * 4;
+      unsigned y = afbc_subblock_order[i][1] * 4;
+
+      for (unsigned r = 0; r < 4; ++r) {
+         memcpy(body, src + ((y + r) * src_stride) + (x * bpp), 4 * bpp);
+         body += 4 * bpp;
+      }
+   }
+}
+
+#define PAN_AFBC_SPECIALIZE(name, bpp, ...)                                    \
+   switch (bpp) {                                                              \
+   case 1:                                                                     \
+      name(__VA_ARGS__, 1);                                                    \
+      break;                                                                   \
+   case 2:                                                                     \
+      name(__VA_ARGS__, 2);                                                    \
+      break;                                                                   \
+   case 3:                                                                     \
+      name(__VA_ARGS__, 3);                                                    \
+      break;                                                                   \
+   case 4:                                                                     \
+      name(__VA_ARGS__, 4);                                                    \
+      break;                                                                   \
+   default:                                                                    \
+      name(__VA_ARGS__, bpp);                                                  \
+      break;                                                                   \
+   }
+
+void
+pan_afbc_decode_superblock(const struct pan_afbc_surface *surf, unsigned sx,
+                           unsigned sy, void *dst, unsigned dst_stride)
+{
+   const uint8_t *header = pan_afbc_header(surf, sx, sy);
+   uint8_t *out = dst;
+   uint32_t words[4];
+
+   memcpy(words, header, sizeof(words));
+   assert(pan_afbc_superblock_is_decodable(surf, sx, sy));
+
+   if (pan_afbc_header_is_solid(surf, words)) {
+      const uint8_t *colour = header + AFBC_SOLID_COLOUR_OFFSET;
+
+      for (unsigned x = 0; x < 16; ++x)
+         memcpy(out + (x * surf->bpp), colour, surf->bpp);
+
+      for (unsigned y = 1; y < 16; ++y)
+         memcpy(out + (y * dst_stride), out, 16 * surf->bpp);
+
+      return;
+   }
+
+   const uint8_t *body = surf->header + words[0];
+
+   PAN_AFBC_SPECIALIZE(pan_afbc_unpack_body, surf->bpp, body, out, dst_stride);
+}
+
+static bool
+pan_afbc_is_uniform(const uint8_t *src, unsigned src_stride, unsigned bpp)
+{
+   uint8_t row[16 * 4];
+
+   if (bpp > 4)
+      return false;
+
+   for (unsigned x = 0; x < 16; ++x)
+      memcpy(row + (x * bpp), src, bpp);
+
+   for (unsigned y = 0; y < 16; ++y) {
+      if (memcmp(src + (y * src_stride), row, 16 * bpp))
+         return false;
+   }
+
+   return true;
+}
+
+void
+pan_afbc_encode_superblock(const struct pan_afbc_surface *surf, unsigned sx,
+                           unsigned sy, const void *src, unsigned src_stride)
+{
+   unsigned index = pan_afbc_header_index(surf, sx, sy);
+   uint8_t *header = surf->header + (index * AFBC_HEADER_BYTES_PER_TILE);
+   const uint8_t *in = src;
+   uint32_t words[4];
+
+   /* Solid colour superblocks need v7, but save reading the body back */
+   if (surf->arch >= 7 && pan_afbc_is_uniform(in, src_stride, surf->bpp)) {
+      memset(words, 0, sizeof(words));
+      memcpy(header, words, sizeof(words));
+      memcpy(header + AFBC_SOLID_COLOUR_OFFSET, in, surf->bpp);
+      return;
+   }
+
+   /* Sparse resources reserve room for an uncompressed superblock at a fixed
+    * location */
+   uint32_t offset = surf->body_offset + (index * 16 * 16 * surf->bpp);
+   uint8_t *body = surf->header + offset;
+
+   PAN_AFBC_SPECIALIZE(pan_afbc_pack_body, surf->bpp, body, in, src_stride);
+
+   words[0] = offset;
+   memcpy(&words[1], afbc_uncompressed_sizes, sizeof(afbc_uncompressed_sizes));
+   memcpy(header, words, sizeof(words));
+}
@@ -26,6 +26,8 @@
 #include "util/blend.h"
 
 #ifdef PAN_ARCH
+#include "util/blob.h"
+#include "util/disk_cache.h"
 #include "pan_shader.h"
 #endif
 
@@ -483,9 +485,10 @@ pan_blend_shader_key_equal(const void *a, const void *b)
 
 void
 pan_blend_shader_cache_init(struct pan_blend_shader_cache *cache,
-                            unsigned gpu_id)
+                            unsigned gpu_id, struct disk_cache *disk_cache)
 {
    cache->gpu_id = gpu_id;
+   cache->disk_cache = disk_cache;
    cache->shaders = _mesa_hash_table_create(NULL, pan_blend_shader_key_hash,
                                             pan_blend_shader_key_equal);
    pthread_mutex_init(&cache->lock, NULL);
@@ -808,6 +811,82 @@ GENX(pan_inline_rt_conversion)(nir_shader *s, enum pipe_format *formats)
 }
 #endif
 
+/* The shader key covers everything pan_blend_create_shader() looks at, except
+ * for the constants when the equation uses them.
+ */
+static void
+pan_blend_disk_cache_compute_key(struct pan_blend_shader_cache *cache,
+                                 const struct pan_blend_shader_key *key,
+                                 const float *constants, cache_key cache_key)
+{
+   struct {
+      uint32_t gpu_id;
+      struct pan_blend_shader_key key;
+      float constants[4];
+   } data;
+
+   memset(&data, 0, sizeof(data));
+   data.gpu_id = cache->gpu_id;
+   data.key = *key;
+
+   if (key->has_constants)
+      memcpy(data.constants, constants, sizeof(data.constants));
+
+   disk_cache_compute_key(cache->disk_cache, &data, sizeof(data), cache_key);
+}
+
+static bool
+pan_blend_disk_cache_load(struct pan_blend_shader_cache *cache,
+                          const cache_key cache_key,
+                          struct pan_blend_shader_variant *variant)
+{
+   size_t size;
+   void *buffer = disk_cache_get(cache->disk_cache, cache_key, &size);
+
+   if (!buffer)
+      return false;
+
+   struct blob_reader blob;
+   blob_reader_init(&blob, buffer, size);
+
+   unsigned first_tag = blob_read_uint32(&blob);
+   unsigned work_reg_count = blob_read_uint32(&blob);
+   uint32_t binary_size = blob_read_uint32(&blob);
+   const void *binary = blob_read_bytes(&blob, binary_size);
+   void *dst = NULL;
+
+   if (!blob.overrun && binary_size)
+      dst = util_dynarray_grow_bytes(&variant->binary, 1, binary_size);
+
+   if (dst) {
+      variant->first_tag = first_tag;
+      variant->work_reg_count = work_reg_count;
+      memcpy(dst, binary, binary_size);
+   }
+
+   free(buffer);
+   return dst != NULL;
+}
+
+static void
+pan_blend_disk_cache_store(struct pan_blend_shader_cache *cache,
+                           const cache_key cache_key,
+                           const struct pan_blend_shader_variant *variant)
+{
+   struct blob blob;
+   blob_init(&blob);
+
+   blob_write_uint32(&blob, variant->first_tag);
+   blob_write_uint32(&blob, variant->work_reg_count);
+   blob_write_uint32(&blob, variant->binary.size);
+   blob_write_bytes(&blob, variant->binary.data, variant->binary.size);
+
+   if (!blob.out_of_memory)
+      disk_cache_put(cache->disk_cache, cache_key, blob.data, blob.size, NULL);
+
+   blob_finish(&blob);
+}
+
 struct pan_blend_shader_variant *
 GENX(pan_blend_get_shader_locked)(struct pan_blend_shader_cache *cache,
                                   const struct pan_blend_state *state,
@@ -867,6 +946,16 @@ GENX(pan_blend_get_shader_locked)(struct pan_blend_shader_cache *cache,
 
    memcpy(variant->constants, state->constants, sizeof(variant->constants));
 
+   cache_key disk_key;
+
+   if (cache->disk_cache) {
+      pan_blend_disk_cache_compute_key(cache, &key, state->constants,
+                                       disk_key);
+
+      if (pan_blend_disk_cache_load(cache, disk_key, variant))
+         return variant;
+   }
+
    nir_shader *nir = pan_blend_create_shader(state, src0_type, src1_type, rt);
 
    /* Compile the NIR shader */
@@ -905,6 +994,9 @@ GENX(pan_blend_get_shader_locked)(struct pan_blend_shader_cache *cache,
 
    ralloc_free(nir);
 
+   if (cache->disk_cache)
+      pan_blend_disk_cache_store(cache, disk_key, variant);
+
    return variant;
 }
 #endif /* ifndef PAN_ARCH */
@@ -35,11 +35,15 @@
 #include "panfrost/util/pan_ir.h"
 
 struct MALI_BLEND_EQUATION;
+struct disk_cache;
 
 struct pan_blend_shader_cache {
    unsigned gpu_id;
    struct hash_table *shaders;
    pthread_mutex_t lock;
+
+   /* Optional, compiled blend shaders are kept there across runs */
+   struct disk_cache *disk_cache;
 };
 
 struct pan_blend_equation {
@@ -149,7 +153,8 @@ void pan_blend_to_fixed_function_equation(const struct pan_blend_equation eq,
 uint32_t pan_pack_blend(const struct pan_blend_equation equation);
 
 void pan_blend_shader_cache_init(struct pan_blend_shader_cache *cache,
-                                 unsigned gpu_id);
+                                 unsigned gpu_id,
+                                 struct disk_cache *disk_cache);
 
 void pan_blend_shader_cache_cleanup(struct pan_blend_shader_cache *cache);
 
@@ -29,6 +29,8 @@
 #include <math.h>
 #include <stdio.h>
 #include "compiler/nir/nir_builder.h"
+#include "util/blob.h"
+#include "util/disk_cache.h"
 #include "util/u_math.h"
 #include "pan_blend.h"
 #include "pan_desc.h"
@@ -307,6 +309,64 @@ pan_blitter_emit_rsd(const struct pan_blit_shader_data *blit_shader,
 #endif
 
 #if PAN_ARCH <= 5
+static mali_ptr
+pan_blitter_get_blend_shader(struct pan_blitter_cache *cache, unsigned rt,
+                             enum pipe_format format, unsigned nr_samples,
+                             nir_alu_type type)
+{
+   struct pan_blit_blend_shader_key key = {
+      .format = format,
+      .rt = rt,
+      .nr_samples = nr_samples,
+      .type = type,
+   };
+
+   pthread_mutex_lock(&cache->shaders.lock);
+   struct hash_entry *he =
+      _mesa_hash_table_search(cache->shaders.blend, &key);
+   struct pan_blit_blend_shader_data *blend_shader = he ? he->data : NULL;
+   if (blend_shader) {
+      pthread_mutex_unlock(&cache->shaders.lock);
+      return blend_shader->address;
+   }
+
+   blend_shader =
+      rzalloc(cache->shaders.blend, struct pan_blit_blend_shader_data);
+   blend_shader->key = key;
+
+   struct pan_blend_state blend_state = {
+      .rt_count = rt + 1,
+   };
+
+   blend_state.rts[rt] = (struct pan_blend_rt_state){
+      .format = format,
+      .nr_samples = nr_samples,
+      .equation =
+         {
+            .blend_enable = false,
+            .color_mask = 0xf,
+         },
+   };
+
+   pthread_mutex_lock(&cache->blend_shader_cache->lock);
+   struct pan_blend_shader_variant *b = GENX(pan_blend_get_shader_locked)(
+      cache->blend_shader_cache, &blend_state, type,
+      nir_type_float32, /* unused */
+      rt);
+
+   assert(b->work_reg_count <= 4);
+   struct panfrost_ptr bin =
+      pan_pool_alloc_aligned(cache->shaders.pool, b->binary.size, 64);
+   memcpy(bin.cpu, b->binary.data, b->binary.size);
+
+   blend_shader->address = bin.gpu | b->first_tag;
+   pthread_mutex_unlock(&cache->blend_shader_cache->lock);
+   _mesa_hash_table_insert(cache->shaders.blend, &blend_shader->key,
+                           blend_shader);
+   pthread_mutex_unlock(&cache->shaders.lock);
+   return blend_shader->address;
+}
+
 static void
 pan_blitter_get_blend_shaders(struct pan_blitter_cache *cache,
                               unsigned rt_count,
@@ -314,65 +374,13 @@ pan_blitter_get_blend_shaders(struct pan_blitter_cache *cache,
                               const struct pan_blit_shader_data *blit_shader,
                               mali_ptr *blend_shaders)
 {
-   if (!rt_count)
-      return;
-
-   struct pan_blend_state blend_state = {
-      .rt_count = rt_count,
-   };
-
    for (unsigned i = 0; i < rt_count; i++) {
       if (!rts[i] || panfrost_blendable_formats_v7[rts[i]->format].internal)
          continue;
 
-      struct pan_blit_blend_shader_key key = {
-         .format = rts[i]->format,
-         .rt = i,
-         .nr_samples = pan_image_view_get_nr_samples(rts[i]),
-         .type = blit_shader->blend_types[i],
-      };
-
-      pthread_mutex_lock(&cache->shaders.lock);
-      struct hash_entry *he =
-         _mesa_hash_table_search(cache->shaders.blend, &key);
-      struct pan_blit_blend_shader_data *blend_shader = he ? he->data : NULL;
-      if (blend_shader) {
-         blend_shaders[i] = blend_shader->address;
-         pthread_mutex_unlock(&cache->shaders.lock);
-         continue;
-      }
-
-      blend_shader =
-         rzalloc(cache->shaders.blend, struct pan_blit_blend_shader_data);
-      blend_shader->key = key;
-
-      blend_state.rts[i] = (struct pan_blend_rt_state){
-         .format = rts[i]->format,
-         .nr_samples = pan_image_view_get_nr_samples(rts[i]),
-         .equation =
-            {
-               .blend_enable = false,
-               .color_mask = 0xf,
-            },
-      };
-
-      pthread_mutex_lock(&cache->blend_shader_cache->lock);
-      struct pan_blend_shader_variant *b = GENX(pan_blend_get_shader_locked)(
-         cache->blend_shader_cache, &blend_state, blit_shader->blend_types[i],
-         nir_type_float32, /* unused */
-         i);
-
-      assert(b->work_reg_count <= 4);
-      struct panfrost_ptr bin =
-         pan_pool_alloc_aligned(cache->shaders.pool, b->binary.size, 64);
-      memcpy(bin.cpu, b->binary.data, b->binary.size);
-
-      blend_shader->address = bin.gpu | b->first_tag;
-      pthread_mutex_unlock(&cache->blend_shader_cache->lock);
-      _mesa_hash_table_insert(cache->shaders.blend, &blend_shader->key,
-                              blend_shader);
-      pthread_mutex_unlock(&cache->shaders.lock);
-      blend_shaders[i] = blend_shader->address;
+      blend_shaders[i] = pan_blitter_get_blend_shader(
+         cache, i, rts[i]->format, pan_image_view_get_nr_samples(rts[i]),
+         blit_shader->blend_types[i]);
    }
 }
 #endif
@@ -402,6 +410,76 @@ lower_sampler_parameters(nir_builder *b, nir_intrinsic_instr *intr,
    return true;
 }
 
+static void
+pan_blitter_disk_cache_compute_key(struct pan_blitter_cache *cache,
+                                   const struct pan_blit_shader_key *key,
+                                   cache_key cache_key)
+{
+   struct {
+      uint32_t gpu_id;
+      struct pan_blit_shader_key key;
+   } data;
+
+   memset(&data, 0, sizeof(data));
+   data.gpu_id = cache->gpu_id;
+   data.key = *key;
+
+   disk_cache_compute_key(cache->disk_cache, &data, sizeof(data), cache_key);
+}
+
+/* Called with the shaders lock held */
+static struct pan_blit_shader_data *
+pan_blitter_disk_cache_load(struct pan_blitter_cache *cache,
+                            const struct pan_blit_shader_key *key,
+                            const cache_key cache_key)
+{
+   size_t size;
+   void *buffer = disk_cache_get(cache->disk_cache, cache_key, &size);
+
+   if (!buffer)
+      return NULL;
+
+   struct blob_reader blob;
+   blob_reader_init(&blob, buffer, size);
+
+   struct pan_shader_info info;
+   blob_copy_bytes(&blob, &info, sizeof(info));
+   uint32_t binary_size = blob_read_uint32(&blob);
+   const void *binary = blob_read_bytes(&blob, binary_size);
+   struct pan_blit_shader_data *shader = NULL;
+
+   if (!blob.overrun && binary_size) {
+      shader = rzalloc(cache->shaders.blit, struct pan_blit_shader_data);
+      shader->key = *key;
+      shader->info = info;
+      shader->address =
+         pan_pool_upload_aligned(cache->shaders.pool, binary, binary_size,
+                                 PAN_ARCH >= 6 ? 128 : 64);
+   }
+
+   free(buffer);
+   return shader;
+}
+
+static void
+pan_blitter_disk_cache_store(struct pan_blitter_cache *cache,
+                             const cache_key cache_key,
+                             const struct pan_shader_info *info,
+                             const struct util_dynarray *binary)
+{
+   struct blob blob;
+   blob_init(&blob);
+
+   blob_write_bytes(&blob, info, sizeof(*info));
+   blob_write_uint32(&blob, binary->size);
+   blob_write_bytes(&blob, binary->data, binary->size);
+
+   if (!blob.out_of_memory)
+      disk_cache_put(cache->disk_cache, cache_key, blob.data, blob.size, NULL);
+
+   blob_finish(&blob);
+}
+
 static const struct pan_blit_shader_data *
 pan_blitter_get_blit_shader(struct pan_blitter_cache *cache,
                             const struct pan_blit_shader_key *key)
@@ -414,6 +492,16 @@ pan_blitter_get_blit_shader(struct pan_blitter_cache *cache,
    if (shader)
       goto out;
 
+   cache_key disk_key;
+
+   if (cache->disk_cache) {
+      pan_blitter_disk_cache_compute_key(cache, key, disk_key);
+      shader = pan_blitter_disk_cache_load(cache, key, disk_key);
+
+      if (shader)
+         goto insert;
+   }
+
    unsigned coord_comps = 0;
    unsigned sig_offset = 0;
    char sig[256];
@@ -634,9 +722,13 @@ pan_blitter_get_blit_shader(struct pan_blitter_cache *cache,
       pan_pool_upload_aligned(cache->shaders.pool, binary.data,
                               binary.size, PAN_ARCH >= 6 ? 128 : 64);
 
+   if (cache->disk_cache)
+      pan_blitter_disk_cache_store(cache, disk_key, &shader->info, &binary);
+
    util_dynarray_fini(&binary);
    ralloc_free(b.shader);
 
+insert:
 #if PAN_ARCH >= 6
    for (unsigned i = 0; i < ARRAY_SIZE(shader->blend_ret_offsets); i++) {
       shader->blend_ret_offsets[i] =
@@ -1284,16 +1376,15 @@ pan_preload_emit_pre_frame_dcd(struct pan_blitter_cache *cache,
 
    bool always_write = false;
 
-   /* If CRC data is currently invalid and this batch will make it valid,
-    * write even clean tiles to make sure CRC data is updated. */
+   /* If some checksums of the render area are stale, write even clean tiles
+    * so that all of them get updated. Otherwise, only tiles with primitives
+    * are preloaded, and the writeback of those that didn't change is
+    * skipped.
+    */
    if (crc_rt >= 0) {
-      bool *valid = fb->rts[crc_rt].crc_valid;
-      bool full = !fb->extent.minx && !fb->extent.miny &&
-                  fb->extent.maxx == (fb->width - 1) &&
-                  fb->extent.maxy == (fb->height - 1);
-
-      if (full && !(*valid))
-         always_write = true;
+      always_write =
+         pan_crc_is_stale(fb->rts[crc_rt].crc, fb->extent.minx,
+                          fb->extent.miny, fb->extent.maxx, fb->extent.maxy);
    }
 
    pan_preload_emit_dcd(cache, desc_pool, fb, zs, coords, tsd, dcd,
@@ -1689,14 +1780,91 @@ pan_blitter_prefill_blit_shader_cache(struct pan_blitter_cache *cache)
       pan_blitter_get_blit_shader(cache, &prefill[i]);
 }
 
+#if PAN_ARCH <= 5
+/* Blit shaders only depend on the type of the format, but Midgard also needs
+ * a blend shader for render target formats that aren't natively blendable.
+ * These are the formats commonly used as render targets.
+ */
+static const enum pipe_format pan_blitter_warm_up_formats[] = {
+   PIPE_FORMAT_R8G8B8A8_UNORM,     PIPE_FORMAT_B8G8R8A8_UNORM,
+   PIPE_FORMAT_B5G6R5_UNORM,       PIPE_FORMAT_R10G10B10A2_UNORM,
+   PIPE_FORMAT_R16G16B16A16_FLOAT, PIPE_FORMAT_R11G11B10_FLOAT,
+};
+#endif
+
+/**
+ * Compile the shaders needed to preload, blit and resolve single-sampled and
+ * 4x multisampled 2D render targets of common formats, so the first frames
+ * don't have to. This may take a while and is meant to be called from a
+ * background thread; shaders are loaded from the disk cache if there is one.
+ */
+void
+GENX(pan_blitter_cache_warm_up)(struct pan_blitter_cache *cache)
+{
+   static const unsigned sample_counts[] = {1, 4};
+
+   for (unsigned i = 0; i < ARRAY_SIZE(sample_counts); i++) {
+      unsigned nr_samples = sample_counts[i];
+      struct pan_blit_surface color = {
+         .loc = FRAG_RESULT_DATA0,
+         .type = nir_type_float32,
+         .dim = MALI_TEXTURE_DIMENSION_2D,
+         .src_samples = nr_samples,
+         .dst_samples = nr_samples,
+      };
+      struct pan_blit_surface resolve = color;
+      struct pan_blit_surface z = color;
+      struct pan_blit_surface s = color;
+
+      resolve.dst_samples = 1;
+      z.loc = FRAG_RESULT_DEPTH;
+      s.loc = FRAG_RESULT_STENCIL;
+      s.type = nir_type_uint32;
+
+      const struct pan_blit_shader_key keys[] = {
+         {.surfaces = {color}},
+         {.surfaces = {z}},
+         {.surfaces = {[1] = s}},
+         {.surfaces = {z, s}},
+         {.surfaces = {resolve}},
+      };
+
+      for (unsigned k = 0; k < ARRAY_SIZE(keys); k++) {
+         /* The resolve key is the plain color one when single-sampled */
+         if (nr_samples == 1 && k == ARRAY_SIZE(keys) - 1)
+            break;
+
+         UNUSED const struct pan_blit_shader_data *blit_shader =
+            pan_blitter_get_blit_shader(cache, &keys[k]);
+
+#if PAN_ARCH <= 5
+         if (k != 0)
+            continue;
+
+         for (unsigned f = 0; f < ARRAY_SIZE(pan_blitter_warm_up_formats);
+              f++) {
+            enum pipe_format format = pan_blitter_warm_up_formats[f];
+
+            if (!panfrost_blendable_formats_v7[format].internal) {
+               pan_blitter_get_blend_shader(cache, 0, format, nr_samples,
+                                            blit_shader->blend_types[0]);
+            }
+         }
+#endif
+      }
+   }
+}
+
 void
 GENX(pan_blitter_cache_init)(struct pan_blitter_cache *cache,
                              unsigned gpu_id,
                              struct pan_blend_shader_cache *blend_shader_cache,
                              struct pan_pool *bin_pool,
-                             struct pan_pool *desc_pool)
+                             struct pan_pool *desc_pool,
+                             struct disk_cache *disk_cache)
 {
    cache->gpu_id = gpu_id;
+   cache->disk_cache = disk_cache;
    cache->shaders.blit = _mesa_hash_table_create(NULL, pan_blit_shader_key_hash,
                                                  pan_blit_shader_key_equal);
    cache->shaders.blend = _mesa_hash_table_create(
@@ -31,6 +31,7 @@
 #include "pan_texture.h"
 #include "pan_util.h"
 
+struct disk_cache;
 struct pan_blend_shader_cache;
 struct pan_fb_info;
 struct pan_jc;
@@ -50,6 +51,9 @@ struct pan_blitter_cache {
       pthread_mutex_t lock;
    } rsds;
    struct pan_blend_shader_cache *blend_shader_cache;
+
+   /* Optional, compiled blit shaders are kept there across runs */
+   struct disk_cache *disk_cache;
 };
 
 struct pan_blit_info {
@@ -117,10 +121,13 @@ void GENX(pan_blitter_cache_init)(struct pan_blitter_cache *cache,
                                   unsigned gpu_id,
                                   struct pan_blend_shader_cache *blend_shader_cache,
                                   struct pan_pool *bin_pool,
-                                  struct pan_pool *desc_pool);
+                                  struct pan_pool *desc_pool,
+                                  struct disk_cache *disk_cache);
 
 void GENX(pan_blitter_cache_cleanup)(struct pan_blitter_cache *cache);
 
+void GENX(pan_blitter_cache_warm_up)(struct pan_blitter_cache *cache);
+
 unsigned GENX(pan_preload_fb)(struct pan_blitter_cache *cache,
                               struct pan_pool *desc_pool, struct pan_jc *jc,
                               struct pan_fb_info *fb, mali_ptr tsd,
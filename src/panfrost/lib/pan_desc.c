@@ -104,17 +104,17 @@ GENX(pan_select_crc_rt)(const struct pan_fb_info *fb, unsigned tile_size)
    bool best_rt_valid = false;
    int best_rt = -1;
 
+   /* Prefer a render target whose checksums can be compared right away,
+    * otherwise refresh the checksums of the first eligible one.
+    */
    for (unsigned i = 0; i < fb->rt_count; i++) {
-      if (!fb->rts[i].view || fb->rts[0].discard ||
+      if (!fb->rts[i].view || fb->rts[i].discard ||
           !pan_image_view_has_crc(fb->rts[i].view))
          continue;
 
-      bool valid = *(fb->rts[i].crc_valid);
-      bool full = !fb->extent.minx && !fb->extent.miny &&
-                  fb->extent.maxx == (fb->width - 1) &&
-                  fb->extent.maxy == (fb->height - 1);
-      if (!full && !valid)
-         continue;
+      bool valid =
+         !pan_crc_is_stale(fb->rts[i].crc, fb->extent.minx, fb->extent.miny,
+                           fb->extent.maxx, fb->extent.maxy);
 
       if (best_rt < 0 || (valid && !best_rt_valid)) {
          best_rt = i;
@@ -672,6 +672,32 @@ pan_force_clean_write(const struct pan_fb_info *fb, unsigned tile_size)
 
 #endif
 
+/* Whether every tile of the render area is written back for the given
+ * render target, tiles without any primitive included. Tiles written back
+ * get their checksum updated.
+ */
+static bool
+pan_rt_writes_all_tiles(const struct pan_fb_info *fb, unsigned rt,
+                        UNUSED unsigned tile_size)
+{
+   if (fb->rts[rt].clear)
+      return true;
+
+   if (!fb->rts[rt].preload)
+      return false;
+
+#if PAN_ARCH >= 6
+   /* Without clean tile writes, an INTERSECT preload leaves the tiles
+    * without primitives untouched.
+    */
+   return pan_force_clean_write(fb, tile_size) ||
+          fb->bifrost.pre_post.modes[0] == MALI_PRE_POST_FRAME_SHADER_MODE_ALWAYS;
+#else
+   /* The preload is a tiler job covering the whole framebuffer */
+   return true;
+#endif
+}
+
 unsigned
 GENX(pan_emit_fbd)(const struct pan_fb_info *fb, const struct pan_tls_info *tls,
                    const struct pan_tiler_context *tiler_ctx, void *out)
@@ -756,19 +782,33 @@ GENX(pan_emit_fbd)(const struct pan_fb_info *fb, const struct pan_tls_info *tls,
       cfg.has_zs_crc_extension = has_zs_crc_ext;
 
       if (crc_rt >= 0) {
-         bool *valid = fb->rts[crc_rt].crc_valid;
-         bool full = !fb->extent.minx && !fb->extent.miny &&
-                     fb->extent.maxx == (fb->width - 1) &&
-                     fb->extent.maxy == (fb->height - 1);
-
-         cfg.crc_read_enable = *valid;
-
-         /* If the data is currently invalid, still write CRC
-          * data if we are doing a full write, so that it is
-          * valid for next time. */
-         cfg.crc_write_enable = *valid || full;
-
-         *valid |= full;
+         struct pan_crc_state *crc = fb->rts[crc_rt].crc;
+         bool stale = pan_crc_is_stale(crc, fb->extent.minx, fb->extent.miny,
+                                       fb->extent.maxx, fb->extent.maxy);
+
+         /* Comparing against stale checksums could skip the writeback of
+          * tiles that did change, only do it if all of them are valid.
+          * Written tiles always get their checksum updated, so that the
+          * next frames can compare against it.
+          */
+         cfg.crc_read_enable = !stale;
+         cfg.crc_write_enable = true;
+
+         unsigned tiles =
+            ((fb->extent.maxx >> 4) - (fb->extent.minx >> 4) + 1) *
+            ((fb->extent.maxy >> 4) - (fb->extent.miny >> 4) + 1);
+
+         if (!stale) {
+            if (fb->crc_stats)
+               fb->crc_stats->checked_tiles += tiles;
+         } else if (pan_rt_writes_all_tiles(fb, crc_rt, tile_size)) {
+            pan_crc_validate(crc, fb->width, fb->height, fb->extent.minx,
+                             fb->extent.miny, fb->extent.maxx,
+                             fb->extent.maxy);
+
+            if (fb->crc_stats)
+               fb->crc_stats->refreshed_tiles += tiles;
+         }
       }
 
 #if PAN_ARCH >= 9
@@ -805,8 +845,10 @@ GENX(pan_emit_fbd)(const struct pan_fb_info *fb, const struct pan_tls_info *tls,
       cbuf_offset += pan_bytes_per_pixel_tib(fb->rts[i].view->format) *
                      tile_size * pan_image_view_get_nr_samples(fb->rts[i].view);
 
-      if (i != crc_rt)
-         *(fb->rts[i].crc_valid) = false;
+      if (i != crc_rt) {
+         pan_crc_invalidate(fb->rts[i].crc, fb->extent.minx, fb->extent.miny,
+                            fb->extent.maxx, fb->extent.maxy);
+      }
    }
 
    struct mali_framebuffer_pointer_packed tag;
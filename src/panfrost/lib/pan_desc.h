@@ -36,9 +36,121 @@ struct pan_compute_dim {
    uint32_t x, y, z;
 };
 
+/* Transaction elimination state of a render target. Checksums are only
+ * maintained for 16x16 tiles, so the stale region is in units of 16x16 tiles.
+ * A zero-initialized state has no valid checksum.
+ */
+struct pan_crc_state {
+   /* If false, no checksum is valid and the stale region is meaningless */
+   bool valid;
+
+   /* Bounding box of the tiles whose checksums may not match the data in
+    * memory, inclusive, empty if minx > maxx.
+    */
+   uint16_t minx, miny, maxx, maxy;
+};
+
+/* Counters updated by pan_emit_fbd() when transaction elimination is used */
+struct pan_crc_stats {
+   /* Tiles written with checksum comparison enabled, whose writeback is
+    * skipped by the hardware if their content didn't change.
+    */
+   uint64_t checked_tiles;
+
+   /* Tiles forcibly written back to make their checksums valid again */
+   uint64_t refreshed_tiles;
+};
+
+static inline void
+pan_crc_invalidate_all(struct pan_crc_state *crc)
+{
+   crc->valid = false;
+}
+
+/* Mark the checksums of the tiles covering the given pixels as stale */
+static inline void
+pan_crc_invalidate(struct pan_crc_state *crc, unsigned minx, unsigned miny,
+                   unsigned maxx, unsigned maxy)
+{
+   if (!crc->valid)
+      return;
+
+   minx >>= 4;
+   miny >>= 4;
+   maxx = MIN2(maxx >> 4, UINT16_MAX);
+   maxy = MIN2(maxy >> 4, UINT16_MAX);
+
+   if (crc->minx > crc->maxx) {
+      crc->minx = minx;
+      crc->miny = miny;
+      crc->maxx = maxx;
+      crc->maxy = maxy;
+   } else {
+      crc->minx = MIN2(crc->minx, minx);
+      crc->miny = MIN2(crc->miny, miny);
+      crc->maxx = MAX2(crc->maxx, maxx);
+      crc->maxy = MAX2(crc->maxy, maxy);
+   }
+}
+
+/* Whether any tile covering the given pixels has a stale checksum */
+static inline bool
+pan_crc_is_stale(const struct pan_crc_state *crc, unsigned minx,
+                 unsigned miny, unsigned maxx, unsigned maxy)
+{
+   if (!crc->valid)
+      return true;
+
+   return crc->minx <= crc->maxx && crc->minx <= (maxx >> 4) &&
+          crc->maxx >= (minx >> 4) && crc->miny <= (maxy >> 4) &&
+          crc->maxy >= (miny >> 4);
+}
+
+/* Record that every tile covering the given pixels of a width x height
+ * render target was written along with its checksum. The stale region is a
+ * bounding box, so it only shrinks when the written tiles cover it along one
+ * axis.
+ */
+static inline void
+pan_crc_validate(struct pan_crc_state *crc, unsigned width, unsigned height,
+                 unsigned minx, unsigned miny, unsigned maxx, unsigned maxy)
+{
+   if (!crc->valid) {
+      crc->valid = true;
+      crc->minx = 0;
+      crc->miny = 0;
+      crc->maxx = MIN2((width - 1) >> 4, UINT16_MAX);
+      crc->maxy = MIN2((height - 1) >> 4, UINT16_MAX);
+   }
+
+   if (crc->minx > crc->maxx)
+      return;
+
+   minx >>= 4;
+   miny >>= 4;
+   maxx >>= 4;
+   maxy >>= 4;
+
+   bool covers_x = minx <= crc->minx && maxx >= crc->maxx;
+   bool covers_y = miny <= crc->miny && maxy >= crc->maxy;
+
+   if (covers_x && covers_y) {
+      crc->minx = 1;
+      crc->maxx = 0;
+   } else if (covers_x && miny <= crc->miny && maxy >= crc->miny) {
+      crc->miny = maxy + 1;
+   } else if (covers_x && maxy >= crc->maxy && miny <= crc->maxy) {
+      crc->maxy = miny - 1;
+   } else if (covers_y && minx <= crc->minx && maxx >= crc->minx) {
+      crc->minx = maxx + 1;
+   } else if (covers_y && maxx >= crc->maxx && minx <= crc->maxx) {
+      crc->maxx = minx - 1;
+   }
+}
+
 struct pan_fb_color_attachment {
    const struct pan_image_view *view;
-   bool *crc_valid;
+   struct pan_crc_state *crc;
    bool clear;
    bool preload;
    bool discard;
@@ -139,6 +251,9 @@ struct pan_fb_info {
    /* Only used on Valhall */
    bool sprite_coord_origin;
    bool first_provoking_vertex;
+
+   /* Optional transaction elimination counters */
+   struct pan_crc_stats *crc_stats;
 };
 
 static inline unsigned
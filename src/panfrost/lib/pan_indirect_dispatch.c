@@ -39,8 +39,8 @@
       nir_imm_int(b, 0),                                                       \
       .base = offsetof(struct pan_indirect_dispatch_info, name))
 
-static void
-pan_indirect_dispatch_init(struct pan_indirect_dispatch_meta *meta)
+void
+GENX(pan_indirect_dispatch_init)(struct pan_indirect_dispatch_meta *meta)
 {
    nir_builder b = nir_builder_init_simple_shader(
       MESA_SHADER_COMPUTE, GENX(pan_shader_get_compiler_options)(), "%s",
@@ -159,7 +159,7 @@ GENX(pan_indirect_dispatch_emit)(struct pan_indirect_dispatch_meta *meta,
 
    /* If we haven't compiled the indirect dispatch shader yet, do it now */
    if (!meta->rsd)
-      pan_indirect_dispatch_init(meta);
+      GENX(pan_indirect_dispatch_init)(meta);
 
    panfrost_pack_work_groups_compute(invocation, 1, 1, 1, 1, 1, 1, false,
                                      false);
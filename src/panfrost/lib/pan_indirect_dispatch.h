@@ -71,6 +71,10 @@ pan_indirect_dispatch_meta_init(struct pan_indirect_dispatch_meta *meta,
 }
 
 #ifdef PAN_ARCH
+/* Compiles the indirect dispatch shader, which is otherwise done lazily by
+ * the first pan_indirect_dispatch_emit() call */
+void GENX(pan_indirect_dispatch_init)(struct pan_indirect_dispatch_meta *meta);
+
 unsigned GENX(pan_indirect_dispatch_emit)(
    struct pan_indirect_dispatch_meta *meta,
    struct pan_pool *pool, struct pan_jc *jc,
@@ -278,6 +278,43 @@ uint32_t pan_slice_align(uint64_t modifier);
 
 uint32_t pan_afbc_body_align(uint64_t modifier);
 
+/* A single 2D AFBC surface accessed by the CPU */
+struct pan_afbc_surface {
+   /* CPU pointer to the headers */
+   uint8_t *header;
+
+   /* Offset of the body from the headers */
+   uint32_t body_offset;
+
+   /* Stride in number of superblocks */
+   unsigned stride;
+
+   uint64_t modifier;
+
+   /* Bytes per pixel */
+   unsigned bpp;
+
+   unsigned arch;
+};
+
+bool pan_afbc_can_access_cpu(unsigned arch, uint64_t modifier,
+                             enum pipe_format format);
+
+void pan_afbc_surface_init(struct pan_afbc_surface *surf, unsigned arch,
+                           const struct pan_image_layout *layout,
+                           unsigned level, void *header);
+
+bool pan_afbc_superblock_is_decodable(const struct pan_afbc_surface *surf,
+                                      unsigned sx, unsigned sy);
+
+void pan_afbc_decode_superblock(const struct pan_afbc_surface *surf,
+                                unsigned sx, unsigned sy, void *dst,
+                                unsigned dst_stride);
+
+void pan_afbc_encode_superblock(const struct pan_afbc_surface *surf,
+                                unsigned sx, unsigned sy, const void *src,
+                                unsigned src_stride);
+
 struct pan_block_size panfrost_block_size(uint64_t modifier,
                                           enum pipe_format format);
 
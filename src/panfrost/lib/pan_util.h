@@ -43,7 +43,7 @@
 #define PAN_DBG_GL3     0x0100
 #define PAN_DBG_NO_AFBC 0x0200
 #define PAN_DBG_MSAA16  0x0400
-/* 0x800 unused */
+#define PAN_DBG_FLUSH_STATS 0x0800
 #define PAN_DBG_LINEAR   0x1000
 #define PAN_DBG_NO_CACHE 0x2000
 #define PAN_DBG_DUMP     0x4000
@@ -54,6 +54,7 @@
 
 #define PAN_DBG_YUV        0x20000
 #define PAN_DBG_FORCE_PACK 0x40000
+#define PAN_DBG_NO_SLAB    0x80000
 
 struct pan_blendable_format;
 
@@ -0,0 +1,437 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_texture.h"
+
+#include <chrono>
+#include <vector>
+#include <gtest/gtest.h>
+
+#define AFBC_SPARSE_16x16                                                      \
+   (AFBC_FORMAT_MOD_BLOCK_SIZE_16x16 | AFBC_FORMAT_MOD_SPARSE)
+
+/* An AFBC surface backed by host memory, with zeroed headers like freshly
+ * created resources */
+struct afbc_image {
+   struct pan_image_layout layout;
+   std::vector<uint8_t> data;
+   struct pan_afbc_surface surf;
+
+   afbc_image(unsigned arch, enum pipe_format format, uint64_t flags,
+              unsigned width, unsigned height)
+   {
+      layout = {};
+      layout.modifier = DRM_FORMAT_MOD_ARM_AFBC(flags);
+      layout.format = format;
+      layout.width = width;
+      layout.height = height;
+      layout.depth = 1;
+      layout.nr_samples = 1;
+      layout.dim = MALI_TEXTURE_DIMENSION_2D;
+      layout.nr_slices = 1;
+      layout.array_size = 1;
+
+      EXPECT_TRUE(pan_image_layout_init(arch, &layout, NULL));
+
+      data.resize(layout.data_size);
+      pan_afbc_surface_init(&surf, arch, &layout, 0, data.data());
+   }
+
+   unsigned width_sb() const
+   {
+      return layout.slices[0].row_stride / AFBC_HEADER_BYTES_PER_TILE /
+             ((layout.modifier & AFBC_FORMAT_MOD_TILED) ? 8 : 1);
+   }
+
+   unsigned height_sb() const
+   {
+      return DIV_ROUND_UP(layout.height, 16);
+   }
+
+   void encode(const uint8_t *src, unsigned src_stride)
+   {
+      for (unsigned y = 0; y < height_sb(); ++y) {
+         for (unsigned x = 0; x < width_sb(); ++x) {
+            pan_afbc_encode_superblock(
+               &surf, x, y, src + (y * 16 * src_stride) + (x * 16 * surf.bpp),
+               src_stride);
+         }
+      }
+   }
+
+   bool decode(uint8_t *dst, unsigned dst_stride)
+   {
+      for (unsigned y = 0; y < height_sb(); ++y) {
+         for (unsigned x = 0; x < width_sb(); ++x) {
+            if (!pan_afbc_superblock_is_decodable(&surf, x, y))
+               return false;
+
+            pan_afbc_decode_superblock(
+               &surf, x, y, dst + (y * 16 * dst_stride) + (x * 16 * surf.bpp),
+               dst_stride);
+         }
+      }
+
+      return true;
+   }
+};
+
+static std::vector<uint8_t>
+random_pixels(size_t size, unsigned seed)
+{
+   std::vector<uint8_t> pixels(size);
+
+   srand(seed);
+   for (size_t i = 0; i < size; ++i)
+      pixels[i] = rand();
+
+   return pixels;
+}
+
+static void
+test_round_trip(unsigned arch, enum pipe_format format, uint64_t flags)
+{
+   afbc_image img(arch, format, flags, 256, 128);
+   unsigned stride = img.width_sb() * 16 * img.surf.bpp;
+   size_t size = stride * img.height_sb() * 16;
+   std::vector<uint8_t> src = random_pixels(size, format);
+   std::vector<uint8_t> dst(size);
+
+   /* Make some superblocks solid, on v7+ these are encoded in the header */
+   for (unsigned y = 0; y < 16; ++y) {
+      for (unsigned x = 0; x < 32; ++x) {
+         memcpy(&src[(y * stride) + (x * img.surf.bpp)], &src[0],
+                img.surf.bpp);
+      }
+   }
+
+   img.encode(src.data(), stride);
+   ASSERT_TRUE(img.decode(dst.data(), stride));
+   EXPECT_EQ(src, dst);
+}
+
+TEST(AFBC, RoundTripRGBA8)
+{
+   test_round_trip(7, PIPE_FORMAT_R8G8B8A8_UNORM, AFBC_SPARSE_16x16);
+}
+
+TEST(AFBC, RoundTripBGRA8Tiled)
+{
+   test_round_trip(7, PIPE_FORMAT_B8G8R8A8_UNORM,
+                   AFBC_SPARSE_16x16 | AFBC_FORMAT_MOD_TILED |
+                      AFBC_FORMAT_MOD_SC);
+}
+
+TEST(AFBC, RoundTripRGB565)
+{
+   test_round_trip(7, PIPE_FORMAT_R5G6B5_UNORM, AFBC_SPARSE_16x16);
+}
+
+TEST(AFBC, RoundTripBGR565)
+{
+   test_round_trip(6, PIPE_FORMAT_B5G6R5_UNORM, AFBC_SPARSE_16x16);
+}
+
+TEST(AFBC, RoundTripRGB8)
+{
+   test_round_trip(6, PIPE_FORMAT_R8G8B8_UNORM, AFBC_SPARSE_16x16);
+}
+
+TEST(AFBC, RoundTripR8)
+{
+   test_round_trip(5, PIPE_FORMAT_R8_UNORM, AFBC_SPARSE_16x16);
+}
+
+TEST(AFBC, ZeroedHeadersAreBlack)
+{
+   afbc_image img(7, PIPE_FORMAT_R8G8B8A8_UNORM, AFBC_SPARSE_16x16, 64, 64);
+   unsigned stride = 64 * 4;
+   std::vector<uint8_t> dst(stride * 64, 0xff);
+
+   ASSERT_TRUE(img.decode(dst.data(), stride));
+   EXPECT_EQ(dst, std::vector<uint8_t>(stride * 64, 0));
+}
+
+TEST(AFBC, ZeroedHeadersNeedV7)
+{
+   /* Before v7 a zero subblock size isn't a solid colour superblock */
+   afbc_image img(6, PIPE_FORMAT_R8G8B8A8_UNORM, AFBC_SPARSE_16x16, 64, 64);
+
+   EXPECT_FALSE(pan_afbc_superblock_is_decodable(&img.surf, 0, 0));
+}
+
+TEST(AFBC, UncompressedLayout)
+{
+   afbc_image img(6, PIPE_FORMAT_R8G8B8A8_UNORM, AFBC_SPARSE_16x16, 64, 64);
+   std::vector<uint8_t> src = random_pixels(16 * 16 * 4, 1);
+
+   pan_afbc_encode_superblock(&img.surf, 1, 2, src.data(), 16 * 4);
+
+   uint32_t header[4];
+   memcpy(header, &img.data[(2 * 4 + 1) * AFBC_HEADER_BYTES_PER_TILE],
+          sizeof(header));
+
+   /* Sparse superblocks keep the body at a fixed location */
+   uint32_t body = img.layout.slices[0].afbc.header_size + (9 * 16 * 16 * 4);
+   EXPECT_EQ(header[0], body);
+
+   /* All subblocks are uncompressed, that is have a size of 1 */
+   for (unsigned i = 0; i < 16; ++i) {
+      unsigned bit = 32 + (i * 6);
+      uint64_t bits = header[bit / 32] >> (bit % 32);
+
+      if ((bit % 32) > 26)
+         bits |= (uint64_t)header[bit / 32 + 1] << (32 - (bit % 32));
+
+      EXPECT_EQ(bits & 0x3f, 1);
+   }
+
+   /* The subblock at (1, 1) is stored first, in raster order */
+   for (unsigned y = 0; y < 4; ++y) {
+      EXPECT_EQ(memcmp(&img.data[body + (y * 16)],
+                       &src[((4 + y) * 16 * 4) + (4 * 4)], 16),
+                0);
+   }
+}
+
+TEST(AFBC, SolidColourNeedsV7)
+{
+   std::vector<uint8_t> src(16 * 16 * 2);
+
+   for (unsigned i = 0; i < src.size(); i += 2) {
+      src[i] = 0x34;
+      src[i + 1] = 0x12;
+   }
+
+   afbc_image v6(6, PIPE_FORMAT_R5G6B5_UNORM, AFBC_SPARSE_16x16, 16, 16);
+   pan_afbc_encode_superblock(&v6.surf, 0, 0, src.data(), 16 * 2);
+   EXPECT_NE(v6.data[0] | v6.data[1] | v6.data[2] | v6.data[3], 0);
+
+   afbc_image v7(7, PIPE_FORMAT_R5G6B5_UNORM, AFBC_SPARSE_16x16, 16, 16);
+   pan_afbc_encode_superblock(&v7.surf, 0, 0, src.data(), 16 * 2);
+
+   for (unsigned i = 0; i < 8; ++i)
+      EXPECT_EQ(v7.data[i], 0);
+
+   EXPECT_EQ(v7.data[8], 0x34);
+   EXPECT_EQ(v7.data[9], 0x12);
+}
+
+/* Order of the subblocks in the body of a 16x16 superblock, as given by the
+ * AFBC specification: subblock (x, y) is stored at index order[y][x].
+ */
+static const unsigned spec_subblock_order[4][4] = {
+   {2, 1, 14, 13},
+   {3, 0, 15, 12},
+   {4, 7, 8, 11},
+   {5, 6, 9, 10},
+};
+
+/* Header of a superblock whose subblocks are all uncompressed: the body
+ * offset, then sixteen 6-bit sizes of 1 */
+static const uint8_t uncompressed_header_sizes[12] = {
+   0x41, 0x10, 0x04, 0x41, 0x10, 0x04, 0x41, 0x10, 0x04, 0x41, 0x10, 0x04,
+};
+
+TEST(AFBC, KnownUncompressedSuperblock)
+{
+   afbc_image img(6, PIPE_FORMAT_R8_UNORM, AFBC_SPARSE_16x16, 16, 16);
+   uint8_t src[16 * 16];
+
+   for (unsigned i = 0; i < sizeof(src); ++i)
+      src[i] = i;
+
+   pan_afbc_encode_superblock(&img.surf, 0, 0, src, 16);
+
+   uint32_t body = img.layout.slices[0].afbc.header_size;
+   const uint8_t expected_header[16] = {
+      (uint8_t)body, (uint8_t)(body >> 8), (uint8_t)(body >> 16),
+      (uint8_t)(body >> 24), 0x41, 0x10, 0x04, 0x41, 0x10, 0x04, 0x41, 0x10,
+      0x04, 0x41, 0x10, 0x04,
+   };
+
+   EXPECT_EQ(memcmp(&img.data[0], expected_header, 16), 0);
+
+   /* Subblocks (1, 1), (1, 0) and (0, 0) come first */
+   const uint8_t expected_body[48] = {
+      0x44, 0x45, 0x46, 0x47, 0x54, 0x55, 0x56, 0x57,
+      0x64, 0x65, 0x66, 0x67, 0x74, 0x75, 0x76, 0x77,
+      0x04, 0x05, 0x06, 0x07, 0x14, 0x15, 0x16, 0x17,
+      0x24, 0x25, 0x26, 0x27, 0x34, 0x35, 0x36, 0x37,
+      0x00, 0x01, 0x02, 0x03, 0x10, 0x11, 0x12, 0x13,
+      0x20, 0x21, 0x22, 0x23, 0x30, 0x31, 0x32, 0x33,
+   };
+
+   EXPECT_EQ(memcmp(&img.data[body], expected_body, sizeof(expected_body)),
+             0);
+
+   for (unsigned y = 0; y < 16; ++y) {
+      for (unsigned x = 0; x < 16; ++x) {
+         unsigned index = spec_subblock_order[y / 4][x / 4];
+
+         EXPECT_EQ(img.data[body + (index * 16) + ((y % 4) * 4) + (x % 4)],
+                   src[(y * 16) + x]);
+      }
+   }
+}
+
+TEST(AFBC, KnownSolidColourSuperblock)
+{
+   afbc_image img(7, PIPE_FORMAT_R8G8B8A8_UNORM, AFBC_SPARSE_16x16, 16, 16);
+   std::vector<uint8_t> src(16 * 16 * 4);
+
+   for (unsigned i = 0; i < src.size(); i += 4) {
+      src[i + 0] = 0x11;
+      src[i + 1] = 0x22;
+      src[i + 2] = 0x33;
+      src[i + 3] = 0x44;
+   }
+
+   pan_afbc_encode_superblock(&img.surf, 0, 0, src.data(), 16 * 4);
+
+   /* Zero body offset and subblock sizes, then the colour */
+   const uint8_t expected[16] = {
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x11, 0x22, 0x33, 0x44, 0x00, 0x00, 0x00, 0x00,
+   };
+
+   EXPECT_EQ(memcmp(&img.data[0], expected, 16), 0);
+
+   /* The body is left alone */
+   uint32_t body = img.layout.slices[0].afbc.header_size;
+   EXPECT_EQ(img.data[body], 0);
+}
+
+TEST(AFBC, DecodeKnownSuperblocks)
+{
+   afbc_image img(7, PIPE_FORMAT_R5G6B5_UNORM, AFBC_SPARSE_16x16, 32, 16);
+   uint32_t body = img.layout.slices[0].afbc.header_size + (16 * 16 * 2);
+   uint16_t dst[16][32];
+
+   /* Superblock 0 is a solid 0xf800 */
+   img.data[8] = 0x00;
+   img.data[9] = 0xf8;
+
+   /* Superblock 1 is uncompressed, subblock i filled with i */
+   uint8_t *header = &img.data[AFBC_HEADER_BYTES_PER_TILE];
+   memcpy(header, &body, sizeof(body));
+   memcpy(header + 4, uncompressed_header_sizes,
+          sizeof(uncompressed_header_sizes));
+
+   for (unsigned i = 0; i < 16 * 16; ++i) {
+      img.data[body + (i * 2)] = i / 16;
+      img.data[body + (i * 2) + 1] = 0;
+   }
+
+   ASSERT_TRUE(img.decode((uint8_t *)dst, sizeof(dst[0])));
+
+   for (unsigned y = 0; y < 16; ++y) {
+      for (unsigned x = 0; x < 16; ++x) {
+         EXPECT_EQ(dst[y][x], 0xf800);
+         EXPECT_EQ(dst[y][16 + x], spec_subblock_order[y / 4][x / 4]);
+      }
+   }
+}
+
+TEST(AFBC, CompressedIsNotDecodable)
+{
+   afbc_image img(7, PIPE_FORMAT_R8G8B8A8_UNORM, AFBC_SPARSE_16x16, 32, 16);
+   std::vector<uint8_t> src = random_pixels(32 * 16 * 4, 2);
+
+   img.encode(src.data(), 32 * 4);
+
+   /* Pretend the GPU compressed the second subblock of the second
+    * superblock down to 20 bytes */
+   uint8_t *header = &img.data[AFBC_HEADER_BYTES_PER_TILE];
+   header[4] = (header[4] & 0x3f) | ((20 & 3) << 6);
+   header[5] = (header[5] & ~0xf) | (20 >> 2);
+
+   EXPECT_TRUE(pan_afbc_superblock_is_decodable(&img.surf, 0, 0));
+   EXPECT_FALSE(pan_afbc_superblock_is_decodable(&img.surf, 1, 0));
+}
+
+TEST(AFBC, CanAccessCPU)
+{
+   enum pipe_format rgba8 = PIPE_FORMAT_R8G8B8A8_UNORM;
+
+   EXPECT_TRUE(pan_afbc_can_access_cpu(
+      7, DRM_FORMAT_MOD_ARM_AFBC(AFBC_SPARSE_16x16), rgba8));
+   EXPECT_TRUE(pan_afbc_can_access_cpu(
+      7,
+      DRM_FORMAT_MOD_ARM_AFBC(AFBC_SPARSE_16x16 | AFBC_FORMAT_MOD_TILED |
+                              AFBC_FORMAT_MOD_SC),
+      rgba8));
+
+   /* Whether YTR applies to the encodings we support isn't known */
+   EXPECT_FALSE(pan_afbc_can_access_cpu(
+      7, DRM_FORMAT_MOD_ARM_AFBC(AFBC_SPARSE_16x16 | AFBC_FORMAT_MOD_YTR),
+      rgba8));
+
+   /* Packed resources have no room to store uncompressed superblocks */
+   EXPECT_FALSE(pan_afbc_can_access_cpu(
+      7, DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_16x16), rgba8));
+   EXPECT_FALSE(pan_afbc_can_access_cpu(
+      7,
+      DRM_FORMAT_MOD_ARM_AFBC(AFBC_FORMAT_MOD_BLOCK_SIZE_32x8 |
+                              AFBC_FORMAT_MOD_SPARSE),
+      rgba8));
+   EXPECT_FALSE(pan_afbc_can_access_cpu(
+      7, DRM_FORMAT_MOD_ARM_AFBC(AFBC_SPARSE_16x16 | AFBC_FORMAT_MOD_SPLIT),
+      rgba8));
+   EXPECT_FALSE(pan_afbc_can_access_cpu(
+      7, DRM_FORMAT_MOD_ARM_AFBC(AFBC_SPARSE_16x16),
+      PIPE_FORMAT_R32G32B32A32_FLOAT));
+   EXPECT_FALSE(pan_afbc_can_access_cpu(7, DRM_FORMAT_MOD_LINEAR, rgba8));
+}
+
+/* Not run by default, use --gtest_also_run_disabled_tests */
+TEST(AFBC, DISABLED_Benchmark)
+{
+   const enum pipe_format formats[] = {
+      PIPE_FORMAT_R8G8B8A8_UNORM,
+      PIPE_FORMAT_R5G6B5_UNORM,
+   };
+
+   for (unsigned i = 0; i < ARRAY_SIZE(formats); ++i) {
+      afbc_image img(7, formats[i], AFBC_SPARSE_16x16, 2048, 2048);
+      unsigned stride = 2048 * img.surf.bpp;
+      std::vector<uint8_t> src = random_pixels(stride * 2048, i);
+      std::vector<uint8_t> dst(stride * 2048);
+      const unsigned iterations = 16;
+
+      auto start = std::chrono::steady_clock::now();
+      for (unsigned it = 0; it < iterations; ++it)
+         img.encode(src.data(), stride);
+      auto mid = std::chrono::steady_clock::now();
+      for (unsigned it = 0; it < iterations; ++it)
+         img.decode(dst.data(), stride);
+      auto end = std::chrono::steady_clock::now();
+
+      double mb = (double)src.size() * iterations / (1024 * 1024);
+      std::chrono::duration<double> encode = mid - start, decode = end - mid;
+
+      printf("%-24s encode %8.1f MiB/s, decode %8.1f MiB/s\n",
+             util_format_short_name(formats[i]), mb / encode.count(),
+             mb / decode.count());
+   }
+}
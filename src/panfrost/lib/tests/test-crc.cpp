@@ -0,0 +1,130 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_desc.h"
+
+#include <gtest/gtest.h>
+
+/*
+ * Test the tracking of stale transaction elimination checksums. Rectangles are
+ * given in pixels, with inclusive maximums, and checksums cover 16x16 tiles.
+ */
+
+#define WIDTH  256
+#define HEIGHT 128
+
+static bool
+stale(const struct pan_crc_state *crc, unsigned minx, unsigned miny,
+      unsigned maxx, unsigned maxy)
+{
+   return pan_crc_is_stale(crc, minx, miny, maxx, maxy);
+}
+
+TEST(CRC, ZeroInitializedIsStale)
+{
+   struct pan_crc_state crc = {};
+
+   EXPECT_TRUE(stale(&crc, 0, 0, 15, 15));
+   EXPECT_TRUE(stale(&crc, 0, 0, WIDTH - 1, HEIGHT - 1));
+}
+
+TEST(CRC, FullWriteValidates)
+{
+   struct pan_crc_state crc = {};
+
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 0, 0, WIDTH - 1, HEIGHT - 1);
+   EXPECT_FALSE(stale(&crc, 0, 0, WIDTH - 1, HEIGHT - 1));
+
+   pan_crc_invalidate_all(&crc);
+   EXPECT_TRUE(stale(&crc, 0, 0, 15, 15));
+}
+
+TEST(CRC, InvalidateTiles)
+{
+   struct pan_crc_state crc = {};
+
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 0, 0, WIDTH - 1, HEIGHT - 1);
+
+   /* Pixels 20..40 span tiles 1 and 2 */
+   pan_crc_invalidate(&crc, 20, 20, 40, 40);
+
+   EXPECT_TRUE(stale(&crc, 16, 16, 31, 31));
+   EXPECT_TRUE(stale(&crc, 32, 32, 47, 47));
+   EXPECT_TRUE(stale(&crc, 0, 0, WIDTH - 1, HEIGHT - 1));
+   EXPECT_FALSE(stale(&crc, 0, 0, 15, 15));
+   EXPECT_FALSE(stale(&crc, 48, 0, WIDTH - 1, HEIGHT - 1));
+   EXPECT_FALSE(stale(&crc, 0, 48, WIDTH - 1, HEIGHT - 1));
+}
+
+TEST(CRC, InvalidateGrowsBoundingBox)
+{
+   struct pan_crc_state crc = {};
+
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 0, 0, WIDTH - 1, HEIGHT - 1);
+   pan_crc_invalidate(&crc, 0, 0, 15, 15);
+   pan_crc_invalidate(&crc, 64, 64, 79, 79);
+
+   /* Tiles between the two invalidated ones are conservatively stale */
+   EXPECT_TRUE(stale(&crc, 32, 32, 47, 47));
+   EXPECT_FALSE(stale(&crc, 80, 0, WIDTH - 1, HEIGHT - 1));
+}
+
+TEST(CRC, PartialWriteShrinksStaleRegion)
+{
+   struct pan_crc_state crc = {};
+
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 0, 0, WIDTH - 1, HEIGHT - 1);
+   pan_crc_invalidate(&crc, 0, 0, 63, 63);
+
+   /* Write the top rows of tiles across the whole stale region */
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 0, 0, WIDTH - 1, 31);
+   EXPECT_FALSE(stale(&crc, 0, 0, WIDTH - 1, 31));
+   EXPECT_TRUE(stale(&crc, 0, 32, 63, 63));
+
+   /* Then the rest of it */
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 0, 32, 63, 63);
+   EXPECT_FALSE(stale(&crc, 0, 0, WIDTH - 1, HEIGHT - 1));
+}
+
+TEST(CRC, PartialWriteOfStaleTarget)
+{
+   struct pan_crc_state crc = {};
+
+   /* The left half becomes valid, the right half stays stale */
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 0, 0, WIDTH / 2 - 1, HEIGHT - 1);
+   EXPECT_FALSE(stale(&crc, 0, 0, WIDTH / 2 - 1, HEIGHT - 1));
+   EXPECT_TRUE(stale(&crc, WIDTH / 2, 0, WIDTH - 1, HEIGHT - 1));
+}
+
+TEST(CRC, InteriorWriteKeepsStaleRegion)
+{
+   struct pan_crc_state crc = {};
+
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 0, 0, WIDTH - 1, HEIGHT - 1);
+   pan_crc_invalidate(&crc, 0, 0, 63, 63);
+
+   /* A bounding box can't have a hole, the whole region stays stale */
+   pan_crc_validate(&crc, WIDTH, HEIGHT, 16, 16, 47, 47);
+   EXPECT_TRUE(stale(&crc, 0, 0, 15, 15));
+   EXPECT_TRUE(stale(&crc, 16, 16, 31, 31));
+}
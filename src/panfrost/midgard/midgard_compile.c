@@ -34,6 +34,7 @@
 #include "compiler/glsl_types.h"
 #include "compiler/glsl/glsl_to_nir.h"
 #include "compiler/nir/nir_builder.h"
+#include "panfrost/util/pan_pass_time.h"
 #include "util/half_float.h"
 #include "util/list.h"
 #include "util/u_debug.h"
@@ -56,6 +57,8 @@ static const struct debug_named_value midgard_debug_options[] = {
    {"inorder", MIDGARD_DBG_INORDER, "Disables out-of-order scheduling"},
    {"verbose", MIDGARD_DBG_VERBOSE, "Dump shaders verbosely"},
    {"internal", MIDGARD_DBG_INTERNAL, "Dump internal shaders"},
+   {"passtime", MIDGARD_DBG_PASSTIME,
+    "Print the time spent in each pass at exit"},
    DEBUG_NAMED_VALUE_END};
 
 DEBUG_GET_ONCE_FLAGS_OPTION(midgard_debug, "MIDGARD_MESA_DEBUG",
@@ -63,6 +66,19 @@ DEBUG_GET_ONCE_FLAGS_OPTION(midgard_debug, "MIDGARD_MESA_DEBUG",
 
 int midgard_debug = 0;
 
+static struct pan_pass_timer mdg_pass_timer = PAN_PASS_TIMER_INIT("midgard");
+
+#define MDG_TIME_PASS(name, pass) PAN_TIME_PASS(&mdg_pass_timer, name, pass)
+
+static void
+mdg_read_debug(void)
+{
+   midgard_debug = debug_get_option_midgard_debug();
+
+   if (midgard_debug & MIDGARD_DBG_PASSTIME)
+      pan_pass_timer_enable(&mdg_pass_timer);
+}
+
 static midgard_block *
 create_empty_block(compiler_context *ctx)
 {
@@ -323,8 +339,8 @@ midgard_vectorize_filter(const nir_instr *instr, const void *data)
    return 4;
 }
 
-void
-midgard_preprocess_nir(nir_shader *nir, unsigned gpu_id)
+static void
+mdg_lower_nir(nir_shader *nir, unsigned gpu_id)
 {
    unsigned quirks = midgard_get_quirks(gpu_id);
 
@@ -405,6 +421,14 @@ midgard_preprocess_nir(nir_shader *nir, unsigned gpu_id)
    NIR_PASS_V(nir, nir_lower_var_copies);
 }
 
+void
+midgard_preprocess_nir(nir_shader *nir, unsigned gpu_id)
+{
+   mdg_read_debug();
+
+   MDG_TIME_PASS("nir_lower", mdg_lower_nir(nir, gpu_id));
+}
+
 static void
 optimise_nir(nir_shader *nir, unsigned quirks, bool is_blend)
 {
@@ -2874,49 +2898,16 @@ mir_add_writeout_loops(compiler_context *ctx)
    }
 }
 
-void
-midgard_compile_shader_nir(nir_shader *nir,
-                           const struct panfrost_compile_inputs *inputs,
-                           struct util_dynarray *binary,
-                           struct pan_shader_info *info)
+/* Translate NIR to MIR */
+static void
+mdg_emit_program(compiler_context *ctx)
 {
-   midgard_debug = debug_get_option_midgard_debug();
-
-   /* TODO: Bound against what? */
-   compiler_context *ctx = rzalloc(NULL, compiler_context);
-
-   ctx->inputs = inputs;
-   ctx->nir = nir;
-   ctx->info = info;
-   ctx->stage = nir->info.stage;
-   ctx->blend_input = ~0;
-   ctx->blend_src1 = ~0;
-   ctx->quirks = midgard_get_quirks(inputs->gpu_id);
-
-   /* Initialize at a global (not block) level hash tables */
-
-   ctx->ssa_constants = _mesa_hash_table_u64_create(ctx);
-
-   /* Collect varyings after lowering I/O */
-   pan_nir_collect_varyings(nir, info);
-
-   /* Optimisation passes */
-   optimise_nir(nir, ctx->quirks, inputs->is_blend);
-
-   bool skip_internal = nir->info.internal;
-   skip_internal &= !(midgard_debug & MIDGARD_DBG_INTERNAL);
-
-   if (midgard_debug & MIDGARD_DBG_SHADERS && !skip_internal)
-      nir_print_shader(nir, stdout);
-
-   info->tls_size = nir->scratch_size;
-
-   nir_foreach_function_with_impl(func, impl, nir) {
+   nir_foreach_function_with_impl(func, impl, ctx->nir) {
       list_inithead(&ctx->blocks);
       ctx->block_count = 0;
       ctx->func = func;
 
-      if (nir->info.outputs_read && !inputs->is_blend) {
+      if (ctx->nir->info.outputs_read && !ctx->inputs->is_blend) {
          emit_block_init(ctx);
 
          struct midgard_instruction wait = v_branch(false, false);
@@ -2930,7 +2921,11 @@ midgard_compile_shader_nir(nir_shader *nir,
       emit_cf_list(ctx, &impl->body);
       break; /* TODO: Multi-function shaders */
    }
+}
 
+static void
+mdg_optimize_program(compiler_context *ctx)
+{
    /* Per-block lowering before opts */
 
    mir_foreach_block(ctx, _block) {
@@ -2938,6 +2933,7 @@ midgard_compile_shader_nir(nir_shader *nir,
       inline_alu_constants(ctx, block);
       embedded_to_inline_constant(ctx, block);
    }
+
    /* MIR-level optimizations */
 
    bool progress = false;
@@ -2961,27 +2957,11 @@ midgard_compile_shader_nir(nir_shader *nir,
       midgard_legalize_invert(ctx, block);
       midgard_cull_dead_branch(ctx, block);
    }
+}
 
-   if (ctx->stage == MESA_SHADER_FRAGMENT)
-      mir_add_writeout_loops(ctx);
-
-   /* Analyze now that the code is known but before scheduling creates
-    * pipeline registers which are harder to track */
-   mir_analyze_helper_requirements(ctx);
-
-   if (midgard_debug & MIDGARD_DBG_SHADERS && !skip_internal)
-      mir_print_shader(ctx);
-
-   /* Schedule! */
-   midgard_schedule_program(ctx);
-   mir_ra(ctx);
-
-   if (midgard_debug & MIDGARD_DBG_SHADERS && !skip_internal)
-      mir_print_shader(ctx);
-
-   /* Analyze after scheduling since this is order-dependent */
-   mir_analyze_helper_terminate(ctx);
-
+static void
+mdg_pack_program(compiler_context *ctx, struct util_dynarray *binary)
+{
    /* Emit flat binary from the instruction arrays. Iterate each block in
     * sequence. Save instruction boundaries such that lookahead tags can
     * be assigned easily */
@@ -3026,6 +3006,70 @@ midgard_compile_shader_nir(nir_shader *nir,
    }
 
    free(source_order_bundles);
+}
+
+void
+midgard_compile_shader_nir(nir_shader *nir,
+                           const struct panfrost_compile_inputs *inputs,
+                           struct util_dynarray *binary,
+                           struct pan_shader_info *info)
+{
+   mdg_read_debug();
+
+   /* TODO: Bound against what? */
+   compiler_context *ctx = rzalloc(NULL, compiler_context);
+
+   ctx->inputs = inputs;
+   ctx->nir = nir;
+   ctx->info = info;
+   ctx->stage = nir->info.stage;
+   ctx->blend_input = ~0;
+   ctx->blend_src1 = ~0;
+   ctx->quirks = midgard_get_quirks(inputs->gpu_id);
+
+   /* Initialize at a global (not block) level hash tables */
+
+   ctx->ssa_constants = _mesa_hash_table_u64_create(ctx);
+
+   /* Collect varyings after lowering I/O */
+   pan_nir_collect_varyings(nir, info);
+
+   /* Optimisation passes */
+   MDG_TIME_PASS("nir_optimize",
+                 optimise_nir(nir, ctx->quirks, inputs->is_blend));
+
+   bool skip_internal = nir->info.internal;
+   skip_internal &= !(midgard_debug & MIDGARD_DBG_INTERNAL);
+
+   if (midgard_debug & MIDGARD_DBG_SHADERS && !skip_internal)
+      nir_print_shader(nir, stdout);
+
+   info->tls_size = nir->scratch_size;
+
+   MDG_TIME_PASS("midgard_emit", mdg_emit_program(ctx));
+   MDG_TIME_PASS("midgard_optimize", mdg_optimize_program(ctx));
+
+   if (ctx->stage == MESA_SHADER_FRAGMENT)
+      mir_add_writeout_loops(ctx);
+
+   /* Analyze now that the code is known but before scheduling creates
+    * pipeline registers which are harder to track */
+   mir_analyze_helper_requirements(ctx);
+
+   if (midgard_debug & MIDGARD_DBG_SHADERS && !skip_internal)
+      mir_print_shader(ctx);
+
+   /* Schedule! */
+   MDG_TIME_PASS("midgard_schedule", midgard_schedule_program(ctx));
+   MDG_TIME_PASS("midgard_ra", mir_ra(ctx));
+
+   if (midgard_debug & MIDGARD_DBG_SHADERS && !skip_internal)
+      mir_print_shader(ctx);
+
+   /* Analyze after scheduling since this is order-dependent */
+   mir_analyze_helper_terminate(ctx);
+
+   MDG_TIME_PASS("midgard_pack", mdg_pack_program(ctx, binary));
 
    /* Report the very first tag executed */
    info->midgard.first_tag = midgard_get_first_tag_from_block(ctx, 0);
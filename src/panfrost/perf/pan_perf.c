@@ -58,8 +58,8 @@ panfrost_perf_counter_read(const struct panfrost_perf_counter *counter,
    return ret;
 }
 
-static const struct panfrost_perf_config *
-panfrost_lookup_counters(const char *name)
+const struct panfrost_perf_config *
+panfrost_perf_lookup_config(const char *name)
 {
    for (unsigned i = 0; i < ARRAY_SIZE(panfrost_perf_configs); ++i) {
       if (strcmp(panfrost_perf_configs[i]->name, name) == 0)
@@ -69,6 +69,93 @@ panfrost_lookup_counters(const char *name)
    return NULL;
 }
 
+/* Counters are numbered across categories, in the order of the XML */
+
+unsigned
+panfrost_perf_num_counters(const struct panfrost_perf_config *cfg)
+{
+   unsigned count = 0;
+
+   for (unsigned i = 0; i < cfg->n_categories; ++i)
+      count += cfg->categories[i].n_counters;
+
+   return count;
+}
+
+const struct panfrost_perf_counter *
+panfrost_perf_get_counter(const struct panfrost_perf_config *cfg,
+                          unsigned index)
+{
+   for (unsigned i = 0; i < cfg->n_categories; ++i) {
+      const struct panfrost_perf_category *cat = &cfg->categories[i];
+
+      if (index < cat->n_counters)
+         return &cat->counters[index];
+
+      index -= cat->n_counters;
+   }
+
+   return NULL;
+}
+
+static int
+panfrost_perf_query(struct panfrost_perf *perf, uint32_t enable)
+{
+   struct drm_panfrost_perfcnt_enable perfcnt_enable = {enable, 0};
+   return drmIoctl(perf->dev->fd, DRM_IOCTL_PANFROST_PERFCNT_ENABLE,
+                   &perfcnt_enable);
+}
+
+static int
+panfrost_perf_kernel_enable(struct panfrost_perf *perf)
+{
+   return panfrost_perf_query(perf, 1 /* enable */);
+}
+
+static int
+panfrost_perf_kernel_disable(struct panfrost_perf *perf)
+{
+   return panfrost_perf_query(perf, 0 /* disable */);
+}
+
+static int
+panfrost_perf_kernel_dump(struct panfrost_perf *perf)
+{
+   // Dump performance counter values to the memory buffer pointed to by
+   // counter_values
+   struct drm_panfrost_perfcnt_dump perfcnt_dump = {
+      (uint64_t)(uintptr_t)perf->counter_values};
+   return drmIoctl(perf->dev->fd, DRM_IOCTL_PANFROST_PERFCNT_DUMP,
+                   &perfcnt_dump);
+}
+
+static const struct panfrost_perf_source panfrost_perf_kernel_source = {
+   .enable = panfrost_perf_kernel_enable,
+   .disable = panfrost_perf_kernel_disable,
+   .dump = panfrost_perf_kernel_dump,
+};
+
+void
+panfrost_perf_init_layout(struct panfrost_perf *perf,
+                          const struct panfrost_perf_config *cfg,
+                          unsigned l2_slices, unsigned core_id_range)
+{
+   perf->cfg = cfg;
+   perf->core_id_range = core_id_range;
+
+   // Generally counter blocks are laid out in the following order:
+   // Job manager, tiler, one or more L2 caches, and one or more shader cores.
+   uint32_t n_blocks = 2 + l2_slices + perf->core_id_range;
+   perf->n_counter_values = PAN_COUNTERS_PER_CATEGORY * n_blocks;
+   perf->counter_values = rzalloc_array(perf, uint32_t, perf->n_counter_values);
+
+   /* Setup the layout */
+   perf->category_offset[0] = PAN_COUNTERS_PER_CATEGORY * 0;
+   perf->category_offset[1] = PAN_COUNTERS_PER_CATEGORY * 1;
+   perf->category_offset[2] = PAN_COUNTERS_PER_CATEGORY * 2;
+   perf->category_offset[3] = PAN_COUNTERS_PER_CATEGORY * (2 + l2_slices);
+}
+
 void
 panfrost_perf_init(struct panfrost_perf *perf, int fd)
 {
@@ -90,54 +177,34 @@ panfrost_perf_init(struct panfrost_perf *perf, int fd)
    if (model == NULL)
       unreachable("Invalid GPU ID");
 
-   perf->cfg = panfrost_lookup_counters(model->performance_counters);
+   const struct panfrost_perf_config *cfg =
+      panfrost_perf_lookup_config(model->performance_counters);
 
-   if (perf->cfg == NULL)
+   if (cfg == NULL)
       unreachable("Performance counters missing!");
 
-   // Generally counter blocks are laid out in the following order:
-   // Job manager, tiler, one or more L2 caches, and one or more shader cores.
+   unsigned core_id_range;
    unsigned l2_slices = panfrost_query_l2_slices(&props);
-   panfrost_query_core_count(&props, &perf->core_id_range);
-
-   uint32_t n_blocks = 2 + l2_slices + perf->core_id_range;
-   perf->n_counter_values = PAN_COUNTERS_PER_CATEGORY * n_blocks;
-   perf->counter_values = ralloc_array(perf, uint32_t, perf->n_counter_values);
+   panfrost_query_core_count(&props, &core_id_range);
 
-   /* Setup the layout */
-   perf->category_offset[0] = PAN_COUNTERS_PER_CATEGORY * 0;
-   perf->category_offset[1] = PAN_COUNTERS_PER_CATEGORY * 1;
-   perf->category_offset[2] = PAN_COUNTERS_PER_CATEGORY * 2;
-   perf->category_offset[3] = PAN_COUNTERS_PER_CATEGORY * (2 + l2_slices);
-}
-
-static int
-panfrost_perf_query(struct panfrost_perf *perf, uint32_t enable)
-{
-   struct drm_panfrost_perfcnt_enable perfcnt_enable = {enable, 0};
-   return drmIoctl(perf->dev->fd, DRM_IOCTL_PANFROST_PERFCNT_ENABLE,
-                   &perfcnt_enable);
+   panfrost_perf_init_layout(perf, cfg, l2_slices, core_id_range);
+   perf->source = &panfrost_perf_kernel_source;
 }
 
 int
 panfrost_perf_enable(struct panfrost_perf *perf)
 {
-   return panfrost_perf_query(perf, 1 /* enable */);
+   return perf->source->enable(perf);
 }
 
 int
 panfrost_perf_disable(struct panfrost_perf *perf)
 {
-   return panfrost_perf_query(perf, 0 /* disable */);
+   return perf->source->disable(perf);
 }
 
 int
 panfrost_perf_dump(struct panfrost_perf *perf)
 {
-   // Dump performance counter values to the memory buffer pointed to by
-   // counter_values
-   struct drm_panfrost_perfcnt_dump perfcnt_dump = {
-      (uint64_t)(uintptr_t)perf->counter_values};
-   return drmIoctl(perf->dev->fd, DRM_IOCTL_PANFROST_PERFCNT_DUMP,
-                   &perfcnt_dump);
+   return perf->source->dump(perf);
 }
@@ -84,8 +84,19 @@ struct panfrost_perf_config {
    uint32_t n_categories;
 };
 
+/* Where counter values come from, the kernel unless overridden by tests */
+struct panfrost_perf_source {
+   int (*enable)(struct panfrost_perf *perf);
+   int (*disable)(struct panfrost_perf *perf);
+
+   /* Fill counter_values with the counters accumulated since the last dump,
+    * the hardware clears them when sampled */
+   int (*dump)(struct panfrost_perf *perf);
+};
+
 struct panfrost_perf {
    struct pan_kmod_dev *dev;
+   const struct panfrost_perf_source *source;
    unsigned core_id_range;
    const struct panfrost_perf_config *cfg;
 
@@ -100,6 +111,19 @@ struct panfrost_perf {
 uint32_t panfrost_perf_counter_read(const struct panfrost_perf_counter *counter,
                                     const struct panfrost_perf *perf);
 
+const struct panfrost_perf_config *
+panfrost_perf_lookup_config(const char *name);
+
+unsigned panfrost_perf_num_counters(const struct panfrost_perf_config *cfg);
+
+const struct panfrost_perf_counter *
+panfrost_perf_get_counter(const struct panfrost_perf_config *cfg,
+                          unsigned index);
+
+void panfrost_perf_init_layout(struct panfrost_perf *perf,
+                               const struct panfrost_perf_config *cfg,
+                               unsigned l2_slices, unsigned core_id_range);
+
 void panfrost_perf_init(struct panfrost_perf *perf, int fd);
 
 int panfrost_perf_enable(struct panfrost_perf *perf);
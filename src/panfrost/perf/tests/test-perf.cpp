@@ -0,0 +1,168 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "perf/pan_perf.h"
+#include "util/ralloc.h"
+
+#include <gtest/gtest.h>
+
+/*
+ * Test the counter layout and sampling against a fake counter source, which
+ * fills every counter of block N with (N + 1) times the dump number.
+ */
+
+#define L2_SLICES     2
+#define CORE_ID_RANGE 4
+#define N_BLOCKS      (2 + L2_SLICES + CORE_ID_RANGE)
+
+static unsigned dumps;
+static bool enabled;
+
+static int
+fake_enable(struct panfrost_perf *perf)
+{
+   enabled = true;
+   return 0;
+}
+
+static int
+fake_disable(struct panfrost_perf *perf)
+{
+   enabled = false;
+   return 0;
+}
+
+static int
+fake_dump(struct panfrost_perf *perf)
+{
+   if (!enabled)
+      return -1;
+
+   dumps++;
+
+   for (unsigned i = 0; i < perf->n_counter_values; ++i)
+      perf->counter_values[i] = (i / 64 + 1) * dumps;
+
+   return 0;
+}
+
+static const struct panfrost_perf_source fake_source = {
+   .enable = fake_enable,
+   .disable = fake_disable,
+   .dump = fake_dump,
+};
+
+class Perf : public testing::Test {
+ protected:
+   Perf()
+   {
+      dumps = 0;
+      enabled = false;
+
+      cfg = panfrost_perf_lookup_config("TGOx");
+      perf = rzalloc(NULL, struct panfrost_perf);
+      panfrost_perf_init_layout(perf, cfg, L2_SLICES, CORE_ID_RANGE);
+      perf->source = &fake_source;
+   }
+
+   ~Perf()
+   {
+      ralloc_free(perf);
+   }
+
+   const struct panfrost_perf_counter *
+   counter(unsigned category)
+   {
+      return &cfg->categories[category].counters[0];
+   }
+
+   const struct panfrost_perf_config *cfg;
+   struct panfrost_perf *perf;
+};
+
+TEST_F(Perf, LookupConfig)
+{
+   ASSERT_NE(cfg, nullptr);
+   EXPECT_STREQ(cfg->name, "TGOx");
+   EXPECT_EQ(panfrost_perf_lookup_config("T62x"), nullptr);
+}
+
+TEST_F(Perf, CountersAreNumberedAcrossCategories)
+{
+   unsigned index = 0;
+
+   for (unsigned i = 0; i < cfg->n_categories; ++i) {
+      for (unsigned j = 0; j < cfg->categories[i].n_counters; ++j) {
+         EXPECT_EQ(panfrost_perf_get_counter(cfg, index),
+                   &cfg->categories[i].counters[j]);
+         index++;
+      }
+   }
+
+   EXPECT_EQ(panfrost_perf_num_counters(cfg), index);
+   EXPECT_EQ(panfrost_perf_get_counter(cfg, index), nullptr);
+}
+
+TEST_F(Perf, DumpNeedsEnable)
+{
+   EXPECT_NE(panfrost_perf_dump(perf), 0);
+
+   EXPECT_EQ(panfrost_perf_enable(perf), 0);
+   EXPECT_EQ(panfrost_perf_dump(perf), 0);
+
+   EXPECT_EQ(panfrost_perf_disable(perf), 0);
+   EXPECT_NE(panfrost_perf_dump(perf), 0);
+}
+
+TEST_F(Perf, ReadBlocks)
+{
+   panfrost_perf_enable(perf);
+   panfrost_perf_dump(perf);
+
+   /* Job manager and tiler come first, then the first L2 slice */
+   EXPECT_EQ(panfrost_perf_counter_read(counter(0), perf), 1);
+   EXPECT_EQ(panfrost_perf_counter_read(counter(1), perf), 2);
+   EXPECT_EQ(panfrost_perf_counter_read(counter(2), perf), 3);
+
+   /* Shader cores are summed */
+   unsigned cores = 0;
+   for (unsigned i = 2 + L2_SLICES; i < N_BLOCKS; ++i)
+      cores += i + 1;
+
+   EXPECT_EQ(panfrost_perf_counter_read(counter(3), perf), cores);
+}
+
+TEST_F(Perf, AccumulateDumps)
+{
+   uint64_t total = 0;
+
+   panfrost_perf_enable(perf);
+
+   for (unsigned i = 0; i < 3; ++i) {
+      panfrost_perf_dump(perf);
+      total += panfrost_perf_counter_read(counter(1), perf);
+   }
+
+   /* Tiler block, dumps 1 to 3 */
+   EXPECT_EQ(total, 2 * (1 + 2 + 3));
+}
@@ -36,14 +36,28 @@
  * line alignment benefits. Insertion is O(1) and in-order until the cache
  * fills up, after that it evicts the oldest cached value in a ring facilitated
  * by index.
+ *
+ * Slices missing from the table are computed on the CPU. To avoid rescanning
+ * the same indices for every new slice of a large buffer, we also keep the
+ * bounds of fixed-size blocks of the buffer. A slice is then made of the
+ * blocks it covers entirely, whose bounds are only computed once, plus two
+ * partial blocks at its ends which are scanned. The scan loops are written
+ * so the compiler vectorizes them.
  */
 
 #include "pan_minmax_cache.h"
+#include "util/detect_arch.h"
+#include "util/macros.h"
+#include "util/u_math.h"
+
+#if DETECT_ARCH_AARCH64
+#include <arm_neon.h>
+#endif
 
 bool
-panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache, unsigned start,
-                          unsigned count, unsigned *min_index,
-                          unsigned *max_index)
+panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache,
+                          unsigned index_size, unsigned start, unsigned count,
+                          unsigned *min_index, unsigned *max_index)
 {
    uint64_t ht_key = (((uint64_t)count) << 32) | start;
    bool found = false;
@@ -52,7 +66,7 @@ panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache, unsigned start,
       return false;
 
    for (unsigned i = 0; i < cache->size; ++i) {
-      if (cache->keys[i] == ht_key) {
+      if (cache->keys[i] == ht_key && cache->index_sizes[i] == index_size) {
          uint64_t hit = cache->values[i];
 
          *min_index = hit & 0xffffffff;
@@ -66,9 +80,9 @@ panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache, unsigned start,
 }
 
 void
-panfrost_minmax_cache_add(struct panfrost_minmax_cache *cache, unsigned start,
-                          unsigned count, unsigned min_index,
-                          unsigned max_index)
+panfrost_minmax_cache_add(struct panfrost_minmax_cache *cache,
+                          unsigned index_size, unsigned start, unsigned count,
+                          unsigned min_index, unsigned max_index)
 {
    uint64_t ht_key = (((uint64_t)count) << 32) | start;
    uint64_t value = min_index | (((uint64_t)max_index) << 32);
@@ -86,41 +100,301 @@ panfrost_minmax_cache_add(struct panfrost_minmax_cache *cache, unsigned start,
 
    cache->keys[index] = ht_key;
    cache->values[index] = value;
+   cache->index_sizes[index] = index_size;
+}
+
+#define MINMAX_SCAN(T)                                                         \
+   static void minmax_scan_##T(const T *indices, unsigned count, bool restart, \
+                               T restart_index, unsigned *min_index,           \
+                               unsigned *max_index)                            \
+   {                                                                           \
+      T lo = (T)~0, hi = 0;                                                    \
+                                                                               \
+      if (restart) {                                                           \
+         /* Turn restart indices into neutral values rather than branching */  \
+         for (unsigned i = 0; i < count; i++) {                                \
+            T v = indices[i];                                                  \
+            T mask = v == restart_index ? (T)~0 : 0;                           \
+            lo = MIN2(lo, v | mask);                                           \
+            hi = MAX2(hi, v & ~mask);                                          \
+         }                                                                     \
+      } else {                                                                 \
+         for (unsigned i = 0; i < count; i++) {                                \
+            lo = MIN2(lo, indices[i]);                                         \
+            hi = MAX2(hi, indices[i]);                                         \
+         }                                                                     \
+      }                                                                        \
+                                                                               \
+      *min_index = MIN2(*min_index, lo);                                       \
+      *max_index = MAX2(*max_index, hi);                                       \
+   }
+
+MINMAX_SCAN(uint8_t)
+MINMAX_SCAN(uint16_t)
+MINMAX_SCAN(uint32_t)
+
+#if DETECT_ARCH_AARCH64
+
+/* Index buffers often live in write-combine mappings, where reads are only
+ * reasonably fast when they are wide and sequential. Scan a whole cache line
+ * per iteration, starting at a line boundary, and leave the unaligned ends
+ * to the scalar loop.
+ */
+#define MINMAX_LINE 64
+
+#define MINMAX_SCAN_NEON(T, V, sfx)                                            \
+   static void minmax_scan_neon_##T(const T *indices, unsigned count,          \
+                                    bool restart, T restart_index,             \
+                                    unsigned *min_index, unsigned *max_index)  \
+   {                                                                           \
+      const unsigned lanes = sizeof(V) / sizeof(T);                            \
+      const unsigned line = MINMAX_LINE / sizeof(T);                           \
+      unsigned head =                                                          \
+         (-(uintptr_t)indices & (MINMAX_LINE - 1)) / sizeof(T);                \
+                                                                               \
+      head = MIN2(head, count);                                                \
+      minmax_scan_##T(indices, head, restart, restart_index, min_index,        \
+                      max_index);                                              \
+      indices += head;                                                         \
+      count -= head;                                                           \
+                                                                               \
+      V lo = vdupq_n_##sfx((T)~0), hi = vdupq_n_##sfx(0);                      \
+      V r = vdupq_n_##sfx(restart_index);                                      \
+      unsigned body = count - (count % line);                                  \
+                                                                               \
+      for (unsigned i = 0; i < body; i += line) {                              \
+         for (unsigned j = 0; j < line; j += lanes) {                          \
+            V v = vld1q_##sfx(indices + i + j);                                \
+                                                                               \
+            if (restart) {                                                     \
+               V mask = vceqq_##sfx(v, r);                                     \
+               lo = vminq_##sfx(lo, vorrq_##sfx(v, mask));                     \
+               hi = vmaxq_##sfx(hi, vbicq_##sfx(v, mask));                     \
+            } else {                                                           \
+               lo = vminq_##sfx(lo, v);                                        \
+               hi = vmaxq_##sfx(hi, v);                                        \
+            }                                                                  \
+         }                                                                     \
+      }                                                                        \
+                                                                               \
+      if (body) {                                                              \
+         *min_index = MIN2(*min_index, vminvq_##sfx(lo));                      \
+         *max_index = MAX2(*max_index, vmaxvq_##sfx(hi));                      \
+      }                                                                        \
+                                                                               \
+      minmax_scan_##T(indices + body, count - body, restart, restart_index,    \
+                      min_index, max_index);                                   \
+   }
+
+MINMAX_SCAN_NEON(uint8_t, uint8x16_t, u8)
+MINMAX_SCAN_NEON(uint16_t, uint16x8_t, u16)
+MINMAX_SCAN_NEON(uint32_t, uint32x4_t, u32)
+
+#define MINMAX_SCAN_FN(T) minmax_scan_neon_##T
+#else
+#define MINMAX_SCAN_FN(T) minmax_scan_##T
+#endif
+
+/* Accumulate the bounds of count indices into min_index/max_index. Restart
+ * indices that don't fit in the index type never match, like in u_vbuf.
+ */
+static void
+minmax_scan(const void *indices, unsigned index_size, unsigned count,
+            bool restart, unsigned restart_index, unsigned *min_index,
+            unsigned *max_index)
+{
+   uint32_t type_max = u_uintN_max(index_size * 8);
+
+   restart = restart && restart_index <= type_max;
+
+   switch (index_size) {
+   case 1:
+      MINMAX_SCAN_FN(uint8_t)(indices, count, restart, restart_index,
+                              min_index, max_index);
+      break;
+   case 2:
+      MINMAX_SCAN_FN(uint16_t)(indices, count, restart, restart_index,
+                               min_index, max_index);
+      break;
+   case 4:
+      MINMAX_SCAN_FN(uint32_t)(indices, count, restart, restart_index,
+                               min_index, max_index);
+      break;
+   default:
+      unreachable("Invalid index size");
+   }
+}
+
+/* Make sure blocks are tracked for the given configuration, up to nr_blocks.
+ * Returns false if they can't be.
+ */
+static bool
+minmax_blocks_prepare(struct panfrost_minmax_cache *cache, uint64_t key,
+                      unsigned nr_blocks)
+{
+   if (cache->blocks_key != key) {
+      memset(cache->blocks, 0xff, cache->nr_blocks * sizeof(uint64_t));
+      cache->blocks_key = key;
+   }
+
+   if (nr_blocks <= cache->nr_blocks)
+      return true;
+
+   uint64_t *blocks = realloc(cache->blocks, nr_blocks * sizeof(uint64_t));
+   if (!blocks)
+      return false;
+
+   memset(blocks + cache->nr_blocks, 0xff,
+          (nr_blocks - cache->nr_blocks) * sizeof(uint64_t));
+   cache->blocks = blocks;
+   cache->nr_blocks = nr_blocks;
+   return true;
+}
+
+/* Compute the bounds of the slice (start, start + count) of an index buffer,
+ * indices pointing to the first index of the slice. The cache is optional, it
+ * is used for the blocks the slice covers and the caller is responsible for
+ * adding the result to it.
+ */
+void
+panfrost_minmax_cache_compute(struct panfrost_minmax_cache *cache,
+                              const void *indices, unsigned index_size,
+                              unsigned start, unsigned count,
+                              bool primitive_restart, unsigned restart_index,
+                              unsigned *min_index, unsigned *max_index)
+{
+   const unsigned block_size = PANFROST_MINMAX_BLOCK_SIZE;
+   uint64_t begin = (uint64_t)start * index_size;
+   uint64_t end = begin + (uint64_t)count * index_size;
+   uint64_t first_block = DIV_ROUND_UP(begin, block_size);
+   uint64_t last_block = end / block_size;
+   uint64_t key = index_size;
+
+   if (primitive_restart)
+      key |= (1 << 8) | ((uint64_t)restart_index << 32);
+
+   *min_index = u_uintN_max(index_size * 8);
+   *max_index = 0;
+
+   if (!count) {
+      *min_index = 0;
+      return;
+   }
+
+   if (!cache || first_block >= last_block ||
+       !minmax_blocks_prepare(cache, key, last_block)) {
+      minmax_scan(indices, index_size, count, primitive_restart, restart_index,
+                  min_index, max_index);
+      return;
+   }
+
+   /* Head of the slice, up to the first block */
+   minmax_scan(indices, index_size,
+               (first_block * block_size - begin) / index_size,
+               primitive_restart, restart_index, min_index, max_index);
+
+   for (uint64_t b = first_block; b < last_block; ++b) {
+      if (cache->blocks[b] == UINT64_MAX) {
+         unsigned block_min = u_uintN_max(index_size * 8), block_max = 0;
+
+         minmax_scan((const uint8_t *)indices + (b * block_size - begin),
+                     index_size, block_size / index_size, primitive_restart,
+                     restart_index, &block_min, &block_max);
+
+         cache->blocks[b] = block_min | ((uint64_t)block_max << 32);
+      }
+
+      *min_index = MIN2(*min_index, cache->blocks[b] & 0xffffffff);
+      *max_index = MAX2(*max_index, cache->blocks[b] >> 32);
+   }
+
+   /* Tail of the slice, after the last block */
+   minmax_scan((const uint8_t *)indices + (last_block * block_size - begin),
+               index_size, (end - last_block * block_size) / index_size,
+               primitive_restart, restart_index, min_index, max_index);
 }
 
 /* If we've been caching min/max indices and we update the index
  * buffer, that may invalidate the min/max. Check what's been cached vs
- * what we've written, and throw out invalid entries. */
+ * what we've written, and throw out invalid entries. The range is in bytes. */
 
 void
-panfrost_minmax_cache_invalidate(struct panfrost_minmax_cache *cache,
-                                 struct pipe_transfer *transfer)
+panfrost_minmax_cache_invalidate_range(struct panfrost_minmax_cache *cache,
+                                       uint64_t offset, uint64_t size)
 {
-   /* Ensure there is a cache to invalidate and a write */
    if (!cache)
       return;
 
-   if (!(transfer->usage & PIPE_MAP_WRITE))
-      return;
-
    unsigned valid_count = 0;
 
+   uint64_t box_start = offset;
+   uint64_t box_end = box_start + size;
+
    for (unsigned i = 0; i < cache->size; ++i) {
       uint64_t key = cache->keys[i];
+      unsigned index_size = cache->index_sizes[i];
 
-      uint32_t start = key & 0xffffffff;
-      uint32_t count = key >> 32;
+      /* The box is in bytes */
+      uint64_t start = (key & 0xffffffff) * index_size;
+      uint64_t count = (key >> 32) * index_size;
 
       /* 1D range intersection */
-      bool invalid = MAX2(transfer->box.x, start) <
-                     MIN2(transfer->box.x + transfer->box.width, start + count);
+      bool invalid =
+         MAX2(box_start, start) < MIN2(box_end, start + count);
       if (!invalid) {
          cache->keys[valid_count] = key;
          cache->values[valid_count] = cache->values[i];
+         cache->index_sizes[valid_count] = index_size;
          valid_count++;
       }
    }
 
    cache->size = valid_count;
    cache->index = 0;
+
+   uint64_t first_block = box_start / PANFROST_MINMAX_BLOCK_SIZE;
+   uint64_t last_block =
+      MIN2(DIV_ROUND_UP(box_end, PANFROST_MINMAX_BLOCK_SIZE), cache->nr_blocks);
+
+   for (uint64_t b = first_block; b < last_block; ++b)
+      cache->blocks[b] = UINT64_MAX;
+}
+
+void
+panfrost_minmax_cache_invalidate(struct panfrost_minmax_cache *cache,
+                                 struct pipe_transfer *transfer)
+{
+   /* Ensure there is a cache to invalidate and a write */
+   if (!cache)
+      return;
+
+   if (!(transfer->usage & PIPE_MAP_WRITE))
+      return;
+
+   panfrost_minmax_cache_invalidate_range(cache, transfer->box.x,
+                                          transfer->box.width);
+}
+
+/* Forget everything, for when the buffer storage is replaced */
+
+void
+panfrost_minmax_cache_reset(struct panfrost_minmax_cache *cache)
+{
+   if (!cache)
+      return;
+
+   cache->size = 0;
+   cache->index = 0;
+   memset(cache->blocks, 0xff, cache->nr_blocks * sizeof(uint64_t));
+}
+
+void
+panfrost_minmax_cache_fini(struct panfrost_minmax_cache *cache)
+{
+   if (!cache)
+      return;
+
+   free(cache->blocks);
+   cache->blocks = NULL;
+   cache->nr_blocks = 0;
 }
@@ -29,24 +29,60 @@
 
 #include "util/u_transfer.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define PANFROST_MINMAX_SIZE 64
 
+/* Granularity of the per-block bounds, in bytes */
+#define PANFROST_MINMAX_BLOCK_SIZE 4096
+
 struct panfrost_minmax_cache {
    uint64_t keys[PANFROST_MINMAX_SIZE];
    uint64_t values[PANFROST_MINMAX_SIZE];
+   uint8_t index_sizes[PANFROST_MINMAX_SIZE];
    unsigned size;
    unsigned index;
+
+   /* Bounds of each PANFROST_MINMAX_BLOCK_SIZE block of the buffer, packed
+    * like values, or ~0 if unknown. They are only valid for the index size
+    * and primitive restart state in blocks_key.
+    */
+   uint64_t *blocks;
+   unsigned nr_blocks;
+   uint64_t blocks_key;
 };
 
 bool panfrost_minmax_cache_get(struct panfrost_minmax_cache *cache,
-                               unsigned start, unsigned count,
-                               unsigned *min_index, unsigned *max_index);
+                               unsigned index_size, unsigned start,
+                               unsigned count, unsigned *min_index,
+                               unsigned *max_index);
 
 void panfrost_minmax_cache_add(struct panfrost_minmax_cache *cache,
-                               unsigned start, unsigned count,
-                               unsigned min_index, unsigned max_index);
+                               unsigned index_size, unsigned start,
+                               unsigned count, unsigned min_index,
+                               unsigned max_index);
+
+void panfrost_minmax_cache_compute(struct panfrost_minmax_cache *cache,
+                                   const void *indices, unsigned index_size,
+                                   unsigned start, unsigned count,
+                                   bool primitive_restart,
+                                   unsigned restart_index, unsigned *min_index,
+                                   unsigned *max_index);
+
+void panfrost_minmax_cache_invalidate_range(struct panfrost_minmax_cache *cache,
+                                            uint64_t offset, uint64_t size);
 
 void panfrost_minmax_cache_invalidate(struct panfrost_minmax_cache *cache,
                                       struct pipe_transfer *transfer);
 
+void panfrost_minmax_cache_reset(struct panfrost_minmax_cache *cache);
+
+void panfrost_minmax_cache_fini(struct panfrost_minmax_cache *cache);
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
 #endif
@@ -0,0 +1,96 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ * SPDX-License-Identifier: MIT
+ */
+
+#ifndef H_PAN_SUBRES
+#define H_PAN_SUBRES
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pipe/p_defines.h"
+#include "util/macros.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Conservative footprint of accesses to a resource: the subresources touched
+ * are within the product of the level and layer masks. Layers alias modulo
+ * 64, which only makes the footprint larger.
+ */
+struct pan_subres_range {
+   uint32_t levels;
+   uint64_t layers;
+};
+
+static inline struct pan_subres_range
+pan_subres_whole(void)
+{
+   return (struct pan_subres_range){
+      .levels = ~0u,
+      .layers = ~0ull,
+   };
+}
+
+static inline struct pan_subres_range
+pan_subres_range(unsigned first_level, unsigned last_level,
+                 unsigned first_layer, unsigned last_layer)
+{
+   unsigned nr_layers = last_layer - first_layer + 1;
+   uint64_t layers = ~0ull;
+
+   if (nr_layers < 64) {
+      unsigned shift = first_layer % 64;
+
+      layers = BITFIELD64_MASK(nr_layers) << shift;
+      if (shift)
+         layers |= BITFIELD64_MASK(nr_layers) >> (64 - shift);
+   }
+
+   return (struct pan_subres_range){
+      .levels = BITFIELD_RANGE(first_level, last_level - first_level + 1),
+      .layers = layers,
+   };
+}
+
+/* Footprint of an access to a range of a texture of the given target. Buffers
+ * have no subresources, and texels of 3D textures may be read from any slice
+ * whatever the layers of the view.
+ */
+static inline struct pan_subres_range
+pan_subres_texture(enum pipe_texture_target target, unsigned first_level,
+                   unsigned last_level, unsigned first_layer,
+                   unsigned last_layer)
+{
+   if (target == PIPE_BUFFER)
+      return pan_subres_whole();
+
+   struct pan_subres_range r =
+      pan_subres_range(first_level, last_level, first_layer, last_layer);
+
+   if (target == PIPE_TEXTURE_3D)
+      r.layers = ~0ull;
+
+   return r;
+}
+
+static inline bool
+pan_subres_overlap(struct pan_subres_range a, struct pan_subres_range b)
+{
+   return (a.levels & b.levels) && (a.layers & b.layers);
+}
+
+static inline void
+pan_subres_union(struct pan_subres_range *a, struct pan_subres_range b)
+{
+   a->levels |= b.levels;
+   a->layers |= b.layers;
+}
+
+#ifdef __cplusplus
+} /* extern C */
+#endif
+
+#endif
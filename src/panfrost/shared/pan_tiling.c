@@ -28,8 +28,13 @@
 #include "pan_tiling.h"
 #include <stdbool.h>
 #include "util/bitscan.h"
+#include "util/detect_arch.h"
 #include "util/macros.h"
 
+#if DETECT_ARCH_AARCH64
+#include <arm_neon.h>
+#endif
+
 /*
  * This file implements software encode/decode of u-interleaved textures.
  * See docs/drivers/panfrost.rst for details on the format.
@@ -138,57 +143,243 @@ typedef struct {
    uint32_t hi;
 } __attribute__((packed)) pan_uint96_t;
 
-/* Optimized routine to tile an aligned (w & 0xF == 0) texture. Explanation:
- *
- * dest_start precomputes the offset to the beginning of the first horizontal
- * tile we're writing to, knowing that x is 16-aligned. Tiles themselves are
- * stored linearly, so we get the X tile number by shifting and then multiply
- * by the bytes per tile .
+/* Optimized routines for power-of-two formats. The region is walked tile by
+ * tile, so the tiled side is accessed sequentially.
  *
- * We iterate across the pixels we're trying to store in source-order. For each
- * row in the destination image, we figure out which row of 16x16 block we're
- * in, by slicing off the lower 4-bits (block_y).
+ * Within a tile, a 4x2 block of pixels starting on a multiple of 4 in X and a
+ * multiple of 2 in Y is stored as 8 consecutive pixels, made of two 2x2 quads.
+ * Calling the top row a and the bottom row b, the quads are stored as
  *
- * dest then precomputes the location of the top-left corner of the block the
- * row starts in. In pixel coordinates (where the origin is the top-left),
- * (block_y, 0) is the top-left corner of the leftmost tile in this row.  While
- * pixels are reordered within a block, the blocks themselves are stored
- * linearly, so multiplying block_y by the pixel stride of the destination
- * image equals the byte offset of that top-left corner of the block this row
- * is in.
+ *    a0 a1 b1 b0 | a2 a3 b3 b2
  *
- * On the other hand, the source is linear so we compute the locations of the
- * start and end of the row in the source by a simple linear addressing.
- *
- * For indexing within the tile, we need to XOR with the [y3 y3 y2 y2 y1 y1 y0
- * y0] value. Since this is constant across a row, we look it up per-row and
- * store in expanded_y.
- *
- * Finally, we iterate each row in source order. In the outer loop, we iterate
- * each 16 pixel tile. Within each tile, we iterate the 16 pixels (this should
- * be unrolled), calculating the index within the tile and writing.
+ * since y0 flips x0 in the index, and the two quads are swapped if y1 is set.
+ * Blocks are accessed with wide loads and stores, so the per-pixel index is
+ * only computed for the pixels of partially covered blocks on the edges of the
+ * region.
  */
 
+#define TILED_BLOCK_TYPE(pixel_t)                                              \
+   static ALWAYS_INLINE void panfrost_access_tiled_block_##pixel_t(            \
+      uint8_t *tiled, uint8_t *row_a, uint8_t *row_b, bool swap,               \
+      bool is_store)                                                           \
+   {                                                                           \
+      pixel_t *q0 = (pixel_t *)tiled + (swap ? 4 : 0);                         \
+      pixel_t *q1 = (pixel_t *)tiled + (swap ? 0 : 4);                         \
+      pixel_t *a = (pixel_t *)row_a;                                           \
+      pixel_t *b = (pixel_t *)row_b;                                           \
+                                                                               \
+      if (is_store) {                                                          \
+         q0[0] = a[0];                                                         \
+         q0[1] = a[1];                                                         \
+         q0[2] = b[1];                                                         \
+         q0[3] = b[0];                                                         \
+         q1[0] = a[2];                                                         \
+         q1[1] = a[3];                                                         \
+         q1[2] = b[3];                                                         \
+         q1[3] = b[2];                                                         \
+      } else {                                                                 \
+         a[0] = q0[0];                                                         \
+         a[1] = q0[1];                                                         \
+         b[1] = q0[2];                                                         \
+         b[0] = q0[3];                                                         \
+         a[2] = q1[0];                                                         \
+         a[3] = q1[1];                                                         \
+         b[3] = q1[2];                                                         \
+         b[2] = q1[3];                                                         \
+      }                                                                        \
+   }
+
+TILED_BLOCK_TYPE(uint8_t);
+TILED_BLOCK_TYPE(pan_uint128_t);
+
+#if DETECT_ARCH_AARCH64
+
+/* With NEON, a block row fits in a single vector for 16 and 32 bpp, and the
+ * bottom row flip is a single reversal. 64 bpp quads are made of 128-bit
+ * halves, one of them with its pixels swapped.
+ */
+
+static ALWAYS_INLINE void
+panfrost_access_tiled_block_uint16_t(uint8_t *tiled, uint8_t *row_a,
+                                     uint8_t *row_b, bool swap, bool is_store)
+{
+   uint16_t *q0 = (uint16_t *)tiled + (swap ? 4 : 0);
+   uint16_t *q1 = (uint16_t *)tiled + (swap ? 0 : 4);
+
+   if (is_store) {
+      uint32x2_t a = vreinterpret_u32_u16(vld1_u16((uint16_t *)row_a));
+      uint32x2_t b =
+         vreinterpret_u32_u16(vrev32_u16(vld1_u16((uint16_t *)row_b)));
+      uint32x2x2_t quads = vzip_u32(a, b);
+
+      vst1_u16(q0, vreinterpret_u16_u32(quads.val[0]));
+      vst1_u16(q1, vreinterpret_u16_u32(quads.val[1]));
+   } else {
+      uint32x2x2_t rows = vuzp_u32(vreinterpret_u32_u16(vld1_u16(q0)),
+                                   vreinterpret_u32_u16(vld1_u16(q1)));
+
+      vst1_u16((uint16_t *)row_a, vreinterpret_u16_u32(rows.val[0]));
+      vst1_u16((uint16_t *)row_b,
+               vrev32_u16(vreinterpret_u16_u32(rows.val[1])));
+   }
+}
+
+static ALWAYS_INLINE void
+panfrost_access_tiled_block_uint32_t(uint8_t *tiled, uint8_t *row_a,
+                                     uint8_t *row_b, bool swap, bool is_store)
+{
+   uint32_t *q0 = (uint32_t *)tiled + (swap ? 4 : 0);
+   uint32_t *q1 = (uint32_t *)tiled + (swap ? 0 : 4);
+
+   if (is_store) {
+      uint32x4_t a = vld1q_u32((uint32_t *)row_a);
+      uint32x4_t b = vrev64q_u32(vld1q_u32((uint32_t *)row_b));
+
+      vst1q_u32(q0, vcombine_u32(vget_low_u32(a), vget_low_u32(b)));
+      vst1q_u32(q1, vcombine_u32(vget_high_u32(a), vget_high_u32(b)));
+   } else {
+      uint32x4_t v0 = vld1q_u32(q0);
+      uint32x4_t v1 = vld1q_u32(q1);
+
+      vst1q_u32((uint32_t *)row_a,
+                vcombine_u32(vget_low_u32(v0), vget_low_u32(v1)));
+      vst1q_u32((uint32_t *)row_b,
+                vrev64q_u32(vcombine_u32(vget_high_u32(v0),
+                                         vget_high_u32(v1))));
+   }
+}
+
+static ALWAYS_INLINE void
+panfrost_access_tiled_block_uint64_t(uint8_t *tiled, uint8_t *row_a,
+                                     uint8_t *row_b, bool swap, bool is_store)
+{
+   uint64_t *q0 = (uint64_t *)tiled + (swap ? 4 : 0);
+   uint64_t *q1 = (uint64_t *)tiled + (swap ? 0 : 4);
+   uint64_t *a = (uint64_t *)row_a;
+   uint64_t *b = (uint64_t *)row_b;
+
+   if (is_store) {
+      uint64x2_t b01 = vld1q_u64(b);
+      uint64x2_t b23 = vld1q_u64(b + 2);
+
+      vst1q_u64(q0, vld1q_u64(a));
+      vst1q_u64(q0 + 2, vextq_u64(b01, b01, 1));
+      vst1q_u64(q1, vld1q_u64(a + 2));
+      vst1q_u64(q1 + 2, vextq_u64(b23, b23, 1));
+   } else {
+      uint64x2_t b10 = vld1q_u64(q0 + 2);
+      uint64x2_t b32 = vld1q_u64(q1 + 2);
+
+      vst1q_u64(a, vld1q_u64(q0));
+      vst1q_u64(b, vextq_u64(b10, b10, 1));
+      vst1q_u64(a + 2, vld1q_u64(q1));
+      vst1q_u64(b + 2, vextq_u64(b32, b32, 1));
+   }
+}
+
+#else
+
+TILED_BLOCK_TYPE(uint16_t);
+TILED_BLOCK_TYPE(uint32_t);
+TILED_BLOCK_TYPE(uint64_t);
+
+#endif
+
+/* Access the pixels [x0, x1) of row y of a tile one by one */
+#define TILED_PIXELS_TYPE(pixel_t)                                             \
+   static ALWAYS_INLINE void panfrost_access_tiled_pixels_##pixel_t(           \
+      uint8_t *tile, uint8_t *row, unsigned row_x, unsigned y, unsigned x0,    \
+      unsigned x1, bool is_store)                                              \
+   {                                                                           \
+      unsigned expanded_y = bit_duplication[y];                                \
+      for (unsigned x = x0; x < x1; ++x) {                                     \
+         pixel_t *tiled = (pixel_t *)tile + (expanded_y ^ space_4[x]);         \
+         pixel_t *linear = (pixel_t *)row + (x - row_x);                       \
+         if (is_store)                                                         \
+            *tiled = *linear;                                                  \
+         else                                                                  \
+            *linear = *tiled;                                                  \
+      }                                                                        \
+   }
+
+/* Access the region [x0, x1) x [y0, y1) of a tile, linear pointing to the
+ * linear copy of pixel (x0, y0). Row pairs are accessed as 4x2 blocks where
+ * the region covers them entirely, the remaining pixels one by one.
+ */
+#define TILED_TILE_TYPE(pixel_t, shift)                                        \
+   static ALWAYS_INLINE void panfrost_access_tile_##pixel_t(                   \
+      uint8_t *tile, uint8_t *linear, uint32_t linear_stride, unsigned x0,     \
+      unsigned y0, unsigned x1, unsigned y1, bool is_store)                    \
+   {                                                                           \
+      unsigned bx0 = ALIGN_POT(x0, 4);                                         \
+      unsigned bx1 = x1 & ~3;                                                  \
+                                                                               \
+      if (bx0 >= bx1)                                                          \
+         bx0 = bx1 = x1;                                                       \
+                                                                               \
+      unsigned y = y0;                                                         \
+      while (y < y1) {                                                         \
+         uint8_t *row = linear + (y - y0) * linear_stride;                     \
+                                                                               \
+         if ((y & 1) || y + 1 == y1) {                                         \
+            panfrost_access_tiled_pixels_##pixel_t(tile, row, x0, y, x0, x1,   \
+                                                   is_store);                  \
+            y++;                                                               \
+            continue;                                                          \
+         }                                                                     \
+                                                                               \
+         for (unsigned x = bx0; x < bx1; x += 4) {                             \
+            unsigned index = (space_4[x] ^ bit_duplication[y]) & ~7;           \
+            uint8_t *a = row + ((x - x0) << shift);                            \
+                                                                               \
+            panfrost_access_tiled_block_##pixel_t(tile + (index << shift), a,  \
+                                                  a + linear_stride, y & 2,    \
+                                                  is_store);                   \
+         }                                                                     \
+                                                                               \
+         for (unsigned i = 0; i < 2; ++i) {                                    \
+            panfrost_access_tiled_pixels_##pixel_t(                            \
+               tile, row + i * linear_stride, x0, y + i, x0, bx0, is_store);   \
+            panfrost_access_tiled_pixels_##pixel_t(                            \
+               tile, row + i * linear_stride, x0, y + i, bx1, x1, is_store);   \
+         }                                                                     \
+                                                                               \
+         y += 2;                                                               \
+      }                                                                        \
+   }
+
+/* Walk the region tile by tile. Fully covered tiles, which are the common
+ * case, get a copy of the tile routine specialized for the whole tile.
+ */
 #define TILED_ACCESS_TYPE(pixel_t, shift)                                      \
+   TILED_PIXELS_TYPE(pixel_t)                                                  \
+   TILED_TILE_TYPE(pixel_t, shift)                                             \
+                                                                               \
    static ALWAYS_INLINE void panfrost_access_tiled_image_##pixel_t(            \
-      void *dst, void *src, uint16_t sx, uint16_t sy, uint16_t w, uint16_t h,  \
+      void *dst, void *src, unsigned sx, unsigned sy, unsigned w, unsigned h,  \
       uint32_t dst_stride, uint32_t src_stride, bool is_store)                 \
    {                                                                           \
-      uint8_t *dest_start =                                                    \
-         dst + ((sx >> 4) * PIXELS_PER_TILE * sizeof(pixel_t));                \
-      for (int y = sy, src_y = 0; src_y < h; ++y, ++src_y) {                   \
-         uint8_t *dest = (uint8_t *)(dest_start + ((y >> 4) * dst_stride));    \
-         pixel_t *source = src + (src_y * src_stride);                         \
-         pixel_t *source_end = source + w;                                     \
-         unsigned expanded_y = bit_duplication[y & 0xF] << shift;              \
-         for (; source < source_end; dest += (PIXELS_PER_TILE << shift)) {     \
-            for (uint8_t i = 0; i < 16; ++i) {                                 \
-               unsigned index = expanded_y ^ (space_4[i] << shift);            \
-               if (is_store)                                                   \
-                  *((pixel_t *)(dest + index)) = *(source++);                  \
-               else                                                            \
-                  *(source++) = *((pixel_t *)(dest + index));                  \
-            }                                                                  \
+      for (unsigned ty = sy & ~(TILE_HEIGHT - 1); ty < sy + h;                 \
+           ty += TILE_HEIGHT) {                                                \
+         unsigned y0 = MAX2(sy, ty) - ty;                                      \
+         unsigned y1 = MIN2(sy + h, ty + TILE_HEIGHT) - ty;                    \
+         uint8_t *tile_row = (uint8_t *)dst + (ty >> 4) * dst_stride;          \
+         uint8_t *linear_row = (uint8_t *)src + (ty + y0 - sy) * src_stride;   \
+                                                                               \
+         for (unsigned tx = sx & ~(TILE_WIDTH - 1); tx < sx + w;               \
+              tx += TILE_WIDTH) {                                              \
+            unsigned x0 = MAX2(sx, tx) - tx;                                   \
+            unsigned x1 = MIN2(sx + w, tx + TILE_WIDTH) - tx;                  \
+            uint8_t *tile = tile_row + ((tx >> 4) * PIXELS_PER_TILE << shift); \
+            uint8_t *linear = linear_row + ((tx + x0 - sx) << shift);          \
+                                                                               \
+            if (x0 == 0 && y0 == 0 && x1 == TILE_WIDTH && y1 == TILE_HEIGHT)   \
+               panfrost_access_tile_##pixel_t(tile, linear, src_stride, 0, 0,  \
+                                              TILE_WIDTH, TILE_HEIGHT,         \
+                                              is_store);                       \
+            else                                                               \
+               panfrost_access_tile_##pixel_t(tile, linear, src_stride, x0,    \
+                                              y0, x1, y1, is_store);           \
          }                                                                     \
       }                                                                        \
    }
@@ -275,10 +466,6 @@ panfrost_access_tiled_image_generic(void *dst, void *src, unsigned sx,
    }
 }
 
-#define OFFSET(src, _x, _y)                                                    \
-   (void *)((uint8_t *)src + ((_y)-orig_y) * src_stride +                      \
-            (((_x)-orig_x) * (bpp / 8)))
-
 static ALWAYS_INLINE void
 panfrost_access_tiled_image(void *dst, void *src, unsigned x, unsigned y,
                             unsigned w, unsigned h, uint32_t dst_stride,
@@ -304,81 +491,21 @@ panfrost_access_tiled_image(void *dst, void *src, unsigned x, unsigned y,
       return;
    }
 
-   unsigned first_full_tile_x = DIV_ROUND_UP(x, TILE_WIDTH) * TILE_WIDTH;
-   unsigned first_full_tile_y = DIV_ROUND_UP(y, TILE_HEIGHT) * TILE_HEIGHT;
-   unsigned last_full_tile_x = ((x + w) / TILE_WIDTH) * TILE_WIDTH;
-   unsigned last_full_tile_y = ((y + h) / TILE_HEIGHT) * TILE_HEIGHT;
-
-   /* First, tile the top portion */
-
-   unsigned orig_x = x, orig_y = y;
-
-   if (first_full_tile_y != y) {
-      unsigned dist = MIN2(first_full_tile_y - y, h);
-
-      panfrost_access_tiled_image_generic(dst, OFFSET(src, x, y), x, y, w, dist,
-                                          dst_stride, src_stride, desc,
-                                          is_store);
-
-      if (dist == h)
-         return;
-
-      y += dist;
-      h -= dist;
-   }
-
-   /* Next, the bottom portion */
-   if (last_full_tile_y != (y + h)) {
-      unsigned dist = (y + h) - last_full_tile_y;
-
-      panfrost_access_tiled_image_generic(
-         dst, OFFSET(src, x, last_full_tile_y), x, last_full_tile_y, w, dist,
-         dst_stride, src_stride, desc, is_store);
-
-      h -= dist;
-   }
-
-   /* The left portion */
-   if (first_full_tile_x != x) {
-      unsigned dist = MIN2(first_full_tile_x - x, w);
-
-      panfrost_access_tiled_image_generic(dst, OFFSET(src, x, y), x, y, dist, h,
-                                          dst_stride, src_stride, desc,
-                                          is_store);
-
-      if (dist == w)
-         return;
-
-      x += dist;
-      w -= dist;
-   }
-
-   /* Finally, the right portion */
-   if (last_full_tile_x != (x + w)) {
-      unsigned dist = (x + w) - last_full_tile_x;
-
-      panfrost_access_tiled_image_generic(
-         dst, OFFSET(src, last_full_tile_x, y), last_full_tile_x, y, dist, h,
-         dst_stride, src_stride, desc, is_store);
-
-      w -= dist;
-   }
-
    if (bpp == 8)
-      panfrost_access_tiled_image_uint8_t(dst, OFFSET(src, x, y), x, y, w, h,
-                                          dst_stride, src_stride, is_store);
+      panfrost_access_tiled_image_uint8_t(dst, src, x, y, w, h, dst_stride,
+                                          src_stride, is_store);
    else if (bpp == 16)
-      panfrost_access_tiled_image_uint16_t(dst, OFFSET(src, x, y), x, y, w, h,
-                                           dst_stride, src_stride, is_store);
+      panfrost_access_tiled_image_uint16_t(dst, src, x, y, w, h, dst_stride,
+                                           src_stride, is_store);
    else if (bpp == 32)
-      panfrost_access_tiled_image_uint32_t(dst, OFFSET(src, x, y), x, y, w, h,
-                                           dst_stride, src_stride, is_store);
+      panfrost_access_tiled_image_uint32_t(dst, src, x, y, w, h, dst_stride,
+                                           src_stride, is_store);
    else if (bpp == 64)
-      panfrost_access_tiled_image_uint64_t(dst, OFFSET(src, x, y), x, y, w, h,
-                                           dst_stride, src_stride, is_store);
+      panfrost_access_tiled_image_uint64_t(dst, src, x, y, w, h, dst_stride,
+                                           src_stride, is_store);
    else if (bpp == 128)
       panfrost_access_tiled_image_pan_uint128_t(
-         dst, OFFSET(src, x, y), x, y, w, h, dst_stride, src_stride, is_store);
+         dst, src, x, y, w, h, dst_stride, src_stride, is_store);
 }
 
 /**
@@ -0,0 +1,197 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_minmax_cache.h"
+#include "util/u_box.h"
+
+#include <gtest/gtest.h>
+
+#define BUFFER_SIZE (4 * PANFROST_MINMAX_BLOCK_SIZE)
+
+/* Reference bounds, written for clarity rather than performance */
+static void
+ref_minmax(const uint8_t *buf, unsigned index_size, unsigned start,
+           unsigned count, bool restart, unsigned restart_index,
+           unsigned *min_index, unsigned *max_index)
+{
+   *min_index = u_uintN_max(index_size * 8);
+   *max_index = 0;
+
+   for (unsigned i = start; i < start + count; ++i) {
+      unsigned v;
+
+      switch (index_size) {
+      case 1:
+         v = buf[i];
+         break;
+      case 2:
+         v = ((const uint16_t *)buf)[i];
+         break;
+      default:
+         v = ((const uint32_t *)buf)[i];
+         break;
+      }
+
+      if (restart && v == restart_index)
+         continue;
+
+      *min_index = MIN2(*min_index, v);
+      *max_index = MAX2(*max_index, v);
+   }
+
+   /* Empty slices have empty bounds */
+   if (!count)
+      *min_index = 0;
+}
+
+class MinMaxCache : public testing::Test {
+ protected:
+   MinMaxCache()
+   {
+      srand(0);
+      for (unsigned i = 0; i < BUFFER_SIZE; ++i)
+         buf[i] = rand();
+
+      memset(&cache, 0, sizeof(cache));
+   }
+
+   ~MinMaxCache()
+   {
+      panfrost_minmax_cache_fini(&cache);
+   }
+
+   void check(struct panfrost_minmax_cache *c, unsigned index_size,
+              unsigned start, unsigned count, bool restart)
+   {
+      unsigned restart_index = u_uintN_max(index_size * 8);
+      unsigned min_index, max_index, ref_min, ref_max;
+
+      panfrost_minmax_cache_compute(c, buf + start * index_size, index_size,
+                                    start, count, restart, restart_index,
+                                    &min_index, &max_index);
+      ref_minmax(buf, index_size, start, count, restart, restart_index,
+                 &ref_min, &ref_max);
+
+      EXPECT_EQ(min_index, ref_min)
+         << "index size " << index_size << ", start " << start << ", count "
+         << count << ", restart " << restart;
+      EXPECT_EQ(max_index, ref_max)
+         << "index size " << index_size << ", start " << start << ", count "
+         << count << ", restart " << restart;
+   }
+
+   alignas(64) uint8_t buf[BUFFER_SIZE];
+   struct panfrost_minmax_cache cache;
+};
+
+/* Unaligned heads and tails around the vectorized body, with and without the
+ * per-block bounds */
+TEST_F(MinMaxCache, Scan)
+{
+   for (unsigned index_size = 1; index_size <= 4; index_size *= 2) {
+      unsigned nr = BUFFER_SIZE / index_size;
+
+      for (unsigned start = 0; start < 70; start += 7) {
+         for (unsigned count : {0u, 1u, 15u, 64u, 257u, nr / 2, nr - start}) {
+            for (bool restart : {false, true}) {
+               check(NULL, index_size, start, count, restart);
+               check(&cache, index_size, start, count, restart);
+            }
+         }
+      }
+   }
+}
+
+TEST_F(MinMaxCache, Restart)
+{
+   /* Only restart indices and a single real one */
+   memset(buf, 0xff, sizeof(buf));
+   ((uint16_t *)buf)[1000] = 1234;
+
+   check(&cache, 2, 0, BUFFER_SIZE / 2, true);
+   check(&cache, 2, 0, BUFFER_SIZE / 2, false);
+}
+
+TEST_F(MinMaxCache, InvalidateRange)
+{
+   unsigned nr = BUFFER_SIZE / 4;
+
+   check(&cache, 4, 0, nr, false);
+   panfrost_minmax_cache_add(&cache, 4, 0, nr, 0, 0);
+
+   /* Write a new maximum in the middle of a block */
+   ((uint32_t *)buf)[nr / 2 + 3] = UINT32_MAX - 1;
+   panfrost_minmax_cache_invalidate_range(&cache, (nr / 2 + 3) * 4, 4);
+
+   unsigned min_index, max_index;
+   EXPECT_FALSE(panfrost_minmax_cache_get(&cache, 4, 0, nr, &min_index,
+                                          &max_index));
+
+   check(&cache, 4, 0, nr, false);
+}
+
+/* Lima only uses the (start, count) entries, and invalidates them with the
+ * transfer box, in bytes, of writes to the index buffer */
+TEST_F(MinMaxCache, TransferInvalidate)
+{
+   unsigned min_index, max_index;
+
+   /* Indices [100, 200) of a 16-bit and of a 32-bit draw */
+   panfrost_minmax_cache_add(&cache, 2, 100, 100, 1, 2);
+   panfrost_minmax_cache_add(&cache, 4, 100, 100, 3, 4);
+
+   /* Entries don't match other index sizes */
+   EXPECT_FALSE(panfrost_minmax_cache_get(&cache, 1, 100, 100, &min_index,
+                                          &max_index));
+
+   ASSERT_TRUE(panfrost_minmax_cache_get(&cache, 2, 100, 100, &min_index,
+                                         &max_index));
+   EXPECT_EQ(min_index, 1);
+   EXPECT_EQ(max_index, 2);
+
+   /* Bytes [500, 600) only overlap the 32-bit entry, at bytes [400, 800) */
+   struct pipe_transfer transfer = {};
+   transfer.usage = PIPE_MAP_WRITE;
+   u_box_1d(500, 100, &transfer.box);
+   panfrost_minmax_cache_invalidate(&cache, &transfer);
+
+   EXPECT_TRUE(panfrost_minmax_cache_get(&cache, 2, 100, 100, &min_index,
+                                         &max_index));
+   EXPECT_FALSE(panfrost_minmax_cache_get(&cache, 4, 100, 100, &min_index,
+                                          &max_index));
+
+   /* Reads don't invalidate */
+   transfer.usage = PIPE_MAP_READ;
+   u_box_1d(200, 100, &transfer.box);
+   panfrost_minmax_cache_invalidate(&cache, &transfer);
+
+   EXPECT_TRUE(panfrost_minmax_cache_get(&cache, 2, 100, 100, &min_index,
+                                         &max_index));
+
+   /* Bytes [200, 400) cover the 16-bit entry */
+   transfer.usage = PIPE_MAP_WRITE;
+   panfrost_minmax_cache_invalidate(&cache, &transfer);
+
+   EXPECT_FALSE(panfrost_minmax_cache_get(&cache, 2, 100, 100, &min_index,
+                                          &max_index));
+}
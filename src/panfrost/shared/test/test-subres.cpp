@@ -0,0 +1,131 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ * SPDX-License-Identifier: MIT
+ */
+
+#include "pan_subres.h"
+
+#include <gtest/gtest.h>
+
+static bool
+overlap(struct pan_subres_range a, struct pan_subres_range b)
+{
+   /* Overlap is symmetric */
+   EXPECT_EQ(pan_subres_overlap(a, b), pan_subres_overlap(b, a));
+   return pan_subres_overlap(a, b);
+}
+
+TEST(Subres, Levels)
+{
+   EXPECT_TRUE(
+      overlap(pan_subres_range(0, 0, 0, 0), pan_subres_range(0, 0, 0, 0)));
+   EXPECT_FALSE(
+      overlap(pan_subres_range(0, 0, 0, 0), pan_subres_range(1, 1, 0, 0)));
+   EXPECT_TRUE(
+      overlap(pan_subres_range(0, 3, 0, 0), pan_subres_range(3, 5, 0, 0)));
+   EXPECT_FALSE(
+      overlap(pan_subres_range(0, 3, 0, 0), pan_subres_range(4, 5, 0, 0)));
+   EXPECT_TRUE(
+      overlap(pan_subres_range(0, 31, 0, 0), pan_subres_range(31, 31, 0, 0)));
+}
+
+TEST(Subres, Layers)
+{
+   EXPECT_FALSE(
+      overlap(pan_subres_range(0, 0, 0, 0), pan_subres_range(0, 0, 1, 1)));
+   EXPECT_TRUE(
+      overlap(pan_subres_range(0, 0, 2, 5), pan_subres_range(0, 0, 5, 7)));
+   EXPECT_FALSE(
+      overlap(pan_subres_range(0, 0, 2, 5), pan_subres_range(0, 0, 6, 7)));
+   EXPECT_FALSE(
+      overlap(pan_subres_range(0, 0, 0, 62), pan_subres_range(0, 0, 63, 63)));
+}
+
+TEST(Subres, LevelsAndLayers)
+{
+   /* Both the levels and the layers must overlap */
+   EXPECT_FALSE(
+      overlap(pan_subres_range(0, 1, 0, 0), pan_subres_range(0, 1, 1, 1)));
+   EXPECT_FALSE(
+      overlap(pan_subres_range(0, 0, 0, 1), pan_subres_range(1, 1, 0, 1)));
+   EXPECT_TRUE(
+      overlap(pan_subres_range(0, 1, 0, 1), pan_subres_range(1, 2, 1, 2)));
+}
+
+TEST(Subres, LayersAliasModulo64)
+{
+   /* Layers past 63 alias, which can only add conflicts */
+   EXPECT_TRUE(
+      overlap(pan_subres_range(0, 0, 64, 64), pan_subres_range(0, 0, 0, 0)));
+   EXPECT_FALSE(
+      overlap(pan_subres_range(0, 0, 64, 64), pan_subres_range(0, 0, 1, 1)));
+
+   /* A range wrapping around bit 63 */
+   struct pan_subres_range wrap = pan_subres_range(0, 0, 62, 65);
+   EXPECT_TRUE(overlap(wrap, pan_subres_range(0, 0, 1, 1)));
+   EXPECT_TRUE(overlap(wrap, pan_subres_range(0, 0, 63, 63)));
+   EXPECT_FALSE(overlap(wrap, pan_subres_range(0, 0, 2, 61)));
+
+   /* 64 layers or more cover everything */
+   struct pan_subres_range all = pan_subres_range(0, 0, 10, 73);
+   EXPECT_EQ(all.layers, ~0ull);
+   EXPECT_EQ(pan_subres_range(0, 0, 0, 1000).layers, ~0ull);
+}
+
+TEST(Subres, Whole)
+{
+   struct pan_subres_range whole = pan_subres_whole();
+
+   EXPECT_TRUE(overlap(whole, pan_subres_range(0, 0, 0, 0)));
+   EXPECT_TRUE(overlap(whole, pan_subres_range(15, 15, 200, 200)));
+}
+
+TEST(Subres, Union)
+{
+   struct pan_subres_range r = {0, 0};
+
+   EXPECT_FALSE(overlap(r, pan_subres_whole()));
+
+   pan_subres_union(&r, pan_subres_range(1, 1, 2, 2));
+   pan_subres_union(&r, pan_subres_range(3, 3, 4, 4));
+
+   /* The union is the product of the masks, so it is conservative */
+   EXPECT_TRUE(overlap(r, pan_subres_range(1, 1, 2, 2)));
+   EXPECT_TRUE(overlap(r, pan_subres_range(3, 3, 2, 2)));
+   EXPECT_FALSE(overlap(r, pan_subres_range(2, 2, 2, 4)));
+   EXPECT_FALSE(overlap(r, pan_subres_range(1, 3, 3, 3)));
+}
+
+TEST(Subres, TextureTargets)
+{
+   struct pan_subres_range r =
+      pan_subres_texture(PIPE_TEXTURE_2D_ARRAY, 1, 2, 3, 4);
+
+   EXPECT_EQ(r.levels, BITFIELD_RANGE(1, 2));
+   EXPECT_EQ(r.layers, BITFIELD64_RANGE(3, 2));
+
+   EXPECT_EQ(pan_subres_texture(PIPE_TEXTURE_CUBE, 0, 0, 5, 5).layers,
+             BITFIELD64_BIT(5));
+}
+
+TEST(Subres, Texture3DUsesAllSlices)
+{
+   struct pan_subres_range r = pan_subres_texture(PIPE_TEXTURE_3D, 2, 2, 0, 0);
+
+   EXPECT_EQ(r.levels, BITFIELD_BIT(2));
+   EXPECT_EQ(r.layers, ~0ull);
+
+   /* Another slice of the same level conflicts, another level doesn't */
+   EXPECT_TRUE(overlap(r, pan_subres_range(2, 2, 7, 7)));
+   EXPECT_FALSE(overlap(r, pan_subres_range(1, 1, 7, 7)));
+}
+
+TEST(Subres, BufferIsWhole)
+{
+   /* Level and layer arguments are meaningless for buffers */
+   struct pan_subres_range r = pan_subres_texture(PIPE_BUFFER, 0, 0, 0, 0);
+
+   EXPECT_EQ(r.levels, ~0u);
+   EXPECT_EQ(r.layers, ~0ull);
+   EXPECT_TRUE(overlap(r, pan_subres_range(5, 5, 9, 9)));
+}
@@ -23,6 +23,7 @@
 
 #include "pan_tiling.h"
 
+#include <chrono>
 #include <gtest/gtest.h>
 
 /*
@@ -234,6 +235,24 @@ TEST(UInterleavedTiling, PartialAccess)
    test_ldst(23, 17, 3, 1, 13, 7, 369 * 16, PIPE_FORMAT_R32G32B32A32_UNORM);
 }
 
+TEST(UInterleavedTiling, PartialTiles)
+{
+   /* Regions starting and ending in the middle of tiles and 4x2 blocks,
+    * spanning several tiles in each direction.
+    */
+   test_ldst(71, 45, 5, 3, 61, 39, 61 * 1, PIPE_FORMAT_R8_UINT);
+   test_ldst(71, 45, 5, 3, 61, 39, 61 * 2, PIPE_FORMAT_R8G8_UINT);
+   test_ldst(71, 45, 5, 3, 61, 39, 61 * 4, PIPE_FORMAT_R32_UINT);
+   test_ldst(71, 45, 5, 3, 61, 39, 61 * 8, PIPE_FORMAT_R32G32_UINT);
+   test_ldst(71, 45, 5, 3, 61, 39, 61 * 16, PIPE_FORMAT_R32G32B32A32_UINT);
+
+   /* Regions narrower than a block */
+   test_ldst(32, 32, 17, 6, 2, 9, 2 * 1, PIPE_FORMAT_R8_UINT);
+   test_ldst(32, 32, 17, 6, 2, 9, 2 * 4, PIPE_FORMAT_R32_UINT);
+   test_ldst(32, 32, 13, 1, 7, 1, 7 * 2, PIPE_FORMAT_R8G8_UINT);
+   test_ldst(32, 32, 13, 1, 7, 1, 7 * 8, PIPE_FORMAT_R32G32_UINT);
+}
+
 TEST(UInterleavedTiling, ETC)
 {
    /* Block alignment assumed */
@@ -281,3 +300,59 @@ TEST(UInterleavedTiling, PartialASTC)
    test_ldst(50, 40, 5, 4, 10, 8, 512, PIPE_FORMAT_ASTC_5x4);
    test_ldst(50, 50, 5, 5, 10, 10, 512, PIPE_FORMAT_ASTC_5x5);
 }
+
+/*
+ * Throughput of loads and stores of a 1024x1024 image, for full and unaligned
+ * regions. Disabled by default, run with --gtest_also_run_disabled_tests.
+ */
+static void
+bench(enum pipe_format format, unsigned rx, unsigned ry, unsigned rw,
+      unsigned rh)
+{
+   const unsigned size = 1024, iterations = 20;
+   unsigned bpp = util_format_get_blocksize(format);
+   unsigned tiled_stride = size * 16 * bpp;
+   unsigned linear_stride = rw * bpp;
+
+   void *tiled = calloc(bpp, size * size);
+   void *linear = calloc(bpp, rw * rh);
+
+   for (unsigned store = 0; store < 2; ++store) {
+      auto start = std::chrono::steady_clock::now();
+
+      for (unsigned i = 0; i < iterations; ++i) {
+         if (store)
+            panfrost_store_tiled_image(tiled, linear, rx, ry, rw, rh,
+                                       tiled_stride, linear_stride, format);
+         else
+            panfrost_load_tiled_image(linear, tiled, rx, ry, rw, rh,
+                                      linear_stride, tiled_stride, format);
+      }
+
+      std::chrono::duration<double> elapsed =
+         std::chrono::steady_clock::now() - start;
+
+      printf("%-24s %4ux%-4u +%u+%u %-5s %8.1f MiB/s\n",
+             util_format_short_name(format), rw, rh, rx, ry,
+             store ? "store" : "load",
+             (double)rw * rh * bpp * iterations /
+                (elapsed.count() * 1024 * 1024));
+   }
+
+   free(tiled);
+   free(linear);
+}
+
+TEST(UInterleavedTiling, DISABLED_Benchmark)
+{
+   enum pipe_format formats[] = {
+      PIPE_FORMAT_R8_UINT,          PIPE_FORMAT_R8G8_UINT,
+      PIPE_FORMAT_R32_UINT,         PIPE_FORMAT_R32G32_UINT,
+      PIPE_FORMAT_R32G32B32A32_UINT,
+   };
+
+   for (unsigned i = 0; i < ARRAY_SIZE(formats); ++i) {
+      bench(formats[i], 0, 0, 1024, 1024);
+      bench(formats[i], 3, 5, 1017, 1013);
+   }
+}
@@ -0,0 +1,1285 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ * SPDX-License-Identifier: MIT
+ */
+
+/*
+ * Offline shader compiler for shader-db style runs. Compiles GLSL
+ * (.vert/.frag/.comp and .shader_test), SPIR-V (.spv) and serialized NIR
+ * (.nir) inputs for any Midgard, Bifrost or Valhall GPU without hardware, and
+ * reports the backend statistics of every shader as CSV or JSON.
+ *
+ * The frontends are not thread-safe, so GLSL/SPIR-V/NIR are translated to NIR
+ * serially. The driver lowering and the backend compile of each shader then
+ * run on a queue with one thread per core.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <getopt.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "compiler/nir/nir_builder.h"
+#include "compiler/nir/nir_serialize.h"
+#include "compiler/spirv/nir_spirv.h"
+
+#include "compiler/glsl/gl_nir.h"
+#include "compiler/glsl/glsl_to_nir.h"
+#include "compiler/glsl/standalone.h"
+#include "compiler/glsl_types.h"
+#include "main/mtypes.h"
+#include "util/blob.h"
+#include "util/hash_table.h"
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/u_cpu_detect.h"
+#include "util/u_debug.h"
+#include "util/u_dynarray.h"
+#include "util/u_queue.h"
+
+#include "compiler/bifrost_compile.h"
+#include "lib/pan_shader.h"
+#include "midgard/midgard_compile.h"
+#include "panfrost/util/pan_pass_time.h"
+
+static unsigned gpu_id = 0x7212;
+
+/* Shader-db names of the supported GPUs, the product ID is also accepted */
+static const struct {
+   const char *name;
+   unsigned gpu_id;
+} gpus[] = {
+   {"T620", 0x620},  {"T720", 0x720},  {"T760", 0x750},  {"T820", 0x820},
+   {"T830", 0x830},  {"T860", 0x860},  {"T880", 0x880},  {"G71", 0x6000},
+   {"G72", 0x6221},  {"G51", 0x7090},  {"G31", 0x7093},  {"G76", 0x7211},
+   {"G52", 0x7212},  {"G57", 0x9093},  {"G610", 0xa867}, {"G310", 0xac74},
+};
+
+static const nir_shader_compiler_options *
+get_nir_options(void)
+{
+   if (pan_arch(gpu_id) >= 9)
+      return &bifrost_nir_options_v9;
+   else if (pan_arch(gpu_id) >= 6)
+      return &bifrost_nir_options_v6;
+   else
+      return &midgard_nir_options;
+}
+
+struct shader_job {
+   struct util_queue_fence fence;
+
+   /* Input file the shader came from */
+   const char *name;
+   gl_shader_stage stage;
+
+   /* Translated by the frontend, owned by the job */
+   nir_shader *nir;
+   unsigned fixed_varying_mask;
+
+   /* Messages from the backend, one per compiled variant */
+   struct util_debug_callback debug;
+   struct util_dynarray stats;
+
+   struct pan_shader_info info;
+   unsigned binary_size;
+
+   int64_t frontend_ns, preprocess_ns, backend_ns;
+
+   /* Time spent in each timed pass of the driver and the backend */
+   struct pan_pass_times pass_times;
+};
+
+static struct util_dynarray jobs;
+static unsigned nr_failed = 0;
+static const char *save_nir_dir = NULL;
+
+static void
+stats_message(void *data, unsigned *id, enum util_debug_type type,
+              const char *fmt, va_list args)
+{
+   struct shader_job *job = data;
+
+   if (type != UTIL_DEBUG_TYPE_SHADER_INFO)
+      return;
+
+   char *msg = ralloc_vasprintf(job, fmt, args);
+   util_dynarray_append(&job->stats, char *, msg);
+}
+
+/*
+ * System values are uploaded by the Gallium driver in an extra UBO, one vec4
+ * slot per system value. The layout only matters to the driver, so simply
+ * give every distinct system value its own slot to get the same code.
+ */
+struct sysval_ctx {
+   struct hash_table_u64 *slots;
+   unsigned count;
+   unsigned ubo;
+};
+
+static bool
+sysval_for_instr(nir_instr *instr, uint64_t *key, unsigned *offset)
+{
+   if (instr->type == nir_instr_type_tex) {
+      nir_tex_instr *tex = nir_instr_as_tex(instr);
+
+      if (tex->op != nir_texop_txs)
+         return false;
+
+      /* Intrinsic keys only use the low 16 bits, keep txs above them */
+      STATIC_ASSERT(nir_num_intrinsics < (1 << 16));
+      *key = ((uint64_t)tex->texture_index << 32) | nir_num_intrinsics |
+             (tex->is_array << 16) | (nir_tex_instr_dest_size(tex) << 17);
+      return true;
+   }
+
+   if (instr->type != nir_instr_type_intrinsic)
+      return false;
+
+   nir_intrinsic_instr *intr = nir_instr_as_intrinsic(instr);
+   nir_intrinsic_op op = intr->intrinsic;
+   uint64_t index = 0;
+
+   switch (op) {
+   case nir_intrinsic_get_ssbo_size:
+      *offset = 8;
+      op = nir_intrinsic_load_ssbo_address;
+      FALLTHROUGH;
+   case nir_intrinsic_load_ssbo_address:
+   case nir_intrinsic_load_sampler_lod_parameters_pan:
+   case nir_intrinsic_image_size:
+      index = nir_src_as_uint(intr->src[0]);
+      break;
+
+   case nir_intrinsic_load_xfb_address:
+   case nir_intrinsic_load_rt_conversion_pan:
+      index = nir_intrinsic_base(intr);
+      break;
+
+   case nir_intrinsic_load_base_vertex:
+      *offset = 4;
+      op = nir_intrinsic_load_first_vertex;
+      break;
+   case nir_intrinsic_load_base_instance:
+      *offset = 8;
+      op = nir_intrinsic_load_first_vertex;
+      break;
+
+   case nir_intrinsic_load_work_dim:
+   case nir_intrinsic_load_sample_positions_pan:
+   case nir_intrinsic_load_num_vertices:
+   case nir_intrinsic_load_first_vertex:
+   case nir_intrinsic_load_draw_id:
+   case nir_intrinsic_load_multisampled_pan:
+   case nir_intrinsic_load_viewport_scale:
+   case nir_intrinsic_load_viewport_offset:
+   case nir_intrinsic_load_num_workgroups:
+   case nir_intrinsic_load_workgroup_size:
+      break;
+
+   default:
+      return false;
+   }
+
+   *key = (index << 32) | op;
+   return true;
+}
+
+static bool
+lower_sysval(nir_builder *b, nir_instr *instr, void *data)
+{
+   struct sysval_ctx *ctx = data;
+   uint64_t key;
+   unsigned offset = 0;
+
+   if (!sysval_for_instr(instr, &key, &offset))
+      return false;
+
+   nir_def *old = nir_instr_def(instr);
+
+   if (ctx->count == 0)
+      ctx->ubo = b->shader->info.num_ubos++;
+
+   void *slot = _mesa_hash_table_u64_search(ctx->slots, key);
+   if (!slot) {
+      slot = (void *)(uintptr_t)(++ctx->count);
+      _mesa_hash_table_u64_insert(ctx->slots, key, slot);
+   }
+
+   unsigned ubo_offset = (((uintptr_t)slot - 1) * 16) + offset;
+
+   b->cursor = nir_after_instr(instr);
+   nir_def *val = nir_load_ubo(
+      b, old->num_components, old->bit_size, nir_imm_int(b, ctx->ubo),
+      nir_imm_int(b, ubo_offset), .align_mul = old->bit_size / 8,
+      .align_offset = 0, .range_base = offset, .range = old->bit_size / 8);
+   nir_def_rewrite_uses(old, val);
+   return true;
+}
+
+static void
+lower_sysvals(nir_shader *nir)
+{
+   bool progress;
+
+   do {
+      progress = false;
+
+      NIR_PASS(progress, nir, nir_copy_prop);
+      NIR_PASS(progress, nir, nir_opt_constant_folding);
+      NIR_PASS(progress, nir, nir_opt_dce);
+   } while (progress);
+
+   struct sysval_ctx ctx = {
+      .slots = _mesa_hash_table_u64_create(NULL),
+   };
+
+   nir_shader_instructions_pass(nir, lower_sysval,
+                                nir_metadata_block_index |
+                                   nir_metadata_dominance,
+                                &ctx);
+
+   _mesa_hash_table_u64_destroy(ctx.slots);
+}
+
+/* Mirrors panfrost_create_shader_state and panfrost_shader_compile */
+static void
+compile_job(void *data, void *gdata, int thread_index)
+{
+   struct shader_job *job = data;
+   nir_shader *nir = job->nir;
+
+   int64_t start = os_time_get_nano();
+
+   pan_pass_times_capture(&job->pass_times);
+
+   if (nir->info.stage == MESA_SHADER_FRAGMENT &&
+       nir->info.outputs_written & BITFIELD_BIT(FRAG_RESULT_COLOR))
+      NIR_PASS_V(nir, nir_lower_fragcolor, 1);
+
+   pan_shader_preprocess(nir, gpu_id);
+
+   if (pan_arch(gpu_id) <= 5 && nir->info.stage == MESA_SHADER_FRAGMENT) {
+      enum pipe_format rt_formats[8] = {PIPE_FORMAT_R8G8B8A8_UNORM};
+
+      NIR_PASS_V(nir, pan_lower_framebuffer, rt_formats,
+                 pan_raw_format_mask_midgard(rt_formats), 0, gpu_id < 0x700);
+   }
+
+   lower_sysvals(nir);
+
+   int64_t preprocessed = os_time_get_nano();
+
+   struct panfrost_compile_inputs inputs = {
+      .debug = &job->debug,
+      .gpu_id = gpu_id,
+      .fixed_varying_mask = job->fixed_varying_mask,
+   };
+   struct util_dynarray binary;
+
+   util_dynarray_init(&binary, NULL);
+
+   if (pan_arch(gpu_id) >= 6)
+      bifrost_compile_shader_nir(nir, &inputs, &binary, &job->info);
+   else
+      midgard_compile_shader_nir(nir, &inputs, &binary, &job->info);
+
+   pan_pass_times_capture(NULL);
+
+   job->preprocess_ns = preprocessed - start;
+   job->backend_ns = os_time_get_nano() - preprocessed;
+   job->binary_size = binary.size;
+
+   util_dynarray_fini(&binary);
+   ralloc_free(nir);
+   job->nir = NULL;
+}
+
+static void
+save_nir(const char *name, nir_shader *nir)
+{
+   const char *base = strrchr(name, '/');
+   char *path = ralloc_asprintf(NULL, "%s/%s.%s.nir", save_nir_dir,
+                                base ? base + 1 : name,
+                                _mesa_shader_stage_to_abbrev(nir->info.stage));
+   struct blob blob;
+
+   blob_init(&blob);
+   nir_serialize(&blob, nir, false);
+
+   FILE *fp = fopen(path, "wb");
+   if (fp) {
+      fwrite(blob.data, 1, blob.size, fp);
+      fclose(fp);
+   } else {
+      fprintf(stderr, "Couldn't write %s\n", path);
+   }
+
+   blob_finish(&blob);
+   ralloc_free(path);
+}
+
+static struct shader_job *
+add_job(const char *name, nir_shader *nir, unsigned fixed_varying_mask,
+        int64_t frontend_ns)
+{
+   struct shader_job *job = rzalloc(NULL, struct shader_job);
+
+   job->name = ralloc_strdup(job, name);
+   job->stage = nir->info.stage;
+   job->nir = nir;
+   job->fixed_varying_mask = fixed_varying_mask;
+   job->frontend_ns = frontend_ns;
+   job->debug.debug_message = stats_message;
+   job->debug.data = job;
+   util_dynarray_init(&job->stats, job);
+   util_queue_fence_init(&job->fence);
+
+   if (save_nir_dir)
+      save_nir(name, nir);
+
+   util_dynarray_append(&jobs, struct shader_job *, job);
+   return job;
+}
+
+/* Varying slots written by the vertex shader that need fixed linkage, as
+ * computed by panfrost_create_shader_state.
+ */
+static unsigned
+fixed_varying_mask(nir_shader *vs)
+{
+   return (vs->info.outputs_written & BITFIELD_MASK(VARYING_SLOT_VAR0)) &
+          ~VARYING_BIT_POS & ~VARYING_BIT_PSIZ;
+}
+
+static int
+type_size_dword(const struct glsl_type *type, bool bindless)
+{
+   return glsl_count_dword_slots(type, bindless);
+}
+
+/*
+ * Assign I/O and uniform locations like mesa/st does before handing the
+ * shader to the driver. Uniforms are packed, as PIPE_CAP_PACKED_UNIFORMS is
+ * set by panfrost.
+ */
+static void
+finish_frontend(nir_shader *nir)
+{
+   nir_shader_gather_info(nir, nir_shader_get_entrypoint(nir));
+
+   if (nir->info.stage == MESA_SHADER_VERTEX) {
+      bool removed_inputs = false;
+
+      nir->num_inputs = util_bitcount64(nir->info.inputs_read);
+
+      nir_foreach_shader_in_variable_safe(var, nir) {
+         if (nir->info.inputs_read & BITFIELD64_BIT(var->data.location)) {
+            var->data.driver_location = util_bitcount64(
+               nir->info.inputs_read & BITFIELD64_MASK(var->data.location));
+         } else {
+            var->data.mode = nir_var_shader_temp;
+            removed_inputs = true;
+         }
+      }
+
+      if (removed_inputs)
+         NIR_PASS_V(nir, nir_lower_global_vars_to_local);
+
+      nir_assign_io_var_locations(nir, nir_var_shader_out, &nir->num_outputs,
+                                  nir->info.stage);
+   } else if (nir->info.stage == MESA_SHADER_FRAGMENT) {
+      nir_assign_io_var_locations(nir, nir_var_shader_in, &nir->num_inputs,
+                                  nir->info.stage);
+      nir_assign_io_var_locations(nir, nir_var_shader_out, &nir->num_outputs,
+                                  nir->info.stage);
+   }
+
+   unsigned uniform_dwords = 0;
+   nir_assign_var_locations(nir, nir_var_uniform, &uniform_dwords,
+                            type_size_dword);
+   nir->num_uniforms = DIV_ROUND_UP(uniform_dwords, 4);
+
+   NIR_PASS_V(nir, nir_lower_io, nir_var_uniform, type_size_dword, 0);
+   NIR_PASS_V(nir, nir_lower_uniforms_to_ubo, true, false);
+
+   /* Images are indexed by their unit, PIPE_CAP_NIR_IMAGES_AS_DEREF is 0 */
+   nir_foreach_image_variable(var, nir)
+      var->data.driver_location = var->data.binding;
+
+   NIR_PASS_V(nir, gl_nir_lower_images, false);
+
+   nir_shader_gather_info(nir, nir_shader_get_entrypoint(nir));
+}
+
+/* Map a #version directive to a language version of the standalone compiler */
+static int
+glsl_version_for_source(const char *src)
+{
+   const char *v = strstr(src, "#version");
+   if (!v)
+      return 110;
+
+   char *end;
+   int version = strtol(v + strlen("#version"), &end, 10);
+   bool es = !strncmp(end, " es", 3) || version == 100;
+
+   /* ES 3.1+ is parsed through ARB_ES3_1/ARB_ES3_2_compatibility */
+   if (es)
+      return version <= 300 ? version : 460;
+   else
+      return version ? version : 110;
+}
+
+static void
+compile_glsl(const char *name, unsigned nr_files, char *const *files,
+             int glsl_version)
+{
+   const struct standalone_options options = {
+      .glsl_version = glsl_version,
+      .do_link = true,
+      .lower_precision = true,
+   };
+   struct gl_context *ctx = calloc(1, sizeof(*ctx));
+   const nir_shader_compiler_options *nir_options = get_nir_options();
+
+   int64_t start = os_time_get_nano();
+   struct gl_shader_program *prog =
+      standalone_compile_shader(&options, nr_files, files, ctx);
+
+   if (!prog || !prog->data->LinkStatus) {
+      fprintf(stderr, "%s: failed to compile\n", name);
+      nr_failed++;
+      if (prog)
+         standalone_compiler_cleanup(prog);
+      free(ctx);
+      return;
+   }
+
+   int64_t link_ns = os_time_get_nano() - start;
+   unsigned vs_fixed_varying_mask = 0;
+
+   for (unsigned i = 0; i < MESA_SHADER_STAGES; i++) {
+      if (!prog->_LinkedShaders[i])
+         continue;
+
+      if (i != MESA_SHADER_VERTEX && i != MESA_SHADER_FRAGMENT &&
+          i != MESA_SHADER_COMPUTE) {
+         fprintf(stderr, "%s: %s shaders are unsupported\n", name,
+                 _mesa_shader_stage_to_string(i));
+         nr_failed++;
+         continue;
+      }
+
+      start = os_time_get_nano();
+
+      nir_shader *nir = glsl_to_nir(&ctx->Const, prog, i, nir_options);
+
+      if (i == MESA_SHADER_FRAGMENT)
+         NIR_PASS_V(nir, nir_lower_io_to_temporaries,
+                    nir_shader_get_entrypoint(nir), true, false);
+      else
+         NIR_PASS_V(nir, nir_lower_io_to_temporaries,
+                    nir_shader_get_entrypoint(nir), true, true);
+
+      NIR_PASS_V(nir, nir_lower_global_vars_to_local);
+      NIR_PASS_V(nir, nir_split_var_copies);
+      NIR_PASS_V(nir, nir_lower_var_copies);
+
+      NIR_PASS_V(nir, gl_nir_lower_atomics, prog, true);
+      NIR_PASS_V(nir, gl_nir_lower_buffers, prog);
+      NIR_PASS_V(nir, nir_lower_atomics_to_ssbo, 0);
+      NIR_PASS_V(nir, nir_lower_system_values);
+      NIR_PASS_V(nir, nir_lower_compute_system_values, NULL);
+      NIR_PASS_V(nir, gl_nir_lower_samplers, prog);
+
+      finish_frontend(nir);
+
+      /* Linked fragment shaders take their fixed varyings from the VS */
+      unsigned mask = 0;
+      if (i == MESA_SHADER_VERTEX)
+         mask = vs_fixed_varying_mask = fixed_varying_mask(nir);
+      else if (i == MESA_SHADER_FRAGMENT)
+         mask = vs_fixed_varying_mask;
+
+      add_job(name, nir, mask, link_ns + os_time_get_nano() - start);
+   }
+
+   standalone_compiler_cleanup(prog);
+   free(ctx);
+}
+
+static char *
+read_file(void *mem_ctx, const char *path, size_t *size)
+{
+   FILE *fp = fopen(path, "rb");
+   if (!fp)
+      return NULL;
+
+   fseek(fp, 0, SEEK_END);
+   long len = ftell(fp);
+   rewind(fp);
+
+   char *data = ralloc_size(mem_ctx, len + 1);
+   if (fread(data, 1, len, fp) != len) {
+      fclose(fp);
+      ralloc_free(data);
+      return NULL;
+   }
+
+   fclose(fp);
+   data[len] = '\0';
+   *size = len;
+   return data;
+}
+
+static gl_shader_stage
+stage_for_extension(const char *ext)
+{
+   if (!strcmp(ext, ".vert"))
+      return MESA_SHADER_VERTEX;
+   else if (!strcmp(ext, ".frag"))
+      return MESA_SHADER_FRAGMENT;
+   else if (!strcmp(ext, ".comp"))
+      return MESA_SHADER_COMPUTE;
+   else
+      return MESA_SHADER_NONE;
+}
+
+/*
+ * Split a piglit .shader_test into one file per shader section so the
+ * standalone compiler can pick up the stages from the file extensions, then
+ * link them together as one program.
+ */
+static void
+compile_shader_test(const char *path)
+{
+   static const struct {
+      const char *section, *ext;
+   } sections[] = {
+      {"[vertex shader]", "vert"},
+      {"[fragment shader]", "frag"},
+      {"[compute shader]", "comp"},
+   };
+
+   void *mem_ctx = ralloc_context(NULL);
+   size_t size;
+   char *text = read_file(mem_ctx, path, &size);
+   char tmpdir[] = "/tmp/panfrost_compiler.XXXXXX";
+   char *files[16];
+   unsigned nr_files = 0;
+   int glsl_version = 110;
+
+   if (!text || !mkdtemp(tmpdir)) {
+      fprintf(stderr, "%s: couldn't read\n", path);
+      nr_failed++;
+      ralloc_free(mem_ctx);
+      return;
+   }
+
+   char *line = text;
+   while (line && *line) {
+      char *next = strchr(line, '\n');
+      const char *ext = NULL;
+
+      for (unsigned i = 0; i < ARRAY_SIZE(sections); ++i) {
+         if (!strncmp(line, sections[i].section, strlen(sections[i].section)))
+            ext = sections[i].ext;
+      }
+
+      if (!ext || !next || nr_files == ARRAY_SIZE(files)) {
+         line = next ? next + 1 : NULL;
+         continue;
+      }
+
+      /* The section extends up to the next line starting with a '[' */
+      char *src = next + 1;
+      char *end = src;
+      while (*end && *end != '[') {
+         char *eol = strchr(end, '\n');
+         end = eol ? eol + 1 : end + strlen(end);
+      }
+
+      char *file =
+         ralloc_asprintf(mem_ctx, "%s/%u.%s", tmpdir, nr_files, ext);
+      FILE *fp = fopen(file, "w");
+      if (fp) {
+         fwrite(src, 1, end - src, fp);
+         fclose(fp);
+         files[nr_files++] = file;
+      }
+
+      char *shader = ralloc_strndup(mem_ctx, src, end - src);
+      glsl_version = MAX2(glsl_version, glsl_version_for_source(shader));
+
+      line = end;
+   }
+
+   if (nr_files)
+      compile_glsl(path, nr_files, files, glsl_version);
+
+   for (unsigned i = 0; i < nr_files; ++i)
+      unlink(files[i]);
+
+   rmdir(tmpdir);
+   ralloc_free(mem_ctx);
+}
+
+static void
+compile_glsl_file(const char *path)
+{
+   size_t size;
+   char *text = read_file(NULL, path, &size);
+
+   if (!text) {
+      fprintf(stderr, "%s: couldn't read\n", path);
+      nr_failed++;
+      return;
+   }
+
+   int glsl_version = glsl_version_for_source(text);
+   ralloc_free(text);
+
+   char *file = (char *)path;
+   compile_glsl(path, 1, &file, glsl_version);
+}
+
+static gl_shader_stage spirv_stage = MESA_SHADER_NONE;
+static const char *spirv_entrypoint = "main";
+
+static void
+compile_spirv(const char *path)
+{
+   const struct spirv_to_nir_options spirv_options = {
+      .environment = NIR_SPIRV_OPENGL,
+      .caps =
+         {
+            .draw_parameters = true,
+            .float16 = pan_arch(gpu_id) >= 6,
+            .image_read_without_format = true,
+            .image_write_without_format = true,
+            .int16 = true,
+            .int64 = true,
+            .storage_16bit = true,
+            .variable_pointers = true,
+         },
+      .ubo_addr_format = nir_address_format_32bit_index_offset,
+      .ssbo_addr_format = nir_address_format_32bit_index_offset,
+      .shared_addr_format = nir_address_format_32bit_offset,
+   };
+   gl_shader_stage stage = spirv_stage;
+
+   /* Otherwise take the stage from names like shader.frag.spv */
+   if (stage == MESA_SHADER_NONE) {
+      const char *ext = strrchr(path, '.');
+      const char *stage_ext = ext;
+
+      while (stage_ext > path && stage_ext[-1] != '.')
+         stage_ext--;
+
+      if (stage_ext > path) {
+         char *name = strndup(stage_ext - 1, ext - stage_ext + 1);
+         stage = stage_for_extension(name);
+         free(name);
+      }
+   }
+
+   if (stage == MESA_SHADER_NONE) {
+      fprintf(stderr, "%s: unknown stage, pass --stage\n", path);
+      nr_failed++;
+      return;
+   }
+
+   size_t size;
+   char *words = read_file(NULL, path, &size);
+   if (!words) {
+      fprintf(stderr, "%s: couldn't read\n", path);
+      nr_failed++;
+      return;
+   }
+
+   int64_t start = os_time_get_nano();
+   nir_shader *nir =
+      spirv_to_nir((const uint32_t *)words, size / 4, NULL, 0, stage,
+                   spirv_entrypoint, &spirv_options, get_nir_options());
+   ralloc_free(words);
+
+   if (!nir) {
+      fprintf(stderr, "%s: failed to translate SPIR-V\n", path);
+      nr_failed++;
+      return;
+   }
+
+   NIR_PASS_V(nir, nir_lower_variable_initializers, nir_var_function_temp);
+   NIR_PASS_V(nir, nir_lower_returns);
+   NIR_PASS_V(nir, nir_inline_functions);
+   NIR_PASS_V(nir, nir_copy_prop);
+   NIR_PASS_V(nir, nir_opt_deref);
+   nir_remove_non_entrypoints(nir);
+   NIR_PASS_V(nir, nir_lower_variable_initializers, ~nir_var_function_temp);
+
+   NIR_PASS_V(nir, nir_lower_io_to_temporaries, nir_shader_get_entrypoint(nir),
+              true, stage != MESA_SHADER_FRAGMENT);
+   NIR_PASS_V(nir, nir_lower_global_vars_to_local);
+   NIR_PASS_V(nir, nir_split_var_copies);
+   NIR_PASS_V(nir, nir_lower_var_copies);
+
+   NIR_PASS_V(nir, nir_lower_explicit_io,
+              nir_var_mem_ubo | nir_var_mem_ssbo,
+              nir_address_format_32bit_index_offset);
+   NIR_PASS_V(nir, nir_lower_vars_to_explicit_types, nir_var_mem_shared,
+              glsl_get_natural_size_align_bytes);
+   NIR_PASS_V(nir, nir_lower_explicit_io, nir_var_mem_shared,
+              nir_address_format_32bit_offset);
+   NIR_PASS_V(nir, nir_lower_system_values);
+   NIR_PASS_V(nir, nir_lower_compute_system_values, NULL);
+   NIR_PASS_V(nir, nir_lower_samplers);
+
+   finish_frontend(nir);
+
+   unsigned mask = 0;
+   if (stage == MESA_SHADER_VERTEX)
+      mask = fixed_varying_mask(nir);
+
+   add_job(path, nir, mask, os_time_get_nano() - start);
+}
+
+static void
+compile_nir(const char *path)
+{
+   size_t size;
+   char *data = read_file(NULL, path, &size);
+
+   if (!data) {
+      fprintf(stderr, "%s: couldn't read\n", path);
+      nr_failed++;
+      return;
+   }
+
+   int64_t start = os_time_get_nano();
+   struct blob_reader reader;
+   blob_reader_init(&reader, data, size);
+
+   nir_shader *nir = nir_deserialize(NULL, get_nir_options(), &reader);
+   ralloc_free(data);
+
+   unsigned mask = 0;
+   if (nir->info.stage == MESA_SHADER_VERTEX)
+      mask = fixed_varying_mask(nir);
+
+   add_job(path, nir, mask, os_time_get_nano() - start);
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+   return strcmp(*(const char **)a, *(const char **)b);
+}
+
+static void
+compile_path(const char *path)
+{
+   struct stat st;
+
+   if (stat(path, &st)) {
+      fprintf(stderr, "%s: no such file\n", path);
+      nr_failed++;
+      return;
+   }
+
+   if (S_ISDIR(st.st_mode)) {
+      DIR *dir = opendir(path);
+      if (!dir)
+         return;
+
+      /* Sort entries, so the output is stable across runs */
+      struct util_dynarray entries;
+      util_dynarray_init(&entries, NULL);
+
+      struct dirent *entry;
+      while ((entry = readdir(dir))) {
+         if (entry->d_name[0] == '.')
+            continue;
+
+         char *child = ralloc_asprintf(NULL, "%s/%s", path, entry->d_name);
+         util_dynarray_append(&entries, char *, child);
+      }
+
+      closedir(dir);
+
+      qsort(entries.data, util_dynarray_num_elements(&entries, char *),
+            sizeof(char *), compare_paths);
+
+      util_dynarray_foreach(&entries, char *, child) {
+         struct stat child_st;
+
+         /* Only pick up known inputs from directories */
+         const char *ext = strrchr(*child, '.');
+         if (!stat(*child, &child_st) &&
+             (S_ISDIR(child_st.st_mode) ||
+              (ext && (!strcmp(ext, ".shader_test") || !strcmp(ext, ".spv") ||
+                       !strcmp(ext, ".nir") ||
+                       stage_for_extension(ext) != MESA_SHADER_NONE))))
+            compile_path(*child);
+
+         ralloc_free(*child);
+      }
+
+      util_dynarray_fini(&entries);
+      return;
+   }
+
+   const char *ext = strrchr(path, '.');
+
+   if (ext && !strcmp(ext, ".shader_test"))
+      compile_shader_test(path);
+   else if (ext && !strcmp(ext, ".spv"))
+      compile_spirv(path);
+   else if (ext && !strcmp(ext, ".nir"))
+      compile_nir(path);
+   else if (ext && stage_for_extension(ext) != MESA_SHADER_NONE)
+      compile_glsl_file(path);
+   else {
+      fprintf(stderr, "%s: unknown input type\n", path);
+      nr_failed++;
+   }
+}
+
+/*
+ * Results are collected as rows of name/value pairs, one row per compiled
+ * variant, so new statistics in the backends show up without changes here.
+ */
+#define MAX_COLUMNS 64
+
+struct row {
+   const char *values[MAX_COLUMNS];
+};
+
+static const char *columns[MAX_COLUMNS];
+static unsigned nr_columns = 0;
+
+static const char *
+row_get(struct row *row, const char *key)
+{
+   for (unsigned i = 0; i < nr_columns; ++i) {
+      if (!strcmp(columns[i], key))
+         return row->values[i];
+   }
+
+   return NULL;
+}
+
+static void
+row_set(struct row *row, const char *key, const char *value)
+{
+   unsigned i;
+
+   for (i = 0; i < nr_columns; ++i) {
+      if (!strcmp(columns[i], key))
+         break;
+   }
+
+   if (i == nr_columns) {
+      if (nr_columns == MAX_COLUMNS)
+         return;
+
+      columns[nr_columns++] = key;
+   }
+
+   row->values[i] = value;
+}
+
+static char *
+column_name(void *mem_ctx, const char *name)
+{
+   char *out = ralloc_strdup(mem_ctx, name);
+
+   for (char *c = out; *c; ++c) {
+      if (*c == ' ')
+         *c = '_';
+   }
+
+   return out;
+}
+
+/*
+ * Parse a shader-db line like
+ *
+ *    MESA_SHADER_FRAGMENT shader: 12 inst, 0.5 cycles, ..., 0:0 spills:fills
+ *
+ * into the variant name and one column per statistic.
+ */
+static void
+parse_stats(void *mem_ctx, struct row *row, const char *msg)
+{
+   const char *stats = strstr(msg, " shader: ");
+   if (!stats)
+      return;
+
+   const char *variant = msg;
+   if (!strncmp(variant, "MESA_SHADER_", strlen("MESA_SHADER_")))
+      variant += strlen("MESA_SHADER_");
+
+   char *name = ralloc_strndup(mem_ctx, variant, stats - variant);
+   for (char *c = name; *c; ++c)
+      *c = tolower(*c);
+
+   row_set(row, "variant", name);
+
+   char *list = ralloc_strdup(mem_ctx, stats + strlen(" shader: "));
+   char *save = NULL;
+
+   for (char *tok = strtok_r(list, ",", &save); tok;
+        tok = strtok_r(NULL, ",", &save)) {
+      while (*tok == ' ')
+         tok++;
+
+      char *key = strchr(tok, ' ');
+      if (!key)
+         continue;
+
+      *(key++) = '\0';
+
+      /* Split pairs like "4:2 spills:fills" */
+      char *value_sep = strchr(tok, ':');
+      char *key_sep = strchr(key, ':');
+
+      if (value_sep && key_sep) {
+         *(value_sep++) = '\0';
+         *(key_sep++) = '\0';
+         row_set(row, column_name(mem_ctx, key_sep), value_sep);
+      }
+
+      row_set(row, column_name(mem_ctx, key), tok);
+   }
+}
+
+static void
+add_job_columns(void *mem_ctx, struct row *row, struct shader_job *job)
+{
+   row_set(row, "tls_size",
+           ralloc_asprintf(mem_ctx, "%u", job->info.tls_size));
+   row_set(row, "wls_size",
+           ralloc_asprintf(mem_ctx, "%u", job->info.wls_size));
+   row_set(row, "binary_size",
+           ralloc_asprintf(mem_ctx, "%u", job->binary_size));
+   row_set(row, "frontend_ms",
+           ralloc_asprintf(mem_ctx, "%.3f", job->frontend_ns / 1000000.0));
+   row_set(row, "preprocess_ms",
+           ralloc_asprintf(mem_ctx, "%.3f", job->preprocess_ns / 1000000.0));
+   row_set(row, "backend_ms",
+           ralloc_asprintf(mem_ctx, "%.3f", job->backend_ns / 1000000.0));
+
+   for (unsigned p = 0; p < job->pass_times.nr_passes; ++p) {
+      struct pan_pass_time *pass = &job->pass_times.passes[p];
+
+      row_set(row, ralloc_asprintf(mem_ctx, "%s_ms", pass->name),
+              ralloc_asprintf(mem_ctx, "%.3f", pass->ns / 1000000.0));
+   }
+}
+
+static void
+add_rows(void *mem_ctx, struct util_dynarray *rows, struct shader_job *job)
+{
+   unsigned nr_stats = util_dynarray_num_elements(&job->stats, char *);
+
+   for (unsigned i = 0; i < MAX2(nr_stats, 1); ++i) {
+      struct row *row = rzalloc(mem_ctx, struct row);
+
+      row_set(row, "shader", job->name);
+      row_set(row, "stage", _mesa_shader_stage_to_abbrev(job->stage));
+
+      if (i < nr_stats)
+         parse_stats(mem_ctx, row, *util_dynarray_element(&job->stats, char *, i));
+
+      /* The varying shader of IDVS pairs has its own register count */
+      const char *variant = row_get(row, "variant");
+      bool varying = variant && !strcmp(variant, "varying");
+      unsigned regs = varying ? job->info.vs.secondary_work_reg_count
+                              : job->info.work_reg_count;
+
+      row_set(row, "work_regs", ralloc_asprintf(mem_ctx, "%u", regs));
+
+      /* Sizes and times cover all variants of the shader. Only report them
+       * on the first row, so summing a column counts each shader once.
+       */
+      if (i == 0)
+         add_job_columns(mem_ctx, row, job);
+
+      util_dynarray_append(rows, struct row *, row);
+   }
+}
+
+static bool
+is_number(const char *str)
+{
+   char *end;
+
+   if (!*str)
+      return false;
+
+   strtod(str, &end);
+   return *end == '\0';
+}
+
+static void
+print_string(FILE *fp, const char *str, bool json)
+{
+   if (!json && !strpbrk(str, ",\"\n")) {
+      fputs(str, fp);
+      return;
+   }
+
+   fputc('"', fp);
+   for (const char *c = str; *c; ++c) {
+      if (*c == '"')
+         fputs(json ? "\\\"" : "\"\"", fp);
+      else if (json && *c == '\\')
+         fputs("\\\\", fp);
+      else
+         fputc(*c, fp);
+   }
+   fputc('"', fp);
+}
+
+static void
+print_rows(FILE *fp, struct util_dynarray *rows, bool json)
+{
+   if (json) {
+      fprintf(fp, "[\n");
+
+      util_dynarray_foreach(rows, struct row *, it) {
+         struct row *row = *it;
+         bool first = true;
+
+         fprintf(fp, "  {");
+         for (unsigned i = 0; i < nr_columns; ++i) {
+            if (!row->values[i])
+               continue;
+
+            fprintf(fp, "%s\"%s\": ", first ? "" : ", ", columns[i]);
+            if (is_number(row->values[i]))
+               fputs(row->values[i], fp);
+            else
+               print_string(fp, row->values[i], true);
+
+            first = false;
+         }
+
+         bool last = (it + 1) == (struct row **)util_dynarray_end(rows);
+         fprintf(fp, "}%s\n", last ? "" : ",");
+      }
+
+      fprintf(fp, "]\n");
+      return;
+   }
+
+   for (unsigned i = 0; i < nr_columns; ++i)
+      fprintf(fp, "%s%s", i ? "," : "", columns[i]);
+   fprintf(fp, "\n");
+
+   util_dynarray_foreach(rows, struct row *, it) {
+      for (unsigned i = 0; i < nr_columns; ++i) {
+         if (i)
+            fputc(',', fp);
+         if ((*it)->values[i])
+            print_string(fp, (*it)->values[i], false);
+      }
+      fprintf(fp, "\n");
+   }
+}
+
+static bool
+parse_gpu(const char *arg)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(gpus); ++i) {
+      if (!strcasecmp(arg, gpus[i].name)) {
+         gpu_id = gpus[i].gpu_id;
+         return true;
+      }
+   }
+
+   char *end;
+   gpu_id = strtoul(arg, &end, 16);
+   return *arg && *end == '\0' && gpu_id != 0;
+}
+
+static void
+print_help(const char *progname, FILE *file)
+{
+   fprintf(file,
+           "Usage: %s [OPTION]... FILE|DIR...\n"
+           "Compile shaders for Mali GPUs and report shader-db statistics.\n\n"
+           "Inputs are GLSL (.vert, .frag, .comp), piglit .shader_test files,\n"
+           "SPIR-V (.spv) and serialized NIR (.nir). Directories are searched\n"
+           "recursively.\n\n"
+           "    -g, --gpu=GPU          GPU name (G52, T860, ...) or hex product ID\n"
+           "    -s, --stage=STAGE      stage of SPIR-V inputs (vert, frag, comp)\n"
+           "    -e, --entry=NAME       SPIR-V entrypoint (default: main)\n"
+           "    -j, --jobs=N           number of compiler threads\n"
+           "    -f, --format=FMT       output format, csv (default) or json\n"
+           "    -o, --output=FILE      write results to FILE instead of stdout\n"
+           "    -n, --save-nir=DIR     save the frontend NIR of each shader\n"
+           "    -h, --help             display this help and exit\n"
+           "Example:\n"
+           "    %s -g G57 -j 8 -o g57.csv shader-db/shaders\n",
+           progname, progname);
+}
+
+int
+main(int argc, char *argv[])
+{
+   unsigned nr_threads = 0;
+   const char *output = NULL;
+   bool json = false;
+   int c;
+
+   /* clang-format off */
+   const struct option longopts[] = {
+      { "gpu",      required_argument, NULL, 'g' },
+      { "stage",    required_argument, NULL, 's' },
+      { "entry",    required_argument, NULL, 'e' },
+      { "jobs",     required_argument, NULL, 'j' },
+      { "format",   required_argument, NULL, 'f' },
+      { "output",   required_argument, NULL, 'o' },
+      { "save-nir", required_argument, NULL, 'n' },
+      { "help",     no_argument,       NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+   };
+   /* clang-format on */
+
+   while ((c = getopt_long(argc, argv, "g:s:e:j:f:o:n:h", longopts, NULL)) !=
+          -1) {
+      switch (c) {
+      case 'g':
+         if (!parse_gpu(optarg)) {
+            fprintf(stderr, "Unknown GPU %s\n", optarg);
+            return EXIT_FAILURE;
+         }
+         break;
+      case 's': {
+         char *ext = ralloc_asprintf(NULL, ".%s", optarg);
+         spirv_stage = stage_for_extension(ext);
+         ralloc_free(ext);
+
+         if (spirv_stage == MESA_SHADER_NONE) {
+            fprintf(stderr, "Unknown stage %s\n", optarg);
+            return EXIT_FAILURE;
+         }
+         break;
+      }
+      case 'e':
+         spirv_entrypoint = optarg;
+         break;
+      case 'j':
+         nr_threads = atoi(optarg);
+         break;
+      case 'f':
+         if (!strcmp(optarg, "json"))
+            json = true;
+         else if (strcmp(optarg, "csv")) {
+            fprintf(stderr, "Unknown format %s\n", optarg);
+            return EXIT_FAILURE;
+         }
+         break;
+      case 'o':
+         output = optarg;
+         break;
+      case 'n':
+         save_nir_dir = optarg;
+         break;
+      case 'h':
+         print_help(argv[0], stdout);
+         return EXIT_SUCCESS;
+      default:
+         print_help(argv[0], stderr);
+         return EXIT_FAILURE;
+      }
+   }
+
+   if (optind >= argc) {
+      print_help(argv[0], stderr);
+      return EXIT_FAILURE;
+   }
+
+   if (!nr_threads)
+      nr_threads = MAX2(util_get_cpu_caps()->nr_cpus, 1);
+
+   glsl_type_singleton_init_or_ref();
+   util_dynarray_init(&jobs, NULL);
+
+   struct util_queue queue;
+   if (!util_queue_init(&queue, "pan_compile", 64, nr_threads,
+                        UTIL_QUEUE_INIT_RESIZE_IF_FULL, NULL)) {
+      fprintf(stderr, "Failed to create the compiler queue\n");
+      return EXIT_FAILURE;
+   }
+
+   /* Frontends run on this thread, compiles are queued as soon as the NIR is
+    * ready so they overlap with the translation of the next inputs. The
+    * standalone GLSL compiler prints info logs to stdout, keep them out of
+    * the results.
+    */
+   unsigned nr_queued = 0;
+   int saved_stdout = dup(STDOUT_FILENO);
+
+   fflush(stdout);
+   dup2(STDERR_FILENO, STDOUT_FILENO);
+
+   for (int i = optind; i < argc; ++i) {
+      compile_path(argv[i]);
+
+      for (; nr_queued < util_dynarray_num_elements(&jobs, void *);
+           ++nr_queued) {
+         struct shader_job *job =
+            *util_dynarray_element(&jobs, struct shader_job *, nr_queued);
+
+         util_queue_add_job(&queue, job, &job->fence, compile_job, NULL, 0);
+      }
+   }
+
+   void *mem_ctx = ralloc_context(NULL);
+   struct util_dynarray rows;
+   util_dynarray_init(&rows, mem_ctx);
+
+   util_dynarray_foreach(&jobs, struct shader_job *, job) {
+      util_queue_fence_wait(&(*job)->fence);
+      add_rows(mem_ctx, &rows, *job);
+   }
+
+   util_queue_destroy(&queue);
+
+   fflush(stdout);
+   dup2(saved_stdout, STDOUT_FILENO);
+   close(saved_stdout);
+
+   FILE *fp = output ? fopen(output, "w") : stdout;
+   if (!fp) {
+      fprintf(stderr, "Couldn't open %s\n", output);
+      return EXIT_FAILURE;
+   }
+
+   print_rows(fp, &rows, json);
+
+   if (output)
+      fclose(fp);
+
+   util_dynarray_foreach(&jobs, struct shader_job *, job)
+      ralloc_free(*job);
+
+   util_dynarray_fini(&jobs);
+   ralloc_free(mem_ctx);
+   glsl_type_singleton_decref();
+
+   if (nr_failed)
+      fprintf(stderr, "%u shaders failed to compile\n", nr_failed);
+
+   return nr_failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,170 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pan_pass_time.h"
+#include <stdlib.h>
+#include <string.h>
+#include "util/macros.h"
+#include "util/u_thread.h"
+
+/* Enabled timers, printed by a single exit handler */
+static struct list_head timers = {&timers, &timers};
+static simple_mtx_t timers_lock = SIMPLE_MTX_INITIALIZER;
+
+/* Per-shader pass times requested by the calling thread, if any */
+static __THREAD_INITIAL_EXEC struct pan_pass_times *thread_times;
+
+static void
+print_timers(void)
+{
+   simple_mtx_lock(&timers_lock);
+
+   list_for_each_entry(struct pan_pass_timer, timer, &timers, link)
+      pan_pass_timer_print(timer, stderr);
+
+   simple_mtx_unlock(&timers_lock);
+}
+
+void
+pan_pass_timer_enable(struct pan_pass_timer *timer)
+{
+   if (timer->enabled)
+      return;
+
+   simple_mtx_lock(&timers_lock);
+
+   if (!timer->enabled) {
+      if (list_is_empty(&timers))
+         atexit(print_timers);
+
+      list_addtail(&timer->link, &timers);
+      timer->enabled = true;
+   }
+
+   simple_mtx_unlock(&timers_lock);
+}
+
+struct pan_pass_times *
+pan_pass_times_capture(struct pan_pass_times *times)
+{
+   struct pan_pass_times *prev = thread_times;
+
+   thread_times = times;
+   return prev;
+}
+
+struct pan_pass_times *
+pan_pass_times_current(void)
+{
+   return thread_times;
+}
+
+bool
+pan_pass_timer_active(const struct pan_pass_timer *timer)
+{
+   return timer->enabled || thread_times;
+}
+
+static void
+record_pass(struct pan_pass_time *passes, unsigned *nr_passes,
+            const char *name, unsigned calls, int64_t ns)
+{
+   /* Passes are few, a linear search is fine */
+   unsigned i;
+   for (i = 0; i < *nr_passes; ++i) {
+      if (!strcmp(passes[i].name, name))
+         break;
+   }
+
+   if (i == *nr_passes && i < PAN_MAX_TIMED_PASSES)
+      passes[(*nr_passes)++].name = name;
+
+   if (i < *nr_passes) {
+      passes[i].calls += calls;
+      passes[i].ns += ns;
+   }
+}
+
+void
+pan_pass_times_merge(struct pan_pass_times *dst,
+                     const struct pan_pass_times *src)
+{
+   for (unsigned i = 0; i < src->nr_passes; ++i) {
+      record_pass(dst->passes, &dst->nr_passes, src->passes[i].name,
+                  src->passes[i].calls, src->passes[i].ns);
+   }
+}
+
+void
+pan_pass_timer_add(struct pan_pass_timer *timer, const char *name, int64_t ns)
+{
+   if (thread_times)
+      record_pass(thread_times->passes, &thread_times->nr_passes, name, 1, ns);
+
+   if (!timer->enabled)
+      return;
+
+   simple_mtx_lock(&timer->lock);
+   record_pass(timer->passes, &timer->nr_passes, name, 1, ns);
+   simple_mtx_unlock(&timer->lock);
+}
+
+static int
+compare_time(const void *a, const void *b)
+{
+   const struct pan_pass_time *pa = a, *pb = b;
+
+   return (pa->ns < pb->ns) - (pa->ns > pb->ns);
+}
+
+void
+pan_pass_timer_print(struct pan_pass_timer *timer, FILE *fp)
+{
+   struct pan_pass_time passes[PAN_MAX_TIMED_PASSES];
+   int64_t total = 0;
+
+   simple_mtx_lock(&timer->lock);
+   unsigned nr_passes = timer->nr_passes;
+   memcpy(passes, timer->passes, sizeof(passes[0]) * nr_passes);
+   simple_mtx_unlock(&timer->lock);
+
+   if (!nr_passes)
+      return;
+
+   qsort(passes, nr_passes, sizeof(passes[0]), compare_time);
+
+   for (unsigned i = 0; i < nr_passes; ++i)
+      total += passes[i].ns;
+
+   fprintf(fp, "%s pass times:\n", timer->compiler);
+   fprintf(fp, "  %-32s %8s %12s %10s %6s\n", "pass", "calls", "total (ms)",
+           "avg (us)", "%");
+
+   for (unsigned i = 0; i < nr_passes; ++i) {
+      struct pan_pass_time *p = &passes[i];
+
+      fprintf(fp, "  %-32s %8u %12.3f %10.1f %6.1f\n", p->name, p->calls,
+              p->ns / 1000000.0, p->ns / (1000.0 * p->calls),
+              total ? (100.0 * p->ns) / total : 0.0);
+   }
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2026 agent <agent@local>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PAN_PASS_TIME_H
+#define __PAN_PASS_TIME_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "util/list.h"
+#include "util/os_time.h"
+#include "util/perf/cpu_trace.h"
+#include "util/simple_mtx.h"
+
+#define PAN_MAX_TIMED_PASSES 64
+
+struct pan_pass_time {
+   const char *name;
+   unsigned calls;
+   int64_t ns;
+};
+
+/*
+ * Wall-clock time spent in each pass of a compiler, accumulated over all
+ * shaders compiled by the process and printed at exit. Passes are identified
+ * by their (static) name string.
+ */
+struct pan_pass_timer {
+   /* Name of the compiler in the summary */
+   const char *compiler;
+
+   bool enabled;
+
+   simple_mtx_t lock;
+   struct list_head link;
+   unsigned nr_passes;
+   struct pan_pass_time passes[PAN_MAX_TIMED_PASSES];
+};
+
+#define PAN_PASS_TIMER_INIT(name)                                              \
+   {                                                                           \
+      .compiler = name, .lock = SIMPLE_MTX_INITIALIZER,                        \
+   }
+
+/*
+ * Pass times of the shaders compiled by one thread, for tools that report
+ * them per shader rather than per process.
+ */
+struct pan_pass_times {
+   unsigned nr_passes;
+   struct pan_pass_time passes[PAN_MAX_TIMED_PASSES];
+};
+
+void pan_pass_timer_enable(struct pan_pass_timer *timer);
+
+/*
+ * Record the passes run by the calling thread into times, until called again
+ * with NULL. This works whether or not the timers are enabled. Returns the
+ * previous capture of the thread, so nested captures can restore it.
+ */
+struct pan_pass_times *pan_pass_times_capture(struct pan_pass_times *times);
+
+struct pan_pass_times *pan_pass_times_current(void);
+
+/* Add passes captured on another thread, for work split across threads */
+void pan_pass_times_merge(struct pan_pass_times *dst,
+                          const struct pan_pass_times *src);
+
+bool pan_pass_timer_active(const struct pan_pass_timer *timer);
+
+void pan_pass_timer_add(struct pan_pass_timer *timer, const char *name,
+                        int64_t ns);
+
+void pan_pass_timer_print(struct pan_pass_timer *timer, FILE *fp);
+
+/*
+ * Run a pass, recording its time if the timer is enabled or the thread is
+ * capturing pass times. The pass also shows
+ * up as a CPU slice when tracing with Perfetto.
+ */
+#define PAN_TIME_PASS(timer, name, pass)                                       \
+   do {                                                                        \
+      MESA_TRACE_SCOPE(name);                                                  \
+      bool _pan_active = pan_pass_timer_active(timer);                         \
+      int64_t _pan_start = _pan_active ? os_time_get_nano() : 0;               \
+      pass;                                                                    \
+      if (_pan_active)                                                         \
+         pan_pass_timer_add(timer, name, os_time_get_nano() - _pan_start);     \
+   } while (0)
+
+#endif
@@ -441,7 +441,7 @@ panvk_cmd_fb_info_set_subpass(struct panvk_cmd_buffer *cmdbuf)
       fbinfo->rts[cb].view = &view->pview;
       fbinfo->rts[cb].clear = subpass->color_attachments[cb].clear;
       fbinfo->rts[cb].preload = subpass->color_attachments[cb].preload;
-      fbinfo->rts[cb].crc_valid = &cmdbuf->state.fb.crc_valid[cb];
+      fbinfo->rts[cb].crc = &cmdbuf->state.fb.crc[cb];
 
       memcpy(fbinfo->rts[cb].clear_value, clears[idx].color,
              sizeof(fbinfo->rts[cb].clear_value));
@@ -480,7 +480,7 @@ panvk_cmd_fb_info_init(struct panvk_cmd_buffer *cmdbuf)
    struct pan_fb_info *fbinfo = &cmdbuf->state.fb.info;
    const struct panvk_framebuffer *fb = cmdbuf->state.framebuffer;
 
-   memset(cmdbuf->state.fb.crc_valid, 0, sizeof(cmdbuf->state.fb.crc_valid));
+   memset(cmdbuf->state.fb.crc, 0, sizeof(cmdbuf->state.fb.crc));
 
    *fbinfo = (struct pan_fb_info){
       .tile_buf_budget = panfrost_query_optimal_tib_size(
@@ -50,6 +50,7 @@
 #include "drm-uapi/panfrost_drm.h"
 
 #include "util/disk_cache.h"
+#include "util/hex.h"
 #include "util/strtod.h"
 #include "util/u_debug.h"
 #include "vk_drm_syncobj.h"
@@ -308,6 +309,11 @@ panvk_physical_device_finish(struct panvk_physical_device *device)
 {
    panvk_wsi_finish(device);
 
+#ifdef ENABLE_SHADER_CACHE
+   if (device->vk.disk_cache)
+      disk_cache_destroy(device->vk.disk_cache);
+#endif
+
    pan_kmod_dev_destroy(device->kmod.dev);
    if (device->master_fd != -1)
       close(device->master_fd);
@@ -533,6 +539,15 @@ panvk_physical_device_init(struct panvk_physical_device *device,
       goto fail_close_device;
    }
 
+#ifdef ENABLE_SHADER_CACHE
+   /* The GPU ID is already part of the cache UUID, so use it as the timestamp
+    * and key the cache on the model name only.
+    */
+   char cache_timestamp[VK_UUID_SIZE * 2 + 1];
+   mesa_bytes_to_hex(cache_timestamp, device->cache_uuid, VK_UUID_SIZE);
+   device->vk.disk_cache = disk_cache_create(device->name, cache_timestamp, 0);
+#endif
+
    return VK_SUCCESS;
 
 fail_close_device:
@@ -1086,6 +1101,13 @@ panvk_CreateDevice(VkPhysicalDevice physicalDevice,
 
    panvk_arch_dispatch(arch, meta_init, device);
 
+   struct vk_pipeline_cache_create_info cache_info = {};
+   device->mem_cache = vk_pipeline_cache_create(&device->vk, &cache_info, NULL);
+   if (!device->mem_cache) {
+      result = VK_ERROR_OUT_OF_HOST_MEMORY;
+      goto fail;
+   }
+
    for (unsigned i = 0; i < pCreateInfo->queueCreateInfoCount; i++) {
       const VkDeviceQueueCreateInfo *queue_create =
          &pCreateInfo->pQueueCreateInfos[i];
@@ -1123,6 +1145,9 @@ fail:
          vk_object_free(&device->vk, NULL, device->queues[i]);
    }
 
+   if (device->mem_cache)
+      vk_pipeline_cache_destroy(device->mem_cache, NULL);
+
    panvk_arch_dispatch(pan_arch(physical_device->kmod.props.gpu_prod_id),
                        meta_cleanup, device);
    panvk_priv_bo_destroy(device->tiler_heap, &device->vk.alloc);
@@ -1153,6 +1178,9 @@ panvk_DestroyDevice(VkDevice _device, const VkAllocationCallbacks *pAllocator)
          vk_object_free(&device->vk, NULL, device->queues[i]);
    }
 
+   if (device->mem_cache)
+      vk_pipeline_cache_destroy(device->mem_cache, NULL);
+
    panvk_arch_dispatch(pan_arch(physical_device->kmod.props.gpu_prod_id),
                        meta_cleanup, device);
    panvk_priv_bo_destroy(device->tiler_heap, &device->vk.alloc);
@@ -1364,6 +1392,7 @@ panvk_MapMemory(VkDevice _device, VkDeviceMemory _memory, VkDeviceSize offset,
       return vk_error(device, VK_ERROR_MEMORY_MAP_FAILED);
 
    mem->addr.host = addr;
+   panvk_device_memory_mark_written(mem);
    *ppData = mem->addr.host + offset;
    return VK_SUCCESS;
 }
@@ -1380,12 +1409,21 @@ panvk_UnmapMemory(VkDevice _device, VkDeviceMemory _memory)
       assert(!ret);
       mem->addr.host = NULL;
    }
+
+   /* Writes done through the mapping are only complete now */
+   panvk_device_memory_mark_written(mem);
 }
 
 VkResult
 panvk_FlushMappedMemoryRanges(VkDevice _device, uint32_t memoryRangeCount,
                               const VkMappedMemoryRange *pMemoryRanges)
 {
+   for (uint32_t i = 0; i < memoryRangeCount; i++) {
+      VK_FROM_HANDLE(panvk_device_memory, mem, pMemoryRanges[i].memory);
+
+      panvk_device_memory_mark_written(mem);
+   }
+
    return VK_SUCCESS;
 }
 
@@ -1454,15 +1492,24 @@ VkResult
 panvk_BindBufferMemory2(VkDevice device, uint32_t bindInfoCount,
                         const VkBindBufferMemoryInfo *pBindInfos)
 {
+   VK_FROM_HANDLE(panvk_device, dev, device);
+
    for (uint32_t i = 0; i < bindInfoCount; ++i) {
       VK_FROM_HANDLE(panvk_device_memory, mem, pBindInfos[i].memory);
       VK_FROM_HANDLE(panvk_buffer, buffer, pBindInfos[i].buffer);
       struct pan_kmod_bo *old_bo = buffer->bo;
 
+      buffer->mem = mem;
+
       if (mem) {
          buffer->bo = pan_kmod_bo_get(mem->bo);
          buffer->dev_addr = mem->addr.dev + pBindInfos[i].memoryOffset;
 
+         if (buffer->vk.usage & (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                                 VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT |
+                                 VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT))
+            mem->shader_writable = true;
+
          /* FIXME: Only host map for index buffers so we can do the min/max
           * index retrieval on the CPU. This is all broken anyway and the
           * min/max search should be done with a compute shader that also
@@ -1481,6 +1528,16 @@ panvk_BindBufferMemory2(VkDevice device, uint32_t bindInfoCount,
 
             assert(map_addr != MAP_FAILED);
             buffer->host_ptr = map_addr + (offset & pgsize);
+
+            /* Allocation failures only disable the cache */
+            if (!buffer->index_bounds.cache) {
+               buffer->index_bounds.cache =
+                  vk_zalloc(&dev->vk.alloc, sizeof(struct panfrost_minmax_cache),
+                            8, VK_SYSTEM_ALLOCATION_SCOPE_OBJECT);
+            }
+
+            panfrost_minmax_cache_reset(buffer->index_bounds.cache);
+            buffer->index_bounds.seqno = p_atomic_read(&mem->write_seqno);
          }
       } else {
          buffer->bo = NULL;
@@ -1670,6 +1727,8 @@ panvk_CreateBuffer(VkDevice _device, const VkBufferCreateInfo *pCreateInfo,
    if (buffer == NULL)
       return vk_error(device, VK_ERROR_OUT_OF_HOST_MEMORY);
 
+   simple_mtx_init(&buffer->index_bounds.lock, mtx_plain);
+
    *pBuffer = panvk_buffer_to_handle(buffer);
 
    return VK_SUCCESS;
@@ -1696,6 +1755,10 @@ panvk_DestroyBuffer(VkDevice _device, VkBuffer _buffer,
       buffer->host_ptr = NULL;
    }
 
+   panfrost_minmax_cache_fini(buffer->index_bounds.cache);
+   vk_free(&device->vk.alloc, buffer->index_bounds.cache);
+   simple_mtx_destroy(&buffer->index_bounds.lock);
+
    pan_kmod_bo_put(buffer->bo);
    vk_buffer_destroy(&device->vk, pAllocator, &buffer->vk);
 }
@@ -22,6 +22,119 @@
  */
 
 /*
- * This file is a stub until we have a real pipeline cache. For now, the
- * pipeline cache functions are stubbed by the common Vulkan runtime.
+ * panvk shaders are stored in the common vk_pipeline_cache as
+ * vk_pipeline_cache_objects keyed by the SHA1 of everything that goes into
+ * panvk_per_arch(shader_create)(). The serialized form is the compiled
+ * binary along with the pan_shader_info, so a cache hit (from memory, from
+ * VkPipelineCacheCreateInfo::pInitialData or from the disk cache) skips
+ * SPIR-V translation, NIR lowering and backend compilation entirely.
  */
+
+#include "panvk_private.h"
+
+#include "util/blob.h"
+#include "util/mesa-sha1.h"
+
+static bool
+panvk_shader_serialize(struct vk_pipeline_cache_object *object,
+                       struct blob *blob)
+{
+   struct panvk_shader *shader =
+      container_of(object, struct panvk_shader, base);
+   uint32_t binary_size = util_dynarray_num_elements(&shader->binary, uint8_t);
+
+   blob_write_uint32(blob, shader->sysval_ubo);
+   blob_write_uint32(blob, shader->local_size.x);
+   blob_write_uint32(blob, shader->local_size.y);
+   blob_write_uint32(blob, shader->local_size.z);
+   blob_write_uint32(blob, shader->has_img_access);
+
+   /* pan_shader_info is plain data, varyings included */
+   blob_write_bytes(blob, &shader->info, sizeof(shader->info));
+
+   blob_write_uint32(blob, binary_size);
+   blob_write_bytes(blob, shader->binary.data, binary_size);
+
+   return !blob->out_of_memory;
+}
+
+static struct vk_pipeline_cache_object *
+panvk_shader_deserialize(struct vk_pipeline_cache *cache, const void *key_data,
+                         size_t key_size, struct blob_reader *blob)
+{
+   struct panvk_device *dev =
+      container_of(cache->base.device, struct panvk_device, vk);
+
+   assert(key_size == SHA1_DIGEST_LENGTH);
+
+   struct panvk_shader *shader = panvk_shader_alloc(dev, key_data);
+   if (!shader)
+      return NULL;
+
+   shader->sysval_ubo = blob_read_uint32(blob);
+   shader->local_size.x = blob_read_uint32(blob);
+   shader->local_size.y = blob_read_uint32(blob);
+   shader->local_size.z = blob_read_uint32(blob);
+   shader->has_img_access = blob_read_uint32(blob);
+   blob_copy_bytes(blob, &shader->info, sizeof(shader->info));
+
+   uint32_t binary_size = blob_read_uint32(blob);
+   const void *binary = blob_read_bytes(blob, binary_size);
+
+   if (blob->overrun) {
+      panvk_shader_destroy(dev, shader);
+      return NULL;
+   }
+
+   if (binary_size) {
+      void *dst = util_dynarray_grow_bytes(&shader->binary, 1, binary_size);
+      if (!dst) {
+         panvk_shader_destroy(dev, shader);
+         return NULL;
+      }
+
+      memcpy(dst, binary, binary_size);
+   }
+
+   return &shader->base;
+}
+
+static void
+panvk_shader_cache_destroy(struct vk_device *vk_dev,
+                           struct vk_pipeline_cache_object *object)
+{
+   struct panvk_device *dev = container_of(vk_dev, struct panvk_device, vk);
+   struct panvk_shader *shader =
+      container_of(object, struct panvk_shader, base);
+
+   panvk_shader_destroy(dev, shader);
+}
+
+const struct vk_pipeline_cache_object_ops panvk_shader_ops = {
+   .serialize = panvk_shader_serialize,
+   .deserialize = panvk_shader_deserialize,
+   .destroy = panvk_shader_cache_destroy,
+};
+
+struct panvk_shader *
+panvk_shader_cache_lookup(struct vk_pipeline_cache *cache,
+                          const unsigned char *sha1)
+{
+   struct vk_pipeline_cache_object *object = vk_pipeline_cache_lookup_object(
+      cache, sha1, SHA1_DIGEST_LENGTH, &panvk_shader_ops, NULL);
+
+   if (!object)
+      return NULL;
+
+   return container_of(object, struct panvk_shader, base);
+}
+
+struct panvk_shader *
+panvk_shader_cache_insert(struct vk_pipeline_cache *cache,
+                          struct panvk_shader *shader)
+{
+   struct vk_pipeline_cache_object *object =
+      vk_pipeline_cache_add_object(cache, &shader->base);
+
+   return container_of(object, struct panvk_shader, base);
+}
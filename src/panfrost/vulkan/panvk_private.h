@@ -48,6 +48,9 @@
 #include "compiler/shader_enums.h"
 #include "util/list.h"
 #include "util/macros.h"
+#include "util/simple_mtx.h"
+#include "util/u_atomic.h"
+#include "util/u_dynarray.h"
 #include "vk_alloc.h"
 #include "vk_buffer.h"
 #include "vk_command_buffer.h"
@@ -59,6 +62,7 @@
 #include "vk_log.h"
 #include "vk_object.h"
 #include "vk_physical_device.h"
+#include "vk_pipeline_cache.h"
 #include "vk_pipeline_layout.h"
 #include "vk_queue.h"
 #include "vk_sync.h"
@@ -70,6 +74,7 @@
 #include "pan_blitter.h"
 #include "pan_desc.h"
 #include "pan_jc.h"
+#include "pan_minmax_cache.h"
 #include "pan_texture.h"
 #include "panvk_mempool.h"
 #include "panvk_varyings.h"
@@ -256,11 +261,6 @@ bool
 panvk_physical_device_extension_supported(struct panvk_physical_device *dev,
                                           const char *name);
 
-struct panvk_pipeline_cache {
-   struct vk_object_base base;
-   VkAllocationCallbacks alloc;
-};
-
 #define PANVK_MAX_QUEUE_FAMILIES 1
 
 struct panvk_queue {
@@ -283,6 +283,9 @@ struct panvk_device {
 
    struct panvk_meta meta;
 
+   /* Used for pipelines created without a VkPipelineCache */
+   struct vk_pipeline_cache *mem_cache;
+
    struct vk_device_dispatch_table cmd_dispatch;
 
    struct panvk_instance *instance;
@@ -355,8 +358,31 @@ struct panvk_device_memory {
       mali_ptr dev;
       void *host;
    } addr;
+
+   /* Bumped on every write to the memory we know about (host map/flush,
+    * transfer commands), so index bounds cached on buffers bound to it can
+    * be dropped.
+    */
+   uint32_t write_seqno;
+
+   /* Queue that last ran transfer commands writing to the memory, until
+    * they are known to be complete. Cached index bounds can't be trusted
+    * while they are in flight.
+    */
+   struct panvk_queue *write_queue;
+
+   /* A buffer that shaders can write to is bound to this memory, so cached
+    * index bounds can never be trusted.
+    */
+   bool shader_writable;
 };
 
+static inline void
+panvk_device_memory_mark_written(struct panvk_device_memory *mem)
+{
+   p_atomic_inc(&mem->write_seqno);
+}
+
 struct panvk_buffer_desc {
    struct panvk_buffer *buffer;
    VkDeviceSize offset;
@@ -545,8 +571,27 @@ struct panvk_buffer {
     * Make sure this field goes away as soon as we fixed indirect draws.
     */
    void *host_ptr;
+
+   /* Memory the buffer is bound to, NULL if unbound */
+   struct panvk_device_memory *mem;
+
+   /* Index bounds already computed for this buffer, only valid as long as
+    * mem->write_seqno is equal to seqno. Only allocated for index buffers.
+    */
+   struct {
+      simple_mtx_t lock;
+      struct panfrost_minmax_cache *cache;
+      uint32_t seqno;
+   } index_bounds;
 };
 
+static inline void
+panvk_buffer_mark_written(struct panvk_buffer *buffer)
+{
+   if (buffer->mem)
+      panvk_device_memory_mark_written(buffer->mem);
+}
+
 static inline mali_ptr
 panvk_buffer_gpu_ptr(const struct panvk_buffer *buffer, uint64_t offset)
 {
@@ -763,7 +808,7 @@ struct panvk_cmd_state {
 
    struct {
       struct pan_fb_info info;
-      bool crc_valid[MAX_RTS];
+      struct pan_crc_state crc[MAX_RTS];
    } fb;
 
    const struct panvk_render_pass *pass;
@@ -811,8 +856,26 @@ struct panvk_cmd_buffer {
    struct panvk_descriptor_set meta_push_descriptors;
 
    struct panvk_cmd_bind_point_state bind_points[MAX_BIND_POINTS];
+
+   /* Memory written by transfer commands, bumped again at submit time */
+   struct util_dynarray written_mems;
 };
 
+/* Index bounds are computed when draws are recorded, so a transfer write
+ * must invalidate them both when it is recorded and when it is submitted.
+ */
+static inline void
+panvk_cmd_mark_buffer_written(struct panvk_cmd_buffer *cmdbuf,
+                              struct panvk_buffer *buffer)
+{
+   if (!buffer->mem)
+      return;
+
+   panvk_device_memory_mark_written(buffer->mem);
+   util_dynarray_append(&cmdbuf->written_mems, struct panvk_device_memory *,
+                        buffer->mem);
+}
+
 #define panvk_cmd_get_bind_point_state(cmdbuf, bindpoint)                      \
    &(cmdbuf)->bind_points[VK_PIPELINE_BIND_POINT_##bindpoint]
 
@@ -839,6 +902,9 @@ struct panvk_event {
 };
 
 struct panvk_shader {
+   struct vk_pipeline_cache_object base;
+   unsigned char sha1[20];
+
    struct pan_shader_info info;
    struct util_dynarray binary;
    unsigned sysval_ubo;
@@ -854,8 +920,25 @@ panvk_shader_create(struct panvk_device *dev, gl_shader_stage stage,
                     bool static_blend_constants,
                     const VkAllocationCallbacks *alloc);
 
-void panvk_shader_destroy(struct panvk_device *dev, struct panvk_shader *shader,
-                          const VkAllocationCallbacks *alloc);
+struct panvk_shader *panvk_shader_alloc(struct panvk_device *dev,
+                                        const unsigned char *sha1);
+
+void panvk_shader_destroy(struct panvk_device *dev,
+                          struct panvk_shader *shader);
+
+extern const struct vk_pipeline_cache_object_ops panvk_shader_ops;
+
+struct panvk_shader *panvk_shader_cache_lookup(struct vk_pipeline_cache *cache,
+                                               const unsigned char *sha1);
+
+struct panvk_shader *panvk_shader_cache_insert(struct vk_pipeline_cache *cache,
+                                               struct panvk_shader *shader);
+
+static inline void
+panvk_shader_unref(struct panvk_device *dev, struct panvk_shader *shader)
+{
+   vk_pipeline_cache_object_unref(&dev->vk, &shader->base);
+}
 
 #define RSD_WORDS        16
 #define BLEND_DESC_WORDS 4
@@ -1112,8 +1195,6 @@ VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_image, vk.base, VkImage,
                                VK_OBJECT_TYPE_IMAGE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_image_view, vk.base, VkImageView,
                                VK_OBJECT_TYPE_IMAGE_VIEW);
-VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_pipeline_cache, base, VkPipelineCache,
-                               VK_OBJECT_TYPE_PIPELINE_CACHE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_pipeline, base, VkPipeline,
                                VK_OBJECT_TYPE_PIPELINE)
 VK_DEFINE_NONDISP_HANDLE_CASTS(panvk_pipeline_layout, vk.base, VkPipelineLayout,
@@ -1178,7 +1259,10 @@ struct panvk_shader *panvk_per_arch(shader_create)(
    const VkPipelineShaderStageCreateInfo *stage_info,
    const struct panvk_pipeline_layout *layout, unsigned sysval_ubo,
    struct pan_blend_state *blend_state, bool static_blend_constants,
-   const VkAllocationCallbacks *alloc);
+   const unsigned char *sha1);
+
+void panvk_per_arch(shader_lower_blend_state)(
+   const struct panvk_device *dev, struct pan_blend_state *blend_state);
 struct nir_shader;
 
 bool panvk_per_arch(nir_lower_descriptors)(
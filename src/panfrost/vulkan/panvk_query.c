@@ -57,6 +57,13 @@ panvk_CmdCopyQueryPoolResults(VkCommandBuffer commandBuffer,
                               VkDeviceSize dstOffset, VkDeviceSize stride,
                               VkQueryResultFlags flags)
 {
+   VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
+   VK_FROM_HANDLE(panvk_buffer, dst, dstBuffer);
+
+   /* Not implemented yet, but the destination can't keep cached index
+    * bounds either way.
+    */
+   panvk_cmd_mark_buffer_written(cmdbuf, dst);
    panvk_stub();
 }
 
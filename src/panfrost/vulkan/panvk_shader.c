@@ -30,10 +30,30 @@
 
 #include "vk_util.h"
 
+struct panvk_shader *
+panvk_shader_alloc(struct panvk_device *dev, const unsigned char *sha1)
+{
+   struct panvk_shader *shader;
+
+   /* Shaders can outlive the pipeline that created them through the pipeline
+    * cache, so they are always allocated from the device allocator.
+    */
+   shader = vk_zalloc(&dev->vk.alloc, sizeof(*shader), 8,
+                      VK_SYSTEM_ALLOCATION_SCOPE_DEVICE);
+   if (!shader)
+      return NULL;
+
+   memcpy(shader->sha1, sha1, sizeof(shader->sha1));
+   vk_pipeline_cache_object_init(&dev->vk, &shader->base, &panvk_shader_ops,
+                                 shader->sha1, sizeof(shader->sha1));
+   util_dynarray_init(&shader->binary, NULL);
+   return shader;
+}
+
 void
-panvk_shader_destroy(struct panvk_device *dev, struct panvk_shader *shader,
-                     const VkAllocationCallbacks *alloc)
+panvk_shader_destroy(struct panvk_device *dev, struct panvk_shader *shader)
 {
+   vk_pipeline_cache_object_finish(&shader->base);
    util_dynarray_fini(&shader->binary);
-   vk_free2(&dev->vk.alloc, alloc, shader);
+   vk_free(&dev->vk.alloc, shader);
 }
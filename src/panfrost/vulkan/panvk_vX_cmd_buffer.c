@@ -41,6 +41,8 @@
 #include "util/u_pack_color.h"
 #include "vk_format.h"
 
+#include <xf86drm.h>
+
 static uint32_t
 panvk_debug_adjust_bo_flags(const struct panvk_device *device,
                             uint32_t bo_flags)
@@ -804,16 +806,89 @@ panvk_per_arch(CmdDraw)(VkCommandBuffer commandBuffer, uint32_t vertexCount,
    panvk_cmd_draw(cmdbuf, &draw);
 }
 
+/* Whether transfer commands writing to the memory may still be running. Once
+ * they are done, bounds computed from what they wrote can be cached again.
+ */
+static bool
+panvk_device_memory_writes_pending(struct panvk_device_memory *mem)
+{
+   struct panvk_queue *queue = p_atomic_read(&mem->write_queue);
+
+   if (!queue)
+      return false;
+
+   /* The queue syncobj signals when everything submitted so far is done */
+   if (drmSyncobjWait(queue->device->vk.drm_fd, &queue->sync, 1, 0, 0, NULL))
+      return true;
+
+   if (p_atomic_cmpxchg(&mem->write_queue, queue, NULL) == queue)
+      panvk_device_memory_mark_written(mem);
+
+   return false;
+}
+
+/* Whether the bounds cached on an index buffer can be trusted, resetting
+ * them if the memory was written since they were computed. Must be called
+ * with the index_bounds lock held.
+ */
+static bool
+panvk_index_bounds_cache_valid(struct panvk_buffer *buffer)
+{
+   struct panvk_device_memory *mem = buffer->mem;
+
+   if (!buffer->index_bounds.cache)
+      return false;
+
+   /* Host writes through a live mapping and shader writes are invisible to
+    * us, so there is nothing to invalidate the cache on.
+    */
+   if (mem->addr.host || mem->shader_writable)
+      return false;
+
+   if (panvk_device_memory_writes_pending(mem))
+      return false;
+
+   uint32_t seqno = p_atomic_read(&mem->write_seqno);
+
+   if (buffer->index_bounds.seqno != seqno) {
+      panfrost_minmax_cache_reset(buffer->index_bounds.cache);
+      buffer->index_bounds.seqno = seqno;
+   }
+
+   return true;
+}
+
 static void
 panvk_index_minmax_search(struct panvk_cmd_buffer *cmdbuf, uint32_t start,
                           uint32_t count, bool restart, uint32_t *min,
                           uint32_t *max)
 {
-   void *ptr = cmdbuf->state.ib.buffer->host_ptr + cmdbuf->state.ib.offset;
+   struct panvk_buffer *buffer = cmdbuf->state.ib.buffer;
+   unsigned index_size = cmdbuf->state.ib.index_size / 8;
+
+   assert(buffer);
+   assert(buffer->bo);
+   assert(buffer->host_ptr);
+
+   /* The bound offset is a multiple of the index size, so ranges can be
+    * tracked in indices from the start of the buffer.
+    */
+   start += cmdbuf->state.ib.offset / index_size;
+
+   simple_mtx_lock(&buffer->index_bounds.lock);
 
-   assert(cmdbuf->state.ib.buffer);
-   assert(cmdbuf->state.ib.buffer->bo);
-   assert(cmdbuf->state.ib.buffer->host_ptr);
+   struct panfrost_minmax_cache *cache =
+      panvk_index_bounds_cache_valid(buffer) ? buffer->index_bounds.cache
+                                             : NULL;
+
+   /* Cached slices don't record the primitive restart state, only the
+    * per-block bounds do.
+    */
+   if (!restart &&
+       panfrost_minmax_cache_get(cache, index_size, start, count, min, max)) {
+      simple_mtx_unlock(&buffer->index_bounds.lock);
+      return;
+   }
 
    uint32_t debug_flags =
       cmdbuf->device->physical_device->instance->debug_flags;
@@ -824,32 +899,15 @@ panvk_index_minmax_search(struct panvk_cmd_buffer *cmdbuf, uint32_t start,
          "WARNING: Crawling index buffers from the CPU isn't valid in Vulkan\n");
    }
 
-   *max = 0;
+   /* Restart indices are all ones in Vulkan */
+   panfrost_minmax_cache_compute(cache, buffer->host_ptr + start * index_size,
+                                 index_size, start, count, restart,
+                                 u_uintN_max(index_size * 8), min, max);
 
-   /* TODO: Use panfrost_minmax_cache */
-   /* TODO: Read full cacheline of data to mitigate the uncached
-    * mapping slowness.
-    */
-   switch (cmdbuf->state.ib.index_size) {
-#define MINMAX_SEARCH_CASE(sz)                                                 \
-   case sz: {                                                                  \
-      uint##sz##_t *indices = ptr;                                             \
-      *min = UINT##sz##_MAX;                                                   \
-      for (uint32_t i = 0; i < count; i++) {                                   \
-         if (restart && indices[i + start] == UINT##sz##_MAX)                  \
-            continue;                                                          \
-         *min = MIN2(indices[i + start], *min);                                \
-         *max = MAX2(indices[i + start], *max);                                \
-      }                                                                        \
-      break;                                                                   \
-   }
-      MINMAX_SEARCH_CASE(32)
-      MINMAX_SEARCH_CASE(16)
-      MINMAX_SEARCH_CASE(8)
-#undef MINMAX_SEARCH_CASE
-   default:
-      unreachable("Invalid index size");
-   }
+   if (!restart)
+      panfrost_minmax_cache_add(cache, index_size, start, count, *min, *max);
+
+   simple_mtx_unlock(&buffer->index_bounds.lock);
 }
 
 void
@@ -1067,6 +1125,7 @@ panvk_reset_cmdbuf(struct vk_command_buffer *vk_cmdbuf,
    panvk_pool_reset(&cmdbuf->desc_pool);
    panvk_pool_reset(&cmdbuf->tls_pool);
    panvk_pool_reset(&cmdbuf->varying_pool);
+   util_dynarray_clear(&cmdbuf->written_mems);
 
    for (unsigned i = 0; i < MAX_BIND_POINTS; i++)
       memset(&cmdbuf->bind_points[i].desc_state.sets, 0,
@@ -1091,6 +1150,7 @@ panvk_destroy_cmdbuf(struct vk_command_buffer *vk_cmdbuf)
    panvk_pool_cleanup(&cmdbuf->desc_pool);
    panvk_pool_cleanup(&cmdbuf->tls_pool);
    panvk_pool_cleanup(&cmdbuf->varying_pool);
+   util_dynarray_fini(&cmdbuf->written_mems);
    vk_command_buffer_finish(&cmdbuf->vk);
    vk_free(&device->vk.alloc, cmdbuf);
 }
@@ -1130,6 +1190,7 @@ panvk_create_cmdbuf(struct vk_command_pool *vk_pool,
       panvk_debug_adjust_bo_flags(device, PAN_KMOD_BO_FLAG_NO_MMAP), 64 * 1024,
       "Varyings pool", false);
    list_inithead(&cmdbuf->batches);
+   util_dynarray_init(&cmdbuf->written_mems, NULL);
    *cmdbuf_out = &cmdbuf->vk;
    return VK_SUCCESS;
 }
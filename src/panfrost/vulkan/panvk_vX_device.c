@@ -290,6 +290,12 @@ panvk_per_arch(queue_submit)(struct vk_queue *vk_queue,
 
          panvk_signal_event_syncobjs(queue, batch);
       }
+
+      util_dynarray_foreach(&cmdbuf->written_mems,
+                            struct panvk_device_memory *, mem) {
+         panvk_device_memory_mark_written(*mem);
+         p_atomic_set(&(*mem)->write_queue, queue);
+      }
    }
 
    /* Transfer the out fence to signal semaphores */
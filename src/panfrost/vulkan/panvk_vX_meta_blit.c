@@ -95,8 +95,8 @@ panvk_meta_blit(struct panvk_cmd_buffer *cmdbuf,
       fbinfo->rt_count = 1;
       fbinfo->rts[0].view = &views[0];
       fbinfo->rts[0].preload = true;
-      cmdbuf->state.fb.crc_valid[0] = false;
-      fbinfo->rts[0].crc_valid = &cmdbuf->state.fb.crc_valid[0];
+      pan_crc_invalidate_all(&cmdbuf->state.fb.crc[0]);
+      fbinfo->rts[0].crc = &cmdbuf->state.fb.crc[0];
    }
 
    if (blitinfo->dst.planes[1].format != PIPE_FORMAT_NONE) {
@@ -233,11 +233,12 @@ panvk_per_arch(meta_blit_init)(struct panvk_device *dev)
    panvk_pool_init(&dev->meta.blitter.desc_pool, dev, NULL, 0, 16 * 1024,
                    "panvk_meta blitter descriptor pool", false);
    pan_blend_shader_cache_init(&dev->meta.blend_shader_cache,
-                               dev->physical_device->kmod.props.gpu_prod_id);
+                               dev->physical_device->kmod.props.gpu_prod_id,
+                               dev->physical_device->vk.disk_cache);
    GENX(pan_blitter_cache_init)
    (&dev->meta.blitter.cache, dev->physical_device->kmod.props.gpu_prod_id,
     &dev->meta.blend_shader_cache, &dev->meta.blitter.bin_pool.base,
-    &dev->meta.blitter.desc_pool.base);
+    &dev->meta.blitter.desc_pool.base, dev->physical_device->vk.disk_cache);
 }
 
 void
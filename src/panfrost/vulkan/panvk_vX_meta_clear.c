@@ -328,7 +328,7 @@ panvk_meta_clear_color_img(struct panvk_cmd_buffer *cmdbuf,
                   PIPE_SWIZZLE_W},
    };
 
-   cmdbuf->state.fb.crc_valid[0] = false;
+   pan_crc_invalidate_all(&cmdbuf->state.fb.crc[0]);
    *fbinfo = (struct pan_fb_info){
       .tile_buf_budget = panfrost_query_optimal_tib_size(
          cmdbuf->device->physical_device->model),
@@ -336,7 +336,7 @@ panvk_meta_clear_color_img(struct panvk_cmd_buffer *cmdbuf,
       .rt_count = 1,
       .rts[0].view = &view,
       .rts[0].clear = true,
-      .rts[0].crc_valid = &cmdbuf->state.fb.crc_valid[0],
+      .rts[0].crc = &cmdbuf->state.fb.crc[0],
    };
 
    uint32_t clearval[4];
@@ -399,7 +399,7 @@ panvk_meta_clear_zs_img(struct panvk_cmd_buffer *cmdbuf,
                   PIPE_SWIZZLE_W},
    };
 
-   cmdbuf->state.fb.crc_valid[0] = false;
+   pan_crc_invalidate_all(&cmdbuf->state.fb.crc[0]);
    *fbinfo = (struct pan_fb_info){
       .tile_buf_budget = panfrost_query_optimal_tib_size(
          cmdbuf->device->physical_device->model),
@@ -622,7 +622,7 @@ panvk_meta_copy_img2img(struct panvk_cmd_buffer *cmdbuf,
       u_minify(dst->pimage.layout.width, region->dstSubresource.mipLevel);
    unsigned height =
       u_minify(dst->pimage.layout.height, region->dstSubresource.mipLevel);
-   cmdbuf->state.fb.crc_valid[0] = false;
+   pan_crc_invalidate_all(&cmdbuf->state.fb.crc[0]);
    *fbinfo = (struct pan_fb_info){
       .tile_buf_budget = panfrost_query_optimal_tib_size(
          cmdbuf->device->physical_device->model),
@@ -636,7 +636,7 @@ panvk_meta_copy_img2img(struct panvk_cmd_buffer *cmdbuf,
       .rt_count = 1,
       .rts[0].view = &dstview,
       .rts[0].preload = true,
-      .rts[0].crc_valid = &cmdbuf->state.fb.crc_valid[0],
+      .rts[0].crc = &cmdbuf->state.fb.crc[0],
    };
 
    mali_ptr texture =
@@ -1052,7 +1052,7 @@ panvk_meta_copy_buf2img(struct panvk_cmd_buffer *cmdbuf,
    };
 
    /* TODO: don't force preloads of dst resources if unneeded */
-   cmdbuf->state.fb.crc_valid[0] = false;
+   pan_crc_invalidate_all(&cmdbuf->state.fb.crc[0]);
    *fbinfo = (struct pan_fb_info){
       .tile_buf_budget = panfrost_query_optimal_tib_size(
          cmdbuf->device->physical_device->model),
@@ -1068,7 +1068,7 @@ panvk_meta_copy_buf2img(struct panvk_cmd_buffer *cmdbuf,
       .rt_count = 1,
       .rts[0].view = &view,
       .rts[0].preload = true,
-      .rts[0].crc_valid = &cmdbuf->state.fb.crc_valid[0],
+      .rts[0].crc = &cmdbuf->state.fb.crc[0],
    };
 
    panvk_per_arch(cmd_close_batch)(cmdbuf);
@@ -1596,6 +1596,8 @@ panvk_per_arch(CmdCopyImageToBuffer2)(
    VK_FROM_HANDLE(panvk_buffer, buf, pCopyImageToBufferInfo->dstBuffer);
    VK_FROM_HANDLE(panvk_image, img, pCopyImageToBufferInfo->srcImage);
 
+   panvk_cmd_mark_buffer_written(cmdbuf, buf);
+
    for (unsigned i = 0; i < pCopyImageToBufferInfo->regionCount; i++) {
       panvk_meta_copy_img2buf(cmdbuf, buf, img,
                               &pCopyImageToBufferInfo->pRegions[i]);
@@ -1731,6 +1733,8 @@ panvk_per_arch(CmdCopyBuffer2)(VkCommandBuffer commandBuffer,
    VK_FROM_HANDLE(panvk_buffer, src, pCopyBufferInfo->srcBuffer);
    VK_FROM_HANDLE(panvk_buffer, dst, pCopyBufferInfo->dstBuffer);
 
+   panvk_cmd_mark_buffer_written(cmdbuf, dst);
+
    for (unsigned i = 0; i < pCopyBufferInfo->regionCount; i++) {
       panvk_meta_copy_buf2buf(cmdbuf, src, dst, &pCopyBufferInfo->pRegions[i]);
    }
@@ -1875,6 +1879,7 @@ panvk_per_arch(CmdFillBuffer)(VkCommandBuffer commandBuffer, VkBuffer dstBuffer,
    VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
    VK_FROM_HANDLE(panvk_buffer, dst, dstBuffer);
 
+   panvk_cmd_mark_buffer_written(cmdbuf, dst);
    panvk_meta_fill_buf(cmdbuf, dst, fillSize, dstOffset, data);
 }
 
@@ -1925,6 +1930,7 @@ panvk_per_arch(CmdUpdateBuffer)(VkCommandBuffer commandBuffer,
    VK_FROM_HANDLE(panvk_cmd_buffer, cmdbuf, commandBuffer);
    VK_FROM_HANDLE(panvk_buffer, dst, dstBuffer);
 
+   panvk_cmd_mark_buffer_written(cmdbuf, dst);
    panvk_meta_update_buf(cmdbuf, dst, dstOffset, dataSize, pData);
 }
 
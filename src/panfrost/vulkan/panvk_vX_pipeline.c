@@ -38,13 +38,14 @@
 #include "util/u_debug.h"
 #include "vk_blend.h"
 #include "vk_format.h"
+#include "vk_pipeline.h"
 #include "vk_util.h"
 
 #include "panfrost/util/pan_lower_framebuffer.h"
 
 struct panvk_pipeline_builder {
    struct panvk_device *device;
-   struct panvk_pipeline_cache *cache;
+   struct vk_pipeline_cache *cache;
    const VkAllocationCallbacks *alloc;
    struct {
       const VkGraphicsPipelineCreateInfo *gfx;
@@ -92,8 +93,7 @@ panvk_pipeline_builder_finish(struct panvk_pipeline_builder *builder)
    for (uint32_t i = 0; i < MESA_SHADER_STAGES; i++) {
       if (!builder->shaders[i])
          continue;
-      panvk_shader_destroy(builder->device, builder->shaders[i],
-                           builder->alloc);
+      panvk_shader_unref(builder->device, builder->shaders[i]);
    }
 }
 
@@ -103,6 +103,53 @@ panvk_pipeline_static_state(struct panvk_pipeline *pipeline, uint32_t id)
    return !(pipeline->dynamic_state_mask & (1 << id));
 }
 
+/* Hash everything panvk_per_arch(shader_create)() depends on, so the result
+ * can be used as a pipeline cache key.
+ */
+static void
+panvk_pipeline_builder_hash_shader(
+   struct panvk_pipeline_builder *builder, struct panvk_pipeline *pipeline,
+   gl_shader_stage stage, const VkPipelineShaderStageCreateInfo *stage_info,
+   bool static_blend_constants, unsigned char *sha1)
+{
+   struct panvk_device *dev = builder->device;
+   uint32_t gpu_id = dev->physical_device->kmod.props.gpu_prod_id;
+   bool robust = dev->vk.enabled_features.robustBufferAccess;
+   unsigned char stage_sha1[SHA1_DIGEST_LENGTH];
+   struct mesa_sha1 ctx;
+
+   vk_pipeline_hash_shader_stage(stage_info, NULL, stage_sha1);
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, &gpu_id, sizeof(gpu_id));
+   _mesa_sha1_update(&ctx, &robust, sizeof(robust));
+   _mesa_sha1_update(&ctx, &stage, sizeof(stage));
+   _mesa_sha1_update(&ctx, stage_sha1, sizeof(stage_sha1));
+   _mesa_sha1_update(&ctx, builder->layout->sha1,
+                     sizeof(builder->layout->sha1));
+
+   if (stage == MESA_SHADER_FRAGMENT) {
+      const struct pan_blend_state *blend = &pipeline->blend.state;
+
+      _mesa_sha1_update(&ctx, &blend->logicop_enable,
+                        sizeof(blend->logicop_enable));
+      _mesa_sha1_update(&ctx, &blend->logicop_func,
+                        sizeof(blend->logicop_func));
+      _mesa_sha1_update(&ctx, &blend->rt_count, sizeof(blend->rt_count));
+      _mesa_sha1_update(&ctx, blend->rts, sizeof(blend->rts));
+      _mesa_sha1_update(&ctx, &static_blend_constants,
+                        sizeof(static_blend_constants));
+
+      /* Blend constants are only baked into the shader when they are
+       * static.
+       */
+      if (static_blend_constants)
+         _mesa_sha1_update(&ctx, blend->constants, sizeof(blend->constants));
+   }
+
+   _mesa_sha1_final(&ctx, sha1);
+}
+
 static VkResult
 panvk_pipeline_builder_compile_shaders(struct panvk_pipeline_builder *builder,
                                        struct panvk_pipeline *pipeline)
@@ -127,16 +174,32 @@ panvk_pipeline_builder_compile_shaders(struct panvk_pipeline_builder *builder,
       if (!stage_info)
          continue;
 
+      bool static_blend_constants =
+         panvk_pipeline_static_state(pipeline, VK_DYNAMIC_STATE_BLEND_CONSTANTS);
+      unsigned char sha1[SHA1_DIGEST_LENGTH];
       struct panvk_shader *shader;
 
-      shader = panvk_per_arch(shader_create)(
-         builder->device, stage, stage_info, builder->layout,
-         PANVK_SYSVAL_UBO_INDEX, &pipeline->blend.state,
-         panvk_pipeline_static_state(pipeline,
-                                     VK_DYNAMIC_STATE_BLEND_CONSTANTS),
-         builder->alloc);
-      if (!shader)
-         return VK_ERROR_OUT_OF_HOST_MEMORY;
+      panvk_pipeline_builder_hash_shader(builder, pipeline, stage, stage_info,
+                                         static_blend_constants, sha1);
+
+      shader = panvk_shader_cache_lookup(builder->cache, sha1);
+      if (shader) {
+         /* The blend lowering done at compile time also patches the
+          * fixed-function blend state, which we still need on a hit.
+          */
+         if (stage == MESA_SHADER_FRAGMENT)
+            panvk_per_arch(shader_lower_blend_state)(builder->device,
+                                                     &pipeline->blend.state);
+      } else {
+         shader = panvk_per_arch(shader_create)(
+            builder->device, stage, stage_info, builder->layout,
+            PANVK_SYSVAL_UBO_INDEX, &pipeline->blend.state,
+            static_blend_constants, sha1);
+         if (!shader)
+            return VK_ERROR_OUT_OF_HOST_MEMORY;
+
+         shader = panvk_shader_cache_insert(builder->cache, shader);
+      }
 
       builder->shaders[stage] = shader;
       builder->shader_total_size = ALIGN_POT(builder->shader_total_size, 128);
@@ -849,7 +912,7 @@ panvk_pipeline_builder_build(struct panvk_pipeline_builder *builder,
 static void
 panvk_pipeline_builder_init_graphics(
    struct panvk_pipeline_builder *builder, struct panvk_device *dev,
-   struct panvk_pipeline_cache *cache,
+   struct vk_pipeline_cache *cache,
    const VkGraphicsPipelineCreateInfo *create_info,
    const VkAllocationCallbacks *alloc)
 {
@@ -900,7 +963,10 @@ panvk_per_arch(CreateGraphicsPipelines)(
    const VkAllocationCallbacks *pAllocator, VkPipeline *pPipelines)
 {
    VK_FROM_HANDLE(panvk_device, dev, device);
-   VK_FROM_HANDLE(panvk_pipeline_cache, cache, pipelineCache);
+   VK_FROM_HANDLE(vk_pipeline_cache, cache, pipelineCache);
+
+   if (!cache)
+      cache = dev->mem_cache;
 
    for (uint32_t i = 0; i < count; i++) {
       struct panvk_pipeline_builder builder;
@@ -929,7 +995,7 @@ panvk_per_arch(CreateGraphicsPipelines)(
 static void
 panvk_pipeline_builder_init_compute(
    struct panvk_pipeline_builder *builder, struct panvk_device *dev,
-   struct panvk_pipeline_cache *cache,
+   struct vk_pipeline_cache *cache,
    const VkComputePipelineCreateInfo *create_info,
    const VkAllocationCallbacks *alloc)
 {
@@ -951,7 +1017,10 @@ panvk_per_arch(CreateComputePipelines)(
    const VkAllocationCallbacks *pAllocator, VkPipeline *pPipelines)
 {
    VK_FROM_HANDLE(panvk_device, dev, device);
-   VK_FROM_HANDLE(panvk_pipeline_cache, cache, pipelineCache);
+   VK_FROM_HANDLE(vk_pipeline_cache, cache, pipelineCache);
+
+   if (!cache)
+      cache = dev->mem_cache;
 
    for (uint32_t i = 0; i < count; i++) {
       struct panvk_pipeline_builder builder;
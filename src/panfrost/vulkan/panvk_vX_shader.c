@@ -120,6 +120,30 @@ panvk_lower_sysvals(nir_builder *b, nir_instr *instr, void *data)
    return true;
 }
 
+/* Render targets whose blending is lowered to the shader get their fixed
+ * function equation forced to a plain replace. This is split from the NIR
+ * lowering so shaders coming from the pipeline cache can apply it too.
+ */
+void
+panvk_per_arch(shader_lower_blend_state)(const struct panvk_device *dev,
+                                         struct pan_blend_state *blend_state)
+{
+   for (unsigned rt = 0; rt < blend_state->rt_count; rt++) {
+      struct pan_blend_rt_state *rt_state = &blend_state->rts[rt];
+
+      if (!panvk_per_arch(blend_needs_lowering)(dev, blend_state, rt))
+         continue;
+
+      rt_state->equation.color_mask = 0xf;
+      rt_state->equation.rgb_func = PIPE_BLEND_ADD;
+      rt_state->equation.rgb_src_factor = PIPE_BLENDFACTOR_ONE;
+      rt_state->equation.rgb_dst_factor = PIPE_BLENDFACTOR_ZERO;
+      rt_state->equation.alpha_func = PIPE_BLEND_ADD;
+      rt_state->equation.alpha_src_factor = PIPE_BLENDFACTOR_ONE;
+      rt_state->equation.alpha_dst_factor = PIPE_BLENDFACTOR_ZERO;
+   }
+}
+
 static void
 panvk_lower_blend(struct panvk_device *dev, nir_shader *nir,
                   struct panfrost_compile_inputs *inputs,
@@ -161,14 +185,6 @@ panvk_lower_blend(struct panvk_device *dev, nir_shader *nir,
          options.rt[rt].alpha.dst_factor = rt_state->equation.alpha_dst_factor;
       }
 
-      /* Update the equation to force a color replacement */
-      rt_state->equation.color_mask = 0xf;
-      rt_state->equation.rgb_func = PIPE_BLEND_ADD;
-      rt_state->equation.rgb_src_factor = PIPE_BLENDFACTOR_ONE;
-      rt_state->equation.rgb_dst_factor = PIPE_BLENDFACTOR_ZERO;
-      rt_state->equation.alpha_func = PIPE_BLEND_ADD;
-      rt_state->equation.alpha_src_factor = PIPE_BLENDFACTOR_ONE;
-      rt_state->equation.alpha_dst_factor = PIPE_BLENDFACTOR_ZERO;
       lower_blend = true;
    }
 
@@ -176,6 +192,8 @@ panvk_lower_blend(struct panvk_device *dev, nir_shader *nir,
       NIR_PASS_V(nir, nir_lower_blend, &options);
       NIR_PASS_V(nir, bifrost_nir_lower_load_output);
    }
+
+   panvk_per_arch(shader_lower_blend_state)(dev, blend_state);
 }
 
 static bool
@@ -215,18 +233,15 @@ panvk_per_arch(shader_create)(struct panvk_device *dev, gl_shader_stage stage,
                               unsigned sysval_ubo,
                               struct pan_blend_state *blend_state,
                               bool static_blend_constants,
-                              const VkAllocationCallbacks *alloc)
+                              const unsigned char *sha1)
 {
    VK_FROM_HANDLE(vk_shader_module, module, stage_info->module);
    struct panvk_shader *shader;
 
-   shader = vk_zalloc2(&dev->vk.alloc, alloc, sizeof(*shader), 8,
-                       VK_SYSTEM_ALLOCATION_SCOPE_COMMAND);
+   shader = panvk_shader_alloc(dev, sha1);
    if (!shader)
       return NULL;
 
-   util_dynarray_init(&shader->binary, NULL);
-
    /* TODO these are made-up */
    const struct spirv_to_nir_options spirv_options = {
       .caps =
@@ -245,7 +260,7 @@ panvk_per_arch(shader_create)(struct panvk_device *dev, gl_shader_stage stage,
       stage_info->pSpecializationInfo, &spirv_options,
       GENX(pan_shader_get_compiler_options)(), NULL, &nir);
    if (result != VK_SUCCESS) {
-      vk_free2(&dev->vk.alloc, alloc, shader);
+      panvk_shader_destroy(dev, shader);
       return NULL;
    }
 
@@ -96,7 +96,8 @@ static struct disk_cache *
 disk_cache_type_create(const char *gpu_name,
                        const char *driver_id,
                        uint64_t driver_flags,
-                       enum disk_cache_type cache_type)
+                       enum disk_cache_type cache_type,
+                       bool allow_android)
 {
    void *local;
    struct disk_cache *cache = NULL;
@@ -119,7 +120,7 @@ disk_cache_type_create(const char *gpu_name,
    cache->path_init_failed = true;
    cache->type = DISK_CACHE_NONE;
 
-   if (!disk_cache_enabled())
+   if (!disk_cache_enabled(allow_android))
       goto path_fail;
 
    char *path = disk_cache_generate_cache_dir(local, gpu_name, driver_id,
@@ -262,23 +263,25 @@ disk_cache_type_create(const char *gpu_name,
    return NULL;
 }
 
-struct disk_cache *
-disk_cache_create(const char *gpu_name, const char *driver_id,
-                  uint64_t driver_flags)
+static struct disk_cache *
+disk_cache_create_common(const char *gpu_name, const char *driver_id,
+                         uint64_t driver_flags, bool allow_android)
 {
    enum disk_cache_type cache_type;
    struct disk_cache *cache;
 
+   /* Android users that opted in get the Mesa-DB backend by default */
    if (debug_get_bool_option("MESA_DISK_CACHE_SINGLE_FILE", false))
       cache_type = DISK_CACHE_SINGLE_FILE;
-   else if (debug_get_bool_option("MESA_DISK_CACHE_DATABASE", false))
+   else if (debug_get_bool_option("MESA_DISK_CACHE_DATABASE",
+                                  DETECT_OS_ANDROID && allow_android))
       cache_type = DISK_CACHE_DATABASE;
    else
       cache_type = DISK_CACHE_MULTI_FILE;
 
    /* Create main writable cache. */
    cache = disk_cache_type_create(gpu_name, driver_id, driver_flags,
-                                  cache_type);
+                                  cache_type, allow_android);
    if (!cache)
       return NULL;
 
@@ -296,12 +299,27 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
        */
       cache->foz_ro_cache = disk_cache_type_create(gpu_name, driver_id,
                                                    driver_flags,
-                                                   DISK_CACHE_SINGLE_FILE);
+                                                   DISK_CACHE_SINGLE_FILE,
+                                                   allow_android);
    }
 
    return cache;
 }
 
+struct disk_cache *
+disk_cache_create(const char *gpu_name, const char *driver_id,
+                  uint64_t driver_flags)
+{
+   return disk_cache_create_common(gpu_name, driver_id, driver_flags, false);
+}
+
+struct disk_cache *
+disk_cache_create_allow_android(const char *gpu_name, const char *driver_id,
+                                uint64_t driver_flags)
+{
+   return disk_cache_create_common(gpu_name, driver_id, driver_flags, true);
+}
+
 void
 disk_cache_destroy(struct disk_cache *cache)
 {
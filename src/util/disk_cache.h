@@ -165,6 +165,16 @@ struct disk_cache *
 disk_cache_create(const char *gpu_name, const char *timestamp,
                   uint64_t driver_flags);
 
+/**
+ * Like disk_cache_create(), but on Android, where the cache is normally left
+ * to EGL_ANDROID_blob_cache, the user can still enable it by setting
+ * MESA_SHADER_CACHE_DIR. For drivers that also run outside of the Android
+ * EGL layer (e.g. in Termux).
+ */
+struct disk_cache *
+disk_cache_create_allow_android(const char *gpu_name, const char *timestamp,
+                                uint64_t driver_flags);
+
 /**
  * Destroy a cache object, (freeing all associated resources).
  */
@@ -274,6 +284,13 @@ disk_cache_create(const char *gpu_name, const char *timestamp,
    return NULL;
 }
 
+static inline struct disk_cache *
+disk_cache_create_allow_android(const char *gpu_name, const char *timestamp,
+                                uint64_t driver_flags)
+{
+   return NULL;
+}
+
 static inline void
 disk_cache_destroy(struct disk_cache *cache)
 {
@@ -973,12 +973,15 @@ disk_cache_generate_cache_dir(void *mem_ctx, const char *gpu_name,
 }
 
 bool
-disk_cache_enabled()
+disk_cache_enabled(bool allow_android)
 {
    /* Disk cache is not enabled for android, but android's EGL layer
-    * uses EGL_ANDROID_blob_cache to manage the cache itself:
+    * uses EGL_ANDROID_blob_cache to manage the cache itself. Drivers that
+    * also run without it, such as in Termux, let the user opt in by
+    * providing a cache directory:
     */
-   if (DETECT_OS_ANDROID)
+   if (DETECT_OS_ANDROID &&
+       !(allow_android && getenv("MESA_SHADER_CACHE_DIR")))
       return false;
 
    /* If running as a users other than the real user disable cache */
@@ -156,7 +156,7 @@ disk_cache_write_item_to_disk(struct disk_cache_put_job *dc_job,
                               char *filename);
 
 bool
-disk_cache_enabled(void);
+disk_cache_enabled(bool allow_android);
 
 bool
 disk_cache_load_cache_index_foz(void *mem_ctx, struct disk_cache *cache);